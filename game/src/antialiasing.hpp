@@ -0,0 +1,249 @@
+#ifndef ANTIALIASING_H
+#define ANTIALIASING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+
+#include "shader.hpp"
+#include "stats.hpp"
+#include "gl_state.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                Anti-Aliasing                               */
+/* -------------------------------------------------------------------------- */
+
+enum class AntiAliasingMode {
+    OFF,
+    MSAA_2X,
+    MSAA_4X,
+    MSAA_8X,
+    FXAA, // edges found in the resolved image, one full screen pass
+    TAA,  // jittered projection, accumulated into a history reprojected from depth
+};
+
+inline const char* antiAliasingModeName(AntiAliasingMode mode)
+{
+    switch (mode)
+    {
+    case AntiAliasingMode::OFF:
+        return "no AA";
+    case AntiAliasingMode::MSAA_2X:
+        return "MSAA 2x";
+    case AntiAliasingMode::MSAA_4X:
+        return "MSAA 4x";
+    case AntiAliasingMode::MSAA_8X:
+        return "MSAA 8x";
+    case AntiAliasingMode::FXAA:
+        return "FXAA";
+    default:
+        return "TAA";
+    }
+}
+
+inline AntiAliasingMode nextAntiAliasingMode(AntiAliasingMode mode)
+{
+    return (AntiAliasingMode)(((int)mode + 1) % 6);
+}
+
+
+// The anti-aliasing stage of DynamicResolution. MSAA modes only set the sample count of its scene
+// target, the samples are resolved by the blit that already ends the frame. FXAA and TAA run on the
+// resolved image at the render scale, before the upscale, so they cost the same at every window size.
+// TAA offsets the projection by a sub-pixel Halton (2, 3) point each frame, see beginFrame(), and
+// blends the frame into a history: each pixel's depth takes it back to where it was on screen the
+// frame before, and the history there is clamped to the colours around the pixel so what was
+// uncovered or changed does not leave trails.
+// Targets are allocated at the window size, like DynamicResolution's, and the history restarts
+// whenever the mode, the render size or the window changes.
+class AntiAliasing
+{
+public:
+    static const int JITTER_SAMPLES = 8;
+
+    AntiAliasingMode Mode = AntiAliasingMode::OFF;
+    // weight of the new frame in the TAA history, lower is smoother and slower to follow changes
+    float CurrentWeight = 0.1f;
+
+    AntiAliasing()
+        : fxaaShader("src/shaders/upscale.vert", "src/shaders/fxaa.frag"), taaShader("src/shaders/upscale.vert", "src/shaders/taa.frag")
+    {
+        glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+
+        glGenFramebuffers(2, targetFBO);
+        glGenTextures(2, targetTexture);
+        glGenFramebuffers(1, &depthFBO);
+        glGenTextures(1, &depthTexture);
+        glGenVertexArrays(1, &emptyVAO);
+
+        fxaaShader.use();
+        fxaaShader.setInt("sceneTexture", 0);
+        taaShader.use();
+        taaShader.setInt("currentFrame", 0);
+        taaShader.setInt("history", 1);
+        taaShader.setInt("depthTexture", 2);
+    }
+
+    // Samples per pixel of the scene target, what the driver supports at most
+    int samples() const
+    {
+        int wanted = Mode == AntiAliasingMode::MSAA_2X ? 2 : Mode == AntiAliasingMode::MSAA_4X ? 4 : Mode == AntiAliasingMode::MSAA_8X ? 8 : 1;
+        return glm::min(wanted, glm::max(maxSamples, 1));
+    }
+
+    // Whether apply() has a pass to run on the resolved image
+    bool postProcess() const
+    {
+        return Mode == AntiAliasingMode::FXAA || Mode == AntiAliasingMode::TAA;
+    }
+
+    // Call once per frame before drawing with the unjittered view projection. Returns the offset
+    // in NDC the projection is translated by this frame, zero unless in TAA mode.
+    glm::vec2 beginFrame(const glm::mat4& viewProjection, const glm::ivec2& renderSize)
+    {
+        previousViewProjection = currentViewProjection;
+        currentViewProjection = viewProjection;
+        frame++;
+        if (Mode != AntiAliasingMode::TAA)
+        {
+            historyValid = false;
+            jitter = glm::vec2(0.0f);
+            return jitter;
+        }
+
+        int index = frame % JITTER_SAMPLES + 1;
+        jitter = (glm::vec2(halton(index, 2), halton(index, 3)) - 0.5f) * 2.0f / glm::vec2(renderSize);
+        return jitter;
+    }
+
+    void resize(const glm::ivec2& size)
+    {
+        allocated = size;
+        for (int i = 0; i < 2; i++)
+        {
+            glState.bindTexture(GL_TEXTURE_2D, targetTexture[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size.x, size.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, targetFBO[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targetTexture[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::ANTIALIASING::TARGET_FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        }
+
+        // the same format as the scene's depth, blits between them need it
+        glState.bindTexture(GL_TEXTURE_2D, depthTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, size.x, size.y, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glState.bindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, depthFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        glDrawBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::ANTIALIASING::DEPTH_FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        historyValid = false;
+    }
+
+    // Runs the mode's pass over the size x size corner of sceneTexture, the resolved colour of
+    // sceneFBO, into outputFBO(). Leaves the output framebuffer bound with its viewport. Depth test
+    // and blending must be off.
+    void apply(unsigned int sceneFBO, unsigned int sceneTexture, const glm::ivec2& size)
+    {
+        glm::vec2 uvScale = glm::vec2(size) / glm::vec2(allocated);
+        glState.bindVertexArray(emptyVAO);
+        if (Mode == AntiAliasingMode::FXAA)
+        {
+            current = 0;
+            glBindFramebuffer(GL_FRAMEBUFFER, targetFBO[current]);
+            glViewport(0, 0, size.x, size.y);
+            fxaaShader.use();
+            fxaaShader.setVec2("uvScale", uvScale);
+            glState.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, sceneTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            frameStats.drawCalls++;
+            historyValid = false;
+            return;
+        }
+
+        if (size != historySize)
+        {
+            historyValid = false;
+            historySize = size;
+        }
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthFBO);
+        glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+        // NDC of this frame's jittered projection to clip space of the last frame
+        glm::mat4 jittered = glm::translate(glm::mat4(1.0f), glm::vec3(jitter, 0.0f)) * currentViewProjection;
+        glm::mat4 reprojection = previousViewProjection * glm::inverse(jittered);
+
+        int history = current;
+        current = 1 - current;
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFBO[current]);
+        glViewport(0, 0, size.x, size.y);
+        taaShader.use();
+        taaShader.setVec2("uvScale", uvScale);
+        taaShader.setMat4("reprojection", reprojection);
+        taaShader.setFloat("currentWeight", historyValid ? CurrentWeight : 1.0f);
+        glState.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, sceneTexture);
+        glState.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D, targetTexture[history]);
+        glState.bindTexture(GL_TEXTURE2, GL_TEXTURE_2D, depthTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        frameStats.drawCalls++;
+        historyValid = true;
+    }
+
+    // What the last apply() wrote, at the window's size like the scene target
+    unsigned int outputFBO() const
+    {
+        return targetFBO[current];
+    }
+
+    unsigned int outputTexture() const
+    {
+        return targetTexture[current];
+    }
+
+private:
+    int maxSamples = 0;
+    glm::ivec2 allocated = glm::ivec2(1);
+    unsigned int targetFBO[2];
+    unsigned int targetTexture[2];
+    unsigned int depthFBO;
+    unsigned int depthTexture;
+    unsigned int emptyVAO;
+    Shader fxaaShader;
+    Shader taaShader;
+
+    // the TAA history is the target apply() did not write last
+    int current = 0;
+    bool historyValid = false;
+    glm::ivec2 historySize = glm::ivec2(0);
+    unsigned int frame = 0;
+    glm::vec2 jitter = glm::vec2(0.0f);
+    glm::mat4 currentViewProjection = glm::mat4(1.0f);
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+
+    static float halton(int index, int base)
+    {
+        float result = 0.0f;
+        float fraction = 1.0f / base;
+        for (; index > 0; index /= base, fraction /= base)
+            result += fraction * (index % base);
+        return result;
+    }
+};
+#endif
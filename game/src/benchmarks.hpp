@@ -0,0 +1,675 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+#include "sculpture.hpp"
+#include "bvh.hpp"
+#include "gallery.hpp"
+#include "pvs.hpp"
+#include "occlusion.hpp"
+#include "frame_pacing.hpp"
+#include "transform_hierarchy.hpp"
+#include "entities.hpp"
+
+// Offline benchmarks, run with `--bench <name>`. None of them need a window or GL context.
+
+inline double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+/* ---------------------------------- Mesh ---------------------------------- */
+// Vertex shader invocations (simulated FIFO post-transform cache) before and after the load-time optimizer
+inline void runMeshBenchmark()
+{
+    const int resolutions[] = { 64, 256, 724 };
+    const int cacheSizes[] = { 16, 32 };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "triangles  cache  unique  invocations-before  invocations-after  acmr-before  acmr-after  optimize-ms" << std::endl;
+
+    for (int resolution : resolutions)
+    {
+        Mesh scanned = generateSculpture(resolution, resolution * 2, 1234u);
+        Mesh optimized = scanned;
+
+        auto start = std::chrono::steady_clock::now();
+        optimizeMesh(optimized);
+        double optimizeMs = millisecondsSince(start);
+
+        size_t triangles = scanned.indices.size() / 3;
+        for (int cacheSize : cacheSizes)
+        {
+            size_t before = countVertexShaderInvocations(scanned.indices, scanned.vertices.size(), cacheSize);
+            size_t after = countVertexShaderInvocations(optimized.indices, optimized.vertices.size(), cacheSize);
+
+            std::cout << std::setw(9) << triangles << "  " << std::setw(5) << cacheSize << "  " << std::setw(6) << scanned.vertices.size()
+                << "  " << std::setw(18) << before << "  " << std::setw(17) << after
+                << "  " << std::setw(11) << (double)before / triangles << "  " << std::setw(10) << (double)after / triangles
+                << "  " << std::setw(11) << optimizeMs << std::endl;
+        }
+    }
+}
+
+
+/* ------------------------------ Vertex Format ----------------------------- */
+// Vertex buffer size, vertex fetch traffic (stride times simulated shader invocations) and the
+// worst decode error of each encoding, relative to the 32 byte float layout
+inline void runVertexFormatBenchmark()
+{
+    Mesh mesh = generateSculpture(256, 512, 1234u);
+    optimizeMesh(mesh);
+
+    glm::vec3 minimum = mesh.vertices[0].position;
+    glm::vec3 maximum = minimum;
+    for (const Vertex& vertex : mesh.vertices)
+    {
+        minimum = glm::min(minimum, vertex.position);
+        maximum = glm::max(maximum, vertex.position);
+    }
+    glm::vec3 extent = maximum - minimum;
+    size_t invocations = countVertexShaderInvocations(mesh.indices, mesh.vertices.size(), 32);
+
+    struct Candidate
+    {
+        const char* name;
+        VertexFormat format;
+    };
+    const Candidate candidates[] = {
+        { "float", VertexFormat::standard() },
+        { "packed-normal", VertexFormat(PositionEncoding::FLOAT, NormalEncoding::PACKED, TexCoordEncoding::FLOAT) },
+        { "octahedral-normal", VertexFormat(PositionEncoding::FLOAT, NormalEncoding::OCTAHEDRAL, TexCoordEncoding::FLOAT) },
+        { "half-uv", VertexFormat(PositionEncoding::FLOAT, NormalEncoding::FLOAT, TexCoordEncoding::HALF) },
+        { "unorm16-position", VertexFormat(PositionEncoding::UNORM16, NormalEncoding::FLOAT, TexCoordEncoding::FLOAT) },
+        { "compact-packed", VertexFormat(PositionEncoding::UNORM16, NormalEncoding::PACKED, TexCoordEncoding::HALF) },
+        { "compact-octahedral", VertexFormat(PositionEncoding::UNORM16, NormalEncoding::OCTAHEDRAL, TexCoordEncoding::HALF) },
+        { "auto", VertexFormat::select(mesh.vertices, extent) },
+    };
+
+    const double baseline = (double)mesh.vertices.size() * VertexFormat::standard().stride;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << mesh.vertices.size() << " vertices, " << mesh.indices.size() / 3 << " triangles, "
+        << invocations << " vertex shader invocations (cache 32)" << std::endl;
+    std::cout << "format              stride  buffer-kb  fetch-kb  vs-float  position-error  normal-error-deg  uv-error" << std::endl;
+
+    std::vector<unsigned char> encoded;
+    for (const Candidate& candidate : candidates)
+    {
+        const VertexFormat& format = candidate.format;
+        glm::vec3 offset = format.position == PositionEncoding::UNORM16 ? minimum : glm::vec3(0.0f);
+        glm::vec3 scale = format.position == PositionEncoding::UNORM16 ? extent : glm::vec3(1.0f);
+
+        encoded.resize(format.stride);
+        double positionError = 0.0;
+        double normalError = 0.0;
+        double uvError = 0.0;
+        for (const Vertex& vertex : mesh.vertices)
+        {
+            format.encode(vertex, offset, scale, encoded.data());
+            Vertex decoded = format.decode(encoded.data(), offset, scale);
+
+            positionError = glm::max(positionError, (double)glm::length(decoded.position - vertex.position));
+            // atan2 stays accurate for the tiny angles acos loses to float rounding
+            glm::dvec3 a(decoded.normal), b(vertex.normal);
+            double angle = std::atan2(glm::length(glm::cross(a, b)), glm::dot(a, b));
+            normalError = glm::max(normalError, glm::degrees(angle));
+            uvError = glm::max(uvError, (double)glm::length(decoded.texCoords - vertex.texCoords));
+        }
+
+        double bufferBytes = (double)mesh.vertices.size() * format.stride;
+        double fetchBytes = (double)invocations * format.stride;
+        std::cout << std::left << std::setw(18) << candidate.name << std::right
+            << "  " << std::setw(6) << format.stride << "  " << std::setw(9) << bufferBytes / 1024.0
+            << "  " << std::setw(8) << fetchBytes / 1024.0 << "  " << std::setw(8) << bufferBytes / baseline
+            << "  " << std::setw(14) << std::setprecision(6) << positionError
+            << "  " << std::setw(16) << std::setprecision(4) << normalError
+            << "  " << std::setw(8) << std::setprecision(6) << uvError << std::setprecision(3) << std::endl;
+    }
+}
+
+
+/* ---------------------------- Frustum Culling ----------------------------- */
+// BVH cull against a linear SIMD pass over every object. Objects are painting-sized boxes spread over
+// a square gallery whose area grows with the count, the camera stands at its centre.
+inline void runCullBenchmark()
+{
+    const size_t counts[] = { 100, 1000, 10000, 100000, 1000000 };
+
+    glm::mat4 projection = glm::perspective(glm::radians(65.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "  objects  visible  build-ms  refit-ms  bvh-cull-ms  linear-cull-ms  speedup" << std::endl;
+
+    for (size_t count : counts)
+    {
+        // about one object per 2 square metres
+        float halfSize = glm::sqrt(count * 2.0f) * 0.5f;
+        std::mt19937 random(42u);
+        std::uniform_real_distribution<float> position(-halfSize, halfSize);
+        std::uniform_real_distribution<float> height(0.5f, 4.0f);
+        std::uniform_real_distribution<float> size(0.2f, 1.5f);
+
+        std::vector<AABB> bounds(count);
+        for (AABB& box : bounds)
+        {
+            glm::vec3 center(position(random), height(random), position(random));
+            glm::vec3 extent(size(random), size(random), 0.05f);
+            box.min = center - extent * 0.5f;
+            box.max = center + extent * 0.5f;
+        }
+
+        BVH bvh;
+        auto start = std::chrono::steady_clock::now();
+        bvh.build(bounds);
+        double buildMs = millisecondsSince(start);
+
+        // a tenth of the objects drift, as if hung on moving sculptures
+        for (size_t i = 0; i < count; i += 10)
+        {
+            bounds[i].min.y += 0.1f;
+            bounds[i].max.y += 0.1f;
+            bvh.update((unsigned int)i, bounds[i]);
+        }
+        start = std::chrono::steady_clock::now();
+        bvh.refit();
+        double refitMs = millisecondsSince(start);
+
+        const int iterations = count >= 100000 ? 10 : 200;
+        std::vector<unsigned int> visible;
+        visible.reserve(count);
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            visible.clear();
+            bvh.cull(frustum, visible);
+        }
+        double bvhMs = millisecondsSince(start) / iterations;
+        size_t bvhVisible = visible.size();
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            visible.clear();
+            for (size_t object = 0; object < count; object++)
+            {
+                if (frustum.classify(bounds[object]) != Visibility::OUTSIDE)
+                    visible.push_back((unsigned int)object);
+            }
+        }
+        double linearMs = millisecondsSince(start) / iterations;
+
+        if (visible.size() != bvhVisible)
+            std::cout << "ERROR::BENCHMARK::CULL_MISMATCH " << bvhVisible << " != " << visible.size() << std::endl;
+
+        std::cout << std::setw(9) << count << "  " << std::setw(7) << bvhVisible << "  " << std::setw(8) << buildMs
+            << "  " << std::setw(8) << refitMs << "  " << std::setw(11) << bvhMs << "  " << std::setw(14) << linearMs
+            << "  " << std::setw(7) << linearMs / bvhMs << std::endl;
+    }
+}
+
+
+/* ----------------------------------- PVS ---------------------------------- */
+// Offline PVS bake of square-ish room grids, reports bake time and in-memory versus compressed size.
+// The bake must be conservative, so on the smaller grids every pair a dense ray sampling finds
+// visible has to be in the baked table too.
+inline void runPVSBenchmark()
+{
+    const glm::ivec2 grids[] = { glm::ivec2(2, 5), glm::ivec2(10, 10), glm::ivec2(25, 40) };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "threads: " << glm::max(std::thread::hardware_concurrency(), 1u) << std::endl;
+    std::cout << "cells  portals  portal-chains     bake-ms  visible-per-cell  memory-bytes  compressed-bytes" << std::endl;
+
+    for (glm::ivec2 grid : grids)
+    {
+        GalleryLayout layout(grid.x, grid.y, 10.0f, 4.5f, 2.0f, 3.0f, 3.0f);
+        PVS pvs = PVS::bake(layout.Graph);
+
+        size_t visiblePairs = 0;
+        for (unsigned int cell = 0; cell < pvs.CellCount; cell++)
+            visiblePairs += pvs.visibleCount(cell);
+
+        std::cout << std::setw(5) << pvs.CellCount << "  " << std::setw(7) << layout.Graph.Portals.size() << "  " << std::setw(13) << pvs.PortalChains
+            << "  " << std::setw(10) << pvs.BakeMs << "  " << std::setw(16) << (double)visiblePairs / pvs.CellCount
+            << "  " << std::setw(12) << pvs.memoryBytes() << "  " << std::setw(16) << pvs.compressedBytes() << std::endl;
+    }
+
+    const glm::ivec2 checked[] = { glm::ivec2(4, 4), glm::ivec2(6, 6), glm::ivec2(10, 10) };
+    const int referenceSamples = 4096;
+
+    std::cout << std::endl << "cells  sampled-pairs  baked-pairs  missed-pairs  sample-ms" << std::endl;
+    for (glm::ivec2 grid : checked)
+    {
+        GalleryLayout layout(grid.x, grid.y, 10.0f, 4.5f, 2.0f, 3.0f, 3.0f);
+        PVS pvs = PVS::bake(layout.Graph);
+        PVS reference = PVS::sample(layout.Graph.Cells, layout.occluders(), referenceSamples);
+
+        size_t bakedPairs = 0;
+        size_t sampledPairs = 0;
+        for (unsigned int cell = 0; cell < pvs.CellCount; cell++)
+        {
+            bakedPairs += pvs.visibleCount(cell);
+            sampledPairs += reference.visibleCount(cell);
+        }
+        unsigned long long missed = pvs.missingPairs(reference);
+        if (missed > 0)
+            std::cout << "ERROR::BENCHMARK::PVS_NOT_CONSERVATIVE " << missed << " pairs" << std::endl;
+
+        std::cout << std::setw(5) << pvs.CellCount << "  " << std::setw(13) << sampledPairs << "  " << std::setw(11) << bakedPairs
+            << "  " << std::setw(12) << missed << "  " << std::setw(9) << reference.BakeMs << std::endl;
+    }
+}
+
+
+/* -------------------------------- Occlusion ------------------------------- */
+// Cameras in every room of a gallery grid looking along both axes. Objects left by the frustum are
+// tested against the occlusion buffer of the walls, and each one it rejects is checked with rays
+// from the camera to its corners and centre, which must all hit a wall.
+inline void runOcclusionBenchmark()
+{
+    const glm::ivec2 grids[] = { glm::ivec2(2, 5), glm::ivec2(10, 10), glm::ivec2(25, 40) };
+    const int objectsPerRoom = 16;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "rooms  objects  in-frustum  occluded  occluded-%  render-ms  test-ms  false-culls" << std::endl;
+
+    for (glm::ivec2 grid : grids)
+    {
+        GalleryLayout layout(grid.x, grid.y, 10.0f, 4.5f, 2.0f, 3.0f, 3.0f);
+        std::vector<Occluder> occluders = layout.occluders();
+
+        std::vector<AABB> occluderBounds;
+        for (const Occluder& occluder : occluders)
+            occluderBounds.push_back(occluder.bounds());
+        BVH occluderBVH;
+        occluderBVH.build(occluderBounds);
+
+        // paintings on plinths scattered through every room
+        std::mt19937 random(42u);
+        std::uniform_real_distribution<float> offset(-4.0f, 4.0f);
+        std::uniform_real_distribution<float> size(0.3f, 1.2f);
+        std::vector<AABB> objects;
+        for (int r = 0; r < layout.roomCount(); r++)
+        {
+            for (int i = 0; i < objectsPerRoom; i++)
+            {
+                glm::vec3 center = layout.roomOrigin(r) + glm::vec3(offset(random), 1.5f, offset(random));
+                glm::vec3 extent(size(random));
+                objects.push_back({ center - extent * 0.5f, center + extent * 0.5f });
+            }
+        }
+        BVH objectBVH;
+        objectBVH.build(objects);
+
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+        const glm::vec3 directions[] = { glm::vec3(1, 0, 1), glm::vec3(1, 0, -1), glm::vec3(-1, 0, 1), glm::vec3(-1, 0, -1) };
+
+        OcclusionBuffer occlusion;
+        size_t inFrustum = 0, occluded = 0, falseCulls = 0;
+        double renderMs = 0.0, testMs = 0.0;
+        int views = 0;
+        std::vector<unsigned int> visible;
+        for (int r = 0; r < layout.roomCount(); r++)
+        {
+            for (glm::vec3 direction : directions)
+            {
+                glm::vec3 eye = layout.roomOrigin(r) - direction * 3.5f + glm::vec3(0.0f, 2.0f, 0.0f);
+                glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + direction, glm::vec3(0, 1, 0));
+
+                visible.clear();
+                objectBVH.cull(Frustum::fromMatrix(viewProjection), visible);
+                occlusion.render(viewProjection, occluders);
+
+                auto start = std::chrono::steady_clock::now();
+                std::vector<unsigned int> hidden;
+                for (unsigned int object : visible)
+                {
+                    if (!occlusion.visible(objects[object]))
+                        hidden.push_back(object);
+                }
+                testMs += millisecondsSince(start);
+                renderMs += occlusion.RenderMs;
+
+                for (unsigned int object : hidden)
+                {
+                    const AABB& box = objects[object];
+                    for (int c = 0; c < 9; c++)
+                    {
+                        glm::vec3 target = c == 8 ? box.center() : glm::vec3((c & 1) ? box.max.x : box.min.x, (c & 2) ? box.max.y : box.min.y, (c & 4) ? box.max.z : box.min.z);
+                        if (!occluderBVH.anyHit(eye, target, [&](unsigned int o) { return occluders[o].blocks(eye, target); }))
+                        {
+                            falseCulls++;
+                            break;
+                        }
+                    }
+                }
+
+                inFrustum += visible.size();
+                occluded += hidden.size();
+                views++;
+            }
+        }
+
+        std::cout << std::setw(5) << layout.roomCount() << "  " << std::setw(7) << objects.size() << "  " << std::setw(10) << (double)inFrustum / views
+            << "  " << std::setw(8) << (double)occluded / views << "  " << std::setw(10) << 100.0 * occluded / glm::max(inFrustum, (size_t)1)
+            << "  " << std::setw(9) << renderMs / views << "  " << std::setw(7) << testMs / views << "  " << std::setw(11) << falseCulls << std::endl;
+    }
+
+    // An empty buffer hides nothing. With an identity view projection world x and y are NDC, so
+    // boxes of every width and height are slid across the whole screen, down to the last rows
+    // that odd pyramid levels fold into the texel before them.
+    OcclusionBuffer empty;
+    empty.render(glm::mat4(1.0f), {});
+    size_t tested = 0, emptyCulls = 0;
+    for (int height = 1; height <= empty.Height; height *= 2)
+    {
+        for (int width = 1; width <= empty.Width; width *= 2)
+        {
+            for (int y = 0; y + height <= empty.Height; y++)
+            {
+                for (int x = 0; x + width <= empty.Width; x += width)
+                {
+                    glm::vec2 minimum = glm::vec2(x, y) / glm::vec2(empty.Width, empty.Height) * 2.0f - 1.0f;
+                    glm::vec2 maximum = glm::vec2(x + width, y + height) / glm::vec2(empty.Width, empty.Height) * 2.0f - 1.0f;
+                    if (!empty.visible({ glm::vec3(minimum, -0.5f), glm::vec3(maximum - 1e-4f, 0.5f) }))
+                        emptyCulls++;
+                    tested++;
+                }
+            }
+        }
+    }
+    std::cout << "empty buffer: " << tested << " boxes, " << emptyCulls << " reported occluded" << std::endl;
+    if (emptyCulls > 0)
+        std::cout << "ERROR::BENCHMARK::EMPTY_OCCLUSION_BUFFER_OCCLUDES" << std::endl;
+}
+
+
+/* ------------------------------- Frame Pacing ----------------------------- */
+// A 60 fps cap over frames with 2-10 ms of busy work, with the wait done by sleeping only,
+// spinning only and the hybrid FramePacer default. Reports frame time jitter and how much of
+// each frame the wait spent burning the CPU.
+inline void runFramePacingBenchmark()
+{
+    struct Variant
+    {
+        const char* name;
+        double spinMs;
+    };
+    const Variant variants[] = { { "sleep", 0.0 }, { "hybrid", FramePacer().SpinMs }, { "spin", 1000.0 } };
+    const int frames = 180;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "wait     mean-ms  deviation-ms  min-ms  max-ms  spin-ms-per-frame" << std::endl;
+
+    for (const Variant& variant : variants)
+    {
+        FramePacer pacer;
+        pacer.Mode = PacingMode::CAPPED;
+        pacer.TargetFps = 60.0;
+        pacer.SpinMs = variant.spinMs;
+
+        std::mt19937 random(42u);
+        std::uniform_real_distribution<double> work(2.0, 10.0);
+        for (int i = 0; i <= frames; i++)
+        {
+            pacer.beginFrame();
+            auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(work(random)));
+            while (std::chrono::steady_clock::now() < end)
+                ;
+            pacer.wait();
+        }
+
+        FramePacer::Report report = pacer.report();
+        std::cout << std::left << std::setw(7) << variant.name << std::right << "  " << std::setw(7) << report.meanMs << "  " << std::setw(12) << report.deviationMs
+            << "  " << std::setw(6) << report.minMs << "  " << std::setw(6) << report.maxMs << "  " << std::setw(17) << report.spinMs << std::endl;
+    }
+}
+
+
+/* ----------------------------- Transform Hierarchy ------------------------ */
+// A 100k node tree, four children per node, with 1% of the nodes turned every frame. World
+// matrices rebuilt with glm::translate, glm::rotate and glm::scale from nodes stored as structs,
+// rebuilt from TransformHierarchy's arrays, and updated through its dirty flags. A turned node
+// takes its subtree along, so about 9% are recomputed (some 9.2k nodes a frame).
+inline void runTransformBenchmark()
+{
+    const int nodeCount = 100000;
+    const int moving = nodeCount / 100;
+    const int frames = 60;
+
+    struct Node
+    {
+        int parent;
+        glm::vec3 position;
+        float angle;
+        glm::vec3 scale;
+        glm::mat4 world;
+    };
+
+    std::mt19937 random(42u);
+    std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+    std::uniform_int_distribution<int> pick(0, nodeCount - 1);
+
+    std::vector<Node> nodes(nodeCount);
+    TransformHierarchy hierarchy;
+    for (int i = 0; i < nodeCount; i++)
+    {
+        Node& node = nodes[i];
+        node.parent = i > 0 ? (i - 1) / 4 : -1;
+        node.position = glm::vec3(offset(random), offset(random), offset(random));
+        node.angle = offset(random);
+        node.scale = glm::vec3(0.9f);
+        hierarchy.add(node.parent, node.position, glm::angleAxis(node.angle, glm::vec3(0.0f, 1.0f, 0.0f)), node.scale);
+    }
+    hierarchy.update();
+
+    // the same nodes turn in every variant
+    std::vector<int> turned((size_t)frames * moving);
+    for (int& node : turned)
+        node = pick(random);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "update       nodes  moved  recomputed  ms-per-frame  upload-bytes" << std::endl;
+
+    auto report = [&](const char* name, size_t recomputed, double ms) {
+        std::cout << std::left << std::setw(10) << name << std::right << "  " << std::setw(6) << nodeCount << "  " << std::setw(5) << moving
+            << "  " << std::setw(10) << recomputed / frames << "  " << std::setw(12) << ms / frames
+            << "  " << std::setw(12) << recomputed / frames * sizeof(glm::mat4) << std::endl;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++)
+    {
+        for (int i = 0; i < moving; i++)
+            nodes[turned[(size_t)frame * moving + i]].angle += 0.01f;
+        for (Node& node : nodes)
+        {
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), node.position);
+            local = glm::rotate(local, node.angle, glm::vec3(0.0f, 1.0f, 0.0f));
+            local = glm::scale(local, node.scale);
+            node.world = node.parent >= 0 ? nodes[node.parent].world * local : local;
+        }
+    }
+    report("rebuild", (size_t)frames * nodeCount, millisecondsSince(start));
+
+    std::vector<float> angles(nodeCount);
+    for (int i = 0; i < nodeCount; i++)
+        angles[i] = nodes[i].angle;
+    auto turn = [&](int frame) {
+        for (int i = 0; i < moving; i++)
+        {
+            int node = turned[(size_t)frame * moving + i];
+            angles[node] += 0.01f;
+            hierarchy.setRotation(node, glm::angleAxis(angles[node], glm::vec3(0.0f, 1.0f, 0.0f)));
+        }
+    };
+
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++)
+    {
+        turn(frame);
+        hierarchy.updateAll();
+    }
+    report("soa-all", (size_t)frames * nodeCount, millisecondsSince(start));
+
+    size_t recomputed = 0;
+    start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; frame++)
+    {
+        turn(frame);
+        hierarchy.update();
+        recomputed += hierarchy.changed().size();
+    }
+    report("dirty", recomputed, millisecondsSince(start));
+}
+
+
+/* --------------------------------- Entities ------------------------------- */
+// Iteration throughput over a million gallery entities: a cull that reads transforms and writes
+// renderables, and a light animation touching only the few percent that are lights. The same
+// objects as one struct each in a vector, the layout gallery objects had before, against
+// GalleryEntities queried on one thread and on every hardware thread.
+inline void runEntityBenchmark()
+{
+    const int entityCount = 1000000;
+    const int passes = 10;
+
+    // everything an object could be, what each system has to stride over
+    struct GalleryObject
+    {
+        WorldTransform transform;
+        Renderable renderable;
+        LightSource light;
+        Painting painting;
+        bool isLight;
+    };
+
+    std::mt19937 random(42u);
+    std::uniform_real_distribution<float> offset(-50.0f, 50.0f);
+    std::uniform_int_distribution<int> kind(0, 19);
+
+    std::vector<GalleryObject> objects(entityCount);
+    GalleryEntities entities;
+    for (GalleryObject& object : objects)
+    {
+        object.transform.Model = glm::translate(glm::mat4(1.0f), glm::vec3(offset(random), offset(random) * 0.1f, offset(random)));
+        object.renderable.TextureLayer = kind(random);
+        object.isLight = object.renderable.TextureLayer == 0;
+        // a twentieth are lights, a quarter of the rest paintings
+        if (object.isLight)
+            entities.create(object.transform, object.light);
+        else if (object.renderable.TextureLayer < 5)
+            entities.create(object.transform, object.renderable, object.painting);
+        else
+            entities.create(object.transform, object.renderable);
+    }
+
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f)
+        * glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    // the centre inside the frustum, Instance stands in for the visible flag a cull would write
+    auto cull = [&](const WorldTransform& transform, Renderable& renderable) {
+        glm::vec4 clip = viewProjection * transform.Model[3];
+        bool inside = glm::abs(clip.x) <= clip.w && glm::abs(clip.y) <= clip.w && clip.z >= -clip.w && clip.z <= clip.w;
+        renderable.Instance = inside ? 1 : -1;
+    };
+    auto animate = [&](LightSource& light) {
+        light.Position.y = glm::sin(light.Position.x + light.Position.y * 0.1f);
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "entities: " << entities.size() << " in " << entities.archetypeCount() << " archetypes, " << entities.threads() << " threads" << std::endl;
+    std::cout << "system   layout        entities  ms-per-pass  M-entities/s" << std::endl;
+
+    auto report = [&](const char* system, const char* layout, size_t visited, double ms) {
+        std::cout << std::left << std::setw(7) << system << "  " << std::setw(12) << layout << std::right << "  " << std::setw(8) << visited
+            << "  " << std::setw(11) << ms / passes << "  " << std::setw(12) << visited * passes / (ms * 1000.0) << std::endl;
+    };
+
+    size_t renderables = entities.count<WorldTransform, Renderable>();
+    size_t lights = entities.count<LightSource>();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (GalleryObject& object : objects)
+        {
+            if (!object.isLight)
+                cull(object.transform, object.renderable);
+        }
+    }
+    report("cull", "objects", renderables, millisecondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+        entities.each<WorldTransform, Renderable>(cull);
+    report("cull", "entities", renderables, millisecondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+        entities.parallelEach<WorldTransform, Renderable>(cull);
+    report("cull", "parallel", renderables, millisecondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        for (GalleryObject& object : objects)
+        {
+            if (object.isLight)
+                animate(object.light);
+        }
+    }
+    report("lights", "objects", lights, millisecondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+        entities.each<LightSource>(animate);
+    report("lights", "entities", lights, millisecondsSince(start));
+
+    start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < passes; pass++)
+        entities.parallelEach<LightSource>(animate);
+    report("lights", "parallel", lights, millisecondsSince(start));
+}
+
+
+inline bool runBenchmark(const std::string& name)
+{
+    if (name == "mesh")
+        runMeshBenchmark();
+    else if (name == "vertex-format")
+        runVertexFormatBenchmark();
+    else if (name == "cull")
+        runCullBenchmark();
+    else if (name == "pvs")
+        runPVSBenchmark();
+    else if (name == "occlusion")
+        runOcclusionBenchmark();
+    else if (name == "frame-pacing")
+        runFramePacingBenchmark();
+    else if (name == "transforms")
+        runTransformBenchmark();
+    else if (name == "entities")
+        runEntityBenchmark();
+    else
+    {
+        std::cerr << "Unknown benchmark: " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,347 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+// SSE2 is part of every x64 target, 32 bit MSVC needs /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE
+#include <emmintrin.h>
+#endif
+
+/* -------------------------------------------------------------------------- */
+/*                                    AABB                                    */
+/* -------------------------------------------------------------------------- */
+
+struct AABB
+{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    void expand(const glm::vec3& point)
+    {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const AABB& other)
+    {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    glm::vec3 center() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    // World bounds of the box after an affine transform (Arvo, "Transforming Axis-Aligned Bounding Boxes")
+    AABB transformed(const glm::mat4& transform) const
+    {
+        glm::vec3 center = glm::vec3(transform * glm::vec4(this->center(), 1.0f));
+        glm::vec3 extent = (max - min) * 0.5f;
+        glm::mat3 absolute = glm::mat3(transform);
+        for (int i = 0; i < 3; i++)
+            absolute[i] = glm::abs(absolute[i]);
+        glm::vec3 radius = absolute * extent;
+
+        AABB result;
+        result.min = center - radius;
+        result.max = center + radius;
+        return result;
+    }
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                                   Frustum                                  */
+/* -------------------------------------------------------------------------- */
+
+enum class Visibility {
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE,
+};
+
+// The six clip planes of a projection * view matrix, stored as columns so one SSE register holds
+// the same component of four planes. The last two lanes are padding planes every box passes.
+struct alignas(16) Frustum
+{
+    float X[8], Y[8], Z[8], W[8];
+    float AbsX[8], AbsY[8], AbsZ[8];
+
+    // Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix".
+    // rect narrows the side planes to a sub-rectangle of the screen in NDC, xy min and zw max.
+    static Frustum fromMatrix(const glm::mat4& viewProjection, const glm::vec4& rect = glm::vec4(-1.0f, -1.0f, 1.0f, 1.0f))
+    {
+        glm::mat4 m = glm::transpose(viewProjection);
+        glm::vec4 planes[6] = {
+            m[0] - rect.x * m[3], rect.z * m[3] - m[0], // left, right
+            m[1] - rect.y * m[3], rect.w * m[3] - m[1], // bottom, top
+            m[3] + m[2], m[3] - m[2],                   // near, far
+        };
+
+        Frustum frustum;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec4 plane = i < 6 ? planes[i] / glm::length(glm::vec3(planes[i])) : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            frustum.X[i] = plane.x;
+            frustum.Y[i] = plane.y;
+            frustum.Z[i] = plane.z;
+            frustum.W[i] = plane.w;
+            frustum.AbsX[i] = glm::abs(plane.x);
+            frustum.AbsY[i] = glm::abs(plane.y);
+            frustum.AbsZ[i] = glm::abs(plane.z);
+        }
+        return frustum;
+    }
+
+    // Centre/extent test, a box is outside as soon as it lies fully behind one plane
+    Visibility classify(const AABB& box) const
+    {
+        glm::vec3 c = box.center();
+        glm::vec3 e = (box.max - box.min) * 0.5f;
+
+#ifdef BVH_SSE
+        __m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+        __m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z);
+        __m128 zero = _mm_setzero_ps();
+        int outside = 0;
+        int crossing = 0;
+
+        for (int i = 0; i < 8; i += 4)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(X + i), cx), _mm_mul_ps(_mm_load_ps(Y + i), cy)),
+                _mm_add_ps(_mm_mul_ps(_mm_load_ps(Z + i), cz), _mm_load_ps(W + i)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(AbsX + i), ex), _mm_mul_ps(_mm_load_ps(AbsY + i), ey)),
+                _mm_mul_ps(_mm_load_ps(AbsZ + i), ez));
+
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+            crossing |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, radius), zero));
+        }
+
+        if (outside)
+            return Visibility::OUTSIDE;
+        return crossing ? Visibility::INTERSECTING : Visibility::INSIDE;
+#else
+        bool crossing = false;
+        for (int i = 0; i < 6; i++)
+        {
+            float distance = X[i] * c.x + Y[i] * c.y + Z[i] * c.z + W[i];
+            float radius = AbsX[i] * e.x + AbsY[i] * e.y + AbsZ[i] * e.z;
+            if (distance + radius < 0.0f)
+                return Visibility::OUTSIDE;
+            if (distance - radius < 0.0f)
+                crossing = true;
+        }
+        return crossing ? Visibility::INTERSECTING : Visibility::INSIDE;
+#endif
+    }
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                         Bounding Volume Hierarchy                          */
+/* -------------------------------------------------------------------------- */
+
+// Binary tree over object bounds in depth-first order: a node's left child directly follows it
+// and every node covers a contiguous run of Objects. Moving objects call update() and the tree is
+// refit bottom-up before the next query instead of being rebuilt.
+class BVH
+{
+public:
+    static const unsigned int LEAF_SIZE = 4;
+
+    struct Node
+    {
+        AABB bounds;
+        unsigned int first;
+        unsigned int count;
+        unsigned int right; // 0 for leaves, the root is never a right child
+    };
+
+    std::vector<Node> Nodes;
+    std::vector<unsigned int> Objects;
+
+    void build(const std::vector<AABB>& objectBounds)
+    {
+        bounds = objectBounds;
+        dirty = false;
+
+        Nodes.clear();
+        Objects.resize(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+            Objects[i] = (unsigned int)i;
+
+        if (bounds.empty())
+            return;
+
+        Nodes.reserve(bounds.size() / LEAF_SIZE * 2 + 1);
+        std::vector<glm::vec3> centers(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+            centers[i] = bounds[i].center();
+
+        buildNode(0, (unsigned int)bounds.size(), centers);
+    }
+
+    void update(unsigned int object, const AABB& objectBounds)
+    {
+        bounds[object] = objectBounds;
+        dirty = true;
+    }
+
+    // Children always follow their parent, so a reverse walk sees them first
+    void refit()
+    {
+        if (!dirty)
+            return;
+
+        for (size_t n = Nodes.size(); n-- > 0;)
+        {
+            Node& node = Nodes[n];
+            node.bounds = AABB();
+            if (node.right == 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; i++)
+                    node.bounds.expand(bounds[Objects[i]]);
+            }
+            else
+            {
+                node.bounds.expand(Nodes[n + 1].bounds);
+                node.bounds.expand(Nodes[node.right].bounds);
+            }
+        }
+        dirty = false;
+    }
+
+    // Appends every object that may be visible. Subtrees fully inside the frustum are taken
+    // whole without testing their children.
+    void cull(const Frustum& frustum, std::vector<unsigned int>& visible)
+    {
+        refit();
+        if (Nodes.empty())
+            return;
+
+        unsigned int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            const Node& node = Nodes[stack[--top]];
+            Visibility visibility = frustum.classify(node.bounds);
+            if (visibility == Visibility::OUTSIDE)
+                continue;
+
+            if (visibility == Visibility::INSIDE)
+            {
+                visible.insert(visible.end(), Objects.begin() + node.first, Objects.begin() + node.first + node.count);
+            }
+            else if (node.right == 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; i++)
+                {
+                    if (frustum.classify(bounds[Objects[i]]) != Visibility::OUTSIDE)
+                        visible.push_back(Objects[i]);
+                }
+            }
+            else
+            {
+                stack[top++] = node.right;
+                stack[top++] = (unsigned int)(&node - Nodes.data()) + 1;
+            }
+        }
+    }
+
+    // Walks the nodes the segment from -> to passes through and calls hit(object) for each object in
+    // them until it returns true. Used for visibility rays, so the first hit ends the query.
+    template <typename Hit>
+    bool anyHit(const glm::vec3& from, const glm::vec3& to, Hit hit)
+    {
+        refit();
+        if (Nodes.empty())
+            return false;
+
+        glm::vec3 direction = to - from;
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+
+        unsigned int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            unsigned int index = stack[--top];
+            const Node& node = Nodes[index];
+            if (!segmentOverlaps(node.bounds, from, inverse))
+                continue;
+
+            if (node.right == 0)
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; i++)
+                {
+                    if (hit(Objects[i]))
+                        return true;
+                }
+            }
+            else
+            {
+                stack[top++] = node.right;
+                stack[top++] = index + 1;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::vector<AABB> bounds;
+    bool dirty = false;
+
+    // Slab test clamped to the segment, t in [0, 1]
+    static bool segmentOverlaps(const AABB& box, const glm::vec3& from, const glm::vec3& inverse)
+    {
+        glm::vec3 t0 = (box.min - from) * inverse;
+        glm::vec3 t1 = (box.max - from) * inverse;
+        glm::vec3 near = glm::min(t0, t1);
+        glm::vec3 far = glm::max(t0, t1);
+        float enter = glm::max(glm::max(near.x, near.y), glm::max(near.z, 0.0f));
+        float exit = glm::min(glm::min(far.x, far.y), glm::min(far.z, 1.0f));
+        return enter <= exit;
+    }
+
+    // Median split on the longest axis of the centres, keeps depth at log2(n / LEAF_SIZE)
+    unsigned int buildNode(unsigned int first, unsigned int count, const std::vector<glm::vec3>& centers)
+    {
+        unsigned int index = (unsigned int)Nodes.size();
+        Nodes.push_back({ AABB(), first, count, 0 });
+
+        AABB nodeBounds;
+        AABB centerBounds;
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            nodeBounds.expand(bounds[Objects[i]]);
+            centerBounds.expand(centers[Objects[i]]);
+        }
+        Nodes[index].bounds = nodeBounds;
+
+        if (count <= LEAF_SIZE)
+            return index;
+
+        glm::vec3 extent = centerBounds.max - centerBounds.min;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        unsigned int half = count / 2;
+        std::nth_element(Objects.begin() + first, Objects.begin() + first + half, Objects.begin() + first + count,
+            [&](unsigned int a, unsigned int b) { return centers[a][axis] < centers[b][axis]; });
+
+        buildNode(first, half, centers);
+        unsigned int right = buildNode(first + half, count - half, centers);
+        Nodes[index].right = right;
+        return index;
+    }
+};
+#endif
@@ -0,0 +1,105 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "camera.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                 Camera Path                                */
+/* -------------------------------------------------------------------------- */
+
+struct CameraKey
+{
+    float time;
+    glm::vec3 position;
+    float yaw;
+    float pitch;
+};
+
+
+// Camera poses over time, recorded while playing and replayed by benchmarks. Saved as text,
+// one "time x y z yaw pitch" line per key.
+class CameraPath
+{
+public:
+    std::vector<CameraKey> Keys;
+
+    void record(float time, const Camera& camera)
+    {
+        Keys.push_back({ time, camera.Position, camera.Yaw, camera.Pitch });
+    }
+
+    float duration() const
+    {
+        return Keys.empty() ? 0.0f : Keys.back().time - Keys.front().time;
+    }
+
+    // Interpolated pose at time seconds from the first key, clamped to the ends of the path
+    Camera sample(float time) const
+    {
+        if (Keys.empty())
+            return Camera();
+
+        time += Keys.front().time;
+        size_t next = 0;
+        while (next < Keys.size() && Keys[next].time < time)
+            next++;
+
+        if (next == 0)
+            return toCamera(Keys.front());
+        if (next == Keys.size())
+            return toCamera(Keys.back());
+
+        const CameraKey& a = Keys[next - 1];
+        const CameraKey& b = Keys[next];
+        float t = (time - a.time) / glm::max(b.time - a.time, 1e-6f);
+        return toCamera({ time, glm::mix(a.position, b.position, t), glm::mix(a.yaw, b.yaw, t), glm::mix(a.pitch, b.pitch, t) });
+    }
+
+    bool save(const std::string& path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::CAMERA_PATH::FILE_NOT_WRITTEN: " << path << std::endl;
+            return false;
+        }
+
+        for (const CameraKey& key : Keys)
+            file << key.time << " " << key.position.x << " " << key.position.y << " " << key.position.z << " " << key.yaw << " " << key.pitch << "\n";
+        return true;
+    }
+
+    // False when the file is missing or has no keys
+    bool load(const std::string& path)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+
+        Keys.clear();
+        std::string line;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            CameraKey key;
+            if (fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+                Keys.push_back(key);
+        }
+        return !Keys.empty();
+    }
+
+private:
+    static Camera toCamera(const CameraKey& key)
+    {
+        return Camera(key.position, glm::vec3(0.0f, 1.0f, 0.0f), key.yaw, key.pitch);
+    }
+};
+#endif
@@ -0,0 +1,226 @@
+#ifndef COMMAND_LIST_H
+#define COMMAND_LIST_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+
+#include "shader.hpp"
+#include "instancing.hpp"
+#include "gl_extensions.hpp"
+#include "stats.hpp"
+#include "gl_state.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                Command List                                */
+/* -------------------------------------------------------------------------- */
+
+// Binary stream of GL state changes and draws, recorded once and replayed unchanged every frame.
+// Uniform locations are looked up while recording, so replay never builds a name or asks the
+// driver for one. Nothing per frame is recorded: camera, lights and time reach the shaders through
+// the uniform blocks bound before replay(). Whatever else changes (the draws, a toggled pass)
+// means clear() and record again. State changes replay through glState, so a bind the previous
+// pass already made costs nothing.
+class CommandList
+{
+public:
+    // draws replay() issues
+    unsigned int Draws = 0;
+
+    void clear()
+    {
+        stream.clear();
+        Draws = 0;
+    }
+
+    bool empty() const
+    {
+        return stream.empty();
+    }
+
+    size_t sizeBytes() const
+    {
+        return stream.size() * sizeof(uint32_t);
+    }
+
+    /* -------------------------------- Recording ------------------------------- */
+
+    void useProgram(const Shader& shader)
+    {
+        emit(USE_PROGRAM, shader.ID);
+    }
+
+    void bindVertexArray(unsigned int vao)
+    {
+        emit(BIND_VERTEX_ARRAY, vao);
+    }
+
+    void bindBuffer(GLenum target, unsigned int buffer)
+    {
+        emit(BIND_BUFFER, target, buffer);
+    }
+
+    void bindTexture(GLenum unit, GLenum target, unsigned int texture)
+    {
+        emit(BIND_TEXTURE, unit, target, texture);
+    }
+
+    void colorMask(bool write)
+    {
+        emit(COLOR_MASK, write ? 1u : 0u);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        emit(DEPTH_FUNC, func);
+    }
+
+    void depthMask(bool write)
+    {
+        emit(DEPTH_MASK, write ? 1u : 0u);
+    }
+
+    void enable(GLenum capability)
+    {
+        emit(ENABLE, capability);
+    }
+
+    void disable(GLenum capability)
+    {
+        emit(DISABLE, capability);
+    }
+
+    // Constant for the lifetime of the recording
+    void uniformInt(const Shader& shader, const std::string& name, int value)
+    {
+        emit(UNIFORM_INT, location(shader, name), (uint32_t)value);
+    }
+
+    // See setInstanceAttributes, expects the instance buffer bound to GL_ARRAY_BUFFER
+    void instanceAttributes(size_t baseInstance)
+    {
+        emit(INSTANCE_ATTRIBUTES, (uint32_t)baseInstance);
+    }
+
+    void drawElementsInstancedBaseVertex(GLuint count, GLuint firstIndex, GLuint instanceCount, GLint baseVertex)
+    {
+        emit(DRAW_ELEMENTS, count, firstIndex, instanceCount, (uint32_t)baseVertex);
+        Draws++;
+    }
+
+    // Reads drawCount commands from the bound GL_DRAW_INDIRECT_BUFFER, starting at firstCommand
+    void multiDrawElementsIndirect(GLsizei drawCount, GLuint firstCommand = 0)
+    {
+        emit(MULTI_DRAW_INDIRECT, (uint32_t)drawCount, firstCommand);
+        Draws++;
+    }
+
+    /* -------------------------------- Replaying ------------------------------- */
+
+    void replay() const
+    {
+        const uint32_t* command = stream.data();
+        const uint32_t* end = command + stream.size();
+        while (command < end)
+        {
+            switch (command[0])
+            {
+            case USE_PROGRAM:
+                glState.useProgram(command[1]);
+                command += 2;
+                break;
+            case BIND_VERTEX_ARRAY:
+                glState.bindVertexArray(command[1]);
+                command += 2;
+                break;
+            case BIND_BUFFER:
+                glState.bindBuffer(command[1], command[2]);
+                command += 3;
+                break;
+            case BIND_TEXTURE:
+                glState.bindTexture(command[1], command[2], command[3]);
+                command += 4;
+                break;
+            case COLOR_MASK:
+                glState.colorMask(command[1] != 0);
+                command += 2;
+                break;
+            case DEPTH_FUNC:
+                glState.depthFunc(command[1]);
+                command += 2;
+                break;
+            case DEPTH_MASK:
+                glState.depthMask(command[1] != 0);
+                command += 2;
+                break;
+            case ENABLE:
+                glState.enable(command[1]);
+                command += 2;
+                break;
+            case DISABLE:
+                glState.disable(command[1]);
+                command += 2;
+                break;
+            case UNIFORM_INT:
+                glUniform1i((GLint)command[1], (GLint)command[2]);
+                command += 3;
+                break;
+            case INSTANCE_ATTRIBUTES:
+                setInstanceAttributes(command[1]);
+                command += 2;
+                break;
+            case DRAW_ELEMENTS:
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command[1], GL_UNSIGNED_INT,
+                    (void*)(command[2] * sizeof(unsigned int)), command[3], (GLint)command[4]);
+                command += 5;
+                break;
+            case MULTI_DRAW_INDIRECT:
+                // a DrawElementsIndirectCommand is five words
+                glExtensions.MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                    (void*)(command[2] * 5 * sizeof(GLuint)), (GLsizei)command[1], 0);
+                command += 3;
+                break;
+            default:
+                std::cout << "ERROR::COMMAND_LIST::UNKNOWN_COMMAND" << std::endl;
+                return;
+            }
+        }
+        frameStats.drawCalls += Draws;
+    }
+
+private:
+    enum Opcode : uint32_t {
+        USE_PROGRAM,
+        BIND_VERTEX_ARRAY,
+        BIND_BUFFER,
+        BIND_TEXTURE,
+        COLOR_MASK,
+        DEPTH_FUNC,
+        DEPTH_MASK,
+        ENABLE,
+        DISABLE,
+        UNIFORM_INT,
+        INSTANCE_ATTRIBUTES,
+        DRAW_ELEMENTS,
+        MULTI_DRAW_INDIRECT,
+    };
+
+    // opcode followed by its operands, one word each
+    std::vector<uint32_t> stream;
+
+    template <typename... Operands>
+    void emit(Opcode opcode, Operands... operands)
+    {
+        stream.push_back(opcode);
+        (stream.push_back((uint32_t)operands), ...);
+    }
+
+    static uint32_t location(const Shader& shader, const std::string& name)
+    {
+        return (uint32_t)glGetUniformLocation(shader.ID, name.c_str());
+    }
+};
+#endif
@@ -0,0 +1,251 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <iostream>
+
+#include "shader.hpp"
+#include "stats.hpp"
+#include "gl_state.hpp"
+#include "antialiasing.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                            Resolution Controller                           */
+/* -------------------------------------------------------------------------- */
+
+// Picks the render scale from measured GPU frame times. Cost is taken to follow the pixel count,
+// the square of the scale. Decisions use the median of the last three timings so a single hitch
+// (or a bogus first query) cannot move the scale. Oscillation is avoided three ways: nothing
+// changes while the time sits between UNDER_BUDGET and the target, scales move in fixed steps
+// and only climb one step at a time, and after each change the timings already in flight are
+// ignored (GpuTimer reads back QUERY_COUNT frames late) before the next decision.
+class ResolutionController
+{
+public:
+    static constexpr float STEP = 0.05f;
+    // time below this fraction of the target is headroom worth spending on resolution
+    static constexpr float UNDER_BUDGET = 0.75f;
+    // a drop aims this far under the target so the next frames have some margin
+    static constexpr float AIM = 0.85f;
+    static const int SETTLE_FRAMES = GpuTimer::QUERY_COUNT + 2;
+
+    float TargetMs;
+    float MinScale;
+    float MaxScale;
+    float Scale;
+
+    ResolutionController(float targetMs = 1000.0f / 60.0f, float minScale = 0.5f, float maxScale = 1.0f)
+        : TargetMs(targetMs), MinScale(minScale), MaxScale(maxScale), Scale(maxScale) {}
+
+    // Returns true when the scale changed
+    bool update(double gpuMs)
+    {
+        if (gpuMs <= 0.0)
+            return false;
+
+        if (settle > 0)
+        {
+            settle--;
+            return false;
+        }
+
+        history[sampleCount++ % 3] = gpuMs;
+        if (sampleCount < 3)
+            return false;
+
+        double medianMs = glm::max(glm::min(history[0], history[1]), glm::min(glm::max(history[0], history[1]), history[2]));
+        float ideal = Scale * (float)glm::sqrt(TargetMs * AIM / medianMs);
+
+        float next = Scale;
+        if (medianMs > TargetMs)
+            next = glm::floor(ideal / STEP) * STEP;
+        else if (medianMs < TargetMs * UNDER_BUDGET)
+            next = glm::min(glm::floor(ideal / STEP) * STEP, Scale + STEP);
+        next = glm::clamp(next, MinScale, MaxScale);
+
+        if (glm::abs(next - Scale) < STEP * 0.5f)
+            return false;
+
+        Scale = next;
+        settle = SETTLE_FRAMES;
+        sampleCount = 0;
+        return true;
+    }
+
+private:
+    double history[3] = {};
+    int sampleCount = 0;
+    int settle = 0;
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                             Dynamic Resolution                             */
+/* -------------------------------------------------------------------------- */
+
+// Offscreen target the scene renders into at Controller.Scale of the window size. It is allocated
+// at the full window size and only a corner of it is used, so scale changes never reallocate.
+// The target has the sample count AA's mode asks for. At full scale and without an AA pass it is
+// blitted straight to the window. Otherwise it is resolved, goes through AA's pass and is blitted
+// or drawn upscaled with a light sharpening filter.
+class DynamicResolution
+{
+public:
+    ResolutionController Controller;
+    // 0 keeps the bilinear upscale as is, 1 is the strongest sharpening at the lowest scale
+    float Sharpness = 0.5f;
+    // framebuffer end() presents into, the window's unless running headless
+    unsigned int OutputFBO = 0;
+    AntiAliasing AA;
+
+    DynamicResolution(const ResolutionController& controller = ResolutionController())
+        : Controller(controller), upscaleShader("src/shaders/upscale.vert", "src/shaders/upscale.frag")
+    {
+        glGenFramebuffers(1, &sceneFBO);
+        glGenRenderbuffers(1, &colorBuffer);
+        glGenRenderbuffers(1, &depthBuffer);
+        glGenFramebuffers(1, &resolveFBO);
+        glGenTextures(1, &resolveTexture);
+        glGenVertexArrays(1, &emptyVAO);
+
+        upscaleShader.use();
+        upscaleShader.setInt("sceneTexture", 0);
+    }
+
+    glm::ivec2 renderSize() const
+    {
+        return glm::max(glm::ivec2(glm::vec2(windowSize) * Controller.Scale + 0.5f), glm::ivec2(1));
+    }
+
+    // Binds the target for the scene at the current scale and clears it
+    void begin(int windowWidth, int windowHeight)
+    {
+        if (windowWidth != windowSize.x || windowHeight != windowSize.y || AA.samples() != samples)
+            resize(windowWidth, windowHeight);
+
+        glm::ivec2 size = renderSize();
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glViewport(0, 0, size.x, size.y);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        frameStats.renderScale = Controller.Scale;
+    }
+
+    // Puts the rendered scene on the window, leaves OutputFBO bound
+    void end()
+    {
+        glm::ivec2 size = renderSize();
+
+        if (size == windowSize && !AA.postProcess())
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OutputFBO);
+            glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, OutputFBO);
+            glViewport(0, 0, windowSize.x, windowSize.y);
+            return;
+        }
+
+        // resolve samples first, a multisampled buffer cannot be filtered
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFBO);
+        glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+        bool depthTest = glState.enabled(GL_DEPTH_TEST);
+        bool blend = glState.enabled(GL_BLEND);
+        glState.disable(GL_DEPTH_TEST);
+        glState.disable(GL_BLEND);
+
+        unsigned int presentFBO = resolveFBO;
+        unsigned int presentTexture = resolveTexture;
+        if (AA.postProcess())
+        {
+            AA.apply(sceneFBO, resolveTexture, size);
+            presentFBO = AA.outputFBO();
+            presentTexture = AA.outputTexture();
+        }
+
+        if (size == windowSize)
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, presentFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OutputFBO);
+            glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, OutputFBO);
+        glViewport(0, 0, windowSize.x, windowSize.y);
+
+        if (size != windowSize)
+        {
+            upscaleShader.use();
+            upscaleShader.setVec2("uvScale", glm::vec2(size) / glm::vec2(windowSize));
+            upscaleShader.setFloat("sharpness", Sharpness * (1.0f - Controller.Scale) / glm::max(1.0f - Controller.MinScale, 1e-3f));
+            glState.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D, presentTexture);
+            glState.bindVertexArray(emptyVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+
+        if (depthTest)
+            glState.enable(GL_DEPTH_TEST);
+        if (blend)
+            glState.enable(GL_BLEND);
+    }
+
+    // Feed the GPU time of the finished frame, returns true when the scale changed
+    bool update(double gpuMs)
+    {
+        return Controller.update(gpuMs);
+    }
+
+private:
+    int samples = 0;
+    glm::ivec2 windowSize = glm::ivec2(0);
+
+    unsigned int sceneFBO;
+    unsigned int colorBuffer;
+    unsigned int depthBuffer;
+    unsigned int resolveFBO;
+    unsigned int resolveTexture;
+    unsigned int emptyVAO;
+    Shader upscaleShader;
+
+    void resize(int width, int height)
+    {
+        windowSize = glm::ivec2(glm::max(width, 1), glm::max(height, 1));
+        samples = AA.samples();
+        AA.resize(windowSize);
+        // a count of 1 could still get a multisampled buffer, TAA reads the depth as single sampled
+        int storageSamples = samples > 1 ? samples : 0;
+
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, storageSamples, GL_RGBA8, windowSize.x, windowSize.y);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorageMultisample(GL_RENDERBUFFER, storageSamples, GL_DEPTH24_STENCIL8, windowSize.x, windowSize.y);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DYNAMIC_RESOLUTION::SCENE_FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+
+        glState.bindTexture(GL_TEXTURE_2D, resolveTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, windowSize.x, windowSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glState.bindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, resolveFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, resolveTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::DYNAMIC_RESOLUTION::RESOLVE_FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+#endif
@@ -0,0 +1,382 @@
+#ifndef ENTITIES_H
+#define ENTITIES_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <type_traits>
+#include <cassert>
+
+/* -------------------------------------------------------------------------- */
+/*                                Entity Store                                */
+/* -------------------------------------------------------------------------- */
+
+// Entities grouped by archetype, the set of component types they have. An archetype keeps one
+// array per component type (structure of arrays) and row i of every array belongs to the same
+// entity, so a query streams through exactly the components it asks for, without gaps or
+// pointers to follow. Components lists every type the store can hold, an archetype leaves the
+// arrays of the types it lacks empty.
+// An entity keeps its id until destroy(), which moves the last row of its archetype into the hole.
+// Components cannot be added to or removed from a living entity, create it again instead.
+template <typename... Components>
+class EntityStore
+{
+public:
+    using Entity = uint32_t;
+    static constexpr Entity INVALID = 0xFFFFFFFFu;
+    // rows a parallelEach() worker takes at a time
+    static constexpr size_t ROWS_PER_CHUNK = 4096;
+
+    // threads 0 uses every core, the calling thread is one of them
+    EntityStore(unsigned int threads = 0)
+    {
+        setThreads(threads);
+    }
+
+    ~EntityStore()
+    {
+        stopWorkers();
+    }
+
+    EntityStore(const EntityStore&) = delete;
+    EntityStore& operator=(const EntityStore&) = delete;
+
+    // parallelEach() workers, started once and kept waiting between calls
+    void setThreads(unsigned int threads)
+    {
+        stopWorkers();
+        if (threads == 0)
+            threads = glm::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned int t = 1; t < threads; t++)
+            workers.emplace_back(&EntityStore::work, this);
+        threadCount = threads;
+    }
+
+    unsigned int threads() const
+    {
+        return threadCount;
+    }
+
+    template <typename... Cs>
+    Entity create(const Cs&... components)
+    {
+        uint32_t index = findArchetype(maskOf<Cs...>());
+        Archetype& archetype = archetypes[index];
+        (std::get<std::vector<Cs>>(archetype.Columns).push_back(components), ...);
+
+        Entity entity = (Entity)locations.size();
+        if (!freeEntities.empty())
+        {
+            entity = freeEntities.back();
+            freeEntities.pop_back();
+        }
+        else
+        {
+            locations.push_back({});
+        }
+        locations[entity] = { index, (uint32_t)archetype.Entities.size() };
+        archetype.Entities.push_back(entity);
+        living++;
+        return entity;
+    }
+
+    void destroy(Entity entity)
+    {
+        assert(locations[entity].ArchetypeIndex != INVALID && "entity destroyed twice");
+        Location location = locations[entity];
+        Archetype& archetype = archetypes[location.ArchetypeIndex];
+        size_t last = archetype.Entities.size() - 1;
+        std::apply([&](auto&... columns) { (removeRow(columns, location.Row, last), ...); }, archetype.Columns);
+
+        Entity moved = archetype.Entities[last];
+        archetype.Entities[location.Row] = moved;
+        archetype.Entities.pop_back();
+        locations[moved].Row = location.Row;
+
+        locations[entity] = { INVALID, 0 };
+        freeEntities.push_back(entity);
+        living--;
+    }
+
+    template <typename C>
+    bool has(Entity entity) const
+    {
+        assert(locations[entity].ArchetypeIndex != INVALID && "entity was destroyed");
+        return (archetypes[locations[entity].ArchetypeIndex].Signature & maskOf<C>()) != 0;
+    }
+
+    template <typename C>
+    C& get(Entity entity)
+    {
+        const Location& location = locations[entity];
+        assert(location.ArchetypeIndex != INVALID && "entity was destroyed");
+        return std::get<std::vector<C>>(archetypes[location.ArchetypeIndex].Columns)[location.Row];
+    }
+
+    // Calls function(Cs&...) for every entity with all of Cs, one archetype after the other and
+    // in creation order within each, as long as nothing was destroyed
+    template <typename... Cs, typename Function>
+    void each(Function function)
+    {
+        Mask wanted = maskOf<Cs...>();
+        for (Archetype& archetype : archetypes)
+        {
+            if ((archetype.Signature & wanted) == wanted)
+                eachRow(0, archetype.Entities.size(), function, std::get<std::vector<Cs>>(archetype.Columns).data()...);
+        }
+    }
+
+    // As each(), with the rows split into chunks handed out to the store's threads, the calling
+    // thread being one of them. function runs concurrently and in no particular order, it may only
+    // write the components it is given.
+    template <typename... Cs, typename Function>
+    void parallelEach(Function function)
+    {
+        struct Chunk
+        {
+            Archetype* archetype;
+            size_t first;
+            size_t last;
+        };
+        std::vector<Chunk> chunks;
+        Mask wanted = maskOf<Cs...>();
+        for (Archetype& archetype : archetypes)
+        {
+            if ((archetype.Signature & wanted) != wanted)
+                continue;
+            for (size_t first = 0; first < archetype.Entities.size(); first += ROWS_PER_CHUNK)
+                chunks.push_back({ &archetype, first, std::min(first + ROWS_PER_CHUNK, archetype.Entities.size()) });
+        }
+
+        std::atomic<size_t> next(0);
+        auto worker = [&]() {
+            for (size_t c = next++; c < chunks.size(); c = next++)
+                eachRow(chunks[c].first, chunks[c].last, function, std::get<std::vector<Cs>>(chunks[c].archetype->Columns).data()...);
+        };
+
+        // a single chunk is not worth waking the workers for
+        if (workers.empty() || chunks.size() < 2)
+        {
+            worker();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = worker;
+            generation++;
+            busy = (unsigned int)workers.size();
+        }
+        started.notify_all();
+
+        worker();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return busy == 0; });
+        job = nullptr;
+    }
+
+    // Entities with all of Cs
+    template <typename... Cs>
+    size_t count() const
+    {
+        Mask wanted = maskOf<Cs...>();
+        size_t total = 0;
+        for (const Archetype& archetype : archetypes)
+        {
+            if ((archetype.Signature & wanted) == wanted)
+                total += archetype.Entities.size();
+        }
+        return total;
+    }
+
+    size_t size() const
+    {
+        return living;
+    }
+
+    size_t archetypeCount() const
+    {
+        return archetypes.size();
+    }
+
+private:
+    using Mask = uint32_t;
+    static_assert(sizeof...(Components) <= 32, "an archetype's signature has one bit per component type");
+
+    struct Archetype
+    {
+        Mask Signature = 0;
+        std::tuple<std::vector<Components>...> Columns;
+        // entity of each row
+        std::vector<Entity> Entities;
+    };
+
+    struct Location
+    {
+        uint32_t ArchetypeIndex = INVALID;
+        uint32_t Row = 0;
+    };
+
+    std::vector<Archetype> archetypes;
+    // indexed by entity
+    std::vector<Location> locations;
+    std::vector<Entity> freeEntities;
+    size_t living = 0;
+
+    unsigned int threadCount = 1;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    // the running parallelEach()'s chunk loop
+    std::function<void()> job;
+    unsigned long long generation = 0;
+    unsigned int busy = 0;
+    bool stopping = false;
+
+    void work()
+    {
+        unsigned long long seen = 0;
+        while (true)
+        {
+            std::function<void()>* task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+                task = &job;
+            }
+
+            (*task)();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+
+    void stopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+        stopping = false;
+    }
+
+    template <typename C>
+    static constexpr uint32_t indexOf()
+    {
+        constexpr bool matches[] = { std::is_same<C, Components>::value... };
+        for (uint32_t i = 0; i < sizeof...(Components); i++)
+        {
+            if (matches[i])
+                return i;
+        }
+        return sizeof...(Components);
+    }
+
+    template <typename... Cs>
+    static constexpr Mask maskOf()
+    {
+        static_assert(((indexOf<Cs>() < sizeof...(Components)) && ...), "component type not in the store's list");
+        return ((Mask(1) << indexOf<Cs>()) | ...);
+    }
+
+    uint32_t findArchetype(Mask signature)
+    {
+        for (uint32_t i = 0; i < (uint32_t)archetypes.size(); i++)
+        {
+            if (archetypes[i].Signature == signature)
+                return i;
+        }
+        archetypes.emplace_back();
+        archetypes.back().Signature = signature;
+        return (uint32_t)archetypes.size() - 1;
+    }
+
+    template <typename C>
+    static void removeRow(std::vector<C>& column, size_t row, size_t last)
+    {
+        if (column.empty())
+            return;
+        if (row != last)
+            column[row] = std::move(column[last]);
+        column.pop_back();
+    }
+
+    template <typename Function, typename... Cs>
+    static void eachRow(size_t first, size_t last, Function& function, Cs*... columns)
+    {
+        for (size_t row = first; row < last; row++)
+            function(columns[row]...);
+    }
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                             Gallery Components                             */
+/* -------------------------------------------------------------------------- */
+
+// Where a static object stands, fixed once it is submitted
+struct WorldTransform
+{
+    glm::mat4 Model = glm::mat4(1.0f);
+};
+
+// How StaticScene draws an object, entities with the same mesh and material share a draw
+struct Renderable
+{
+    int Mesh = 0;
+    // index into default.frag's materials[]
+    int Material = 0;
+    int SampleSpace = 0;
+    int TextureLayer = 0;
+    // see Lightmap::addChart, zero for objects lit every frame
+    glm::vec4 LightmapRect = glm::vec4(0.0f);
+    // PortalGraph cell, -1 when never portal culled
+    int Cell = -1;
+    // StaticScene instance, filled in on submission
+    int Instance = -1;
+};
+
+// A spot light. Slot is its index into default.frag's lights[], slot 0 lights the floor of the
+// first room and the others a painting each.
+struct LightSource
+{
+    glm::vec3 Position = glm::vec3(0.0f);
+    int Slot = 0;
+};
+
+// An artwork, on the catalogue's entities and on every copy hung on a wall
+struct Painting
+{
+    int textureLayer{};
+    glm::vec3 size{};
+
+    Painting() = default;
+
+    Painting(int layer, glm::ivec2 pixelSize)
+    {
+        textureLayer = layer;
+        size = glm::vec3((float)pixelSize.x / 64.0f, (float)pixelSize.y / 64.0f, 1.0f);
+    }
+}; // struct Painting
+
+using GalleryEntities = EntityStore<WorldTransform, Renderable, LightSource, Painting>;
+#endif
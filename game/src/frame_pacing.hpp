@@ -0,0 +1,217 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+// Without this Windows rounds every sleep up to its 15.6 ms scheduler tick
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <timeapi.h>
+#pragma comment(lib, "winmm.lib")
+#endif
+
+/* -------------------------------------------------------------------------- */
+/*                                Frame Pacing                                */
+/* -------------------------------------------------------------------------- */
+
+enum class PacingMode {
+    UNCAPPED,
+    VSYNC,
+    ADAPTIVE_VSYNC, // vsync while on time, tears instead of waiting a whole refresh when late
+    CAPPED,         // TargetFps held by the CPU, independent of the display
+};
+
+inline const char* pacingModeName(PacingMode mode)
+{
+    switch (mode)
+    {
+    case PacingMode::UNCAPPED:
+        return "uncapped";
+    case PacingMode::VSYNC:
+        return "vsync";
+    case PacingMode::ADAPTIVE_VSYNC:
+        return "adaptive vsync";
+    default:
+        return "capped";
+    }
+}
+
+inline PacingMode nextPacingMode(PacingMode mode)
+{
+    return (PacingMode)(((int)mode + 1) % 4);
+}
+
+
+// Owns the swap interval and the frame clock. beginFrame() measures the last frame and hands out a
+// smoothed delta time. In CAPPED mode wait() holds each frame until its deadline: it sleeps while
+// more than SpinMs remain, since sleeps can overshoot by the scheduler's granularity, and spins for
+// the rest. Deadlines advance by a fixed period so an early wake never shifts later frames.
+class FramePacer
+{
+public:
+    // frame times kept for report()
+    static const int HISTORY = 240;
+    // deltas averaged by smoothedDelta
+    static const int SMOOTHING = 8;
+
+    struct Report
+    {
+        double meanMs = 0.0;
+        double deviationMs = 0.0;
+        double minMs = 0.0;
+        double maxMs = 0.0;
+        double spinMs = 0.0; // average time per frame wait() spent busy waiting
+    };
+
+    PacingMode Mode = PacingMode::VSYNC;
+    double TargetFps = 60.0;
+    double SpinMs = 1.5;
+    // raw duration of the last frame in seconds
+    float LastDelta = 0.0f;
+
+    FramePacer()
+    {
+#ifdef _WIN32
+        timeBeginPeriod(1);
+#endif
+        last = Clock::now();
+        deadline = last;
+    }
+
+    ~FramePacer()
+    {
+#ifdef _WIN32
+        timeEndPeriod(1);
+#endif
+    }
+
+    // Sets the swap interval, on the thread owning the context. Adaptive vsync falls back to vsync
+    // without the swap_control_tear extensions
+    void setMode(PacingMode mode)
+    {
+        Mode = mode;
+        int interval = 0;
+        if (mode == PacingMode::VSYNC)
+            interval = 1;
+        else if (mode == PacingMode::ADAPTIVE_VSYNC)
+            interval = glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear") ? -1 : 1;
+        glfwSwapInterval(interval);
+        deadline = Clock::now();
+    }
+
+    // Call once at the start of every frame, returns the smoothed delta in seconds
+    float beginFrame()
+    {
+        Clock::time_point now = Clock::now();
+        double frameMs = std::chrono::duration<double, std::milli>(now - last).count();
+        last = now;
+
+        // nothing to measure before the first frame, only start up time
+        if (!started)
+        {
+            started = true;
+            return 0.0f;
+        }
+
+        history[frames % HISTORY] = frameMs;
+        spinHistory[frames % HISTORY] = spinMs;
+        frames++;
+        spinMs = 0.0;
+
+        LastDelta = (float)(frameMs / 1000.0);
+        return smoothedDelta();
+    }
+
+    // Call right before swapping buffers
+    void wait()
+    {
+        if (Mode != PacingMode::CAPPED || TargetFps <= 0.0)
+            return;
+
+        Clock::duration period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / TargetFps));
+        deadline += period;
+
+        // far behind (a hitch or a mode change), restart the schedule rather than rushing to catch up
+        Clock::time_point now = Clock::now();
+        if (now > deadline + period)
+            deadline = now;
+
+        Clock::duration spin = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(SpinMs));
+        if (deadline - now > spin)
+            std::this_thread::sleep_for(deadline - now - spin);
+
+        Clock::time_point spinStart = Clock::now();
+        while (Clock::now() < deadline)
+            std::this_thread::yield();
+        spinMs += std::chrono::duration<double, std::milli>(Clock::now() - spinStart).count();
+    }
+
+    // Average of the last SMOOTHING frames. A latest frame longer than four times the average of
+    // the others is counted as that average, so a single stall does not throw the camera across
+    // the room.
+    float smoothedDelta() const
+    {
+        int count = (int)std::min<unsigned long long>(frames, SMOOTHING);
+        if (count == 0)
+            return 0.0f;
+
+        double latest = history[(frames - 1) % HISTORY];
+        double others = 0.0;
+        for (int i = 2; i <= count; i++)
+            others += history[(frames - i) % HISTORY];
+        if (count > 1 && latest > others / (count - 1) * 4.0)
+            latest = others / (count - 1);
+
+        return (float)((others + latest) / count / 1000.0);
+    }
+
+    // Statistics over the last HISTORY frames
+    Report report() const
+    {
+        Report result;
+        int count = (int)std::min<unsigned long long>(frames, HISTORY);
+        if (count == 0)
+            return result;
+
+        result.minMs = history[(frames - 1) % HISTORY];
+        result.maxMs = result.minMs;
+        for (int i = 1; i <= count; i++)
+        {
+            double ms = history[(frames - i) % HISTORY];
+            result.meanMs += ms;
+            result.spinMs += spinHistory[(frames - i) % HISTORY];
+            result.minMs = std::min(result.minMs, ms);
+            result.maxMs = std::max(result.maxMs, ms);
+        }
+        result.meanMs /= count;
+        result.spinMs /= count;
+
+        for (int i = 1; i <= count; i++)
+        {
+            double difference = history[(frames - i) % HISTORY] - result.meanMs;
+            result.deviationMs += difference * difference;
+        }
+        result.deviationMs = glm::sqrt(result.deviationMs / count);
+        return result;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Clock::time_point last;
+    Clock::time_point deadline;
+    double history[HISTORY] = {};
+    double spinHistory[HISTORY] = {};
+    double spinMs = 0.0;
+    unsigned long long frames = 0;
+    bool started = false;
+};
+#endif
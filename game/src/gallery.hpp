@@ -0,0 +1,144 @@
+#ifndef GALLERY_H
+#define GALLERY_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+
+#include "bvh.hpp"
+#include "portals.hpp"
+#include "pvs.hpp"
+
+// One instance of the unit plane mesh (x and z in [-0.5, 0.5], facing +y) placed in the gallery
+struct GallerySurface
+{
+    glm::mat4 model;
+    int cell;
+    int wall; // 0-3 turning from +z around y, -1 for floors and ceilings
+};
+
+
+// Rooms on a grid with room 0 at the origin, neighbours joined by a doorway near one end of their
+// shared wall. Needs no GL context, so offline tools such as the PVS baker can build the same layout.
+class GalleryLayout
+{
+public:
+    int RoomsX;
+    int RoomsZ;
+    float RoomSize;
+    float RoomHeight;
+    float DoorWidth;
+    float DoorHeight;
+    float DoorOffset;
+
+    PortalGraph Graph;
+    std::vector<GallerySurface> Floors;
+    std::vector<GallerySurface> Ceilings;
+    std::vector<GallerySurface> Walls;
+
+    GalleryLayout(int roomsX, int roomsZ, float roomSize, float roomHeight, float doorWidth, float doorHeight, float doorOffset)
+        : RoomsX(roomsX), RoomsZ(roomsZ), RoomSize(roomSize), RoomHeight(roomHeight), DoorWidth(doorWidth), DoorHeight(doorHeight), DoorOffset(doorOffset)
+    {
+        for (int r = 0; r < roomCount(); r++)
+        {
+            AABB bounds;
+            bounds.min = roomOrigin(r) - glm::vec3(RoomSize * 0.5f, 0.0f, RoomSize * 0.5f);
+            bounds.max = roomOrigin(r) + glm::vec3(RoomSize * 0.5f, RoomHeight, RoomSize * 0.5f);
+            Graph.addCell(bounds);
+        }
+
+        for (int r = 0; r < roomCount(); r++)
+        {
+            glm::mat4 model = glm::translate(glm::mat4(1.0f), roomOrigin(r));
+            model = glm::scale(model, glm::vec3(RoomSize));
+            Floors.push_back({ model, r, -1 });
+
+            model = glm::translate(glm::mat4(1.0f), roomOrigin(r) + glm::vec3(0.0, RoomHeight, 0.0));
+            model = glm::scale(model, glm::vec3(RoomSize));
+            model = glm::rotate(model, glm::radians(-180.0f), glm::vec3(1, 0, 0));
+            Ceilings.push_back({ model, r, -1 });
+
+            for (int i = 0; i < 4; i++)
+                addWall(r, i);
+        }
+    }
+
+    int roomCount() const
+    {
+        return RoomsX * RoomsZ;
+    }
+
+    glm::vec3 roomOrigin(int room) const
+    {
+        return glm::vec3(room % RoomsX, 0.0f, room / RoomsX) * RoomSize;
+    }
+
+    // Wall space spans x in [-RoomSize/2, RoomSize/2] and y in [0, RoomHeight] on the plane z = RoomSize/2
+    glm::mat4 wallTransform(int room, int wall) const
+    {
+        return glm::translate(glm::mat4(1.0f), roomOrigin(room)) * glm::rotate(glm::mat4(1.0f), glm::radians(90.0f * wall), glm::vec3(0, 1, 0));
+    }
+
+    // Walls are the only surfaces that block sight between rooms
+    std::vector<Occluder> occluders() const
+    {
+        std::vector<Occluder> result;
+        for (const GallerySurface& wall : Walls)
+            result.push_back(Occluder::fromPlane(wall.model));
+        return result;
+    }
+
+    // Neighbouring room behind a wall, -1 at the edge of the gallery
+    int roomBehindWall(int room, int wall) const
+    {
+        int x = room % RoomsX + (wall == 1 ? 1 : wall == 3 ? -1 : 0);
+        int z = room / RoomsX + (wall == 0 ? 1 : wall == 2 ? -1 : 0);
+        if (x < 0 || x >= RoomsX || z < 0 || z >= RoomsZ)
+            return -1;
+        return z * RoomsX + x;
+    }
+
+private:
+    glm::mat4 wallSegment(int room, int wall, float x0, float x1, float y0, float y1) const
+    {
+        glm::mat4 tranMat = glm::translate(glm::mat4(1.0f), glm::vec3((x0 + x1) * 0.5f, (y0 + y1) * 0.5f, RoomSize * 0.5f));
+        glm::mat4 rotMat = glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0));
+        glm::mat4 scaMat = glm::scale(glm::mat4(1.0f), glm::vec3(x1 - x0, RoomSize, y1 - y0));
+        return wallTransform(room, wall) * tranMat * rotMat * scaMat;
+    }
+
+    // Split around a doorway wherever there is a room behind the wall
+    void addWall(int room, int wall)
+    {
+        float half = RoomSize * 0.5f;
+        int neighbour = roomBehindWall(room, wall);
+        if (neighbour < 0)
+        {
+            Walls.push_back({ wallSegment(room, wall, -half, half, 0.0f, RoomHeight), room, wall });
+            return;
+        }
+
+        // both sides of a doorway sit at the same world position, so the offset flips on the far walls
+        float doorCenter = wall < 2 ? DoorOffset : -DoorOffset;
+        float door0 = doorCenter - DoorWidth * 0.5f;
+        float door1 = doorCenter + DoorWidth * 0.5f;
+        Walls.push_back({ wallSegment(room, wall, -half, door0, 0.0f, RoomHeight), room, wall });
+        Walls.push_back({ wallSegment(room, wall, door1, half, 0.0f, RoomHeight), room, wall });
+        Walls.push_back({ wallSegment(room, wall, door0, door1, DoorHeight, RoomHeight), room, wall });
+
+        // one portal per doorway, added from the room on its -x/-z side
+        if (wall < 2)
+        {
+            glm::mat4 toWorld = wallTransform(room, wall);
+            glm::vec3 corners[4] = {
+                glm::vec3(toWorld * glm::vec4(door0, 0.0f, half, 1.0f)),
+                glm::vec3(toWorld * glm::vec4(door1, 0.0f, half, 1.0f)),
+                glm::vec3(toWorld * glm::vec4(door1, DoorHeight, half, 1.0f)),
+                glm::vec3(toWorld * glm::vec4(door0, DoorHeight, half, 1.0f)),
+            };
+            Graph.addPortal(room, neighbour, corners);
+        }
+    }
+};
+#endif
@@ -9,9 +9,40 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <functional>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
 
 #include "shader.hpp"
 #include "camera.hpp"
+#include "gl_extensions.hpp"
+#include "gl_state.hpp"
+#include "mesh.hpp"
+#include "mesh_optimizer.hpp"
+#include "instancing.hpp"
+#include "static_scene.hpp"
+#include "portals.hpp"
+#include "gallery.hpp"
+#include "pvs.hpp"
+#include "occlusion.hpp"
+#include "stats.hpp"
+#include "dynamic_resolution.hpp"
+#include "camera_path.hpp"
+#include "frame_pacing.hpp"
+#include "render_thread.hpp"
+#include "command_list.hpp"
+#include "ring_buffer.hpp"
+#include "headless.hpp"
+#include "software_rasterizer.hpp"
+#include "lightmap.hpp"
+#include "shadow_atlas.hpp"
+#include "shading_cache.hpp"
+#include "light_volume.hpp"
+#include "transform_hierarchy.hpp"
+#include "entities.hpp"
+#include "benchmarks.hpp"
+#include "render_benchmarks.hpp"
 
 // #define DEBUG
 
@@ -27,6 +58,70 @@ const char* WINDOW_NAME = "The Art Gallery";
 const float roomSize = 10.0f;
 const float roomHeightFactor = 0.45f;
 
+// Rooms laid out on a grid, neighbours joined by a doorway near one end of their shared wall
+const int galleryRoomsX = 1;
+const int galleryRoomsZ = 1;
+const float doorWidth = 2.0f;
+const float doorHeight = 3.0f;
+const float doorOffset = roomSize * 0.3f;
+GalleryLayout gallery(galleryRoomsX, galleryRoomsZ, roomSize, roomSize * roomHeightFactor, doorWidth, doorHeight, doorOffset);
+
+// Baked with --bake-pvs, portal traversal is used instead when missing or out of date
+const char* galleryPVSPath = "resources/gallery.pvs";
+PVS galleryPVS;
+
+// Walls rasterized into a low resolution depth buffer each frame, instances fully behind them are not drawn
+const bool occlusionCulling = true;
+OcclusionBuffer occlusionBuffer;
+
+// Floors, walls and ceilings of every room, baked at startup from the lights' rest pose
+Lightmap galleryLightmap;
+
+/* -------------------------------- Paintings ------------------------------- */
+// Extra painting instances tiled over the walls, used to measure instancing throughput
+const int stressPaintingCount = 0;
+
+/* ------------------------------- Sculptures ------------------------------- */
+// Sculptures turning on pedestals around the first room, the only moving shadow casters. None in
+// the gallery yet, the shadow benchmark places some.
+int sculptureCount = 0;
+
+/* -------------------------------- Rendering ------------------------------- */
+// Depth-only pass before shading so default.frag runs at most once per pixel, P toggles it
+bool depthPrepass = true;
+// set by the depth prepass benchmark and headless --fragments, reads back fragment counts every pass
+bool countFragments = false;
+// Scene rendered offscreen at a scale that keeps GPU time within the budget, R toggles it
+bool dynamicResolution = true;
+const float gpuBudgetMs = 1000.0f / 60.0f;
+// The room's passes are recorded into a command list once and replayed, C toggles back to issuing them every frame
+bool commandLists = true;
+// GL submission runs on its own thread, fed frame packets by the simulation in main()
+const bool threadedRendering = true;
+// 2 lets the simulation work one frame ahead of the renderer, 3 two frames
+const int framePackets = 2;
+// Camera and lights are streamed through a ring of uniform buffer regions, one per frame the GPU may still be reading
+const int uniformRingFrames = 3;
+const GLsizeiptr uniformRingRegionSize = 64 * 1024;
+// The room is drawn by GL or by SoftwareRasterizer on the CPU, B toggles
+enum class RenderBackend {
+    OPENGL,
+    SOFTWARE,
+};
+RenderBackend renderBackend = RenderBackend::OPENGL;
+// Room surfaces take their lights' cones, attenuation and ambient from galleryLightmap, L toggles back to computing them per pixel
+bool lightmaps = true;
+// Spotlights cast shadows from a cached ShadowAtlas, H toggles
+bool shadows = true;
+// Room surfaces are lit once per lightmap texel by a ShadingCache pass rather than once per pixel, T toggles
+bool texelShading = false;
+// Surfaces without a lightmap take their lights' cones, attenuation and ambient from a LightVolume
+// kept up to date on the CPU, G toggles. Off by default, the animated lights touch most bricks every frame.
+bool lightVolumes = false;
+// Off, MSAA 2x, 4x or 8x, FXAA or TAA on the scene target, see AntiAliasing, X cycles
+AntiAliasingMode antiAliasing = AntiAliasingMode::FXAA;
+// --record-path writes the camera of every frame here on exit, for replay by benchmarks
+const char* cameraPathPath = "resources/camera_path.txt";
 
 /* --------------------------------- Player --------------------------------- */
 Camera camera(glm::vec3(0.0f, 2.0f, 0.0f));
@@ -35,24 +130,41 @@ float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
 const float collisionPadding = 0.1;
-glm::vec4 cameraCollisonBounds(glm::vec4(-1, 1, -1, 1)* (roomSize * 0.5f)* (1.0f - collisionPadding));
+int cameraCell = 0;
 
 
 /* ---------------------------------- Time ---------------------------------- */
-float deltaTime = 0.0f;	// time between current frame and last frame
-float lastFrame = 0.0f;
-
-
-GLFWwindow* createWindow();
+float deltaTime = 0.0f;	// smoothed time between frames, see FramePacer
+// swap interval and frame cap, V cycles through the modes
+PacingMode pacingMode = PacingMode::VSYNC;
+// paces presentation on the render thread
+FramePacer framePacer;
+// only measures the simulation loop for deltaTime, the render thread holds it to the presented rate
+FramePacer simulationClock;
+// set by headless runs so lights animate in step with the camera path, the clock drives them while negative
+double scriptedTime = -1.0;
+
+
+// Hidden windows are for the rendering benchmarks. Headless needs no display at all: GLFW's null
+// platform with a surfaceless EGL context, or OSMesa without EGL. There is no window framebuffer
+// then, frames are presented into an OffscreenTarget.
+enum class WindowMode {
+    VISIBLE,
+    HIDDEN,
+    HEADLESS,
+};
+GLFWwindow* createWindow(WindowMode mode, int width = SCR_WIDTH, int height = SCR_HEIGHT);
 void setGlGlobalSettings();
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow* window);
 unsigned int loadTexture(const char* path);
 unsigned int loadTexture(char const* path, int* width, int* height);
+unsigned int loadTextureArray(const std::vector<std::string>& paths, std::vector<glm::ivec2>* sizes = nullptr, SoftwareTexture* copy = nullptr);
 void processCameraCollision(Camera* camera);
-void setLights(std::vector<glm::vec3>* lightPositions, Shader* shader);
+void setMaterial(Shader* shader, int index, float shininess, glm::vec3 scale, glm::vec3 translate, float opacity = 1.0f, float alphaCutoff = 0.0f);
 
 enum SampleSpace {
     TEXCOORDS,
@@ -61,88 +173,170 @@ enum SampleSpace {
     ZY,
 };
 
-struct Painting {
-    unsigned int artDiffuseTexture{};
-    unsigned int artSpecularTexture{};
-    glm::vec3 size{};
+// Index into materials[] in default.frag. All are drawn in the solid pass, one with an opacity
+// below 1 goes to StaticScene::setMaterialPass as BLENDED, one with an alphaCutoff as ALPHA_TESTED.
+enum SceneMaterial {
+    FLOOR_MATERIAL,
+    CEILING_MATERIAL,
+    WALL_MATERIAL,
+    PAINTING_MATERIAL,
+};
 
-    Painting(char const* diffusePath, char const* specularPath)
+// Light of default.frag in std140 layout, each vec3 followed by the float sharing its 16 bytes
+struct SpotLight {
+    glm::vec3 position{};
+    float cutOff{};
+    glm::vec3 direction{};
+    float outerCutOff{};
+    glm::vec3 ambient{};
+    float constant{};
+    glm::vec3 diffuse{};
+    float linear{};
+    glm::vec3 specular{};
+    float quadratic{};
+}; // struct SpotLight
+
+// Uniform blocks of default.vert and default.frag, std140
+const int MAX_LIGHTS = 5;
+const unsigned int CAMERA_BINDING = 0;
+const unsigned int LIGHTS_BINDING = 1;
+
+struct CameraBlock {
+    glm::mat4 view{};
+    glm::mat4 projection{};
+    glm::vec3 viewPos{};
+    float padding{};
+}; // struct CameraBlock
+
+struct LightsBlock {
+    SpotLight lights[MAX_LIGHTS];
+    // Lightmap::intensityScale of light i in lightmapScale[i / 4][i % 4]
+    glm::vec4 lightmapScale[2]{};
+    int lightmapEnabled{};
+    int shadowsEnabled{};
+    int texelShadingEnabled{};
+    int lightVolumeEnabled{};
+    // see ShadowFrame::Matrices
+    glm::mat4 shadowMatrix[MAX_LIGHTS]{};
+    // see LightVolume::shaderOrigin
+    glm::vec4 lightVolumeOrigin{};
+}; // struct LightsBlock
+
+// Everything the renderer needs for one frame, built by the simulation and left alone after it is submitted
+struct FramePacket {
+    glm::mat4 view{};
+    glm::mat4 projection{};
+    glm::vec3 viewPos{};
+    std::vector<SpotLight> lights;
+    DrawList room;
+    int windowWidth{};
+    int windowHeight{};
+    bool depthPrepass{};
+    bool dynamicResolution{};
+    bool commandList{};
+    bool lightmaps{};
+    bool shadows{};
+    ShadowFrame shadowFrame;
+    bool texelShading{};
+    std::vector<ShadingBlock> shadingBlocks;
+    bool lightVolume{};
+    // bricks the simulation recomputed for this frame's lights
+    LightVolumeUpload lightVolumeUpload;
+    glm::vec4 lightVolumeOrigin{};
+    RenderBackend backend{};
+    PacingMode pacing{};
+    AntiAliasingMode antiAliasing{};
+    // headless runs save the presented frame here when set
+    std::string dumpPath;
+    // culling counters of the simulation side
+    FrameStats stats;
+}; // struct FramePacket
+
+void animateLights(GalleryEntities& entities, double time, std::vector<SpotLight>* lights);
+void setLights(GalleryEntities& entities, glm::vec3 noise, float breath, std::vector<SpotLight>* lights);
+void submitRenderables(GalleryEntities& entities, StaticScene& scene);
+void setFrameUniforms(const FramePacket& packet, RingBuffer* ring, const glm::vec2& jitter);
+bool runHeadless(GLFWwindow* window, const std::function<void(FramePacket&, const glm::mat4&, const glm::mat4&)>& buildPacket,
+    const std::function<void(const FramePacket&)>& renderFrame, const HeadlessOptions& options);
+
+
+int main(int argc, char** argv)
+{
+    // Offline benchmarks run without a window, the rendering ones draw the gallery to a hidden one
+    std::string benchmark = argc > 2 && std::string(argv[1]) == "--bench" ? argv[2] : "";
+    bool renderBenchmark = benchmark == "depth-prepass" || benchmark == "dynamic-resolution" || benchmark == "render-thread" || benchmark == "command-list" || benchmark == "ring-buffer"
+        || benchmark == "software-raster" || benchmark == "lightmap" || benchmark == "shadows"
+        || benchmark == "texel-shading" || benchmark == "light-volume" || benchmark == "antialiasing";
+    if (!benchmark.empty() && !renderBenchmark)
+        return runBenchmark(benchmark) ? 0 : 1;
+
+    // moving casters for the shadow passes to skip or not
+    if (benchmark == "shadows")
+        sculptureCount = 4;
+
+    CameraPath recordedPath;
+    bool recordPath = argc > 1 && std::string(argv[1]) == "--record-path";
+
+    // No display, renders a camera path offscreen and reports frame times, see HeadlessOptions
+    HeadlessOptions headlessOptions;
+    bool headless = parseHeadlessOptions(argc, argv, &headlessOptions);
+
+    // Offline PVS bake of the gallery layout, picked up by the next run
+    if (argc > 1 && std::string(argv[1]) == "--bake-pvs")
     {
-        int width, height;
-
-        artDiffuseTexture = loadTexture(diffusePath, &width, &height);
-        artSpecularTexture = loadTexture(specularPath, &width, &height);
-        size = glm::vec3((float)width / 64.0f, (float)height / 64.0f, 1.0f);
-
-        std::cout << size.x << " " << size.y << '\n';
+        PVS pvs = PVS::bake(gallery.Graph);
+        std::cout << "PVS: " << pvs.CellCount << " cells, " << pvs.PortalChains << " portal chains, " << pvs.BakeMs << " ms, "
+            << pvs.memoryBytes() << " bytes (" << pvs.compressedBytes() << " compressed)" << std::endl;
+        return pvs.save(argc > 2 ? argv[2] : galleryPVSPath) ? 0 : 1;
     }
 
-    Painting(char const* path) : Painting(path, path) {}
-}; // struct Painting
-
-
-int main()
-{
     /* ------------------- Create OpenGL Context and Windowing ------------------ */
-    GLFWwindow* mainWindow = createWindow();
+    GLFWwindow* mainWindow = headless ? createWindow(WindowMode::HEADLESS, headlessOptions.Width, headlessOptions.Height)
+        : createWindow(renderBenchmark ? WindowMode::HIDDEN : WindowMode::VISIBLE);
+    if (mainWindow == nullptr)
+        return 1;
     setGlGlobalSettings();
 
 
     /* ---------------------------- Create Materials ---------------------------- */
+    // The whole room samples one shared texture array so it can be submitted in a single draw
+
+    // Enviroment, layers 0-2
+    std::vector<std::string> texturePaths = {
+        "resources/textures/enviroment/floor.jpg",
+        "resources/textures/enviroment/wall.jpg",
+        "resources/textures/enviroment/ceiling.jpg",
+    };
+    const int floorLayer = 0;
+    const int wallLayer = 1;
+    const int ceilingLayer = 2;
+
+    // Painting, one layer per artwork
+    std::vector<std::string> paintingPaths = {
+        "resources/textures/art/starry-night.jpg",
+        "resources/textures/art/micheal.jpg",
+        "resources/textures/art/mona-lisa.jpg",
+        //"resources/textures/art/girl.jpg",
+        "resources/textures/art/wave.jpg",
+    };
+    const int paintingFirstLayer = (int)texturePaths.size();
+    texturePaths.insert(texturePaths.end(), paintingPaths.begin(), paintingPaths.end());
+
+    // and again on the CPU for the software rasterizer
+    std::vector<glm::ivec2> textureSizes;
+    SoftwareTexture softwareDiffuseTexture;
+    SoftwareTexture softwareSpecularTexture;
+    unsigned int sceneDiffuseTexture = loadTextureArray(texturePaths, &textureSizes, &softwareDiffuseTexture);
+    unsigned int sceneSpecularTexture = loadTextureArray(texturePaths, nullptr, &softwareSpecularTexture);
 
-    // Floor Material
-    unsigned int floorDiffuseTexture = loadTexture("resources/textures/enviroment/floor.jpg");
-    unsigned int floorSpecularTexture = loadTexture("resources/textures/enviroment/floor.jpg");
-    Shader floorShader("src/shaders/default.vert", "src/shaders/default.frag");
-    floorShader.use();
-    floorShader.setInt("material.diffuse", 0);
-    floorShader.setInt("material.specular", 1);
-    floorShader.setFloat("material.shininess", 32.0f);
-    floorShader.setInt("material.sampleSpace", 1);
-    floorShader.setVec3("material.scale", glm::vec3(1.0f));
-    floorShader.setVec3("material.translate", glm::vec3(0.0f));
-
-    // Wall Material
-    unsigned int wallDiffuseTexture = loadTexture("resources/textures/enviroment/wall.jpg");
-    unsigned int wallSpecularTexture = loadTexture("resources/textures/enviroment/wall.jpg");
-    Shader wallShader("src/shaders/default.vert", "src/shaders/default.frag");
-    wallShader.use();
-    wallShader.setInt("material.diffuse", 0);
-    wallShader.setInt("material.specular", 1);
-    wallShader.setFloat("material.shininess", 14.0f);
-    wallShader.setInt("material.sampleSpace", 2);
-    // wallShader.setVec3("material.scale", glm::vec3(0.5f, 0.75f, 0.5f));
-    wallShader.setVec3("material.scale", glm::vec3(1.f));
-    wallShader.setVec3("material.translate", glm::vec3(0.0f));
-
-    // Ceiling Material
-    unsigned int ceilingDiffuseTexture = loadTexture("resources/textures/enviroment/ceiling.jpg");
-    unsigned int ceilingSpecularTexture = loadTexture("resources/textures/enviroment/ceiling.jpg");
-    Shader ceilingShader("src/shaders/default.vert", "src/shaders/default.frag");
-    ceilingShader.use();
-    ceilingShader.setInt("material.diffuse", 0);
-    ceilingShader.setInt("material.specular", 1);
-    ceilingShader.setFloat("material.shininess", 16.0f);
-    ceilingShader.setInt("material.sampleSpace", 3);
-    ceilingShader.setVec3("material.scale", glm::vec3(1.0f));
-    ceilingShader.setVec3("material.translate", glm::vec3(0.0f));
-
-    // Painting
-    std::vector<Painting> paintings;
-    paintings.push_back(Painting("resources/textures/art/starry-night.jpg"));
-    paintings.push_back(Painting("resources/textures/art/micheal.jpg"));
-    paintings.push_back(Painting("resources/textures/art/mona-lisa.jpg"));
-    //paintings.push_back(Painting("resources/textures/art/girl.jpg"));
-    paintings.push_back(Painting("resources/textures/art/wave.jpg"));
-
-    Shader paintingShader("src/shaders/default.vert", "src/shaders/default.frag");
-    paintingShader.use();
-    paintingShader.setInt("material.diffuse", 0);
-    paintingShader.setInt("material.specular", 1);
-    paintingShader.setFloat("material.shininess", 1.8f);
-    paintingShader.setInt("material.sampleSpace", 2);
-    paintingShader.setVec3("material.scale", glm::vec3(1.0f));
-    paintingShader.setVec3("material.translate", glm::vec3(0.0f));
+    // Everything placed in the gallery, see submitRenderables. The catalogue's artworks are
+    // entities of their own, every painting hung on a wall copies one.
+    GalleryEntities galleryEntities;
+    std::vector<GalleryEntities::Entity> artworks;
+    for (int i = 0; i < (int)paintingPaths.size(); i++)
+        artworks.push_back(galleryEntities.create(Painting(paintingFirstLayer + i, textureSizes[paintingFirstLayer + i])));
+
+    StaticScene room;
 
     /* --------------------------- Primitives Vertcies -------------------------- */
     // layout: Pos vec3, Normals vec3, TexCoords vec2 
@@ -200,74 +394,606 @@ int main()
         -0.5f, 0.0f,  0.5f,  0.0f, 1.0f,  0.0f,  0.0f, 0.0f,
     };
 
-    float planeDownVertices[] = {
-         0.5f, 0.0f, -0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 1.0f,
-        -0.5f, 0.0f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-         0.5f, 0.0f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-         0.5f, 0.0f,  0.5f,  0.0f, -1.0f,  0.0f,  1.0f, 0.0f,
-        -0.5f, 0.0f, -0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 1.0f,
-        -0.5f, 0.0f,  0.5f,  0.0f, -1.0f,  0.0f,  0.0f, 0.0f,
-    };
-
 
 
     /* ----------------------------- Light Positions ---------------------------- */
 
-    std::vector<glm::vec3> LightPositions = {
+    const glm::vec3 lightPositions[] = {
         glm::vec3(0.0f, roomSize * roomHeightFactor, 0.0f),
         glm::vec3(roomSize * 0.45, roomSize * roomHeightFactor, 0.0f),
         glm::vec3(-roomSize * 0.45, roomSize * roomHeightFactor,  0.0f),
         glm::vec3(0.0f, roomSize * roomHeightFactor,  roomSize * 0.45),
         glm::vec3(0.0f, roomSize * roomHeightFactor,  -roomSize * 0.45)
     };
+    for (int i = 0; i < 5; i++)
+        galleryEntities.create(LightSource{ lightPositions[i], i });
 
 
-    /* ----------------------- Create VAOs From Primitives ---------------------- */
+    /* ---------------------------- Meshes From Primitives ---------------------- */
+    // Welded into indexed meshes and optimized once at load, all sharing the room's pooled buffers
+    Mesh cube = Mesh::fromTriangleSoup(cubeVertices, sizeof(cubeVertices) / (8 * sizeof(float)));
+    Mesh planeUp = Mesh::fromTriangleSoup(planeUpVertices, sizeof(planeUpVertices) / (8 * sizeof(float)));
+    optimizeMesh(cube);
+    optimizeMesh(planeUp);
 
-    // Cube
-    unsigned int cubeVAO, cubeVBO;
-    glGenVertexArrays(1, &cubeVAO);
-    glGenBuffers(1, &cubeVBO);
-    glBindVertexArray(cubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices, GL_STATIC_DRAW);
+    int cubeMesh = room.addMesh(cube);
+    int planeMesh = room.addMesh(planeUp);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
 
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    /* ----------------------------- Static Room Draws -------------------------- */
+    // The gallery never moves, so every transform is built once and uploaded with the draw commands.
+    // Surfaces and paintings are entities until submitRenderables() turns them into draws.
+    glm::mat4 model;
+    glm::mat4 tranMat;
+    glm::mat4 rotMat;
+    glm::mat4 scaMat;
 
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    // Floor, ceiling and walls, one instance per gallery surface. Walls alternate between XY and ZY sampling.
+    // Each surface gets a chart of its own in the lightmap.
+    auto addSurfaces = [&](const std::vector<GallerySurface>& surfaces, int material, int layer, int sampleSpace) {
+        for (const GallerySurface& surface : surfaces)
+        {
+            int space = surface.wall < 0 ? sampleSpace : (surface.wall % 2 == 0 ? SampleSpace::XY : SampleSpace::ZY);
+            Renderable renderable;
+            renderable.Mesh = planeMesh;
+            renderable.Material = material;
+            renderable.SampleSpace = space;
+            renderable.TextureLayer = layer;
+            renderable.LightmapRect = galleryLightmap.addChart(planeUp, surface.model);
+            renderable.Cell = surface.cell;
+            galleryEntities.create(WorldTransform{ surface.model }, renderable);
+        }
+    };
+    addSurfaces(gallery.Floors, FLOOR_MATERIAL, floorLayer, SampleSpace::XZ);
+    addSurfaces(gallery.Ceilings, CEILING_MATERIAL, ceilingLayer, SampleSpace::ZY);
+    addSurfaces(gallery.Walls, WALL_MATERIAL, wallLayer, SampleSpace::XY);
+
+    // Art Paintings, one centred on every wall
+    auto hangPainting = [&](const Painting& painting, const glm::mat4& transform, int cell) {
+        Renderable renderable;
+        renderable.Mesh = planeMesh;
+        renderable.Material = PAINTING_MATERIAL;
+        renderable.SampleSpace = SampleSpace::TEXCOORDS;
+        renderable.TextureLayer = painting.textureLayer;
+        renderable.Cell = cell;
+        galleryEntities.create(WorldTransform{ transform }, renderable, painting);
+    };
+    tranMat = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, roomSize * roomHeightFactor, roomSize * 0.99) * 0.5f);
+    rotMat = glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0));
 
+    for (int r = 0; r < gallery.roomCount(); r++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            const Painting& paintingCurr = galleryEntities.get<Painting>(artworks[(r * 4 + i) % artworks.size()]);
+            scaMat = glm::scale(glm::mat4(1.f), paintingCurr.size * 2.0f);
+            model = gallery.wallTransform(r, i) * tranMat * scaMat * rotMat;
+            hangPainting(paintingCurr, model, r);
+        }
+    }
+
+    // Stress test, tile the walls of the first room with a grid of small paintings
+    int stressPerWall = (stressPaintingCount + 3) / 4;
+    int stressColumns = (int)glm::ceil(glm::sqrt((float)stressPerWall));
+    float cellWidth = roomSize * 0.9f / glm::max(stressColumns, 1);
+    float cellHeight = roomSize * roomHeightFactor * 0.9f / glm::max(stressColumns, 1);
 
-    // Plane
-    unsigned int planeVAO, planeVBO;
-    glGenVertexArrays(1, &planeVAO);
-    glGenBuffers(1, &planeVBO);
-    glBindVertexArray(planeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeUpVertices), &planeUpVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(1);
+    for (int i = 0; i < stressPaintingCount; i++)
+    {
+        int wall = i % 4;
+        int cell = i / 4;
+        const Painting& paintingCurr = galleryEntities.get<Painting>(artworks[i % artworks.size()]);
+
+        glm::vec3 position(
+            -roomSize * 0.45f + cellWidth * (cell % stressColumns + 0.5f),
+            roomSize * roomHeightFactor * 0.05f + cellHeight * (cell / stressColumns + 0.5f),
+            roomSize * 0.98f * 0.5f);
+        glm::vec3 size = paintingCurr.size / glm::max(paintingCurr.size.x, paintingCurr.size.y) * glm::min(cellWidth, cellHeight) * 0.8f;
+
+        model = glm::translate(glm::mat4(1.0f), position) * glm::scale(glm::mat4(1.f), size) * rotMat;
+        model = glm::rotate(glm::mat4(1.0f), glm::radians(90.0f * wall), glm::vec3(0, 1, 0)) * model;
+
+        hangPainting(paintingCurr, model, 0);
+    }
+    submitRenderables(galleryEntities, room);
+
+    // Sculptures on pedestals in a ring around the first room's centre, turned every frame. Each
+    // stand is a node with its pedestal and sculpture under it. Only the sculptures turn, so only
+    // their world matrices are recomputed and handed to the room again.
+    TransformHierarchy sculptureTransforms;
+    std::vector<int> sculptureNodes;
+    // room instance of each node, -1 for the stands
+    std::vector<int> sculptureNodeInstances;
+    auto sculptureRotation = [](int i, double time) {
+        return glm::angleAxis((float)time * 0.5f + i, glm::vec3(0.0f, 1.0f, 0.0f));
+    };
+    if (sculptureCount > 0)
+    {
+        Mesh sculpture = generateSculpture(24, 48, 1234u, false);
+        optimizeMesh(sculpture);
+        int sculptureMesh = room.addMesh(sculpture);
+
+        std::vector<int> pedestalNodes;
+        for (int i = 0; i < sculptureCount; i++)
+        {
+            float angle = glm::two_pi<float>() * (i + 0.5f) / sculptureCount;
+            int stand = sculptureTransforms.add(-1, glm::vec3(glm::cos(angle), 0.0f, glm::sin(angle)) * roomSize * 0.25f);
+            pedestalNodes.push_back(sculptureTransforms.add(stand, glm::vec3(0.0f, 0.5f, 0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(0.6f, 1.0f, 0.6f)));
+            sculptureNodes.push_back(sculptureTransforms.add(stand, glm::vec3(0.0f, 1.4f, 0.0f), sculptureRotation(i, 0.0), glm::vec3(0.35f)));
+        }
+        sculptureTransforms.update();
+
+        std::vector<InstanceData> pedestalInstances;
+        std::vector<InstanceData> sculptureInstances;
+        for (int i = 0; i < sculptureCount; i++)
+        {
+            pedestalInstances.push_back({ sculptureTransforms.world(pedestalNodes[i]), SampleSpace::TEXCOORDS, wallLayer });
+            sculptureInstances.push_back({ sculptureTransforms.world(sculptureNodes[i]), SampleSpace::TEXCOORDS, ceilingLayer });
+        }
+        int firstPedestal = room.addDraw(cubeMesh, WALL_MATERIAL, pedestalInstances, std::vector<int>(sculptureCount, 0));
+        int firstSculpture = room.addDraw(sculptureMesh, CEILING_MATERIAL, sculptureInstances, std::vector<int>(sculptureCount, 0));
+
+        sculptureNodeInstances.assign(sculptureTransforms.size(), -1);
+        for (int i = 0; i < sculptureCount; i++)
+        {
+            sculptureNodeInstances[pedestalNodes[i]] = firstPedestal + i;
+            sculptureNodeInstances[sculptureNodes[i]] = firstSculpture + i;
+            room.setDynamic(firstSculpture + i);
+        }
+    }
+
+    room.build();
+
+    // the shader depends on the vertex format build() picked
+    Shader sceneShader("src/shaders/default.vert", "src/shaders/default.frag", room.shaderDefines());
+    sceneShader.use();
+    sceneShader.setInt("diffuseTexture", 0);
+    sceneShader.setInt("specularTexture", 1);
+    sceneShader.setInt("lightmap", 2);
+    sceneShader.setInt("staticShadows", 3);
+    sceneShader.setInt("dynamicShadows", 4);
+    sceneShader.setInt("shadedTexels", 5);
+    sceneShader.setInt("lightVolume", 6);
+
+    // the ShadingCache pass, default.frag lighting lightmap texels instead of fragments
+    Shader texelShader("src/shaders/texel_shading.vert", "src/shaders/default.frag", "#define TEXEL_SHADING\n");
+    texelShader.use();
+    texelShader.setInt("lightmap", 2);
+    texelShader.setInt("staticShadows", 3);
+    texelShader.setInt("dynamicShadows", 4);
+    texelShader.setInt("lightVolume", 6);
+
+    SoftwareRasterizer softwareRasterizer;
+    SoftwarePresenter softwarePresenter;
+    softwareRasterizer.DiffuseTexture = &softwareDiffuseTexture;
+    softwareRasterizer.SpecularTexture = &softwareSpecularTexture;
+
+    // the same materials for both backends
+    auto setSceneMaterial = [&](int index, float shininess, glm::vec3 scale, glm::vec3 translate) {
+        setMaterial(&sceneShader, index, shininess, scale, translate);
+        setMaterial(&texelShader, index, shininess, scale, translate);
+        softwareRasterizer.setMaterial(index, shininess, scale, translate);
+    };
+    setSceneMaterial(FLOOR_MATERIAL, 32.0f, glm::vec3(1.0f), glm::vec3(0.0f));
+    // setSceneMaterial(WALL_MATERIAL, 14.0f, glm::vec3(0.5f, 0.75f, 0.5f), glm::vec3(0.0f));
+    setSceneMaterial(WALL_MATERIAL, 14.0f, glm::vec3(1.f), glm::vec3(0.0f));
+    setSceneMaterial(CEILING_MATERIAL, 16.0f, glm::vec3(1.0f), glm::vec3(0.0f));
+    setSceneMaterial(PAINTING_MATERIAL, 1.8f, glm::vec3(1.0f), glm::vec3(0.0f));
+    room.setDrawParameters(sceneShader);
+
+    std::vector<Occluder> galleryOccluders = gallery.occluders();
+
+    // the lights without their flicker, halfway through their breathing
+    std::vector<SpotLight> restLights;
+    setLights(galleryEntities, glm::vec3(0.0f), 0.5f, &restLights);
+    galleryLightmap.bake(restLights, galleryOccluders);
+    galleryLightmap.upload();
+    std::cout << "lightmap: " << galleryLightmap.Width << "x" << galleryLightmap.Height << ", " << galleryLightmap.Charts.size() << " charts, "
+        << galleryLightmap.BakeMs << " ms on " << galleryLightmap.BakeThreads << " threads, " << galleryLightmap.memoryBytes() << " bytes" << std::endl;
+
+    if (galleryPVS.load(galleryPVSPath, gallery.Graph))
+        std::cout << "PVS: " << galleryPVSPath << ", " << galleryPVS.CellCount << " cells" << std::endl;
+
+
+    Shader depthShader("src/shaders/default.vert", "src/shaders/depth.frag", room.shaderDefines());
+    room.setDrawParameters(depthShader);
+    depthShader.setUniformBlock("Camera", CAMERA_BINDING);
+    sceneShader.setUniformBlock("Camera", CAMERA_BINDING);
+    sceneShader.setUniformBlock("Lights", LIGHTS_BINDING);
+    texelShader.setUniformBlock("Camera", CAMERA_BINDING);
+    texelShader.setUniformBlock("Lights", LIGHTS_BINDING);
+    RingBuffer frameUniforms(GL_UNIFORM_BUFFER, uniformRingRegionSize, uniformRingFrames);
+    // swapped by the ring buffer benchmark
+    RingBuffer* uniformRing = &frameUniforms;
+    FragmentCounter fragmentCounter;
+    ShadowAtlas shadowAtlas;
+    shadowAtlas.create();
+    ShadingCache shadingCache;
+    shadingCache.create(galleryLightmap);
+    AABB galleryBounds;
+    for (const Cell& cell : gallery.Graph.Cells)
+        galleryBounds.expand(cell.Bounds);
+    LightVolume lightVolume;
+    lightVolume.create(galleryBounds);
+
+    // Simulation side of a frame, culls the gallery for the view and fills the packet
+    auto buildPacket = [&](FramePacket& packet, const glm::mat4& view, const glm::mat4& projection) {
+        packet.view = view;
+        packet.projection = projection;
+        packet.viewPos = camera.Position;
+        double time = scriptedTime >= 0.0 ? scriptedTime : glfwGetTime();
+        animateLights(galleryEntities, time, &packet.lights);
+        for (int i = 0; i < sculptureCount; i++)
+            sculptureTransforms.setRotation(sculptureNodes[i], sculptureRotation(i, time));
+        sculptureTransforms.update();
+        for (int node : sculptureTransforms.changed())
+        {
+            if (sculptureNodeInstances[node] >= 0)
+                room.setInstanceTransform(sculptureNodeInstances[node], sculptureTransforms.world(node));
+        }
+
+        glm::mat4 viewProjection = packet.projection * packet.view;
+        if (occlusionCulling)
+        {
+            occlusionBuffer.render(viewProjection, galleryOccluders);
+            room.Occlusion = &occlusionBuffer;
+        }
+
+        frameStats.rooms = (unsigned int)gallery.Graph.Cells.size();
+        if (galleryPVS.CellCount > 0)
+        {
+            frameStats.visibleRooms = cameraCell >= 0 ? galleryPVS.visibleCount(cameraCell) : frameStats.rooms;
+            room.cull(viewProjection, galleryPVS, cameraCell);
+        }
+        else
+        {
+            gallery.Graph.traverse(viewProjection, gallery.Graph.findCell(camera.Position));
+            frameStats.visibleRooms = gallery.Graph.VisibleCount;
+            frameStats.portalMs = gallery.Graph.TraverseMs;
+            room.cull(viewProjection, &gallery.Graph);
+        }
+        packet.room = room.drawList();
+
+        // the software backend has no shadows, planning for it would mark passes done that never ran
+        packet.shadows = shadows && renderBackend == RenderBackend::OPENGL;
+        if (packet.shadows)
+        {
+            shadowAtlas.plan(packet.lights, room, packet.view, packet.projection, &packet.shadowFrame);
+            frameStats.shadowPasses = packet.shadowFrame.StaticPasses + packet.shadowFrame.OverlayPasses;
+            frameStats.shadowPassesSkipped = packet.shadowFrame.StaticSkipped + packet.shadowFrame.OverlaySkipped;
+        }
+
+        packet.texelShading = texelShading && renderBackend == RenderBackend::OPENGL;
+        if (packet.texelShading)
+        {
+            shadingCache.plan(packet.room, room, galleryLightmap, viewProjection, packet.viewPos, &packet.shadingBlocks);
+            frameStats.shadedTexels = shadingCache.Texels;
+        }
+
+        // the packet carries the bricks that changed, the render thread uploads them in order
+        packet.lightVolume = lightVolumes && renderBackend == RenderBackend::OPENGL;
+        packet.lightVolumeUpload.Bricks.clear();
+        if (packet.lightVolume)
+        {
+            lightVolume.update(packet.lights);
+            lightVolume.collect(&packet.lightVolumeUpload);
+            packet.lightVolumeOrigin = lightVolume.shaderOrigin();
+            frameStats.lightVolumeBricks = lightVolume.BricksUpdated;
+            frameStats.lightVolumeMs = lightVolume.UpdateMs;
+        }
+
+        frameStats.occlusionTested = occlusionBuffer.Tested;
+        frameStats.occludedInstances = occlusionBuffer.Occluded;
+        frameStats.occlusionMs = occlusionBuffer.RenderMs + occlusionBuffer.TestMs;
+        frameStats.depthPrepass = depthPrepass;
+
+        glfwGetFramebufferSize(mainWindow, &packet.windowWidth, &packet.windowHeight);
+        packet.depthPrepass = depthPrepass;
+        packet.dynamicResolution = dynamicResolution;
+        packet.commandList = commandLists;
+        packet.lightmaps = lightmaps;
+        packet.backend = renderBackend;
+        packet.pacing = pacingMode;
+        packet.antiAliasing = antiAliasing;
+        packet.stats = frameStats;
+    };
+
+    // Both passes of the room as a command list, recorded again when the draws or the passes change.
+    // Camera and lights live in uniform blocks bound before the replay, the list never sees them.
+    CommandList roomCommands;
+    unsigned long long recordedDraws = 0;
+    bool recordedPrepass = false;
+
+    auto recordRoom = [&](const FramePacket& packet) {
+        roomCommands.clear();
+
+        roomCommands.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, sceneDiffuseTexture);
+        roomCommands.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D_ARRAY, sceneSpecularTexture);
+        roomCommands.bindTexture(GL_TEXTURE2, GL_TEXTURE_2D_ARRAY, galleryLightmap.Texture);
+        roomCommands.bindTexture(GL_TEXTURE3, GL_TEXTURE_2D, shadowAtlas.StaticDepth);
+        roomCommands.bindTexture(GL_TEXTURE4, GL_TEXTURE_2D, shadowAtlas.DynamicDepth);
+        roomCommands.bindTexture(GL_TEXTURE5, GL_TEXTURE_2D_ARRAY, shadingCache.Texture);
+        roomCommands.bindTexture(GL_TEXTURE6, GL_TEXTURE_3D, lightVolume.Texture);
+
+        if (packet.depthPrepass)
+        {
+            roomCommands.useProgram(depthShader);
+            roomCommands.colorMask(false);
+            room.record(roomCommands, depthShader, MaterialPass::SOLID);
+            roomCommands.colorMask(true);
+            roomCommands.depthFunc(GL_EQUAL);
+            roomCommands.depthMask(false);
+        }
+
+        roomCommands.useProgram(sceneShader);
+        room.record(roomCommands, sceneShader, MaterialPass::SOLID);
+
+        if (packet.depthPrepass)
+        {
+            roomCommands.depthFunc(GL_LESS);
+            roomCommands.depthMask(true);
+        }
+
+        room.record(roomCommands, sceneShader, MaterialPass::ALPHA_TESTED);
+        if (room.hasPass(MaterialPass::BLENDED))
+        {
+            roomCommands.enable(GL_BLEND);
+            roomCommands.depthMask(false);
+            room.record(roomCommands, sceneShader, MaterialPass::BLENDED);
+            roomCommands.depthMask(true);
+            roomCommands.disable(GL_BLEND);
+        }
+
+        recordedDraws = packet.room.Version;
+        recordedPrepass = packet.depthPrepass;
+    };
+
+    // A shadow pass from the light's camera, streamed through the ring like the frame's
+    auto drawShadowCasters = [&](const ShadowPass& pass) {
+        CameraBlock cameraData;
+        cameraData.view = pass.View;
+        cameraData.projection = pass.Projection;
+        cameraData.viewPos = glm::vec3(glm::inverse(pass.View)[3]);
+        RingBuffer::Allocation cameraBlock = uniformRing->allocate(sizeof(CameraBlock));
+        std::memcpy(cameraBlock.Data, &cameraData, sizeof(CameraBlock));
+        uniformRing->flush();
+        glState.bindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BINDING, uniformRing->ID, cameraBlock.Offset, cameraBlock.Size);
+
+        room.submit(pass.Casters);
+        depthShader.use();
+        room.draw(depthShader);
+    };
+
+    // NDC offset of the frame's projection, set by renderFrame() while TAA is on
+    glm::vec2 projectionJitter(0.0f);
+
+    // Render side, draws the gallery of a packet with the depth prepass when it asks for one.
+    // Shadow passes go first, the room's instances are uploaded again after them. Texels are shaded
+    // once the frame's uniforms are bound, the room's passes read them.
+    // The prepass only covers the solid pass. Alpha tested draws follow with the depth test back to
+    // GL_LESS, a discard would keep early-z from rejecting anything they are drawn with, and
+    // blended ones go last over the finished depth without writing to it.
+    auto drawRoom = [&](const FramePacket& packet) {
+        if (packet.shadows)
+            shadowAtlas.render(packet.shadowFrame, drawShadowCasters);
+        room.submit(packet.room);
+        if (packet.lightVolume)
+            lightVolume.upload(packet.lightVolumeUpload);
+        setFrameUniforms(packet, uniformRing, projectionJitter);
+        if (packet.texelShading)
+        {
+            glState.bindTexture(GL_TEXTURE2, GL_TEXTURE_2D_ARRAY, galleryLightmap.Texture);
+            glState.bindTexture(GL_TEXTURE3, GL_TEXTURE_2D, shadowAtlas.StaticDepth);
+            glState.bindTexture(GL_TEXTURE4, GL_TEXTURE_2D, shadowAtlas.DynamicDepth);
+            glState.bindTexture(GL_TEXTURE6, GL_TEXTURE_3D, lightVolume.Texture);
+            shadingCache.render(packet.shadingBlocks, texelShader);
+        }
+
+        // fragment counting wraps each pass in queries, only the immediate path has them
+        if (packet.commandList && !countFragments)
+        {
+            if (roomCommands.empty() || recordedDraws != packet.room.Version || recordedPrepass != packet.depthPrepass)
+                recordRoom(packet);
+            roomCommands.replay();
+            return;
+        }
+
+        glState.bindTexture(GL_TEXTURE0, GL_TEXTURE_2D_ARRAY, sceneDiffuseTexture);
+        glState.bindTexture(GL_TEXTURE1, GL_TEXTURE_2D_ARRAY, sceneSpecularTexture);
+        glState.bindTexture(GL_TEXTURE2, GL_TEXTURE_2D_ARRAY, galleryLightmap.Texture);
+        glState.bindTexture(GL_TEXTURE3, GL_TEXTURE_2D, shadowAtlas.StaticDepth);
+        glState.bindTexture(GL_TEXTURE4, GL_TEXTURE_2D, shadowAtlas.DynamicDepth);
+        glState.bindTexture(GL_TEXTURE5, GL_TEXTURE_2D_ARRAY, shadingCache.Texture);
+        glState.bindTexture(GL_TEXTURE6, GL_TEXTURE_3D, lightVolume.Texture);
+
+        // Depth only, then shade just the fragments that ended up in front
+        if (packet.depthPrepass)
+        {
+            depthShader.use();
+            glState.colorMask(false);
+            if (countFragments)
+                fragmentCounter.begin();
+            room.draw(depthShader, MaterialPass::SOLID);
+            if (countFragments)
+                frameStats.prepassFragments = fragmentCounter.end();
+            glState.colorMask(true);
+            glState.depthFunc(GL_EQUAL);
+            glState.depthMask(false);
+        }
+
+        sceneShader.use();
+        if (countFragments)
+            fragmentCounter.begin();
+        room.draw(sceneShader, MaterialPass::SOLID);
+
+        if (packet.depthPrepass)
+        {
+            glState.depthFunc(GL_LESS);
+            glState.depthMask(true);
+        }
+
+        room.draw(sceneShader, MaterialPass::ALPHA_TESTED);
+        if (room.hasPass(MaterialPass::BLENDED))
+        {
+            glState.enable(GL_BLEND);
+            glState.depthMask(false);
+            room.draw(sceneShader, MaterialPass::BLENDED);
+            glState.depthMask(true);
+            glState.disable(GL_BLEND);
+        }
+        if (countFragments)
+            frameStats.shadedFragments = fragmentCounter.end();
+    };
+
+    // The same frame on the CPU, presented to target, which is window sized
+    auto drawRoomSoftware = [&](const FramePacket& packet, unsigned int target) {
+        softwareRasterizer.setLights(packet.lights);
+        softwareRasterizer.render(room, packet.room, packet.view, packet.projection, packet.viewPos, packet.windowWidth, packet.windowHeight);
+        softwarePresenter.present(softwareRasterizer, target, packet.windowWidth, packet.windowHeight);
+
+        frameStats.softwareTriangles = softwareRasterizer.Triangles;
+        frameStats.softwareSetupMs = softwareRasterizer.SetupMs;
+        frameStats.softwareBinMs = softwareRasterizer.BinMs;
+        frameStats.softwareRasterMs = softwareRasterizer.RasterMs;
+        frameStats.softwareShadeMs = softwareRasterizer.ShadeMs;
+    };
+
+    // Both sides on the calling thread, for the benchmarks that render a given view
+    FramePacket roomPacket;
+    auto renderRoom = [&](const glm::mat4& view, const glm::mat4& projection) {
+        buildPacket(roomPacket, view, projection);
+        drawRoom(roomPacket);
+    };
+
+    ResolutionController resolutionController(gpuBudgetMs);
+    DynamicResolution sceneTarget(resolutionController);
+    sceneTarget.AA.Mode = antiAliasing;
+    OffscreenTarget offscreen;
+    if (headless)
+    {
+        offscreen.create(headlessOptions.Width, headlessOptions.Height);
+        sceneTarget.OutputFBO = offscreen.FBO;
+    }
+
+    GpuTimer gpuTimer;
+
+    // A whole frame on the thread owning the context, presents it when done
+    auto renderFrame = [&](const FramePacket& packet) {
+        framePacer.beginFrame();
+        frameStats = packet.stats;
+        if (packet.pacing != framePacer.Mode)
+            framePacer.setMode(packet.pacing);
+
+        if (packet.backend == RenderBackend::SOFTWARE)
+        {
+            drawRoomSoftware(packet, sceneTarget.OutputFBO);
+        }
+        else
+        {
+            frameUniforms.beginFrame();
+
+            gpuTimer.begin();
+            sceneTarget.AA.Mode = packet.antiAliasing;
+            sceneTarget.begin(packet.windowWidth, packet.windowHeight);
+            projectionJitter = sceneTarget.AA.beginFrame(packet.projection * packet.view, sceneTarget.renderSize());
+            drawRoom(packet);
+            projectionJitter = glm::vec2(0.0f);
+            sceneTarget.end();
+            gpuTimer.end();
+            frameUniforms.endFrame();
+
+            if (packet.dynamicResolution)
+                sceneTarget.update(gpuTimer.LastMs);
+            else
+                sceneTarget.Controller.Scale = sceneTarget.Controller.MaxScale;
+            frameStats.gpuMs = gpuTimer.LastMs;
+        }
+
+        frameStats.frameMs = framePacer.LastDelta * 1000.0;
+        frameStats.pacingMode = pacingModeName(framePacer.Mode);
+        frameStats.antiAliasing = antiAliasingModeName(packet.antiAliasing);
+        frameStats.frameDeviationMs = framePacer.report().deviationMs;
+
+#ifdef _DEBUG
+        glState.validate();
+#endif
+        // nothing to present to, the frame stays in the offscreen target
+        if (headless)
+        {
+            if (!packet.dumpPath.empty())
+                offscreen.save(packet.dumpPath);
+            return;
+        }
+
+        framePacer.wait();
+        glfwSwapBuffers(mainWindow);
+    };
+
+    if (headless)
+        return runHeadless(mainWindow, buildPacket, renderFrame, headlessOptions) ? 0 : 1;
+
+    BenchmarkState benchmarkState{ camera, cameraCell, scriptedTime, gallery.Graph, depthPrepass, countFragments, dynamicResolution, commandLists,
+        lightmaps, shadows, texelShading, lightVolumes, pacingMode, antiAliasing };
+    if (benchmark == "depth-prepass")
+        return runDepthPrepassBenchmark(mainWindow, benchmarkState, renderRoom) ? 0 : 1;
+    if (benchmark == "dynamic-resolution")
+        return runDynamicResolutionBenchmark(mainWindow, benchmarkState, renderRoom, sceneTarget, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
+    if (benchmark == "command-list")
+    {
+        auto redrawRoom = [&]() { drawRoom(roomPacket); };
+        auto recordRoomPacket = [&]() { recordRoom(roomPacket); };
+        return runCommandListBenchmark(mainWindow, benchmarkState, renderRoom, redrawRoom, recordRoomPacket, roomCommands) ? 0 : 1;
+    }
+    if (benchmark == "ring-buffer")
+    {
+        auto redrawRoom = [&](RingBuffer* ring) {
+            uniformRing = ring;
+            drawRoom(roomPacket);
+            uniformRing = &frameUniforms;
+        };
+        return runRingBufferBenchmark(mainWindow, benchmarkState, renderRoom, redrawRoom, uniformRingRegionSize) ? 0 : 1;
+    }
+    if (benchmark == "software-raster")
+    {
+        auto rasterizeRoom = [&]() {
+            softwareRasterizer.setLights(roomPacket.lights);
+            softwareRasterizer.render(room, roomPacket.room, roomPacket.view, roomPacket.projection, roomPacket.viewPos, roomPacket.windowWidth, roomPacket.windowHeight);
+        };
+        return runSoftwareRasterBenchmark(mainWindow, benchmarkState, renderRoom, rasterizeRoom, softwareRasterizer, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
+    }
+    if (benchmark == "texel-shading")
+        return runTexelShadingBenchmark(mainWindow, benchmarkState, renderRoom, roomPacket, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
+    if (benchmark == "light-volume")
+    {
+        auto animateGalleryLights = [&](double time, std::vector<SpotLight>* lights) { animateLights(galleryEntities, time, lights); };
+        return runLightVolumeBenchmark<SpotLight>(mainWindow, benchmarkState, renderRoom, lightVolume, animateGalleryLights, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
+    }
+    if (benchmark == "shadows")
+        return runShadowBenchmark(mainWindow, benchmarkState, renderRoom, shadowAtlas, sculptureCount, roomPacket, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
+    if (benchmark == "lightmap")
+        return runLightmapBenchmark(mainWindow, benchmarkState, renderRoom, galleryLightmap, restLights, galleryOccluders, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
+    if (benchmark == "render-thread")
+        return runRenderThreadBenchmark<FramePacket>(mainWindow, benchmarkState, buildPacket, renderFrame, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
+    if (benchmark == "antialiasing")
+        return runAntiAliasingBenchmark<FramePacket>(mainWindow, benchmarkState, buildPacket, renderFrame, argc > 3 ? argv[3] : cameraPathPath) ? 0 : 1;
 
 
     /* -------------------------------------------------------------------------- */
     /*                                  Main Loop                                 */
     /* -------------------------------------------------------------------------- */
+    // Input, camera and culling run here, GL submission on the render thread from here on
+    StatsReporter statsReporter;
+    framePacer.setMode(pacingMode);
+    RenderThread<FramePacket> renderThread(mainWindow, renderFrame, framePackets, threadedRendering);
+
     while (!glfwWindowShouldClose(mainWindow))
     {
         // Update time
         float currentFrame = static_cast<float>(glfwGetTime());
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
+        deltaTime = simulationClock.beginFrame();
+
+        FramePacket& packet = renderThread.acquire();
+        frameStats.reset();
 
 
         // Window and Player Input
@@ -275,191 +1001,282 @@ int main()
 
 #ifndef DEBUG
         processCameraCollision(&camera);
+#else
+        cameraCell = gallery.Graph.findCell(camera.Position);
 #endif // !DEBUG
 
+        if (recordPath)
+            recordedPath.record(currentFrame, camera);
 
 
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
         /* -------------------------------------------------------------------------- */
-        /*                                Render Scene                                */
+        /*                                 Frame Packet                               */
         /* -------------------------------------------------------------------------- */
 
         glm::mat4 view = camera.GetViewMatrix();
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 model;
-        glm::mat4 tranMat;
-        glm::mat4 rotMat;
-        glm::mat4 scaMat;
-
-
-        /* ---------------------------------- Floor --------------------------------- */
-        model = glm::mat4(1.0f);
-        model = glm::scale(model, glm::vec3(roomSize));
-        floorShader.use();
-        floorShader.setMat4("model", model);
-        floorShader.setMat4("view", view);
-        floorShader.setMat4("projection", projection);
-        floorShader.setVec3("viewPos", camera.Position);
-        setLights(&LightPositions, &floorShader);
-
-        glBindVertexArray(planeVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, floorDiffuseTexture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, floorSpecularTexture);
-
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-
-        /* --------------------------------- Ceiling -------------------------------- */
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0, roomSize * roomHeightFactor, 0.0));
-        model = glm::scale(model, glm::vec3(roomSize));
-        model = glm::rotate(model, glm::radians(-180.0f), glm::vec3(1, 0, 0));
-        ceilingShader.use();
-        ceilingShader.setMat4("model", model);
-        ceilingShader.setMat4("view", view);
-        ceilingShader.setMat4("projection", projection);
-        ceilingShader.setVec3("viewPos", camera.Position);
-        setLights(&LightPositions, &ceilingShader);
-
-        glBindVertexArray(planeVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, ceilingDiffuseTexture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, ceilingSpecularTexture);
-
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-
-
-        /* ---------------------------------- Walls ---------------------------------- */
-        wallShader.use();
-        glBindVertexArray(planeVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, wallDiffuseTexture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, wallSpecularTexture);
-
-        wallShader.setMat4("view", view);
-        wallShader.setMat4("projection", projection);
-        wallShader.setVec3("viewPos", camera.Position);
-        setLights(&LightPositions, &wallShader);
-
-
-        tranMat = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, roomSize * roomHeightFactor, roomSize) * 0.5f);
-        rotMat = glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0));
-        scaMat = glm::scale(glm::mat4(1.0f), glm::vec3(roomSize, roomSize, roomSize * roomHeightFactor));   
-        model = tranMat * rotMat * scaMat;
 
-        for (int i = 0; i < 4; i++)
+        buildPacket(packet, view, projection);
+        renderThread.submit();
+
+        // the title shows the newest frame the renderer finished
+        for (const FrameStats& rendered : renderThread.finished())
         {
-            wallShader.setMat4("model", glm::rotate(glm::mat4(1.0f), glm::radians(90.0f * i), glm::vec3(0, 1, 0)) * model);
-            wallShader.setInt("material.sampleSpace", i % 2 == 0 ? SampleSpace::XY : SampleSpace::ZY);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+            statsReporter.addFrame(rendered);
+            frameStats = rendered;
         }
+        statsReporter.report(mainWindow, WINDOW_NAME);
 
-        glBindVertexArray(0);
-
-        /* ------------------------------ Art Paintings ----------------------------- */
-        paintingShader.use();
-        glBindVertexArray(planeVAO);
-
-        paintingShader.setMat4("view", view);
-        paintingShader.setMat4("projection", projection);
-        paintingShader.setVec3("viewPos", camera.Position);
-        setLights(&LightPositions, &paintingShader);
+        glfwPollEvents();
+    }
 
-        tranMat = glm::translate(glm::mat4(1.0f), glm::vec3(0.0, roomSize * roomHeightFactor, roomSize * 0.99) * 0.5f);
-        rotMat = glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1, 0, 0));
+    renderThread.stop();
+    glfwTerminate();
 
-        for (int i = 0; i < 4; i++)
-        {
-            Painting paintingCurr = paintings[i];
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, paintingCurr.artDiffuseTexture);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, paintingCurr.artSpecularTexture);
+    if (recordPath)
+        return recordedPath.save(argc > 2 ? argv[2] : cameraPathPath) ? 0 : 1;
+    return 0;
+}
 
-            scaMat = glm::scale(glm::mat4(1.f), paintingCurr.size * 2.0f);
-            model = tranMat * scaMat * rotMat;
-            model = glm::rotate(glm::mat4(1.0f), glm::radians(90.0f * i), glm::vec3(0, 1, 0)) * model;
+// Renders options.Frames frames through the render thread as the main loop does, with the camera
+// spread evenly over the path, then prints a summary and writes the per-frame stats. Dynamic
+// resolution and pacing are off so the work per frame only depends on the arguments.
+bool runHeadless(GLFWwindow* window, const std::function<void(FramePacket&, const glm::mat4&, const glm::mat4&)>& buildPacket,
+    const std::function<void(const FramePacket&)>& renderFrame, const HeadlessOptions& options)
+{
+    CameraPath path = loadBenchmarkPath(options.PathFile.empty() ? cameraPathPath : options.PathFile);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)options.Width / (float)options.Height, 0.1f, 100.0f);
 
-            paintingShader.setMat4("model", model);
+    dynamicResolution = false;
+    pacingMode = PacingMode::UNCAPPED;
+    renderBackend = options.Software ? RenderBackend::SOFTWARE : RenderBackend::OPENGL;
+    countFragments = options.CountFragments;
 
-            paintingShader.setInt("material.sampleSpace", SampleSpace::TEXCOORDS);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+    std::vector<FrameStats> frames;
+    double start = glfwGetTime();
+    {
+        RenderThread<FramePacket> renderThread(window, renderFrame, framePackets, threadedRendering);
+        for (int frame = 0; frame < options.Frames; frame++)
+        {
+            FramePacket& packet = renderThread.acquire();
+            scriptedTime = options.Frames > 1 ? path.duration() * frame / (options.Frames - 1) : 0.0;
+            camera = path.sample((float)scriptedTime);
+            cameraCell = gallery.Graph.findCell(camera.Position);
+            frameStats.reset();
+            buildPacket(packet, camera.GetViewMatrix(), projection);
+
+            bool dump = frame == options.Frames - 1 || (options.DumpEvery > 0 && frame % options.DumpEvery == 0);
+            packet.dumpPath = dump && !options.DumpPrefix.empty() ? options.DumpPrefix + std::to_string(frame) + ".ppm" : "";
+            renderThread.submit();
+
+            std::vector<FrameStats> finished = renderThread.finished();
+            frames.insert(frames.end(), finished.begin(), finished.end());
         }
+        renderThread.stop();
 
-        glBindVertexArray(0);
-
-        glfwSwapBuffers(mainWindow);
-        glfwPollEvents();
+        std::vector<FrameStats> finished = renderThread.finished();
+        frames.insert(frames.end(), finished.begin(), finished.end());
     }
+    double seconds = glfwGetTime() - start;
 
-    glfwTerminate();
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << options.Frames << " frames at " << options.Width << "x" << options.Height << " in " << seconds << " s, "
+        << options.Frames / seconds << " fps" << std::endl;
+    printFrameSummary(frames);
 
-    return 0;
+    bool written = options.StatsFile.empty() || writeFrameStats(options.StatsFile, frames);
+    glfwTerminate();
+    return written;
 }
 
-void setLights(std::vector<glm::vec3>* lightPositions, Shader* shader)
+// Light parameters at the given time, the spots flicker and breathe a little
+void animateLights(GalleryEntities& entities, double time, std::vector<SpotLight>* lights)
 {
-    float t = glfwGetTime();
+    float t = time;
     glm::vec3 w1(cos(t + 0.2), sin(t + 0.86), cos(t + 0.35));
     glm::vec3 w2(cos(t * 2 + 0.54), cos(t * 2 + 0.32), cos(t * 2 + 0.83));
     glm::vec3 w3(cos(t * 2 * 2 + 0.2), sin(t * 2 * 2 + 0.86), cos(t * 2 * 2 + 0.35));
     glm::vec3 noise = w1 * 0.33f + w2 * 0.33f + w3 * 0.33f;
 
-    /* ------------------------------- Floor Light ------------------------------ */
-    shader->setVec3("lights[0].position", glm::vec3(0.0f, 2.0f, 0.0f));
-    shader->setVec3("lights[0].direction", glm::vec3(0.0f, -1.0f, 0.0f) + noise * 0.02f);
-    shader->setFloat("lights[0].cutOff", glm::cos(glm::radians(20.f)));
-    shader->setFloat("lights[0].outerCutOff", glm::cos(glm::radians(75.f - (sin(glfwGetTime() * 2) + 1) * 0.5)));
-    shader->setVec3("lights[0].ambient", 0.1f, 0.1f, 0.2f);
-    shader->setVec3("lights[0].diffuse", 0.60f * 1.0f, 0.50f * 1.0f, 0.30f * 1.0f);
-    shader->setVec3("lights[0].specular", 1.0f * 2.0f, 1.0f * 2.0f, 1.0f * 2.0f);
-    shader->setFloat("lights[0].constant", 1.0f);
-    shader->setFloat("lights[0].linear", 0.08f);
-    shader->setFloat("lights[0].quadratic", 0.016f);
-
-    /* ----------------------------- Painting Lights ---------------------------- */
-    for (int i = 1; i < lightPositions->size(); i++)
-    {
-        std::string idx = "lights[" + std::to_string(i) + "]";
+    setLights(entities, noise, (sin(time * 2) + 1) * 0.5, lights);
+}
+
+// Light animation, the parameters of every LightSource for a flicker offset and a breath between
+// 0 and 1, which narrows the cones by a degree
+void setLights(GalleryEntities& entities, glm::vec3 noise, float breath, std::vector<SpotLight>* lights)
+{
+    lights->resize(entities.count<LightSource>());
+    entities.each<LightSource>([&](const LightSource& source) {
+        SpotLight& light = lights->at(source.Slot);
+
+        // Floor light
+        if (source.Slot == 0)
+        {
+            light.position = glm::vec3(0.0f, 2.0f, 0.0f);
+            light.direction = glm::vec3(0.0f, -1.0f, 0.0f) + noise * 0.02f;
+            light.cutOff = glm::cos(glm::radians(20.f));
+            light.outerCutOff = glm::cos(glm::radians(75.f - breath));
+            light.ambient = glm::vec3(0.1f, 0.1f, 0.2f);
+            light.diffuse = glm::vec3(0.60f * 1.0f, 0.50f * 1.0f, 0.30f * 1.0f);
+            light.specular = glm::vec3(1.0f * 2.0f, 1.0f * 2.0f, 1.0f * 2.0f);
+            light.constant = 1.0f;
+            light.linear = 0.08f;
+            light.quadratic = 0.016f;
+            return;
+        }
 
-        shader->setVec3(idx + ".position", lightPositions->at(i) + glm::vec3(0.0f, 0.1f, 0.0f));
+        // Painting lights
+        light.position = source.Position + glm::vec3(0.0f, 0.1f, 0.0f);
+
+        glm::vec3 direction = glm::normalize(glm::vec3(0.f, -5.f, 0.f) - glm::normalize(source.Position) * glm::vec3(-1, 0, -1));
+
+        light.direction = direction + noise * 0.01f;
+        light.cutOff = glm::cos(glm::radians(0.f));
+        light.outerCutOff = glm::cos(glm::radians(35.f - breath));
+        light.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+        light.diffuse = glm::vec3(0.60f * 0.9f, 0.50f * 0.9f, 0.30f * 0.9f);
+        light.specular = glm::vec3(1.0f * 1.2f, 1.0f * 1.2f, 1.0f * 1.2f);
+        light.constant = 0.3f;
+        light.linear = 0.04f;
+        light.quadratic = 0.032f;
+    });
+}
 
-        glm::vec3 direction = glm::normalize(glm::vec3(0.f, -5.f, 0.f) - glm::normalize(lightPositions->at(i)) * glm::vec3(-1, 0, -1));
+// Submission, one StaticScene draw per mesh and material in the order they first come up, with
+// the instances in entity order. Leaves each entity's instance in its Renderable.
+void submitRenderables(GalleryEntities& entities, StaticScene& scene)
+{
+    struct Batch
+    {
+        int mesh;
+        int material;
+        std::vector<InstanceData> instances;
+        std::vector<int> cells;
+        std::vector<Renderable*> renderables;
+    };
+    std::vector<Batch> batches;
+
+    entities.each<WorldTransform, Renderable>([&](const WorldTransform& transform, Renderable& renderable) {
+        auto batch = std::find_if(batches.begin(), batches.end(), [&](const Batch& b) { return b.mesh == renderable.Mesh && b.material == renderable.Material; });
+        if (batch == batches.end())
+        {
+            Batch added;
+            added.mesh = renderable.Mesh;
+            added.material = renderable.Material;
+            batch = batches.insert(batches.end(), added);
+        }
+        batch->instances.push_back({ transform.Model, renderable.SampleSpace, renderable.TextureLayer, renderable.LightmapRect });
+        batch->cells.push_back(renderable.Cell);
+        batch->renderables.push_back(&renderable);
+    });
 
-        shader->setVec3(idx + ".direction", direction + noise * 0.01f);
-        shader->setFloat(idx + ".cutOff", glm::cos(glm::radians(0.f)));
-        shader->setFloat(idx + ".outerCutOff", glm::cos(glm::radians(35.f - (sin(glfwGetTime() * 2) + 1) * 0.5)));
-        shader->setVec3(idx + ".ambient", 0.0f, 0.0f, 0.0f);
-        shader->setVec3(idx + ".diffuse", 0.60f * 0.9f, 0.50f * 0.9f, 0.30f * 0.9f);
-        shader->setVec3(idx + ".specular", 1.0f * 1.2f, 1.0f * 1.2f, 1.0f * 1.2f);
-        shader->setFloat(idx + ".constant", 0.3f);
-        shader->setFloat(idx + ".linear", 0.04f);
-        shader->setFloat(idx + ".quadratic", 0.032f);
+    for (const Batch& batch : batches)
+    {
+        int first = scene.addDraw(batch.mesh, batch.material, batch.instances, batch.cells);
+        for (size_t i = 0; i < batch.renderables.size(); i++)
+            batch.renderables[i]->Instance = first < 0 ? -1 : first + (int)i;
     }
 }
 
+// Camera and lights of a packet into the ring, bound for every pass that follows
+void setFrameUniforms(const FramePacket& packet, RingBuffer* ring, const glm::vec2& jitter)
+{
+    CameraBlock cameraData;
+    cameraData.view = packet.view;
+    cameraData.projection = glm::translate(glm::mat4(1.0f), glm::vec3(jitter, 0.0f)) * packet.projection;
+    cameraData.viewPos = packet.viewPos;
+
+    LightsBlock lightsData;
+    std::copy_n(packet.lights.begin(), std::min<size_t>(packet.lights.size(), MAX_LIGHTS), lightsData.lights);
+    for (int i = 0; i < (int)std::min<size_t>(packet.lights.size(), MAX_LIGHTS); i++)
+        lightsData.lightmapScale[i / 4][i % 4] = galleryLightmap.intensityScale(i, packet.lights[i]);
+    lightsData.lightmapEnabled = packet.lightmaps && galleryLightmap.Texture != 0;
+    lightsData.shadowsEnabled = packet.shadows;
+    lightsData.texelShadingEnabled = packet.texelShading;
+    lightsData.lightVolumeEnabled = packet.lightVolume;
+    if (packet.shadows)
+        std::copy_n(packet.shadowFrame.Matrices, MAX_LIGHTS, lightsData.shadowMatrix);
+    lightsData.lightVolumeOrigin = packet.lightVolumeOrigin;
+
+    RingBuffer::Allocation cameraBlock = ring->allocate(sizeof(CameraBlock));
+    RingBuffer::Allocation lightsBlock = ring->allocate(sizeof(LightsBlock));
+    std::memcpy(cameraBlock.Data, &cameraData, sizeof(CameraBlock));
+    std::memcpy(lightsBlock.Data, &lightsData, sizeof(LightsBlock));
+    ring->flush();
+
+    glState.bindBufferRange(GL_UNIFORM_BUFFER, CAMERA_BINDING, ring->ID, cameraBlock.Offset, cameraBlock.Size);
+    glState.bindBufferRange(GL_UNIFORM_BUFFER, LIGHTS_BINDING, ring->ID, lightsBlock.Offset, lightsBlock.Size);
+}
+
+
+void setMaterial(Shader* shader, int index, float shininess, glm::vec3 scale, glm::vec3 translate, float opacity, float alphaCutoff)
+{
+    std::string idx = "materials[" + std::to_string(index) + "]";
+
+    shader->use();
+    shader->setFloat(idx + ".shininess", shininess);
+    shader->setVec3(idx + ".scale", scale);
+    shader->setVec3(idx + ".translate", translate);
+    shader->setFloat(idx + ".opacity", opacity);
+    shader->setFloat(idx + ".alphaCutoff", alphaCutoff);
+}
+
 
 void processCameraCollision(Camera* camera)
 {
+    // Keep to the room the camera was in, unless it is lined up with an open doorway
+    const Cell& cell = gallery.Graph.Cells[cameraCell];
+    float padding = roomSize * 0.5f * collisionPadding;
+    glm::vec4 collisionBounds(cell.Bounds.min.x + padding, cell.Bounds.max.x - padding, cell.Bounds.min.z + padding, cell.Bounds.max.z - padding);
+
+    for (int p : cell.Portals)
+    {
+        const Portal& portal = gallery.Graph.Portals[p];
+        if (!portal.Open)
+            continue;
+
+        AABB opening;
+        for (const glm::vec3& corner : portal.Corners)
+            opening.expand(corner);
+        const AABB& beyond = gallery.Graph.Cells[portal.other(cameraCell)].Bounds;
+
+        // doorways are flat, the thin axis is the one they let the camera cross
+        if (opening.max.x - opening.min.x < opening.max.z - opening.min.z)
+        {
+            if (camera->Position.z < opening.min.z + padding || camera->Position.z > opening.max.z - padding)
+                continue;
+            if (beyond.min.x >= cell.Bounds.max.x)
+                collisionBounds.y = beyond.max.x - padding;
+            else
+                collisionBounds.x = beyond.min.x + padding;
+        }
+        else
+        {
+            if (camera->Position.x < opening.min.x + padding || camera->Position.x > opening.max.x - padding)
+                continue;
+            if (beyond.min.z >= cell.Bounds.max.z)
+                collisionBounds.w = beyond.max.z - padding;
+            else
+                collisionBounds.z = beyond.min.z + padding;
+        }
+    }
+
     // x-min
-    if (camera->Position.x < cameraCollisonBounds.x)
-        camera->Position.x = cameraCollisonBounds.x;
+    if (camera->Position.x < collisionBounds.x)
+        camera->Position.x = collisionBounds.x;
     // x-max
-    if (camera->Position.x > cameraCollisonBounds.y)
-        camera->Position.x = cameraCollisonBounds.y;
+    if (camera->Position.x > collisionBounds.y)
+        camera->Position.x = collisionBounds.y;
     // z-min
-    if (camera->Position.z < cameraCollisonBounds.z)
-        camera->Position.z = cameraCollisonBounds.z;
+    if (camera->Position.z < collisionBounds.z)
+        camera->Position.z = collisionBounds.z;
     // z-max
-    if (camera->Position.z > cameraCollisonBounds.w)
-        camera->Position.z = cameraCollisonBounds.w;
+    if (camera->Position.z > collisionBounds.w)
+        camera->Position.z = collisionBounds.w;
+
+    int next = gallery.Graph.findCell(camera->Position);
+    if (next >= 0)
+        cameraCell = next;
 }
 
 
@@ -480,6 +1297,34 @@ void processInput(GLFWwindow* window)
         camera.ProcessKeyboard(RIGHT, deltaTime);
 }
 
+// Toggles, once per key press
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    if (key == GLFW_KEY_P)
+        depthPrepass = !depthPrepass;
+    if (key == GLFW_KEY_R)
+        dynamicResolution = !dynamicResolution;
+    if (key == GLFW_KEY_C)
+        commandLists = !commandLists;
+    if (key == GLFW_KEY_V)
+        pacingMode = nextPacingMode(pacingMode);
+    if (key == GLFW_KEY_X)
+        antiAliasing = nextAntiAliasingMode(antiAliasing);
+    if (key == GLFW_KEY_B)
+        renderBackend = renderBackend == RenderBackend::OPENGL ? RenderBackend::SOFTWARE : RenderBackend::OPENGL;
+    if (key == GLFW_KEY_L)
+        lightmaps = !lightmaps;
+    if (key == GLFW_KEY_H)
+        shadows = !shadows;
+    if (key == GLFW_KEY_T)
+        texelShading = !texelShading;
+    if (key == GLFW_KEY_G)
+        lightVolumes = !lightVolumes;
+}
+
 void mouse_callback(GLFWwindow* window, double xposIn, double yposIn)
 {
     float xpos = static_cast<float>(xposIn);
@@ -509,20 +1354,41 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
-    glViewport(0, 0, width, height);
+    // nothing to do here, the context is on the render thread and the viewport follows each packet's window size
 }
 
-GLFWwindow* createWindow()
+GLFWwindow* createWindow(WindowMode mode, int width, int height)
 {
+    if (mode == WindowMode::HEADLESS)
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_VISIBLE, mode == WindowMode::VISIBLE ? GLFW_TRUE : GLFW_FALSE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     // glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-    glfwWindowHint(GLFW_SAMPLES, 8);
+    // scenes are drawn offscreen, DynamicResolution's target has the samples, see AntiAliasing
+    glfwWindowHint(GLFW_SAMPLES, 0);
+
+    // Newest context first for the multi-draw indirect path, 3.3 core is the baseline
+    const int contextVersions[][2] = { { 4, 6 }, { 4, 3 }, { 3, 3 } };
+    std::vector<int> contextApis = { GLFW_NATIVE_CONTEXT_API };
+    if (mode == WindowMode::HEADLESS)
+        contextApis = { GLFW_EGL_CONTEXT_API, GLFW_OSMESA_CONTEXT_API };
 
     GLFWwindow* window = nullptr;
-    window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, WINDOW_NAME, NULL, NULL);
+    for (int api : contextApis)
+    {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, api);
+        for (const auto& version : contextVersions)
+        {
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+            glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+            window = glfwCreateWindow(width, height, WINDOW_NAME, NULL, NULL);
+            if (window != nullptr)
+                break;
+        }
+        if (window != nullptr)
+            break;
+    }
 
     if (window == nullptr)
     {
@@ -537,7 +1403,9 @@ GLFWwindow* createWindow()
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    glfwSetKeyCallback(window, key_callback);
+    if (mode == WindowMode::VISIBLE)
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     // Load Opengl Function Pointers
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
@@ -546,22 +1414,31 @@ GLFWwindow* createWindow()
         return window;
     }
 
+    glExtensions.load((GLADloadproc)glfwGetProcAddress);
+    std::cout << "OpenGL " << glExtensions.Major << "." << glExtensions.Minor
+        << (glExtensions.MultiDrawIndirect && glExtensions.ShaderDrawParameters ? ", multi-draw indirect" : ", per-draw fallback")
+        << (glExtensions.PersistentMapping ? ", persistent mapping" : ", buffer orphaning") << std::endl;
+
     return window;
 }
 
 void setGlGlobalSettings()
 {
-    glEnable(GL_DEPTH_TEST);
-
-    glEnable(GL_MULTISAMPLE);
-    glEnable(GL_BLEND);
-    glEnable(GL_POLYGON_SMOOTH);
-    glHint(GL_POLYGON_SMOOTH_HINT, GL_NICEST);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
-    glFrontFace(GL_CCW);
+    glState.enable(GL_DEPTH_TEST);
+    glState.depthFunc(GL_LESS);
+    glState.depthMask(true);
+    glState.colorMask(true);
+
+    // only affects multisampled targets, the AA mode picks their sample count. The gallery is
+    // opaque, a pass that blends turns blending on and off itself.
+    glState.enable(GL_MULTISAMPLE);
+    glState.disable(GL_BLEND);
+    glState.disable(GL_POLYGON_SMOOTH);
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glState.enable(GL_CULL_FACE);
+    glState.cullFace(GL_BACK);
+    glState.frontFace(GL_CCW);
 }
 
 
@@ -582,7 +1459,7 @@ unsigned int loadTexture(char const* path)
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        glState.bindTexture(GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -619,7 +1496,7 @@ unsigned int loadTexture(char const* path)
             else if (nrComponents == 4)
                 format = GL_RGBA;
 
-            glBindTexture(GL_TEXTURE_2D, textureID);
+            glState.bindTexture(GL_TEXTURE_2D, textureID);
             glTexImage2D(GL_TEXTURE_2D, 0, format, *width, *height, 0, format, GL_UNSIGNED_BYTE, data);
             glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -640,4 +1517,78 @@ unsigned int loadTexture(char const* path)
     }
 
 
+unsigned int loadTextureArray(const std::vector<std::string>& paths, std::vector<glm::ivec2>* sizes, SoftwareTexture* copy)
+{
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    // Every layer of an array shares one size. Images are nearest-upscaled to the next power of two
+    // square above the largest one, so small tiling textures scale by whole factors and keep their look.
+    std::vector<unsigned char*> images(paths.size());
+    std::vector<glm::ivec2> imageSizes(paths.size(), glm::ivec2(1));
+    int layerWidth = 1;
+    int layerHeight = 1;
+
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        int nrComponents;
+        images[i] = stbi_load(paths[i].c_str(), &imageSizes[i].x, &imageSizes[i].y, &nrComponents, 4);
+        if (images[i])
+        {
+            layerWidth = glm::max(layerWidth, imageSizes[i].x);
+            layerHeight = glm::max(layerHeight, imageSizes[i].y);
+        }
+        else
+        {
+            std::cout << "Texture failed to load at path: " << paths[i] << std::endl;
+            imageSizes[i] = glm::ivec2(1);
+        }
+    }
 
+    int layerSize = 1;
+    while (layerSize < layerWidth || layerSize < layerHeight)
+        layerSize *= 2;
+    layerWidth = layerHeight = layerSize;
+
+    glState.bindTexture(GL_TEXTURE_2D_ARRAY, textureID);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, layerWidth, layerHeight, (GLsizei)paths.size(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    if (copy)
+        copy->create(layerWidth, layerHeight, (int)paths.size());
+
+    std::vector<unsigned char> layer(layerWidth * layerHeight * 4, 0);
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        if (!images[i])
+            continue;
+
+        glm::ivec2 size = imageSizes[i];
+        for (int y = 0; y < layerHeight; y++)
+        {
+            for (int x = 0; x < layerWidth; x++)
+            {
+                const unsigned char* src = images[i] + ((y * size.y / layerHeight) * size.x + (x * size.x / layerWidth)) * 4;
+                unsigned char* dst = &layer[(y * layerWidth + x) * 4];
+                dst[0] = src[0]; dst[1] = src[1]; dst[2] = src[2]; dst[3] = src[3];
+            }
+        }
+
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, layerWidth, layerHeight, 1, GL_RGBA, GL_UNSIGNED_BYTE, layer.data());
+        if (copy)
+            copy->setLayer((int)i, layer.data());
+        stbi_image_free(images[i]);
+    }
+
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    if (copy)
+        copy->generateMipmaps();
+
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    if (sizes)
+        *sizes = imageSizes;
+
+    return textureID;
+}
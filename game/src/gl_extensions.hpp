@@ -0,0 +1,83 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// glad is generated for the 3.3 core profile only. Entry points newer than that are
+// loaded here by hand and every fast path checks its flag before using them.
+
+/* -------------------------------- Constants ------------------------------- */
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER_BINDING
+#define GL_DRAW_INDIRECT_BUFFER_BINDING 0x8F43
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_FRAGMENT_SHADER_INVOCATIONS
+#define GL_FRAGMENT_SHADER_INVOCATIONS 0x82F4
+#endif
+
+/* ------------------------------- Prototypes ------------------------------- */
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+
+struct GLExtensions
+{
+    int Major = 3;
+    int Minor = 3;
+
+    // GL 4.3 or ARB_multi_draw_indirect
+    bool MultiDrawIndirect = false;
+    // GL_ARB_shader_draw_parameters, exposes gl_DrawIDARB to vertex shaders
+    bool ShaderDrawParameters = false;
+    // GL 4.6 or ARB_pipeline_statistics_query, counts shader invocations with glBeginQuery
+    bool PipelineStatistics = false;
+    // GL 4.4 or ARB_buffer_storage, buffers that stay mapped while the GPU reads them
+    bool PersistentMapping = false;
+
+    PFNGLMULTIDRAWELEMENTSINDIRECTPROC MultiDrawElementsIndirect = nullptr;
+    PFNGLBUFFERSTORAGEPROC BufferStorage = nullptr;
+
+    void load(GLADloadproc loader)
+    {
+        glGetIntegerv(GL_MAJOR_VERSION, &Major);
+        glGetIntegerv(GL_MINOR_VERSION, &Minor);
+
+        MultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)loader("glMultiDrawElementsIndirect");
+        MultiDrawIndirect = (version(4, 3) || has("GL_ARB_multi_draw_indirect")) && MultiDrawElementsIndirect;
+        ShaderDrawParameters = has("GL_ARB_shader_draw_parameters");
+        PipelineStatistics = version(4, 6) || has("GL_ARB_pipeline_statistics_query");
+        BufferStorage = (PFNGLBUFFERSTORAGEPROC)loader("glBufferStorage");
+        PersistentMapping = (version(4, 4) || has("GL_ARB_buffer_storage")) && BufferStorage;
+    }
+
+    bool version(int major, int minor) const
+    {
+        return Major > major || (Major == major && Minor >= minor);
+    }
+
+    bool has(const char* name) const
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (extension && std::strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+};
+
+inline GLExtensions glExtensions;
+#endif
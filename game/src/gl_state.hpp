@@ -0,0 +1,352 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+#include "gl_extensions.hpp"
+#include "stats.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                  GL State                                  */
+/* -------------------------------------------------------------------------- */
+
+// Shadow copy of the GL state the renderer changes every frame: program, vertex array, buffer and
+// texture bindings, blend, depth and cull state. A call that would set what is already set is
+// dropped. Every change of these goes through here, one made behind its back leaves the shadow
+// wrong until invalidate(). Bindings start unknown, so the first call always reaches GL.
+// Issued and elided calls are counted in frameStats.
+class GLStateCache
+{
+public:
+    static const int MAX_TEXTURE_UNITS = 16;
+    static const unsigned int MAX_UNIFORM_BINDINGS = 8;
+
+    GLStateCache()
+    {
+        for (auto& unit : textures)
+            unit[0] = unit[1] = unit[2] = UNKNOWN;
+    }
+
+    void useProgram(unsigned int program)
+    {
+        if (set(this->program, program))
+            glUseProgram(program);
+    }
+
+    void bindVertexArray(unsigned int vao)
+    {
+        if (set(vertexArray, vao))
+            glBindVertexArray(vao);
+    }
+
+    // GL_ELEMENT_ARRAY_BUFFER belongs to the vertex array and is not tracked
+    void bindBuffer(GLenum target, unsigned int buffer)
+    {
+        unsigned int* bound = bufferSlot(target);
+        if (bound == nullptr ? issue() : set(*bound, buffer))
+            glBindBuffer(target, buffer);
+    }
+
+    // Also binds the buffer to the target's general binding, as GL does. Indexed uniform buffer
+    // bindings below MAX_UNIFORM_BINDINGS are tracked, anything else passes through.
+    void bindBufferRange(GLenum target, unsigned int index, unsigned int buffer, GLintptr offset, GLsizeiptr size)
+    {
+        bool tracked = target == GL_UNIFORM_BUFFER && index < MAX_UNIFORM_BINDINGS;
+        if (tracked)
+        {
+            UniformBinding& binding = uniformBindings[index];
+            bool changed = binding.buffer != buffer || binding.offset != offset || binding.size != size;
+            binding = { buffer, offset, size };
+            if (!count(changed))
+            {
+                bindBuffer(target, buffer);
+                return;
+            }
+        }
+        else
+        {
+            issue();
+        }
+
+        glBindBufferRange(target, index, buffer, offset, size);
+        if (unsigned int* bound = bufferSlot(target))
+            *bound = buffer;
+    }
+
+    void activeTexture(GLenum unit)
+    {
+        if (set(activeUnit, unit))
+            glActiveTexture(unit);
+    }
+
+    // Binds to the active unit
+    void bindTexture(GLenum target, unsigned int texture)
+    {
+        unsigned int* bound = textureSlot(activeUnit, target);
+        if (bound == nullptr ? issue() : set(*bound, texture))
+            glBindTexture(target, texture);
+    }
+
+    void bindTexture(GLenum unit, GLenum target, unsigned int texture)
+    {
+        activeTexture(unit);
+        bindTexture(target, texture);
+    }
+
+    void enable(GLenum capability)
+    {
+        setCapability(capability, true);
+    }
+
+    void disable(GLenum capability)
+    {
+        setCapability(capability, false);
+    }
+
+    bool enabled(GLenum capability)
+    {
+        unsigned int* state = capabilitySlot(capability);
+        if (state == nullptr || *state == UNKNOWN)
+            return glIsEnabled(capability);
+        return *state == 1;
+    }
+
+    void blendFunc(GLenum source, GLenum destination)
+    {
+        bool changed = set(blendSource, source, false) | set(blendDestination, destination, false);
+        if (count(changed))
+            glBlendFunc(source, destination);
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if (set(depthFunction, func))
+            glDepthFunc(func);
+    }
+
+    void depthMask(bool write)
+    {
+        if (set(depthWrite, write ? 1u : 0u))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    // All four channels together, the renderer never masks them one by one
+    void colorMask(bool write)
+    {
+        if (set(colorWrite, write ? 1u : 0u))
+            glColorMask(write, write, write, write);
+    }
+
+    void cullFace(GLenum face)
+    {
+        if (set(culledFace, face))
+            glCullFace(face);
+    }
+
+    void frontFace(GLenum winding)
+    {
+        if (set(frontWinding, winding))
+            glFrontFace(winding);
+    }
+
+    // Forgets everything, for when GL state was changed without the cache
+    void invalidate()
+    {
+        *this = GLStateCache();
+    }
+
+    // Compares the shadow with what glGet reports, prints every mismatch. Slow, for debug builds.
+    bool validate() const
+    {
+        bool valid = true;
+        auto check = [&](const char* name, unsigned int shadow, GLenum query) {
+            GLint actual = 0;
+            glGetIntegerv(query, &actual);
+            if (shadow != UNKNOWN && shadow != (unsigned int)actual)
+            {
+                std::cout << "ERROR::GL_STATE::MISMATCH " << name << " cached " << shadow << ", bound " << actual << std::endl;
+                valid = false;
+            }
+        };
+
+        check("program", program, GL_CURRENT_PROGRAM);
+        check("vertex array", vertexArray, GL_VERTEX_ARRAY_BINDING);
+        check("array buffer", buffers[0], GL_ARRAY_BUFFER_BINDING);
+        check("uniform buffer", buffers[1], GL_UNIFORM_BUFFER_BINDING);
+        if (glExtensions.MultiDrawIndirect)
+            check("draw indirect buffer", buffers[2], GL_DRAW_INDIRECT_BUFFER_BINDING);
+        check("active texture", activeUnit, GL_ACTIVE_TEXTURE);
+        check("blend source", blendSource, GL_BLEND_SRC_RGB);
+        check("blend destination", blendDestination, GL_BLEND_DST_RGB);
+        check("depth func", depthFunction, GL_DEPTH_FUNC);
+        check("depth mask", depthWrite, GL_DEPTH_WRITEMASK);
+        check("cull face", culledFace, GL_CULL_FACE_MODE);
+        check("front face", frontWinding, GL_FRONT_FACE);
+
+        GLboolean colorMask[4];
+        glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+        if (colorWrite != UNKNOWN && colorWrite != colorMask[0])
+        {
+            std::cout << "ERROR::GL_STATE::MISMATCH color mask" << std::endl;
+            valid = false;
+        }
+
+        const GLenum capabilities[] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_MULTISAMPLE, GL_POLYGON_SMOOTH, GL_RASTERIZER_DISCARD };
+        for (GLenum capability : capabilities)
+        {
+            unsigned int shadow = this->capabilities[capabilityIndex(capability)];
+            if (shadow != UNKNOWN && shadow != (unsigned int)glIsEnabled(capability))
+            {
+                std::cout << "ERROR::GL_STATE::MISMATCH capability 0x" << std::hex << capability << std::dec << std::endl;
+                valid = false;
+            }
+        }
+
+        for (unsigned int i = 0; i < MAX_UNIFORM_BINDINGS; i++)
+        {
+            const UniformBinding& binding = uniformBindings[i];
+            if (binding.buffer == UNKNOWN)
+                continue;
+            GLint buffer = 0;
+            GLint64 offset = 0, size = 0;
+            glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, i, &buffer);
+            glGetInteger64i_v(GL_UNIFORM_BUFFER_START, i, &offset);
+            glGetInteger64i_v(GL_UNIFORM_BUFFER_SIZE, i, &size);
+            if ((unsigned int)buffer != binding.buffer || offset != binding.offset || size != binding.size)
+            {
+                std::cout << "ERROR::GL_STATE::MISMATCH uniform buffer binding " << i << std::endl;
+                valid = false;
+            }
+        }
+
+        GLint unit = 0;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+        for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + i);
+            check("texture 2D", textures[i][0], GL_TEXTURE_BINDING_2D);
+            check("texture 2D array", textures[i][1], GL_TEXTURE_BINDING_2D_ARRAY);
+            check("texture 3D", textures[i][2], GL_TEXTURE_BINDING_3D);
+        }
+        glActiveTexture(unit);
+        return valid;
+    }
+
+private:
+    static const unsigned int UNKNOWN = 0xFFFFFFFFu;
+
+    unsigned int program = UNKNOWN;
+    unsigned int vertexArray = UNKNOWN;
+    // GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_DRAW_INDIRECT_BUFFER
+    unsigned int buffers[3] = { UNKNOWN, UNKNOWN, UNKNOWN };
+    struct UniformBinding
+    {
+        unsigned int buffer = UNKNOWN;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+    };
+    UniformBinding uniformBindings[MAX_UNIFORM_BINDINGS];
+    unsigned int activeUnit = UNKNOWN;
+    // GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D of each unit
+    unsigned int textures[MAX_TEXTURE_UNITS][3];
+    // see capabilityIndex, 1 enabled, 0 disabled
+    unsigned int capabilities[6] = { UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN };
+    unsigned int blendSource = UNKNOWN;
+    unsigned int blendDestination = UNKNOWN;
+    unsigned int depthFunction = UNKNOWN;
+    unsigned int depthWrite = UNKNOWN;
+    unsigned int colorWrite = UNKNOWN;
+    unsigned int culledFace = UNKNOWN;
+    unsigned int frontWinding = UNKNOWN;
+
+    // Stores value, true when it differs from the shadow and the call has to be made
+    bool set(unsigned int& shadow, unsigned int value, bool counted = true)
+    {
+        bool changed = shadow != value;
+        shadow = value;
+        return counted ? count(changed) : changed;
+    }
+
+    bool count(bool changed)
+    {
+        if (changed)
+            frameStats.stateCalls++;
+        else
+            frameStats.stateCallsElided++;
+        return changed;
+    }
+
+    // an untracked call still goes through, and is counted as issued
+    bool issue()
+    {
+        return count(true);
+    }
+
+    void setCapability(GLenum capability, bool on)
+    {
+        unsigned int* state = capabilitySlot(capability);
+        if (state == nullptr ? issue() : set(*state, on ? 1u : 0u))
+            on ? glEnable(capability) : glDisable(capability);
+    }
+
+    unsigned int* bufferSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_ARRAY_BUFFER:
+            return &buffers[0];
+        case GL_UNIFORM_BUFFER:
+            return &buffers[1];
+        case GL_DRAW_INDIRECT_BUFFER:
+            return &buffers[2];
+        default:
+            return nullptr;
+        }
+    }
+
+    unsigned int* textureSlot(unsigned int unit, GLenum target)
+    {
+        int index = (int)unit - GL_TEXTURE0;
+        if (unit == UNKNOWN || index < 0 || index >= MAX_TEXTURE_UNITS)
+            return nullptr;
+        if (target == GL_TEXTURE_2D)
+            return &textures[index][0];
+        if (target == GL_TEXTURE_2D_ARRAY)
+            return &textures[index][1];
+        if (target == GL_TEXTURE_3D)
+            return &textures[index][2];
+        return nullptr;
+    }
+
+    static int capabilityIndex(GLenum capability)
+    {
+        switch (capability)
+        {
+        case GL_BLEND:
+            return 0;
+        case GL_DEPTH_TEST:
+            return 1;
+        case GL_CULL_FACE:
+            return 2;
+        case GL_MULTISAMPLE:
+            return 3;
+        case GL_POLYGON_SMOOTH:
+            return 4;
+        case GL_RASTERIZER_DISCARD:
+            return 5;
+        default:
+            return -1;
+        }
+    }
+
+    unsigned int* capabilitySlot(GLenum capability)
+    {
+        int index = capabilityIndex(capability);
+        return index < 0 ? nullptr : &capabilities[index];
+    }
+};
+
+inline GLStateCache glState;
+#endif
@@ -0,0 +1,248 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "stats.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                  Headless                                  */
+/* -------------------------------------------------------------------------- */
+
+// Settings of a run without a display, for automated performance and regression runs:
+//   --headless [--size 1280x720] [--frames 300] [--path camera_path.txt]
+//              [--stats frames.csv] [--dump prefix] [--dump-every 60] [--backend gl|software]
+//              [--fragments on|off]
+// The camera follows the path over the whole run and the lights animate on the same clock, so
+// the same arguments render the same frames on every machine.
+struct HeadlessOptions
+{
+    int Width = 1280;
+    int Height = 720;
+    int Frames = 300;
+    // camera path to replay, the built in one when empty or missing
+    std::string PathFile;
+    // per-frame stats as CSV, nothing written when empty
+    std::string StatsFile;
+    // frames saved as <DumpPrefix><frame>.ppm every DumpEvery frames and on the last one, the
+    // read back stalls the pipeline so those frames time slower
+    std::string DumpPrefix;
+    int DumpEvery = 0;
+    // frames drawn by SoftwareRasterizer instead of GL
+    bool Software = false;
+    // fragments of the depth prepass and the shading passes counted every frame, see FragmentCounter.
+    // Waiting for the counts stalls every pass, frames time slower.
+    bool CountFragments = false;
+};
+
+// True when argv asks for a headless run, options are filled from the flags that follow
+inline bool parseHeadlessOptions(int argc, char** argv, HeadlessOptions* options)
+{
+    if (argc < 2 || std::string(argv[1]) != "--headless")
+        return false;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        std::string flag = argv[i];
+        std::string value = argv[i + 1];
+        if (flag == "--size")
+        {
+            if (std::sscanf(value.c_str(), "%dx%d", &options->Width, &options->Height) != 2)
+                std::cout << "ERROR::HEADLESS::BAD_SIZE " << value << std::endl;
+        }
+        else if (flag == "--frames")
+            options->Frames = std::atoi(value.c_str());
+        else if (flag == "--path")
+            options->PathFile = value;
+        else if (flag == "--stats")
+            options->StatsFile = value;
+        else if (flag == "--dump")
+            options->DumpPrefix = value;
+        else if (flag == "--dump-every")
+            options->DumpEvery = std::atoi(value.c_str());
+        else if (flag == "--fragments")
+            options->CountFragments = value == "on";
+        else if (flag == "--backend")
+        {
+            options->Software = value == "software";
+            if (value != "gl" && value != "software")
+                std::cout << "ERROR::HEADLESS::UNKNOWN_BACKEND " << value << std::endl;
+        }
+        else
+            std::cout << "ERROR::HEADLESS::UNKNOWN_FLAG " << flag << std::endl;
+    }
+
+    options->Width = std::max(options->Width, 1);
+    options->Height = std::max(options->Height, 1);
+    options->Frames = std::max(options->Frames, 1);
+    return true;
+}
+
+
+/* ---------------------------- Offscreen Target ---------------------------- */
+// Stands in for the window's framebuffer when there is none, frames are presented into it and
+// read back from it. With a depth buffer the room can be drawn into it directly, as the rendering
+// benchmarks do at sizes the window does not have.
+class OffscreenTarget
+{
+public:
+    unsigned int FBO = 0;
+    int Width = 0;
+    int Height = 0;
+
+    void create(int width, int height, bool depth = false)
+    {
+        Width = width;
+        Height = height;
+
+        glGenFramebuffers(1, &FBO);
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, Width, Height);
+        if (depth)
+        {
+            glGenRenderbuffers(1, &depthBuffer);
+            glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, Width, Height);
+        }
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        if (depth)
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::HEADLESS::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void destroy()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteRenderbuffers(1, &colorBuffer);
+        if (depthBuffer != 0)
+            glDeleteRenderbuffers(1, &depthBuffer);
+        FBO = colorBuffer = depthBuffer = 0;
+    }
+
+    // Binary PPM, top row first
+    bool save(const std::string& path) const
+    {
+        std::vector<unsigned char> pixels((size_t)Width * Height * 3);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, Width, Height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::HEADLESS::IMAGE_NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+
+        file << "P6\n" << Width << " " << Height << "\n255\n";
+        for (int y = Height - 1; y >= 0; y--)
+            file.write((const char*)&pixels[(size_t)y * Width * 3], (std::streamsize)Width * 3);
+        return true;
+    }
+
+private:
+    unsigned int colorBuffer = 0;
+    unsigned int depthBuffer = 0;
+};
+
+
+/* ------------------------------- Frame Report ----------------------------- */
+// One CSV row per frame
+inline bool writeFrameStats(const std::string& path, const std::vector<FrameStats>& frames)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::HEADLESS::STATS_NOT_WRITTEN " << path << std::endl;
+        return false;
+    }
+
+    file << "frame,frame_ms,simulation_ms,render_ms,gpu_ms,draws,state_calls,instances,culled,fence_waits,render_scale,"
+         << "software_triangles,software_setup_ms,software_bin_ms,software_raster_ms,software_shade_ms,shadow_passes,shadow_passes_skipped,shaded_texels,"
+         << "light_volume_bricks,light_volume_ms,prepass_samples,shaded_samples,shaded_invocations\n";
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        const FrameStats& stats = frames[i];
+        file << i << "," << stats.frameMs << "," << stats.simulationMs << "," << stats.renderMs << "," << stats.gpuMs
+             << "," << stats.drawCalls << "," << stats.stateCalls << "," << stats.instances << "," << stats.culledInstances
+             << "," << stats.fenceWaits << "," << stats.renderScale << "," << stats.softwareTriangles << "," << stats.softwareSetupMs
+             << "," << stats.softwareBinMs << "," << stats.softwareRasterMs << "," << stats.softwareShadeMs
+             << "," << stats.shadowPasses << "," << stats.shadowPassesSkipped << "," << stats.shadedTexels
+             << "," << stats.lightVolumeBricks << "," << stats.lightVolumeMs << "," << stats.prepassFragments.samples
+             << "," << stats.shadedFragments.samples << "," << stats.shadedFragments.invocations << "\n";
+    }
+    return true;
+}
+
+// Mean and percentiles of the frames after the first quarter, which also compile shaders and
+// upload textures
+inline void printFrameSummary(const std::vector<FrameStats>& frames)
+{
+    auto summarize = [&](const char* name, double FrameStats::*field) {
+        std::vector<double> values;
+        for (size_t i = frames.size() / 4; i < frames.size(); i++)
+            values.push_back(frames[i].*field);
+        if (values.empty())
+            return;
+
+        std::sort(values.begin(), values.end());
+        double mean = 0.0;
+        for (double value : values)
+            mean += value;
+        mean /= values.size();
+
+        auto percentile = [&](double p) { return values[std::min(values.size() - 1, (size_t)(p * values.size()))]; };
+        std::cout << std::left << std::setw(10) << name << std::right << "  " << std::setw(9) << mean << "  " << std::setw(9) << percentile(0.5)
+            << "  " << std::setw(9) << percentile(0.95) << "  " << std::setw(9) << values.back() << std::endl;
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "ms               mean        p50        p95        max" << std::endl;
+    summarize("frame", &FrameStats::frameMs);
+    summarize("simulation", &FrameStats::simulationMs);
+    summarize("render", &FrameStats::renderMs);
+    summarize("gpu", &FrameStats::gpuMs);
+    if (!frames.empty() && frames.back().softwareTriangles > 0)
+    {
+        summarize("sw setup", &FrameStats::softwareSetupMs);
+        summarize("sw bin", &FrameStats::softwareBinMs);
+        summarize("sw raster", &FrameStats::softwareRasterMs);
+        summarize("sw shade", &FrameStats::softwareShadeMs);
+    }
+
+    // Shader invocations the depth test then threw away, only known where the driver counts
+    // invocations before the test. With the prepass that is what it failed to reject early.
+    unsigned long long samples = 0, invocations = 0, prepassSamples = 0;
+    for (size_t i = frames.size() / 4; i < frames.size(); i++)
+    {
+        prepassSamples += frames[i].prepassFragments.samples;
+        samples += frames[i].shadedFragments.samples;
+        invocations += frames[i].shadedFragments.invocations;
+    }
+    size_t counted = frames.size() - frames.size() / 4;
+    if (samples > 0)
+    {
+        std::cout << "fragments per frame: " << prepassSamples / counted << " prepass samples, " << samples / counted << " shaded samples, "
+            << invocations / counted << " shader invocations";
+        if (invocations >= samples && invocations > 0)
+            std::cout << ", " << 100.0 * (invocations - samples) / invocations << "% failed the depth test after shading";
+        std::cout << std::endl;
+    }
+}
+#endif
@@ -0,0 +1,40 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Per-instance attributes, matches locations 3-8 in default.vert
+struct InstanceData
+{
+    glm::mat4 model;
+    int sampleSpace;
+    int textureLayer;
+    // see Lightmap::addChart, zero for instances lit every frame
+    glm::vec4 lightmapRect = glm::vec4(0.0f);
+};
+
+
+// Points attributes 3-8 of the bound VAO at the GL_ARRAY_BUFFER bound instance data, starting at
+// baseInstance. GL 3.3 has no baseInstance draw parameter, so fallbacks re-point the attributes instead.
+inline void setInstanceAttributes(size_t baseInstance)
+{
+    size_t base = baseInstance * sizeof(InstanceData);
+
+    // a mat4 takes four consecutive vec4 locations
+    for (int i = 0; i < 4; i++)
+    {
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, model) + i * sizeof(glm::vec4)));
+        glVertexAttribDivisor(3 + i, 1);
+    }
+    glEnableVertexAttribArray(7);
+    glVertexAttribIPointer(7, 2, GL_INT, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, sampleSpace)));
+    glVertexAttribDivisor(7, 1);
+    glEnableVertexAttribArray(8);
+    glVertexAttribPointer(8, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(base + offsetof(InstanceData, lightmapRect)));
+    glVertexAttribDivisor(8, 1);
+}
+#endif
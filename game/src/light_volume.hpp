@@ -0,0 +1,525 @@
+#ifndef LIGHT_VOLUME_H
+#define LIGHT_VOLUME_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// SSE2 is part of every x64 target, 32 bit MSVC needs /arch:SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIGHT_VOLUME_SSE
+#endif
+
+#include "bvh.hpp"
+#include "lighting.hpp"
+#include "gl_state.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                Light Volume                                */
+/* -------------------------------------------------------------------------- */
+
+// Bricks of a LightVolume copied out by collect(), for upload() on the thread owning the context
+struct LightVolumeUpload
+{
+    std::vector<int> Bricks;
+    // the voxels of each brick in turn, LightVolume::CHANNELS values each
+    std::vector<int16_t> Voxels;
+};
+
+
+// The lights of the current frame on a 3D grid over the gallery. default.frag snaps fragments and
+// lights to 1/16 m, so at 16 voxels per metre a voxel holds exactly what calcLight() computes for
+// the fragments snapped to it, apart from the terms that need the normal or the view.
+// Like the Lightmap a voxel keeps each light's spot cone times banded attenuation in a channel of
+// its own and the ambient with its noise summed over the lights: eight 16 bit fixed point values,
+// one RGBA32UI texel, so default.frag shades from a single texelFetch.
+// The grid is split into bricks of BrickSize^3 voxels. update() compares the lights with those of
+// the last update and recomputes only the channels of the lights that changed, in the bricks their
+// old or new cone reaches; a moved light or a changed ambient rebuilds the ambient everywhere.
+// Bricks are spread over a pool of threads, rows of voxels are computed four at a time with SSE2.
+class LightVolume
+{
+public:
+    // keep in sync with default.frag
+    static const int MAX_LIGHTS = 5;
+    static const int CHANNELS = 8;
+    static constexpr float RANGE = 8.0f;
+
+    int VoxelsPerMeter;
+    int BrickSize;
+    // world position of voxel 0, and the grid in voxels, whole bricks on every axis
+    glm::vec3 Origin = glm::vec3(0.0f);
+    glm::ivec3 Size = glm::ivec3(0);
+    glm::ivec3 Bricks = glm::ivec3(0);
+    // brick after brick, x fastest within one, CHANNELS values per voxel
+    std::vector<int16_t> Voxels;
+    unsigned int Texture = 0;
+    bool UseSSE = true;
+
+    // of the last update()
+    unsigned int BricksUpdated = 0;
+    unsigned int LightsChanged = 0;
+    double UpdateMs = 0.0;
+
+    // threads 0 uses every core, the calling thread is one of them
+    LightVolume(int voxelsPerMeter = 16, int brickSize = 8, unsigned int threads = 0) : VoxelsPerMeter(voxelsPerMeter), BrickSize(brickSize)
+    {
+        setThreads(threads);
+    }
+
+    ~LightVolume()
+    {
+        stopWorkers();
+    }
+
+    LightVolume(const LightVolume&) = delete;
+    LightVolume& operator=(const LightVolume&) = delete;
+
+    void setThreads(unsigned int threads)
+    {
+        stopWorkers();
+        if (threads == 0)
+            threads = glm::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned int t = 1; t < threads; t++)
+            workers.emplace_back(&LightVolume::work, this);
+        threadCount = threads;
+    }
+
+    unsigned int threads() const
+    {
+        return threadCount;
+    }
+
+    // Covers bounds on the 1/16 m grid. Nothing is computed until the first update(), which
+    // computes every brick.
+    void create(const AABB& bounds)
+    {
+        Origin = glm::floor(bounds.min * (float)VoxelsPerMeter) / (float)VoxelsPerMeter;
+        glm::ivec3 voxels = glm::ivec3(glm::ceil((bounds.max - Origin) * (float)VoxelsPerMeter)) + 1;
+        Bricks = (voxels + BrickSize - 1) / BrickSize;
+        Size = Bricks * BrickSize;
+        Voxels.assign((size_t)brickCount() * brickVoxels() * CHANNELS, 0);
+        valid = false;
+
+        if (Texture == 0)
+            glGenTextures(1, &Texture);
+        glState.bindTexture(GL_TEXTURE_3D, Texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA32UI, Size.x, Size.y, Size.z, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+
+    int brickCount() const
+    {
+        return Bricks.x * Bricks.y * Bricks.z;
+    }
+
+    int brickVoxels() const
+    {
+        return BrickSize * BrickSize * BrickSize;
+    }
+
+    // Any struct with the fields of default.frag's Light
+    template <typename Light>
+    void update(const std::vector<Light>& lights)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        int count = glm::min((int)lights.size(), MAX_LIGHTS);
+        LightState current[MAX_LIGHTS];
+        for (int i = 0; i < count; i++)
+            current[i] = LightState::from(lights[i]);
+
+        // a light that moved or changed its falloff reaches every voxel through its ambient
+        bool ambientChanged = !valid || count != lightCount;
+        bool everywhere[MAX_LIGHTS] = {};
+        bool changed[MAX_LIGHTS] = {};
+        LightsChanged = 0;
+        for (int i = 0; i < MAX_LIGHTS; i++)
+        {
+            // channels of lights that were never there stay at zero
+            if (valid && i >= count && i >= lightCount)
+                continue;
+            bool moved = !valid || i >= count || i >= lightCount || current[i].Position != last[i].Position || current[i].Constant != last[i].Constant
+                || current[i].Linear != last[i].Linear || current[i].Quadratic != last[i].Quadratic;
+            ambientChanged = ambientChanged || moved || (i < count && current[i].Ambient != last[i].Ambient);
+            everywhere[i] = moved;
+            changed[i] = moved || current[i].Facing != last[i].Facing || current[i].CutOff != last[i].CutOff || current[i].OuterCutOff != last[i].OuterCutOff;
+            LightsChanged += changed[i] && i < count;
+        }
+
+        jobs.clear();
+        for (int brick = 0; brick < brickCount(); brick++)
+        {
+            unsigned int mask = ambientChanged ? AMBIENT : 0u;
+            for (int i = 0; i < MAX_LIGHTS; i++)
+            {
+                if (!changed[i])
+                    continue;
+                if (everywhere[i] || (i < lightCount && inCone(brick, last[i])) || (i < count && inCone(brick, current[i])))
+                    mask |= 1u << i;
+            }
+            if (mask != 0)
+                jobs.push_back({ brick, mask });
+        }
+
+        std::copy(current, current + count, last);
+        lightCount = count;
+        valid = true;
+
+        runJobs();
+
+        BricksUpdated = (unsigned int)jobs.size();
+        UpdateMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Copies the bricks of the last update() out, a render thread may upload them while the next
+    // update() runs
+    void collect(LightVolumeUpload* upload) const
+    {
+        size_t brickValues = (size_t)brickVoxels() * CHANNELS;
+        upload->Bricks.resize(jobs.size());
+        upload->Voxels.resize(jobs.size() * brickValues);
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            upload->Bricks[i] = jobs[i].Brick;
+            std::memcpy(&upload->Voxels[i * brickValues], &Voxels[(size_t)jobs[i].Brick * brickValues], brickValues * sizeof(int16_t));
+        }
+    }
+
+    // One glTexSubImage3D per brick, the two 16 bit channels of a component in little endian order
+    void upload(const LightVolumeUpload& upload)
+    {
+        if (upload.Bricks.empty())
+            return;
+
+        glState.bindTexture(GL_TEXTURE_3D, Texture);
+        size_t brickValues = (size_t)brickVoxels() * CHANNELS;
+        for (size_t i = 0; i < upload.Bricks.size(); i++)
+        {
+            glm::ivec3 origin = brickOrigin(upload.Bricks[i]);
+            glTexSubImage3D(GL_TEXTURE_3D, 0, origin.x, origin.y, origin.z, BrickSize, BrickSize, BrickSize, GL_RGBA_INTEGER, GL_UNSIGNED_INT,
+                &upload.Voxels[i * brickValues]);
+        }
+    }
+
+    // Shader side size of the grid, what default.frag's lightVolumeOrigin holds
+    glm::vec4 shaderOrigin() const
+    {
+        return glm::vec4(Origin, (float)VoxelsPerMeter);
+    }
+
+    size_t memoryBytes() const
+    {
+        return (size_t)Size.x * Size.y * Size.z * CHANNELS * sizeof(int16_t);
+    }
+
+    static int16_t encode(float value)
+    {
+        return (int16_t)glm::round(glm::clamp(value, -RANGE, RANGE) * (32767.0f / RANGE));
+    }
+
+    static float decode(int16_t value)
+    {
+        return value * (RANGE / 32767.0f);
+    }
+
+private:
+    // what a voxel's channels depend on, lights are compared with these between updates
+    struct LightState
+    {
+        glm::vec3 Position = glm::vec3(0.0f);
+        glm::vec3 Facing = glm::vec3(0.0f);
+        float CutOff = 0.0f;
+        float OuterCutOff = 0.0f;
+        glm::vec3 Ambient = glm::vec3(0.0f);
+        float Constant = 1.0f;
+        float Linear = 0.0f;
+        float Quadratic = 0.0f;
+
+        template <typename Light>
+        static LightState from(const Light& light)
+        {
+            LightState state;
+            state.Position = quantizePosition(light.position, 16.0f);
+            state.Facing = glm::normalize(-light.direction);
+            state.CutOff = light.cutOff;
+            state.OuterCutOff = light.outerCutOff;
+            state.Ambient = light.ambient;
+            state.Constant = light.constant;
+            state.Linear = light.linear;
+            state.Quadratic = light.quadratic;
+            return state;
+        }
+    };
+
+    struct Job
+    {
+        int Brick;
+        // bit i recomputes light i, AMBIENT the ambient
+        unsigned int Mask;
+    };
+
+    static const unsigned int AMBIENT = 1u << MAX_LIGHTS;
+
+    LightState last[MAX_LIGHTS];
+    int lightCount = 0;
+    bool valid = false;
+    std::vector<Job> jobs;
+
+    unsigned int threadCount = 1;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    unsigned long long generation = 0;
+    unsigned int busy = 0;
+    bool stopping = false;
+    std::atomic<size_t> nextJob{ 0 };
+
+    glm::ivec3 brickOrigin(int brick) const
+    {
+        return glm::ivec3(brick % Bricks.x, (brick / Bricks.x) % Bricks.y, brick / (Bricks.x * Bricks.y)) * BrickSize;
+    }
+
+    glm::vec3 voxelPosition(const glm::ivec3& voxel) const
+    {
+        return quantizePosition(Origin + glm::vec3(voxel) / (float)VoxelsPerMeter, 16.0f);
+    }
+
+    // Whether a brick's bounding sphere reaches into the cone where the light's intensity is above zero
+    bool inCone(int brick, const LightState& light) const
+    {
+        float half = BrickSize * 0.5f / VoxelsPerMeter;
+        glm::vec3 center = Origin + (glm::vec3(brickOrigin(brick)) + (BrickSize - 1) * 0.5f) / (float)VoxelsPerMeter;
+        float radius = half * 1.7321f + 1.0f / VoxelsPerMeter;
+
+        glm::vec3 toBrick = center - light.Position;
+        float distance = glm::length(toBrick);
+        if (distance <= radius)
+            return true;
+
+        float coneAngle = glm::acos(glm::clamp(light.OuterCutOff, -1.0f, 1.0f));
+        float offAxis = glm::acos(glm::clamp(glm::dot(toBrick / distance, -light.Facing), -1.0f, 1.0f));
+        return offAxis - glm::asin(radius / distance) < coneAngle;
+    }
+
+    void runJobs()
+    {
+        nextJob = 0;
+        if (workers.empty())
+        {
+            updateBricks();
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+            busy = (unsigned int)workers.size();
+        }
+        started.notify_all();
+
+        updateBricks();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return busy == 0; });
+    }
+
+    void work()
+    {
+        unsigned long long seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+
+            updateBricks();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+
+    void stopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+        stopping = false;
+    }
+
+    void updateBricks()
+    {
+        std::vector<float> rowX(BrickSize);
+        std::vector<float> row(BrickSize);
+        for (size_t j = nextJob++; j < jobs.size(); j = nextJob++)
+        {
+            const Job& job = jobs[j];
+            glm::ivec3 origin = brickOrigin(job.Brick);
+            int16_t* voxels = &Voxels[(size_t)job.Brick * brickVoxels() * CHANNELS];
+
+            for (int x = 0; x < BrickSize; x++)
+                rowX[x] = voxelPosition(origin + glm::ivec3(x, 0, 0)).x;
+
+            for (int z = 0; z < BrickSize; z++)
+            {
+                for (int y = 0; y < BrickSize; y++)
+                {
+                    glm::vec3 rowStart = voxelPosition(origin + glm::ivec3(0, y, z));
+                    int16_t* out = voxels + (size_t)((z * BrickSize + y) * BrickSize) * CHANNELS;
+
+                    for (int i = 0; i < MAX_LIGHTS; i++)
+                    {
+                        if (!(job.Mask & (1u << i)))
+                            continue;
+                        if (i < lightCount)
+                            directRow(last[i], rowX.data(), rowStart.y, rowStart.z, row.data());
+                        else
+                            std::fill(row.begin(), row.end(), 0.0f);
+                        for (int x = 0; x < BrickSize; x++)
+                            out[x * CHANNELS + i] = encode(row[x]);
+                    }
+
+                    if (job.Mask & AMBIENT)
+                    {
+                        for (int x = 0; x < BrickSize; x++)
+                        {
+                            glm::vec3 ambient = this->ambient(glm::vec3(rowX[x], rowStart.y, rowStart.z));
+                            out[x * CHANNELS + 5] = encode(ambient.r);
+                            out[x * CHANNELS + 6] = encode(ambient.g);
+                            out[x * CHANNELS + 7] = encode(ambient.b);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // calcLight()'s ambient summed over the lights, with its noise
+    glm::vec3 ambient(const glm::vec3& position) const
+    {
+        glm::vec3 sum(0.0f);
+        for (int i = 0; i < lightCount; i++)
+        {
+            const LightState& light = last[i];
+            if (light.Ambient == glm::vec3(0.0f))
+                continue;
+            float distance = glm::length(light.Position - position);
+            sum += light.Ambient * (1.0f / (light.Constant + light.Linear * distance + light.Quadratic * (distance * distance)));
+        }
+        return sum * (1.0f - ambientNoise(position));
+    }
+
+    // Spot cone times banded attenuation of one light, for a row of BrickSize voxels at x along y, z
+    void directRow(const LightState& light, const float* x, float y, float z, float* out) const
+    {
+#ifdef LIGHT_VOLUME_SSE
+        if (UseSSE)
+        {
+            directRowSSE(light, x, y, z, out);
+            return;
+        }
+#endif
+        for (int i = 0; i < BrickSize; i++)
+            out[i] = direct(light, glm::vec3(x[i], y, z));
+    }
+
+    // Evaluates exactly what directRowSSE does, in the same order, one voxel at a time
+    static float direct(const LightState& light, const glm::vec3& position)
+    {
+        glm::vec3 toLight = light.Position - position;
+        float distance = std::sqrt(toLight.x * toLight.x + toLight.y * toLight.y + toLight.z * toLight.z);
+        glm::vec3 lightDir = toLight / distance;
+        float theta = lightDir.x * light.Facing.x + lightDir.y * light.Facing.y + lightDir.z * light.Facing.z;
+        float intensity = glm::clamp((theta - light.OuterCutOff) / (light.CutOff - light.OuterCutOff), 0.0f, 1.0f);
+        if (!(intensity > 0.0f))
+            return 0.0f;
+
+        float attenuation = 1.0f / (light.Constant + light.Linear * distance + light.Quadratic * (distance * distance));
+        return intensity * bandedAttenuation(attenuation);
+    }
+
+#ifdef LIGHT_VOLUME_SSE
+    void directRowSSE(const LightState& light, const float* x, float y, float z, float* out) const
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 dy = _mm_set1_ps(light.Position.y - y);
+        const __m128 dz = _mm_set1_ps(light.Position.z - z);
+        const __m128 lightX = _mm_set1_ps(light.Position.x);
+        const __m128 outer = _mm_set1_ps(light.OuterCutOff);
+        const __m128 cone = _mm_set1_ps(light.CutOff - light.OuterCutOff);
+
+        // four voxels at a time, a brick size that is not a multiple of 4 ends on direct()
+        int i = 0;
+        for (; i + 4 <= BrickSize; i += 4)
+        {
+            __m128 dx = _mm_sub_ps(lightX, _mm_loadu_ps(x + i));
+            __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+            __m128 theta = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_div_ps(dx, distance), _mm_set1_ps(light.Facing.x)),
+                _mm_mul_ps(_mm_div_ps(dy, distance), _mm_set1_ps(light.Facing.y))), _mm_mul_ps(_mm_div_ps(dz, distance), _mm_set1_ps(light.Facing.z)));
+            __m128 intensity = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_sub_ps(theta, outer), cone), zero), one);
+            if (_mm_movemask_ps(_mm_cmpgt_ps(intensity, zero)) == 0)
+            {
+                _mm_storeu_ps(out + i, zero);
+                continue;
+            }
+
+            __m128 attenuation = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_set1_ps(light.Constant), _mm_mul_ps(_mm_set1_ps(light.Linear), distance)),
+                _mm_mul_ps(_mm_set1_ps(light.Quadratic), _mm_mul_ps(distance, distance))));
+
+            // bandedAttenuation() without its early outs, which only skip adding whole weights or zeros
+            const int steps = 10;
+            __m128 banded = zero;
+            for (int step = 1; step <= steps; step++)
+            {
+                float offset = 0.8f / steps * step;
+                __m128 weight = _mm_set1_ps(std::sqrt((float)step));
+                __m128 edge = smoothstep(offset - 0.01f, offset, attenuation);
+                __m128 lower = smoothstep(offset - 0.1f, offset - 0.02f, attenuation);
+                banded = _mm_add_ps(banded, _mm_mul_ps(edge, weight));
+                banded = _mm_add_ps(banded, _mm_mul_ps(_mm_sub_ps(edge, lower), weight));
+            }
+            banded = _mm_div_ps(banded, _mm_set1_ps((float)steps));
+
+            __m128 lit = _mm_cmpgt_ps(intensity, zero);
+            _mm_storeu_ps(out + i, _mm_and_ps(lit, _mm_mul_ps(intensity, banded)));
+        }
+        for (; i < BrickSize; i++)
+            out[i] = direct(light, glm::vec3(x[i], y, z));
+    }
+
+    static __m128 smoothstep(float edge0, float edge1, __m128 x)
+    {
+        __m128 t = _mm_div_ps(_mm_sub_ps(x, _mm_set1_ps(edge0)), _mm_set1_ps(edge1 - edge0));
+        t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        return _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), t)));
+    }
+#endif
+};
+#endif
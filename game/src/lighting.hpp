@@ -0,0 +1,118 @@
+#ifndef LIGHTING_H
+#define LIGHTING_H
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+
+/* -------------------------------------------------------------------------- */
+/*                                  Lighting                                  */
+/* -------------------------------------------------------------------------- */
+
+// The terms of default.frag's calcLight() on the CPU, for SoftwareRasterizer and the Lightmap baker
+
+// default.frag snaps light, view and fragment positions to a 1/16 grid before lighting
+inline glm::vec3 quantizePosition(const glm::vec3& v, float factor)
+{
+    return glm::floor(v * factor + 0.5f) / factor;
+}
+
+// The stepped falloff of calcLight(). Steps far below the attenuation add sqrt(i) and those far
+// above it nothing, only the ones around it need their smoothsteps.
+inline float bandedAttenuation(float attenuation)
+{
+    const int steps = 10;
+    float banded = 0.0f;
+    for (int i = 1; i <= steps; i++)
+    {
+        float offset = 0.8f / steps * i;
+        float weight = std::sqrt((float)i);
+        if (attenuation >= offset)
+        {
+            banded += weight;
+            continue;
+        }
+        if (attenuation < offset - 0.1f)
+            break;
+
+        float edge = glm::smoothstep(offset - 0.01f, offset, attenuation);
+        banded += edge * weight;
+        banded += (edge - glm::smoothstep(offset - 0.1f, offset - 0.02f, attenuation)) * weight;
+    }
+    return banded / steps;
+}
+
+// Classic Perlin 3D noise as in default.frag (Stefan Gustavson, webgl-noise)
+inline glm::vec4 perlinPermute(const glm::vec4& x)
+{
+    return glm::mod(((x * 34.0f) + 1.0f) * x, 289.0f);
+}
+
+inline float perlinNoise(const glm::vec3& P)
+{
+    glm::vec3 Pi0 = glm::mod(glm::floor(P), 289.0f);
+    glm::vec3 Pi1 = glm::mod(glm::floor(P) + 1.0f, 289.0f);
+    glm::vec3 Pf0 = glm::fract(P);
+    glm::vec3 Pf1 = Pf0 - 1.0f;
+    glm::vec4 ix(Pi0.x, Pi1.x, Pi0.x, Pi1.x);
+    glm::vec4 iy(Pi0.y, Pi0.y, Pi1.y, Pi1.y);
+
+    glm::vec4 ixy = perlinPermute(perlinPermute(ix) + iy);
+    glm::vec4 ixy0 = perlinPermute(ixy + Pi0.z);
+    glm::vec4 ixy1 = perlinPermute(ixy + Pi1.z);
+
+    auto gradients = [](const glm::vec4& hash, glm::vec4* gx, glm::vec4* gy, glm::vec4* gz) {
+        *gx = hash / 7.0f;
+        *gy = glm::fract(glm::floor(*gx) / 7.0f) - 0.5f;
+        *gx = glm::fract(*gx);
+        *gz = glm::vec4(0.5f) - glm::abs(*gx) - glm::abs(*gy);
+        glm::vec4 sz = glm::step(*gz, glm::vec4(0.0f));
+        *gx -= sz * (glm::step(glm::vec4(0.0f), *gx) - 0.5f);
+        *gy -= sz * (glm::step(glm::vec4(0.0f), *gy) - 0.5f);
+    };
+    glm::vec4 gx0, gy0, gz0, gx1, gy1, gz1;
+    gradients(ixy0, &gx0, &gy0, &gz0);
+    gradients(ixy1, &gx1, &gy1, &gz1);
+
+    glm::vec3 g000(gx0.x, gy0.x, gz0.x);
+    glm::vec3 g100(gx0.y, gy0.y, gz0.y);
+    glm::vec3 g010(gx0.z, gy0.z, gz0.z);
+    glm::vec3 g110(gx0.w, gy0.w, gz0.w);
+    glm::vec3 g001(gx1.x, gy1.x, gz1.x);
+    glm::vec3 g101(gx1.y, gy1.y, gz1.y);
+    glm::vec3 g011(gx1.z, gy1.z, gz1.z);
+    glm::vec3 g111(gx1.w, gy1.w, gz1.w);
+
+    auto taylorInvSqrt = [](const glm::vec4& r) { return 1.79284291400159f - 0.85373472095314f * r; };
+    glm::vec4 norm0 = taylorInvSqrt(glm::vec4(glm::dot(g000, g000), glm::dot(g010, g010), glm::dot(g100, g100), glm::dot(g110, g110)));
+    g000 *= norm0.x;
+    g010 *= norm0.y;
+    g100 *= norm0.z;
+    g110 *= norm0.w;
+    glm::vec4 norm1 = taylorInvSqrt(glm::vec4(glm::dot(g001, g001), glm::dot(g011, g011), glm::dot(g101, g101), glm::dot(g111, g111)));
+    g001 *= norm1.x;
+    g011 *= norm1.y;
+    g101 *= norm1.z;
+    g111 *= norm1.w;
+
+    float n000 = glm::dot(g000, Pf0);
+    float n100 = glm::dot(g100, glm::vec3(Pf1.x, Pf0.y, Pf0.z));
+    float n010 = glm::dot(g010, glm::vec3(Pf0.x, Pf1.y, Pf0.z));
+    float n110 = glm::dot(g110, glm::vec3(Pf1.x, Pf1.y, Pf0.z));
+    float n001 = glm::dot(g001, glm::vec3(Pf0.x, Pf0.y, Pf1.z));
+    float n101 = glm::dot(g101, glm::vec3(Pf1.x, Pf0.y, Pf1.z));
+    float n011 = glm::dot(g011, glm::vec3(Pf0.x, Pf1.y, Pf1.z));
+    float n111 = glm::dot(g111, Pf1);
+
+    glm::vec3 fade = Pf0 * Pf0 * Pf0 * (Pf0 * (Pf0 * 6.0f - 15.0f) + 10.0f);
+    glm::vec4 nz = glm::mix(glm::vec4(n000, n100, n010, n110), glm::vec4(n001, n101, n011, n111), fade.z);
+    glm::vec2 nyz = glm::mix(glm::vec2(nz.x, nz.y), glm::vec2(nz.z, nz.w), fade.y);
+    return 2.2f * glm::mix(nyz.x, nyz.y, fade.x);
+}
+
+// How much of the ambient term calcLight() takes away at a quantized fragment position
+inline float ambientNoise(const glm::vec3& fragPos)
+{
+    return perlinNoise(fragPos / 2.0f) * 0.7f * perlinNoise(fragPos) + perlinNoise(fragPos * 5.0f) * 0.3f;
+}
+#endif
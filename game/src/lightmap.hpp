@@ -0,0 +1,241 @@
+#ifndef LIGHTMAP_H
+#define LIGHTMAP_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include "mesh.hpp"
+#include "bvh.hpp"
+#include "pvs.hpp"
+#include "lighting.hpp"
+#include "gl_state.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                  Lightmap                                  */
+/* -------------------------------------------------------------------------- */
+
+// Static lighting of the room surfaces, baked on the CPU. Texels are 1/16 m apart, the grid
+// default.frag quantizes fragment positions to, so a texel holds exactly what the shader would
+// compute for the fragments around it and sampling it needs no filtering.
+// Each light's spot cone, banded attenuation and shadow are baked for its rest pose into a channel
+// of their own, which the renderer scales by intensityScale() as the light breathes. Ambient with
+// its noise never changes and is baked summed over the lights.
+// Layout: layer 0 holds lights 0-3 in rgba, layer 1 light 4 in r and the ambient in gba.
+class Lightmap
+{
+public:
+    // keep in sync with default.frag
+    static const int TEXELS_PER_METER = 16;
+    static const int MAX_LIGHTS = 5;
+    static const int LAYERS = 2;
+    // charts are packed on shelves this wide, wider ones widen the atlas
+    static const int ATLAS_WIDTH = 1024;
+
+    // One planar surface, texel (x, y) sits at Corner + x * StepU + y * StepV
+    struct Chart
+    {
+        glm::ivec2 Origin = glm::ivec2(0);
+        glm::ivec2 Size = glm::ivec2(0);
+        glm::vec3 Corner = glm::vec3(0.0f);
+        glm::vec3 StepU = glm::vec3(0.0f);
+        glm::vec3 StepV = glm::vec3(0.0f);
+        glm::vec3 Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+    };
+
+    int Width = 0;
+    int Height = 0;
+    std::vector<Chart> Charts;
+    // Width x Height texels per layer, layer after layer as glTexImage3D takes them
+    std::vector<glm::vec4> Texels;
+    unsigned int Texture = 0;
+
+    // bake statistics
+    double BakeMs = 0.0;
+    unsigned int BakeThreads = 0;
+    unsigned long long ShadowRays = 0;
+
+    // Chart for a planar mesh placed by model, parameterized by its texture coordinates, which
+    // must span [0, 1]. Returns what default.vert expects in InstanceData::lightmapRect: the
+    // texel coordinates at texture coordinate 0 and their change up to 1.
+    glm::vec4 addChart(const Mesh& mesh, const glm::mat4& model)
+    {
+        // position as an affine function of the texture coordinates, from the first triangle
+        const Vertex& v0 = mesh.vertices[mesh.indices[0]];
+        const Vertex& v1 = mesh.vertices[mesh.indices[1]];
+        const Vertex& v2 = mesh.vertices[mesh.indices[2]];
+        glm::mat2 texCoords(v1.texCoords - v0.texCoords, v2.texCoords - v0.texCoords);
+        glm::mat2 toTexCoords = glm::inverse(texCoords);
+        glm::vec3 edge1 = glm::vec3(model * glm::vec4(v1.position, 1.0f)) - glm::vec3(model * glm::vec4(v0.position, 1.0f));
+        glm::vec3 edge2 = glm::vec3(model * glm::vec4(v2.position, 1.0f)) - glm::vec3(model * glm::vec4(v0.position, 1.0f));
+        glm::vec3 axisU = edge1 * toTexCoords[0][0] + edge2 * toTexCoords[0][1];
+        glm::vec3 axisV = edge1 * toTexCoords[1][0] + edge2 * toTexCoords[1][1];
+        glm::vec3 origin = glm::vec3(model * glm::vec4(v0.position, 1.0f)) - axisU * v0.texCoords.x - axisV * v0.texCoords.y;
+
+        // a texel on both edges, so the grid lines up with the quantization when the surface does
+        Chart chart;
+        chart.Size.x = glm::max((int)glm::round(glm::length(axisU) * TEXELS_PER_METER), 1) + 1;
+        chart.Size.y = glm::max((int)glm::round(glm::length(axisV) * TEXELS_PER_METER), 1) + 1;
+        chart.Corner = origin;
+        chart.StepU = axisU / (float)(chart.Size.x - 1);
+        chart.StepV = axisV / (float)(chart.Size.y - 1);
+        chart.Normal = glm::normalize(glm::mat3(glm::transpose(glm::inverse(model))) * v0.normal);
+
+        // shelf packing, one texel of padding between charts
+        if (shelfX > 0 && shelfX + chart.Size.x > ATLAS_WIDTH)
+        {
+            shelfY += shelfHeight + 1;
+            shelfX = shelfHeight = 0;
+        }
+        chart.Origin = glm::ivec2(shelfX, shelfY);
+        shelfX += chart.Size.x + 1;
+        shelfHeight = glm::max(shelfHeight, chart.Size.y);
+        Width = glm::max(Width, chart.Origin.x + chart.Size.x);
+        Height = glm::max(Height, chart.Origin.y + chart.Size.y);
+        Charts.push_back(chart);
+
+        // texel centres at the ends of the surface
+        return glm::vec4(glm::vec2(chart.Origin) + 0.5f, glm::vec2(chart.Size - 1));
+    }
+
+    // Any struct with the fields of default.frag's Light, in their rest pose. Walls and other
+    // occluders cast shadows, rows of texels are split across threads.
+    template <typename Light>
+    void bake(const std::vector<Light>& lights, const std::vector<Occluder>& occluders, unsigned int threads = 0)
+    {
+        static_assert(MAX_LIGHTS + 3 <= LAYERS * 4, "lights and ambient do not fit the layers");
+        auto start = std::chrono::steady_clock::now();
+
+        int lightCount = glm::min((int)lights.size(), MAX_LIGHTS);
+        for (int i = 0; i < MAX_LIGHTS; i++)
+            restPower[i] = i < lightCount ? conePower(lights[i]) : 0.0f;
+
+        std::vector<AABB> occluderBounds;
+        for (const Occluder& occluder : occluders)
+            occluderBounds.push_back(occluder.bounds());
+        BVH bvh;
+        bvh.build(occluderBounds);
+
+        Texels.assign((size_t)Width * Height * LAYERS, glm::vec4(0.0f));
+
+        struct Row
+        {
+            int chart;
+            int y;
+        };
+        std::vector<Row> rows;
+        for (int c = 0; c < (int)Charts.size(); c++)
+        {
+            for (int y = 0; y < Charts[c].Size.y; y++)
+                rows.push_back({ c, y });
+        }
+
+        std::atomic<size_t> nextRow(0);
+        std::atomic<unsigned long long> rays(0);
+
+        auto worker = [&]() {
+            unsigned long long cast = 0;
+            for (size_t r = nextRow++; r < rows.size(); r = nextRow++)
+            {
+                const Chart& chart = Charts[rows[r].chart];
+                int y = rows[r].y;
+                for (int x = 0; x < chart.Size.x; x++)
+                {
+                    glm::vec3 fragPos = quantizePosition(chart.Corner + chart.StepU * (float)x + chart.StepV * (float)y, (float)TEXELS_PER_METER);
+                    float direct[MAX_LIGHTS] = {};
+                    glm::vec3 ambient(0.0f);
+
+                    // calcLight() without the terms that need the normal, the view or the texture
+                    for (int i = 0; i < lightCount; i++)
+                    {
+                        const Light& light = lights[i];
+                        glm::vec3 lightPos = quantizePosition(light.position, (float)TEXELS_PER_METER);
+                        glm::vec3 toLight = lightPos - fragPos;
+                        float distance = glm::length(toLight);
+                        glm::vec3 lightDir = toLight / distance;
+                        float attenuation = 1.0f / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+                        ambient += light.ambient * attenuation;
+
+                        float theta = glm::dot(lightDir, glm::normalize(-light.direction));
+                        float intensity = glm::clamp((theta - light.outerCutOff) / (light.cutOff - light.outerCutOff), 0.0f, 1.0f);
+                        if (!(intensity > 0.0f))
+                            continue;
+
+                        // stops short of the surface, which may be an occluder itself
+                        glm::vec3 to = fragPos + lightDir * 0.01f;
+                        cast++;
+                        if (bvh.anyHit(lightPos, to, [&](unsigned int o) { return occluders[o].blocks(lightPos, to); }))
+                            continue;
+                        direct[i] = intensity * bandedAttenuation(attenuation);
+                    }
+                    ambient *= 1.0f - ambientNoise(fragPos);
+
+                    size_t texel = (size_t)(chart.Origin.y + y) * Width + chart.Origin.x + x;
+                    size_t layer = (size_t)Width * Height;
+                    Texels[texel] = glm::vec4(direct[0], direct[1], direct[2], direct[3]);
+                    Texels[layer + texel] = glm::vec4(direct[4], ambient);
+                }
+            }
+            rays += cast;
+        };
+
+        if (threads == 0)
+            threads = glm::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<std::thread> pool;
+        for (unsigned int t = 1; t < threads; t++)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread& thread : pool)
+            thread.join();
+
+        BakeThreads = threads;
+        ShadowRays = rays;
+        BakeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // What a light's baked channel is multiplied by for its animated pose. The flicker only turns
+    // the cone, the breathing widens it and so changes how much light it sends out.
+    template <typename Light>
+    float intensityScale(int light, const Light& animated) const
+    {
+        return restPower[light] > 0.0f ? conePower(animated) / restPower[light] : 0.0f;
+    }
+
+    void upload()
+    {
+        if (Texture == 0)
+            glGenTextures(1, &Texture);
+        glState.bindTexture(GL_TEXTURE_2D_ARRAY, Texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16F, Width, Height, LAYERS, 0, GL_RGBA, GL_FLOAT, Texels.data());
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    size_t memoryBytes() const
+    {
+        // four half floats per texel on the GPU
+        return (size_t)Width * Height * LAYERS * 8;
+    }
+
+private:
+    float restPower[MAX_LIGHTS] = {};
+    int shelfX = 0;
+    int shelfY = 0;
+    int shelfHeight = 0;
+
+    // The spot falloff integrated over the sphere, up to a factor of 2 pi
+    template <typename Light>
+    static float conePower(const Light& light)
+    {
+        return 1.0f - (light.cutOff + light.outerCutOff) * 0.5f;
+    }
+};
+#endif
@@ -0,0 +1,458 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <glm/gtc/packing.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <cstring>
+
+#include "gl_state.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                   Vertex                                   */
+/* -------------------------------------------------------------------------- */
+
+struct Vertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 texCoords;
+};
+
+/* -------------------------------------------------------------------------- */
+/*                                Vertex Format                               */
+/* -------------------------------------------------------------------------- */
+
+struct VertexAttribute
+{
+    unsigned int location;
+    int size;
+    GLenum type;
+    bool normalized;
+    bool integer;
+    unsigned int offset;
+};
+
+enum class PositionEncoding {
+    FLOAT,      // 12 bytes
+    UNORM16,    // 8 bytes, dequantized per mesh in the vertex shader
+};
+
+enum class NormalEncoding {
+    FLOAT,      // 12 bytes
+    PACKED,     // 4 bytes, GL_INT_2_10_10_10_REV, decoded by the vertex fetch
+    OCTAHEDRAL, // 4 bytes, snorm16 x2, decoded in the vertex shader
+};
+
+enum class TexCoordEncoding {
+    FLOAT,      // 8 bytes
+    HALF,       // 4 bytes
+};
+
+// Describes one interleaved vertex in a GPU buffer, replaces hand written glVertexAttribPointer blocks.
+// Attributes keep locations 0-2 whatever the encoding, default.vert only needs to know about
+// octahedral normals.
+struct VertexFormat
+{
+    PositionEncoding position = PositionEncoding::FLOAT;
+    NormalEncoding normal = NormalEncoding::FLOAT;
+    TexCoordEncoding texCoords = TexCoordEncoding::FLOAT;
+
+    std::vector<VertexAttribute> attributes;
+    unsigned int stride = 0;
+
+    VertexFormat() = default;
+
+    VertexFormat(PositionEncoding positionEncoding, NormalEncoding normalEncoding, TexCoordEncoding texCoordEncoding)
+        : position(positionEncoding), normal(normalEncoding), texCoords(texCoordEncoding)
+    {
+        if (position == PositionEncoding::UNORM16)
+            add(0, 4, GL_UNSIGNED_SHORT, true);
+        else
+            add(0, 3, GL_FLOAT);
+
+        if (normal == NormalEncoding::PACKED)
+            add(1, 4, GL_INT_2_10_10_10_REV, true);
+        else if (normal == NormalEncoding::OCTAHEDRAL)
+            add(1, 2, GL_SHORT, true);
+        else
+            add(1, 3, GL_FLOAT);
+
+        if (texCoords == TexCoordEncoding::HALF)
+            add(2, 2, GL_HALF_FLOAT);
+        else
+            add(2, 2, GL_FLOAT);
+    }
+
+    VertexFormat& add(unsigned int location, int size, GLenum type, bool normalized = false, bool integer = false)
+    {
+        attributes.push_back({ location, size, type, normalized, integer, stride });
+        stride += attributeSize(size, type);
+        return *this;
+    }
+
+    // Points the attributes at the bound GL_ARRAY_BUFFER, a VAO must be bound
+    void apply() const
+    {
+        for (const VertexAttribute& attribute : attributes)
+        {
+            glEnableVertexAttribArray(attribute.location);
+            if (attribute.integer)
+                glVertexAttribIPointer(attribute.location, attribute.size, attribute.type, stride, (void*)(size_t)attribute.offset);
+            else
+                glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, stride, (void*)(size_t)attribute.offset);
+        }
+    }
+
+    std::string shaderDefines() const
+    {
+        return normal == NormalEncoding::OCTAHEDRAL ? "#define OCTAHEDRAL_NORMALS\n" : "";
+    }
+
+    // Writes stride bytes. Quantized positions are stored as (position - offset) / scale.
+    void encode(const Vertex& vertex, const glm::vec3& positionOffset, const glm::vec3& positionScale, unsigned char* out) const
+    {
+        if (position == PositionEncoding::UNORM16)
+        {
+            glm::vec3 unit = (vertex.position - positionOffset) / positionScale;
+            glm::uint64 packed = glm::packUnorm4x16(glm::vec4(unit, 0.0f));
+            std::memcpy(out, &packed, 8);
+            out += 8;
+        }
+        else
+        {
+            std::memcpy(out, &vertex.position, 12);
+            out += 12;
+        }
+
+        if (normal == NormalEncoding::PACKED)
+        {
+            glm::uint32 packed = glm::packSnorm3x10_1x2(glm::vec4(vertex.normal, 0.0f));
+            std::memcpy(out, &packed, 4);
+            out += 4;
+        }
+        else if (normal == NormalEncoding::OCTAHEDRAL)
+        {
+            glm::uint32 packed = glm::packSnorm2x16(octahedralEncode(vertex.normal));
+            std::memcpy(out, &packed, 4);
+            out += 4;
+        }
+        else
+        {
+            std::memcpy(out, &vertex.normal, 12);
+            out += 12;
+        }
+
+        if (texCoords == TexCoordEncoding::HALF)
+        {
+            glm::uint32 packed = glm::packHalf2x16(vertex.texCoords);
+            std::memcpy(out, &packed, 4);
+        }
+        else
+        {
+            std::memcpy(out, &vertex.texCoords, 8);
+        }
+    }
+
+    // Vertex as the GPU will see it after fetch and decode, used to measure encoding error
+    Vertex decode(const unsigned char* in, const glm::vec3& positionOffset, const glm::vec3& positionScale) const
+    {
+        Vertex vertex;
+        if (position == PositionEncoding::UNORM16)
+        {
+            glm::uint64 packed;
+            std::memcpy(&packed, in, 8);
+            vertex.position = glm::vec3(glm::unpackUnorm4x16(packed)) * positionScale + positionOffset;
+            in += 8;
+        }
+        else
+        {
+            std::memcpy(&vertex.position, in, 12);
+            in += 12;
+        }
+
+        glm::uint32 packed;
+        if (normal == NormalEncoding::PACKED)
+        {
+            std::memcpy(&packed, in, 4);
+            vertex.normal = glm::normalize(glm::vec3(glm::unpackSnorm3x10_1x2(packed)));
+            in += 4;
+        }
+        else if (normal == NormalEncoding::OCTAHEDRAL)
+        {
+            std::memcpy(&packed, in, 4);
+            vertex.normal = octahedralDecode(glm::unpackSnorm2x16(packed));
+            in += 4;
+        }
+        else
+        {
+            std::memcpy(&vertex.normal, in, 12);
+            in += 12;
+        }
+
+        if (texCoords == TexCoordEncoding::HALF)
+        {
+            std::memcpy(&packed, in, 4);
+            vertex.texCoords = glm::unpackHalf2x16(packed);
+        }
+        else
+        {
+            std::memcpy(&vertex.texCoords, in, 8);
+        }
+        return vertex;
+    }
+
+    static unsigned int attributeSize(int size, GLenum type)
+    {
+        switch (type)
+        {
+        case GL_INT_2_10_10_10_REV:
+        case GL_UNSIGNED_INT_2_10_10_10_REV:
+            return 4;
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return size;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT:
+            return size * 2;
+        default:
+            return size * 4;
+        }
+    }
+
+    // Octahedral mapping of a unit vector to [-1, 1]^2, matches octahedralDecode in default.vert
+    static glm::vec2 octahedralEncode(glm::vec3 n)
+    {
+        n /= glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z);
+        glm::vec2 e(n.x, n.y);
+        if (n.z < 0.0f)
+        {
+            glm::vec2 flipped = 1.0f - glm::abs(glm::vec2(n.y, n.x));
+            e = glm::vec2(n.x >= 0.0f ? flipped.x : -flipped.x, n.y >= 0.0f ? flipped.y : -flipped.y);
+        }
+        return e;
+    }
+
+    static glm::vec3 octahedralDecode(glm::vec2 e)
+    {
+        glm::vec3 n(e.x, e.y, 1.0f - glm::abs(e.x) - glm::abs(e.y));
+        if (n.z < 0.0f)
+        {
+            glm::vec2 flipped = 1.0f - glm::abs(glm::vec2(n.y, n.x));
+            n.x = e.x >= 0.0f ? flipped.x : -flipped.x;
+            n.y = e.y >= 0.0f ? flipped.y : -flipped.y;
+        }
+        return glm::normalize(n);
+    }
+
+    // layout: Pos vec3, Normals vec3, TexCoords vec2
+    static VertexFormat standard()
+    {
+        return VertexFormat(PositionEncoding::FLOAT, NormalEncoding::FLOAT, TexCoordEncoding::FLOAT);
+    }
+
+    // Smallest encoding whose error stays within tolerance for every vertex. positionTolerance is
+    // in mesh units, normalTolerance in degrees, texture coordinates must stay sub-texel on a 2048 texture.
+    static VertexFormat select(const std::vector<Vertex>& vertices, const glm::vec3& extent,
+        float positionTolerance = 0.0005f, float normalTolerance = 0.05f)
+    {
+        float maxExtent = glm::max(extent.x, glm::max(extent.y, extent.z));
+        PositionEncoding positionEncoding = maxExtent / 65535.0f * 0.5f <= positionTolerance ? PositionEncoding::UNORM16 : PositionEncoding::FLOAT;
+
+        // axis aligned normals survive 10 bits exactly, curved surfaces get the finer octahedral grid
+        NormalEncoding normalEncoding = NormalEncoding::PACKED;
+        float minCosine = glm::cos(glm::radians(normalTolerance));
+        float maxTexCoord = 0.0f;
+        for (const Vertex& vertex : vertices)
+        {
+            glm::vec3 packed = glm::normalize(glm::vec3(glm::unpackSnorm3x10_1x2(glm::packSnorm3x10_1x2(glm::vec4(vertex.normal, 0.0f)))));
+            if (glm::dot(packed, vertex.normal) < minCosine)
+                normalEncoding = NormalEncoding::OCTAHEDRAL;
+
+            maxTexCoord = glm::max(maxTexCoord, glm::max(glm::abs(vertex.texCoords.x), glm::abs(vertex.texCoords.y)));
+        }
+
+        // half floats keep 11 significant bits, enough for 1/2048 steps within [-1, 1]
+        TexCoordEncoding texCoordEncoding = maxTexCoord <= 1.0f ? TexCoordEncoding::HALF : TexCoordEncoding::FLOAT;
+
+        return VertexFormat(positionEncoding, normalEncoding, texCoordEncoding);
+    }
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                                    Mesh                                    */
+/* -------------------------------------------------------------------------- */
+
+// Indexed triangle list kept on the CPU until it is added to a MeshPool
+struct Mesh
+{
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+
+    // Welds the duplicated corners of a non-indexed triangle list
+    // layout: Pos vec3, Normals vec3, TexCoords vec2
+    static Mesh fromTriangleSoup(const float* data, size_t vertexCount)
+    {
+        auto less = [](const Vertex& a, const Vertex& b) { return std::memcmp(&a, &b, sizeof(Vertex)) < 0; };
+        std::map<Vertex, unsigned int, decltype(less)> unique(less);
+
+        Mesh mesh;
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            const float* v = data + i * 8;
+            Vertex vertex{ glm::vec3(v[0], v[1], v[2]), glm::vec3(v[3], v[4], v[5]), glm::vec2(v[6], v[7]) };
+
+            auto found = unique.find(vertex);
+            if (found == unique.end())
+            {
+                found = unique.emplace(vertex, (unsigned int)mesh.vertices.size()).first;
+                mesh.vertices.push_back(vertex);
+            }
+            mesh.indices.push_back(found->second);
+        }
+        return mesh;
+    }
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                                  Mesh Pool                                 */
+/* -------------------------------------------------------------------------- */
+
+// Every mesh of one vertex format shares a single vertex and index buffer, and a single VAO.
+// Meshes are drawn by range with glDrawElementsBaseVertex or indirect commands. Unless a format is
+// given, upload() picks the most compact one that keeps every added mesh within tolerance, and
+// quantized positions are stored relative to each mesh's own bounds.
+class MeshPool
+{
+public:
+    struct Range
+    {
+        unsigned int firstIndex;
+        unsigned int indexCount;
+        int baseVertex;
+        unsigned int vertexCount;
+
+        // dequantization, position = stored * positionScale + positionOffset
+        glm::vec3 positionOffset;
+        glm::vec3 positionScale;
+    };
+
+    unsigned int VAO;
+    VertexFormat Format;
+    bool AutoFormat;
+
+    MeshPool() : AutoFormat(true)
+    {
+        generateBuffers();
+    }
+
+    MeshPool(const VertexFormat& format) : Format(format), AutoFormat(false)
+    {
+        generateBuffers();
+    }
+
+    int add(const Mesh& mesh)
+    {
+        glm::vec3 minimum(0.0f);
+        glm::vec3 maximum(0.0f);
+        if (!mesh.vertices.empty())
+            minimum = maximum = mesh.vertices[0].position;
+        for (const Vertex& vertex : mesh.vertices)
+        {
+            minimum = glm::min(minimum, vertex.position);
+            maximum = glm::max(maximum, vertex.position);
+        }
+
+        // flat axes still need a non-zero scale to divide by
+        glm::vec3 extent = maximum - minimum;
+        glm::vec3 scale(extent.x > 0.0f ? extent.x : 1.0f, extent.y > 0.0f ? extent.y : 1.0f, extent.z > 0.0f ? extent.z : 1.0f);
+
+        ranges.push_back({ (unsigned int)indices.size(), (unsigned int)mesh.indices.size(), (int)vertices.size(), (unsigned int)mesh.vertices.size(), minimum, scale });
+        vertices.insert(vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+        indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+        return (int)ranges.size() - 1;
+    }
+
+    const Range& range(int mesh) const
+    {
+        return ranges[mesh];
+    }
+
+    // Everything added so far, unquantized, for CPU side consumers such as SoftwareRasterizer
+    const std::vector<Vertex>& vertexData() const
+    {
+        return vertices;
+    }
+
+    const std::vector<unsigned int>& indexData() const
+    {
+        return indices;
+    }
+
+    size_t vertexBytes() const
+    {
+        return vertices.size() * Format.stride;
+    }
+
+    // Uploads every added mesh and leaves the pool VAO bound so callers can attach more attributes
+    void upload()
+    {
+        if (AutoFormat)
+        {
+            glm::vec3 extent(0.0f);
+            for (const Range& range : ranges)
+                extent = glm::max(extent, range.positionScale);
+            Format = VertexFormat::select(vertices, extent);
+        }
+
+        // unquantized formats draw with an identity dequantization
+        if (Format.position == PositionEncoding::FLOAT)
+        {
+            for (Range& range : ranges)
+            {
+                range.positionOffset = glm::vec3(0.0f);
+                range.positionScale = glm::vec3(1.0f);
+            }
+        }
+
+        std::vector<unsigned char> data(vertices.size() * Format.stride);
+        for (const Range& range : ranges)
+        {
+            for (size_t v = range.baseVertex; v < range.baseVertex + range.vertexCount; v++)
+                Format.encode(vertices[v], range.positionOffset, range.positionScale, &data[v * Format.stride]);
+        }
+
+        glState.bindVertexArray(VAO);
+
+        glState.bindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+        Format.apply();
+
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    }
+
+private:
+    unsigned int VBO;
+    unsigned int EBO;
+
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<Range> ranges;
+
+    void generateBuffers()
+    {
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+    }
+};
+#endif
@@ -0,0 +1,294 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "mesh.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                             Load-Time Optimizer                            */
+/* -------------------------------------------------------------------------- */
+
+// Vertices the post-transform cache would shade for this index order, simulated as a FIFO
+inline size_t countVertexShaderInvocations(const std::vector<unsigned int>& indices, size_t vertexCount, int cacheSize = 16)
+{
+    std::vector<size_t> timestamps(vertexCount, 0);
+    size_t time = cacheSize + 1;
+    size_t invocations = 0;
+
+    for (unsigned int index : indices)
+    {
+        if (time - timestamps[index] > (size_t)cacheSize)
+        {
+            timestamps[index] = time++;
+            invocations++;
+        }
+    }
+    return invocations;
+}
+
+
+// Score from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+inline float vertexCacheScore(int cachePosition, unsigned int liveTriangles, int cacheSize)
+{
+    if (liveTriangles == 0)
+        return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // the last triangle's vertices get a fixed score so the next one doesn't just repeat them
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - (cachePosition - 3) / (float)(cacheSize - 3), 1.5f);
+    }
+
+    // favour vertices with few triangles left, so they get finished off and leave the cache
+    score += 2.0f * std::pow((float)liveTriangles, -0.5f);
+    return score;
+}
+
+// Reorders triangles so consecutive ones reuse recently transformed vertices
+inline void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount, int cacheSize = 32)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // vertex -> triangle adjacency, the first liveTriangles[v] entries are still unemitted
+    std::vector<unsigned int> liveTriangles(vertexCount, 0);
+    for (unsigned int index : indices)
+        liveTriangles[index]++;
+
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + liveTriangles[v];
+
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+    std::vector<int> cachePositions(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexCacheScore(-1, liveTriangles[v], cacheSize);
+
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    int bestTriangle = 0;
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+        if (triangleScores[t] > triangleScores[bestTriangle])
+            bestTriangle = (int)t;
+    }
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    std::vector<unsigned int> cache;
+    std::vector<unsigned int> nextCache;
+    size_t scanCursor = 0;
+
+    for (size_t n = 0; n < triangleCount; n++)
+    {
+        // nothing adjacent to the cache is left, restart from the next unemitted triangle
+        if (bestTriangle < 0)
+        {
+            while (emitted[scanCursor])
+                scanCursor++;
+            bestTriangle = (int)scanCursor;
+        }
+
+        const unsigned int* triangle = &indices[bestTriangle * 3];
+        output.insert(output.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = true;
+
+        for (int i = 0; i < 3; i++)
+        {
+            unsigned int v = triangle[i];
+            unsigned int* live = &adjacency[offsets[v]];
+            for (unsigned int k = 0; k < liveTriangles[v]; k++)
+            {
+                if (live[k] == (unsigned int)bestTriangle)
+                {
+                    std::swap(live[k], live[liveTriangles[v] - 1]);
+                    liveTriangles[v]--;
+                    break;
+                }
+            }
+        }
+
+        // LRU cache, the emitted triangle's vertices move to the front
+        nextCache.assign(triangle, triangle + 3);
+        for (unsigned int v : cache)
+        {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        }
+
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            unsigned int v = nextCache[i];
+            cachePositions[v] = i < (size_t)cacheSize ? (int)i : -1;
+            vertexScores[v] = vertexCacheScore(cachePositions[v], liveTriangles[v], cacheSize);
+        }
+
+        // only triangles touching the cache changed score
+        bestTriangle = -1;
+        float bestScore = -1.0f;
+        for (unsigned int v : nextCache)
+        {
+            for (unsigned int k = 0; k < liveTriangles[v]; k++)
+            {
+                unsigned int t = adjacency[offsets[v] + k];
+                triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+                if (triangleScores[t] > bestScore)
+                {
+                    bestScore = triangleScores[t];
+                    bestTriangle = (int)t;
+                }
+            }
+        }
+
+        if (nextCache.size() > (size_t)cacheSize)
+            nextCache.resize(cacheSize);
+        cache.swap(nextCache);
+    }
+
+    indices.swap(output);
+}
+
+
+// Splits the cache-optimized order into clusters and sorts them so outward facing clusters draw
+// first, letting them occlude the rest (after Sander et al., "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw"). A cluster only ends where restarting costs at most threshold
+// times the mesh's own cache efficiency.
+inline void optimizeOverdraw(std::vector<unsigned int>& indices, const std::vector<Vertex>& vertices, int cacheSize = 32, float threshold = 1.05f)
+{
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    float meshAcmr = countVertexShaderInvocations(indices, vertices.size(), cacheSize) / (float)triangleCount;
+
+    // cluster boundaries from a FIFO simulation, each cluster is simulated from a cold cache
+    // since after sorting it may follow any other cluster
+    std::vector<size_t> clusterStarts = { 0 };
+    std::vector<size_t> timestamps(vertices.size(), 0);
+    size_t time = cacheSize + 1;
+    size_t clusterMisses = 0;
+
+    auto cached = [&](unsigned int v) { return time - timestamps[v] <= (size_t)cacheSize; };
+
+    for (size_t t = 0; t < triangleCount; t++)
+    {
+        const unsigned int* triangle = &indices[t * 3];
+
+        // hard boundary, the optimizer restarted here with nothing in the cache
+        if (t > clusterStarts.back() && !cached(triangle[0]) && !cached(triangle[1]) && !cached(triangle[2]))
+        {
+            clusterStarts.push_back(t);
+            clusterMisses = 0;
+            time += cacheSize + 1;
+        }
+
+        for (int i = 0; i < 3; i++)
+        {
+            if (!cached(triangle[i]))
+            {
+                timestamps[triangle[i]] = time++;
+                clusterMisses++;
+            }
+        }
+
+        // soft boundary, the cluster already paid for its cold start
+        size_t clusterTriangles = t + 1 - clusterStarts.back();
+        if (t + 1 < triangleCount && clusterMisses <= threshold * meshAcmr * clusterTriangles)
+        {
+            clusterStarts.push_back(t + 1);
+            clusterMisses = 0;
+            time += cacheSize + 1;
+        }
+    }
+    clusterStarts.push_back(triangleCount);
+
+    // area weighted centroid and normal per cluster
+    glm::vec3 meshCentroid(0.0f);
+    for (const Vertex& vertex : vertices)
+        meshCentroid += vertex.position;
+    meshCentroid /= (float)glm::max<size_t>(vertices.size(), 1);
+
+    size_t clusterCount = clusterStarts.size() - 1;
+    std::vector<float> sortKeys(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        glm::vec3 centroid(0.0f);
+        glm::vec3 normal(0.0f);
+        float area = 0.0f;
+
+        for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++)
+        {
+            glm::vec3 a = vertices[indices[t * 3]].position;
+            glm::vec3 b = vertices[indices[t * 3 + 1]].position;
+            glm::vec3 d = vertices[indices[t * 3 + 2]].position;
+            glm::vec3 n = glm::cross(b - a, d - a);
+            float triangleArea = glm::length(n);
+
+            centroid += (a + b + d) / 3.0f * triangleArea;
+            normal += n;
+            area += triangleArea;
+        }
+
+        if (area > 0.0f)
+            centroid /= area;
+        float length = glm::length(normal);
+        sortKeys[c] = length > 0.0f ? glm::dot(centroid - meshCentroid, normal / length) : 0.0f;
+    }
+
+    std::vector<size_t> order(clusterCount);
+    for (size_t c = 0; c < clusterCount; c++)
+        order[c] = c;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<unsigned int> output;
+    output.reserve(indices.size());
+    for (size_t c : order)
+        output.insert(output.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+    indices.swap(output);
+}
+
+
+// Renumbers vertices in first-use order so vertex fetch walks the buffer linearly
+inline void optimizeVertexFetch(Mesh& mesh)
+{
+    std::vector<unsigned int> remap(mesh.vertices.size(), ~0u);
+    std::vector<Vertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+
+    for (unsigned int& index : mesh.indices)
+    {
+        if (remap[index] == ~0u)
+        {
+            remap[index] = (unsigned int)vertices.size();
+            vertices.push_back(mesh.vertices[index]);
+        }
+        index = remap[index];
+    }
+    mesh.vertices.swap(vertices);
+}
+
+
+// Full load-time pass: cache order, then overdraw clusters, then fetch locality
+inline void optimizeMesh(Mesh& mesh, int cacheSize = 32)
+{
+    optimizeVertexCache(mesh.indices, mesh.vertices.size(), cacheSize);
+    optimizeOverdraw(mesh.indices, mesh.vertices, cacheSize);
+    optimizeVertexFetch(mesh);
+}
+#endif
@@ -0,0 +1,270 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "bvh.hpp"
+#include "pvs.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                              Occlusion Buffer                              */
+/* -------------------------------------------------------------------------- */
+
+// Low resolution depth of the large occluders (the gallery walls), rasterized on the CPU with the
+// current frame's matrices, and a max-depth pyramid over it. An object is occluded when every
+// pyramid texel under its screen rectangle is nearer than the nearest point of its bounds.
+// Pixels are only written where an occluder covers them completely, at the depth of their
+// farthest corner, so the buffer never claims more occlusion than the real geometry has.
+class OcclusionBuffer
+{
+public:
+    int Width;
+    int Height;
+
+    // stats of the last frame
+    unsigned int Tested = 0;
+    unsigned int Occluded = 0;
+    double RenderMs = 0.0;
+    double TestMs = 0.0;
+
+    OcclusionBuffer(int width = 256, int height = 144) : Width(width), Height(height)
+    {
+        int w = width;
+        int h = height;
+        while (true)
+        {
+            levels.push_back({ w, h, std::vector<float>(w * h, 1.0f) });
+            if (w == 1 && h == 1)
+                break;
+            w = glm::max(w / 2, 1);
+            h = glm::max(h / 2, 1);
+        }
+    }
+
+    // Clears to the far plane, draws the occluders inside the frustum and builds the pyramid
+    void render(const glm::mat4& viewProjection, const std::vector<Occluder>& occluders)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        this->viewProjection = viewProjection;
+        std::fill(levels[0].depth.begin(), levels[0].depth.end(), 1.0f);
+
+        Frustum frustum = Frustum::fromMatrix(viewProjection);
+        for (const Occluder& occluder : occluders)
+        {
+            if (frustum.classify(occluder.bounds()) != Visibility::OUTSIDE)
+                rasterize(occluder);
+        }
+
+        for (size_t l = 1; l < levels.size(); l++)
+        {
+            const Level& fine = levels[l - 1];
+            Level& coarse = levels[l];
+            for (int y = 0; y < coarse.height; y++)
+            {
+                for (int x = 0; x < coarse.width; x++)
+                {
+                    // odd sizes fold the last row or column into the texel before it
+                    int x0 = x * 2, x1 = (x == coarse.width - 1) ? fine.width - 1 : x * 2 + 1;
+                    int y0 = y * 2, y1 = (y == coarse.height - 1) ? fine.height - 1 : y * 2 + 1;
+                    float farthest = 0.0f;
+                    for (int fy = y0; fy <= y1; fy++)
+                    {
+                        for (int fx = x0; fx <= x1; fx++)
+                            farthest = glm::max(farthest, fine.depth[fy * fine.width + fx]);
+                    }
+                    coarse.depth[y * coarse.width + x] = farthest;
+                }
+            }
+        }
+
+        Tested = Occluded = 0;
+        TestMs = 0.0;
+        RenderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool visible(const AABB& box)
+    {
+        Tested++;
+
+        glm::vec2 minimum(FLT_MAX);
+        glm::vec2 maximum(-FLT_MAX);
+        float nearest = FLT_MAX;
+        for (int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+            glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+
+            // crossing the near plane, too close to prove anything
+            if (clip.w <= NEAR_W)
+                return true;
+
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            minimum = glm::min(minimum, glm::vec2(ndc));
+            maximum = glm::max(maximum, glm::vec2(ndc));
+            nearest = glm::min(nearest, ndc.z * 0.5f + 0.5f);
+        }
+
+        // pixel rectangle, clamped to the screen
+        int x0 = glm::clamp((int)((minimum.x * 0.5f + 0.5f) * Width), 0, Width - 1);
+        int x1 = glm::clamp((int)((maximum.x * 0.5f + 0.5f) * Width), 0, Width - 1);
+        int y0 = glm::clamp((int)((minimum.y * 0.5f + 0.5f) * Height), 0, Height - 1);
+        int y1 = glm::clamp((int)((maximum.y * 0.5f + 0.5f) * Height), 0, Height - 1);
+
+        // coarsest level where the rectangle still spans at most 4 texels a side
+        int level = 0;
+        while (level + 1 < (int)levels.size() && glm::max(x1 - x0, y1 - y0) >> level >= 4)
+            level++;
+
+        // odd sizes fold the last row or column into the texel before it, so both ends are clamped
+        const Level& pyramid = levels[level];
+        int ty0 = glm::min(y0 >> level, pyramid.height - 1), ty1 = glm::min(y1 >> level, pyramid.height - 1);
+        int tx0 = glm::min(x0 >> level, pyramid.width - 1), tx1 = glm::min(x1 >> level, pyramid.width - 1);
+        for (int y = ty0; y <= ty1; y++)
+        {
+            for (int x = tx0; x <= tx1; x++)
+            {
+                if (pyramid.depth[y * pyramid.width + x] >= nearest)
+                    return true;
+            }
+        }
+
+        Occluded++;
+        return false;
+    }
+
+    // Depth in [0, 1] of the full resolution buffer, for debugging
+    const std::vector<float>& depth() const
+    {
+        return levels[0].depth;
+    }
+
+private:
+    static constexpr float NEAR_W = 1e-3f;
+
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<float> depth;
+    };
+
+    std::vector<Level> levels;
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+
+    void rasterize(const Occluder& occluder)
+    {
+        glm::vec3 corners[4] = {
+            occluder.Corner,
+            occluder.Corner + occluder.EdgeU,
+            occluder.Corner + occluder.EdgeU + occluder.EdgeV,
+            occluder.Corner + occluder.EdgeV,
+        };
+
+        // clip against the near plane, keeps the polygon convex
+        glm::vec4 clipped[8];
+        int count = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            glm::vec4 a = viewProjection * glm::vec4(corners[i], 1.0f);
+            glm::vec4 b = viewProjection * glm::vec4(corners[(i + 1) % 4], 1.0f);
+            float da = a.z + a.w;
+            float db = b.z + b.w;
+            if (da >= 0.0f)
+                clipped[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                clipped[count++] = a + (b - a) * (da / (da - db));
+        }
+        if (count < 3)
+            return;
+
+        // screen space polygon, pixel units, depth in [0, 1]
+        glm::vec3 screen[8];
+        glm::vec2 minimum(FLT_MAX);
+        glm::vec2 maximum(-FLT_MAX);
+        for (int i = 0; i < count; i++)
+        {
+            glm::vec3 ndc = glm::vec3(clipped[i]) / glm::max(clipped[i].w, NEAR_W);
+            screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * Width, (ndc.y * 0.5f + 0.5f) * Height, ndc.z * 0.5f + 0.5f);
+            minimum = glm::min(minimum, glm::vec2(screen[i]));
+            maximum = glm::max(maximum, glm::vec2(screen[i]));
+        }
+
+        // orientation so "inside" is a positive edge function either way round
+        float area = 0.0f;
+        for (int i = 0; i < count; i++)
+        {
+            const glm::vec3& a = screen[i];
+            const glm::vec3& b = screen[(i + 1) % count];
+            area += a.x * b.y - b.x * a.y;
+        }
+        if (glm::abs(area) < 1e-6f)
+            return;
+        float winding = area > 0.0f ? 1.0f : -1.0f;
+
+        // depth plane through the polygon, z = dx * x + dy * y + z0
+        glm::vec3 normal(0.0f);
+        for (int i = 0; i < count; i++)
+        {
+            const glm::vec3& a = screen[i];
+            const glm::vec3& b = screen[(i + 1) % count];
+            normal += glm::vec3((a.y - b.y) * (a.z + b.z), (a.z - b.z) * (a.x + b.x), (a.x - b.x) * (a.y + b.y));
+        }
+        if (glm::abs(normal.z) < 1e-9f)
+            return;
+        float dzdx = -normal.x / normal.z;
+        float dzdy = -normal.y / normal.z;
+        float z0 = screen[0].z - dzdx * screen[0].x - dzdy * screen[0].y;
+
+        // edge functions A * x + B * y + C, positive inside. Taken at the pixel corner where they are
+        // smallest, so a pixel passes every edge only when it is fully covered.
+        float edgeA[8], edgeB[8], edgeC[8];
+        for (int i = 0; i < count; i++)
+        {
+            const glm::vec3& a = screen[i];
+            const glm::vec3& b = screen[(i + 1) % count];
+            edgeA[i] = -winding * (b.y - a.y);
+            edgeB[i] = winding * (b.x - a.x);
+            edgeC[i] = -edgeA[i] * a.x - edgeB[i] * a.y + glm::min(edgeA[i], 0.0f) + glm::min(edgeB[i], 0.0f);
+        }
+
+        // and the depth plane at the farthest corner
+        float depthOffset = z0 + glm::max(dzdx, 0.0f) + glm::max(dzdy, 0.0f);
+
+        int x0 = glm::max((int)glm::floor(minimum.x), 0);
+        int x1 = glm::min((int)glm::ceil(maximum.x), Width - 1);
+        int y0 = glm::max((int)glm::floor(minimum.y), 0);
+        int y1 = glm::min((int)glm::ceil(maximum.y), Height - 1);
+
+        // each edge bounds the covered run of a row from one side, so rows are filled as one span
+        std::vector<float>& depth = levels[0].depth;
+        for (int y = y0; y <= y1; y++)
+        {
+            float spanStart = (float)x0;
+            float spanEnd = (float)x1;
+            for (int i = 0; i < count; i++)
+            {
+                float value = edgeB[i] * y + edgeC[i];
+                if (edgeA[i] > 0.0f)
+                    spanStart = glm::max(spanStart, glm::ceil(-value / edgeA[i]));
+                else if (edgeA[i] < 0.0f)
+                    spanEnd = glm::min(spanEnd, glm::floor(-value / edgeA[i]));
+                else if (value < 0.0f)
+                    spanEnd = -1.0f;
+            }
+
+            if (spanStart > spanEnd)
+                continue;
+
+            float* row = &depth[y * Width];
+            float rowDepth = depthOffset + dzdy * y;
+            for (int x = (int)spanStart; x <= (int)spanEnd; x++)
+                row[x] = glm::min(row[x], rowDepth + dzdx * x);
+        }
+    }
+};
+#endif
@@ -0,0 +1,180 @@
+#ifndef PORTALS_H
+#define PORTALS_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <chrono>
+
+#include "bvh.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                              Cells and Portals                             */
+/* -------------------------------------------------------------------------- */
+
+// Rooms are cells, doorways are portal quads joining two of them
+struct Portal
+{
+    glm::vec3 Corners[4];
+    int Cells[2];
+    bool Open = true;
+
+    int other(int cell) const
+    {
+        return Cells[0] == cell ? Cells[1] : Cells[0];
+    }
+};
+
+struct Cell
+{
+    AABB Bounds;
+    std::vector<int> Portals;
+};
+
+
+// Each frame the view is narrowed through every open portal it can see, starting from the camera's
+// cell. The view is kept as a screen rectangle in NDC: a portal's projection is intersected with
+// the rectangle it was seen through, and cells are only reached while that intersection is not empty.
+class PortalGraph
+{
+public:
+    // recursion limit, portal chains longer than this are treated as hidden
+    static const int MAX_DEPTH = 32;
+
+    std::vector<Cell> Cells;
+    std::vector<Portal> Portals;
+
+    // results of the last traverse()
+    std::vector<unsigned char> VisibleCells;
+    std::vector<glm::vec4> CellRects; // union of the NDC rects each cell was seen through, xy min, zw max
+    unsigned int VisibleCount = 0;
+    double TraverseMs = 0.0;
+
+    int addCell(const AABB& bounds)
+    {
+        Cells.push_back({ bounds, {} });
+        return (int)Cells.size() - 1;
+    }
+
+    // Corners in order around the quad
+    int addPortal(int cellA, int cellB, const glm::vec3 corners[4])
+    {
+        Portal portal;
+        for (int i = 0; i < 4; i++)
+            portal.Corners[i] = corners[i];
+        portal.Cells[0] = cellA;
+        portal.Cells[1] = cellB;
+        Portals.push_back(portal);
+
+        int index = (int)Portals.size() - 1;
+        Cells[cellA].Portals.push_back(index);
+        Cells[cellB].Portals.push_back(index);
+        return index;
+    }
+
+    // -1 when the point is in no cell
+    int findCell(const glm::vec3& point) const
+    {
+        for (size_t i = 0; i < Cells.size(); i++)
+        {
+            const AABB& bounds = Cells[i].Bounds;
+            if (glm::all(glm::greaterThanEqual(point, bounds.min)) && glm::all(glm::lessThanEqual(point, bounds.max)))
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // Outside every cell nothing can be proven hidden, so all cells are marked visible
+    void traverse(const glm::mat4& viewProjection, int cameraCell)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        const glm::vec4 fullScreen(-1.0f, -1.0f, 1.0f, 1.0f);
+        VisibleCells.assign(Cells.size(), cameraCell < 0 ? 1 : 0);
+        CellRects.assign(Cells.size(), cameraCell < 0 ? fullScreen : glm::vec4(1.0f, 1.0f, -1.0f, -1.0f));
+        onPath.assign(Cells.size(), 0);
+
+        if (cameraCell >= 0)
+            visit(viewProjection, cameraCell, fullScreen, 0);
+
+        VisibleCount = 0;
+        for (unsigned char visible : VisibleCells)
+            VisibleCount += visible;
+
+        TraverseMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::vector<unsigned char> onPath;
+
+    void visit(const glm::mat4& viewProjection, int cell, const glm::vec4& rect, int depth)
+    {
+        VisibleCells[cell] = 1;
+        glm::vec4& cellRect = CellRects[cell];
+        cellRect = glm::vec4(glm::min(glm::vec2(cellRect), glm::vec2(rect)), glm::max(glm::vec2(cellRect.z, cellRect.w), glm::vec2(rect.z, rect.w)));
+
+        if (depth == MAX_DEPTH)
+            return;
+
+        onPath[cell] = 1;
+        for (int p : Cells[cell].Portals)
+        {
+            const Portal& portal = Portals[p];
+            int next = portal.other(cell);
+            if (!portal.Open || onPath[next])
+                continue;
+
+            glm::vec4 portalRect;
+            if (!projectPortal(viewProjection, portal, portalRect))
+                continue;
+
+            glm::vec4 narrowed(glm::max(glm::vec2(rect), glm::vec2(portalRect)), glm::min(glm::vec2(rect.z, rect.w), glm::vec2(portalRect.z, portalRect.w)));
+            if (narrowed.x >= narrowed.z || narrowed.y >= narrowed.w)
+                continue;
+
+            visit(viewProjection, next, narrowed, depth + 1);
+        }
+        onPath[cell] = 0;
+    }
+
+    // NDC bounds of the portal quad clipped against the near plane, false when fully behind it
+    static bool projectPortal(const glm::mat4& viewProjection, const Portal& portal, glm::vec4& rect)
+    {
+        glm::vec4 clip[4];
+        for (int i = 0; i < 4; i++)
+            clip[i] = viewProjection * glm::vec4(portal.Corners[i], 1.0f);
+
+        glm::vec2 minimum(FLT_MAX);
+        glm::vec2 maximum(-FLT_MAX);
+        bool any = false;
+
+        // Sutherland-Hodgman against z > -w, only the resulting points matter
+        for (int i = 0; i < 4; i++)
+        {
+            const glm::vec4& a = clip[i];
+            const glm::vec4& b = clip[(i + 1) % 4];
+            float da = a.z + a.w;
+            float db = b.z + b.w;
+
+            if (da >= 0.0f)
+            {
+                glm::vec2 ndc = glm::vec2(a) / glm::max(a.w, 1e-6f);
+                minimum = glm::min(minimum, ndc);
+                maximum = glm::max(maximum, ndc);
+                any = true;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                glm::vec4 crossing = a + (b - a) * (da / (da - db));
+                glm::vec2 ndc = glm::vec2(crossing) / glm::max(crossing.w, 1e-6f);
+                minimum = glm::min(minimum, ndc);
+                maximum = glm::max(maximum, ndc);
+                any = true;
+            }
+        }
+
+        rect = glm::vec4(minimum, maximum);
+        return any;
+    }
+};
+#endif
@@ -0,0 +1,552 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+#include "bvh.hpp"
+#include "portals.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                          Potentially Visible Sets                          */
+/* -------------------------------------------------------------------------- */
+
+// Flat quad occluding visibility rays: corner + s * EdgeU + t * EdgeV for s, t in [0, 1]
+struct Occluder
+{
+    glm::vec3 Corner;
+    glm::vec3 EdgeU;
+    glm::vec3 EdgeV;
+
+    // The unit plane mesh (x and z in [-0.5, 0.5]) placed by model
+    static Occluder fromPlane(const glm::mat4& model)
+    {
+        glm::vec3 corner = glm::vec3(model * glm::vec4(-0.5f, 0.0f, -0.5f, 1.0f));
+        return {
+            corner,
+            glm::vec3(model * glm::vec4(0.5f, 0.0f, -0.5f, 1.0f)) - corner,
+            glm::vec3(model * glm::vec4(-0.5f, 0.0f, 0.5f, 1.0f)) - corner,
+        };
+    }
+
+    AABB bounds() const
+    {
+        AABB box;
+        box.expand(Corner);
+        box.expand(Corner + EdgeU);
+        box.expand(Corner + EdgeV);
+        box.expand(Corner + EdgeU + EdgeV);
+        return box;
+    }
+
+    bool blocks(const glm::vec3& from, const glm::vec3& to) const
+    {
+        glm::vec3 normal = glm::cross(EdgeU, EdgeV);
+        glm::vec3 direction = to - from;
+        float facing = glm::dot(normal, direction);
+        if (facing == 0.0f)
+            return false;
+
+        float t = glm::dot(normal, Corner - from) / facing;
+        if (t <= 0.0f || t >= 1.0f)
+            return false;
+
+        glm::vec3 local = from + direction * t - Corner;
+        float s = glm::dot(local, EdgeU) / glm::dot(EdgeU, EdgeU);
+        float r = glm::dot(local, EdgeV) / glm::dot(EdgeV, EdgeV);
+        return s >= 0.0f && s <= 1.0f && r >= 0.0f && r <= 1.0f;
+    }
+};
+
+
+// Cell-to-cell visibility baked offline. bake() marks a cell visible from another when some line
+// passes through every doorway of a portal chain between them, seen from above: any sight line
+// through the rooms crosses such a chain, so the table is conservative and culling by it never
+// hides a room that can be seen. Rows are kept as plain bitsets in memory so lookups are a single
+// bit test, and run-length compressed on disk.
+class PVS
+{
+public:
+    unsigned int CellCount = 0;
+    // layoutHash() of the portal graph it was baked from
+    uint64_t LayoutHash = 0;
+
+    // bake statistics
+    double BakeMs = 0.0;
+    // portal chains bake() tested, rays sample() cast
+    unsigned long long PortalChains = 0;
+    unsigned long long RaysCast = 0;
+
+    bool visible(int from, int to) const
+    {
+        return (rows[(size_t)from * rowBytes + (to >> 3)] >> (to & 7)) & 1;
+    }
+
+    unsigned int visibleCount(int from) const
+    {
+        unsigned int count = 0;
+        for (size_t i = 0; i < rowBytes; i++)
+        {
+            for (unsigned char bits = rows[(size_t)from * rowBytes + i]; bits; bits &= bits - 1)
+                count++;
+        }
+        return count;
+    }
+
+    // Pairs visible in reference that are hidden here, zero when every row is a superset of its row
+    unsigned long long missingPairs(const PVS& reference) const
+    {
+        if (reference.CellCount != CellCount)
+            return ~0ull;
+        unsigned long long missing = 0;
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+            for (unsigned char bits = reference.rows[i] & ~rows[i]; bits; bits &= bits - 1)
+                missing++;
+        }
+        return missing;
+    }
+
+    size_t memoryBytes() const
+    {
+        return rows.size();
+    }
+
+    size_t compressedBytes() const
+    {
+        size_t total = 0;
+        for (unsigned int cell = 0; cell < CellCount; cell++)
+            total += compressRow(cell).size();
+        return total;
+    }
+
+    // FNV-1a over everything the bake reads, a saved PVS is only loaded for the layout it was baked from
+    static uint64_t layoutHash(const PortalGraph& graph)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const void* data, size_t size) {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+        };
+        for (const Cell& cell : graph.Cells)
+        {
+            add(&cell.Bounds.min, sizeof(glm::vec3));
+            add(&cell.Bounds.max, sizeof(glm::vec3));
+        }
+        for (const Portal& portal : graph.Portals)
+        {
+            add(portal.Corners, sizeof(portal.Corners));
+            add(portal.Cells, sizeof(portal.Cells));
+        }
+        return hash;
+    }
+
+    // Each row walks every portal chain leaving its cell, as long as a line can still stab all of
+    // the chain's doorways, and marks the cells it reaches. Rows are split across threads.
+    static PVS bake(const PortalGraph& graph, unsigned int threads = 0)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        PVS pvs;
+        pvs.resize((unsigned int)graph.Cells.size());
+        pvs.LayoutHash = layoutHash(graph);
+
+        size_t n = graph.Cells.size();
+        std::atomic<unsigned int> nextRow(0);
+        std::atomic<unsigned long long> chains(0);
+
+        // rows are whole bytes apart, each is only written by the thread baking it
+        auto worker = [&]() {
+            Stabber stabber(graph, pvs);
+            for (unsigned int a = nextRow++; a < n; a = nextRow++)
+                stabber.bakeRow((int)a);
+            chains += stabber.Chains;
+        };
+
+        if (threads == 0)
+            threads = glm::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<std::thread> pool;
+        for (unsigned int t = 1; t < threads; t++)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread& thread : pool)
+            thread.join();
+
+        pvs.PortalChains = chains;
+        pvs.BakeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return pvs;
+    }
+
+    // A pair of cells is visible when any of a number of rays between random points inside them
+    // misses every occluder. Only ever finds visibility, never proves it absent, so it stands as
+    // the reference bake() must cover. Pairs are split across threads by row, each pair is tested
+    // once and mirrored.
+    static PVS sample(const std::vector<Cell>& cells, const std::vector<Occluder>& occluders, int samples, unsigned int threads = 0)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        PVS pvs;
+        pvs.resize((unsigned int)cells.size());
+
+        std::vector<AABB> occluderBounds;
+        for (const Occluder& occluder : occluders)
+            occluderBounds.push_back(occluder.bounds());
+        BVH bvh;
+        bvh.build(occluderBounds);
+
+        size_t n = cells.size();
+        std::vector<unsigned char> pairs(n * n, 0);
+        std::atomic<unsigned int> nextRow(0);
+        std::atomic<unsigned long long> rays(0);
+
+        auto worker = [&]() {
+            unsigned long long cast = 0;
+            for (unsigned int a = nextRow++; a < n; a = nextRow++)
+            {
+                // seeded per row so the result does not depend on the thread count
+                std::mt19937 random(a * 7919u + 1u);
+                std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+                auto samplePoint = [&](const AABB& box) {
+                    glm::vec3 inset = (box.max - box.min) * 0.02f;
+                    glm::vec3 t(unit(random), unit(random), unit(random));
+                    return glm::mix(box.min + inset, box.max - inset, t);
+                };
+
+                pairs[a * n + a] = 1;
+                for (size_t b = a + 1; b < n; b++)
+                {
+                    for (int s = 0; s < samples; s++)
+                    {
+                        glm::vec3 from = samplePoint(cells[a].Bounds);
+                        glm::vec3 to = samplePoint(cells[b].Bounds);
+                        cast++;
+                        if (!bvh.anyHit(from, to, [&](unsigned int o) { return occluders[o].blocks(from, to); }))
+                        {
+                            pairs[a * n + b] = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+            rays += cast;
+        };
+
+        if (threads == 0)
+            threads = glm::max(std::thread::hardware_concurrency(), 1u);
+        std::vector<std::thread> pool;
+        for (unsigned int t = 1; t < threads; t++)
+            pool.emplace_back(worker);
+        worker();
+        for (std::thread& thread : pool)
+            thread.join();
+
+        for (size_t a = 0; a < n; a++)
+        {
+            for (size_t b = a; b < n; b++)
+            {
+                if (pairs[a * n + b])
+                {
+                    pvs.set((int)a, (int)b);
+                    pvs.set((int)b, (int)a);
+                }
+            }
+        }
+
+        pvs.RaysCast = rays;
+        pvs.BakeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return pvs;
+    }
+
+    // layout: "PVS3", uint32 cell count, uint64 layout hash, then per cell a uint32 byte count and
+    // the row, stored raw when the byte count is that of the bitset and compressed otherwise
+    bool save(const std::string& path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::PVS::FILE_NOT_WRITTEN: " << path << std::endl;
+            return false;
+        }
+
+        file.write("PVS3", 4);
+        writeUint(file, CellCount);
+        writeUint(file, (uint32_t)LayoutHash);
+        writeUint(file, (uint32_t)(LayoutHash >> 32));
+        for (unsigned int cell = 0; cell < CellCount; cell++)
+        {
+            std::vector<unsigned char> row = compressRow(cell);
+            writeUint(file, (uint32_t)row.size());
+            file.write((const char*)row.data(), row.size());
+        }
+        return true;
+    }
+
+    // False when the file is missing, malformed or baked from a different layout
+    bool load(const std::string& path, const PortalGraph& graph)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return false;
+
+        char magic[4];
+        uint32_t count = 0, hashLow = 0, hashHigh = 0;
+        file.read(magic, 4);
+        if (!file || std::string(magic, 4) != "PVS3" || !readUint(file, count) || !readUint(file, hashLow) || !readUint(file, hashHigh))
+        {
+            std::cout << "ERROR::PVS::FILE_NOT_COMPATIBLE: " << path << std::endl;
+            return false;
+        }
+        uint64_t hash = hashLow | ((uint64_t)hashHigh << 32);
+        if (count != graph.Cells.size() || hash != layoutHash(graph))
+        {
+            std::cout << "ERROR::PVS::LAYOUT_CHANGED: " << path << ", bake it again with --bake-pvs" << std::endl;
+            return false;
+        }
+
+        resize(count);
+        LayoutHash = hash;
+        for (unsigned int cell = 0; cell < count; cell++)
+        {
+            uint32_t size = 0;
+            std::vector<unsigned char> row;
+            if (readUint(file, size))
+            {
+                row.resize(size);
+                file.read((char*)row.data(), size);
+            }
+            if (!file || !decompressRow(cell, row))
+            {
+                std::cout << "ERROR::PVS::FILE_NOT_COMPATIBLE: " << path << std::endl;
+                resize(0);
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    size_t rowBytes = 0;
+    std::vector<unsigned char> rows;
+
+    // Depth first over the portal chains leaving one cell. Doorways are seen from above as segments
+    // in x and z, with their endpoints sorted to the left and right of the direction the chain
+    // crosses them in. A line stabs the chain when it has every left endpoint on its left and every
+    // right one on its right; height is left out, which can only add visible pairs.
+    class Stabber
+    {
+    public:
+        unsigned long long Chains = 0;
+
+        Stabber(const PortalGraph& graph, PVS& pvs) : graph(graph), pvs(pvs), onPath(graph.Cells.size(), 0)
+        {
+        }
+
+        void bakeRow(int cell)
+        {
+            lefts.clear();
+            rights.clear();
+            row = cell;
+            pvs.set(cell, cell);
+            visit(cell);
+        }
+
+    private:
+        const PortalGraph& graph;
+        PVS& pvs;
+        std::vector<unsigned char> onPath;
+        std::vector<glm::dvec2> lefts;
+        std::vector<glm::dvec2> rights;
+        int row = 0;
+
+        void visit(int cell)
+        {
+            onPath[cell] = 1;
+            for (int p : graph.Cells[cell].Portals)
+            {
+                const Portal& portal = graph.Portals[p];
+                int next = portal.other(cell);
+                if (onPath[next])
+                    continue;
+
+                addDoorway(portal, cell, next);
+                Chains++;
+                if (stabbable())
+                {
+                    pvs.set(row, next);
+                    visit(next);
+                }
+                lefts.pop_back();
+                rights.pop_back();
+            }
+            onPath[cell] = 0;
+        }
+
+        static glm::dvec2 topDown(const glm::vec3& point)
+        {
+            return glm::dvec2(point.x, point.z);
+        }
+
+        static double cross(const glm::dvec2& a, const glm::dvec2& b)
+        {
+            return a.x * b.y - a.y * b.x;
+        }
+
+        // the two corners farthest apart seen from above
+        void addDoorway(const Portal& portal, int from, int to)
+        {
+            glm::dvec2 a = topDown(portal.Corners[0]);
+            glm::dvec2 b = a;
+            double longest = -1.0;
+            for (int i = 0; i < 4; i++)
+            {
+                for (int j = i + 1; j < 4; j++)
+                {
+                    double length = glm::length(topDown(portal.Corners[i]) - topDown(portal.Corners[j]));
+                    if (length > longest)
+                    {
+                        longest = length;
+                        a = topDown(portal.Corners[i]);
+                        b = topDown(portal.Corners[j]);
+                    }
+                }
+            }
+
+            glm::dvec2 crossing = topDown(graph.Cells[to].Bounds.center()) - topDown(graph.Cells[from].Bounds.center());
+            if (cross(crossing, a - b) > 0.0)
+                std::swap(a, b);
+            lefts.push_back(b);
+            rights.push_back(a);
+        }
+
+        // A separating line can be turned until it touches two of the endpoints, so only the lines
+        // through pairs of them are tried, both ways round. Touching counts as passing.
+        bool stabbable() const
+        {
+            if (lefts.size() < 2)
+                return true;
+
+            const double EPSILON = 1e-6;
+            size_t count = lefts.size() * 2;
+            auto point = [&](size_t i) { return i < lefts.size() ? lefts[i] : rights[i - lefts.size()]; };
+            for (size_t i = 0; i < count; i++)
+            {
+                for (size_t j = i + 1; j < count; j++)
+                {
+                    glm::dvec2 origin = point(i);
+                    glm::dvec2 direction = point(j) - origin;
+                    double length = glm::length(direction);
+                    if (length < EPSILON)
+                        continue;
+                    direction /= length;
+
+                    for (double side : { 1.0, -1.0 })
+                    {
+                        bool separates = true;
+                        for (size_t k = 0; k < lefts.size() && separates; k++)
+                        {
+                            separates = side * cross(direction, lefts[k] - origin) >= -EPSILON
+                                && side * cross(direction, rights[k] - origin) <= EPSILON;
+                        }
+                        if (separates)
+                            return true;
+                    }
+                }
+            }
+            return false;
+        }
+    };
+
+    void resize(unsigned int cellCount)
+    {
+        CellCount = cellCount;
+        rowBytes = (cellCount + 7) / 8;
+        rows.assign(rowBytes * cellCount, 0);
+    }
+
+    void set(int from, int to)
+    {
+        rows[(size_t)from * rowBytes + (to >> 3)] |= 1 << (to & 7);
+    }
+
+    // Zero bytes are stored as a 0 followed by the run length (1-255), everything else verbatim.
+    // Dense rows grow under that, they are returned raw when the encoding saves nothing.
+    std::vector<unsigned char> compressRow(unsigned int cell) const
+    {
+        const unsigned char* row = &rows[(size_t)cell * rowBytes];
+        std::vector<unsigned char> out;
+        for (size_t i = 0; i < rowBytes && out.size() < rowBytes;)
+        {
+            if (row[i] != 0)
+            {
+                out.push_back(row[i++]);
+                continue;
+            }
+
+            size_t run = 0;
+            while (i < rowBytes && row[i] == 0 && run < 255)
+            {
+                run++;
+                i++;
+            }
+            out.push_back(0);
+            out.push_back((unsigned char)run);
+        }
+        if (out.size() >= rowBytes)
+            out.assign(row, row + rowBytes);
+        return out;
+    }
+
+    bool decompressRow(unsigned int cell, const std::vector<unsigned char>& in)
+    {
+        unsigned char* row = &rows[(size_t)cell * rowBytes];
+        if (in.size() == rowBytes)
+        {
+            std::copy(in.begin(), in.end(), row);
+            return true;
+        }
+
+        size_t written = 0;
+        for (size_t i = 0; i < in.size(); i++)
+        {
+            if (in[i] != 0)
+            {
+                if (written == rowBytes)
+                    return false;
+                row[written++] = in[i];
+                continue;
+            }
+
+            if (++i == in.size() || written + in[i] > rowBytes)
+                return false;
+            written += in[i]; // rows start zeroed
+        }
+        return written == rowBytes;
+    }
+
+    static void writeUint(std::ofstream& file, uint32_t value)
+    {
+        unsigned char bytes[4] = { (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24) };
+        file.write((const char*)bytes, 4);
+    }
+
+    static bool readUint(std::ifstream& file, uint32_t& value)
+    {
+        unsigned char bytes[4];
+        if (!file.read((char*)bytes, 4))
+            return false;
+        value = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,1060 @@
+#ifndef RENDER_BENCHMARKS_H
+#define RENDER_BENCHMARKS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cfloat>
+
+#include "camera.hpp"
+#include "camera_path.hpp"
+#include "portals.hpp"
+#include "frame_pacing.hpp"
+#include "antialiasing.hpp"
+#include "gl_extensions.hpp"
+#include "gl_state.hpp"
+#include "stats.hpp"
+#include "dynamic_resolution.hpp"
+#include "render_thread.hpp"
+#include "command_list.hpp"
+#include "ring_buffer.hpp"
+#include "headless.hpp"
+#include "software_rasterizer.hpp"
+#include "lightmap.hpp"
+#include "shadow_atlas.hpp"
+#include "light_volume.hpp"
+#include "entities.hpp"
+
+// Rendering benchmarks, run with `--bench <name>` on a hidden window. Each one draws through the
+// callbacks it is given and steers them through a BenchmarkState. The ones handling frame packets
+// or lights take their types as template parameters, as RenderThread does.
+
+/* --------------------------------- Helpers -------------------------------- */
+// The game's camera, the clock of its lights and its rendering switches, which the renderRoom and
+// buildPacket callbacks read
+struct BenchmarkState
+{
+    Camera& View;
+    // cell of View in Graph
+    int& ViewCell;
+    // the lights animate to this time while it is not negative
+    double& ScriptedTime;
+    const PortalGraph& Graph;
+
+    bool& DepthPrepass;
+    bool& CountFragments;
+    bool& DynamicResolution;
+    bool& CommandLists;
+    bool& Lightmaps;
+    bool& Shadows;
+    bool& TexelShading;
+    bool& LightVolumes;
+    PacingMode& Pacing;
+    AntiAliasingMode& AntiAliasing;
+
+    void moveCamera(const Camera& camera)
+    {
+        View = camera;
+        ViewCell = Graph.findCell(View.Position);
+    }
+
+    // Moves the camera time seconds along path, with the lights animating to the same time
+    void placeCamera(const CameraPath& path, double time)
+    {
+        ScriptedTime = time;
+        moveCamera(path.sample((float)ScriptedTime));
+    }
+};
+
+// Camera path for the benchmarks, the recorded one when there is one
+inline CameraPath loadBenchmarkPath(const std::string& pathFile)
+{
+    CameraPath path;
+    if (path.load(pathFile))
+    {
+        std::cout << "path: " << pathFile << ", " << path.Keys.size() << " keys" << std::endl;
+        return path;
+    }
+
+    // walk around the first room while turning, when nothing was recorded yet
+    path.Keys = {
+        { 0.0f, glm::vec3(0.0f, 2.0f, 0.0f), -90.0f, 0.0f },
+        { 2.0f, glm::vec3(0.0f, 2.0f, -3.0f), 0.0f, -10.0f },
+        { 4.0f, glm::vec3(3.0f, 2.0f, -3.0f), 90.0f, 0.0f },
+        { 6.0f, glm::vec3(3.0f, 2.0f, 2.0f), 180.0f, 10.0f },
+        { 8.0f, glm::vec3(0.0f, 2.0f, 0.0f), 270.0f, 0.0f },
+    };
+    std::cout << "path: built in, " << path.Keys.size() << " keys" << std::endl;
+    return path;
+}
+
+// Clears fbo (0 is the window's) and draws the room into it, returns the time in ms until the
+// frame is finished
+inline double drawFrame(const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom, const glm::mat4& view,
+    const glm::mat4& projection, unsigned int fbo, int width, int height)
+{
+    double start = glfwGetTime();
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    renderRoom(view, projection);
+    glFinish();
+    return (glfwGetTime() - start) * 1000.0;
+}
+
+// Total time of frames draws of the current view. An untimed one goes first, the first frame of a
+// view may still record the command list.
+inline double timeView(const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom, const glm::mat4& view,
+    const glm::mat4& projection, unsigned int fbo, int width, int height, int frames)
+{
+    drawFrame(renderRoom, view, projection, fbo, width, height);
+    double frameMs = 0.0;
+    for (int i = 0; i < frames; i++)
+        frameMs += drawFrame(renderRoom, view, projection, fbo, width, height);
+    return frameMs;
+}
+
+// RGBA8 pixels of fbo, bottom row first
+inline std::vector<unsigned int> readImage(unsigned int fbo, int width, int height)
+{
+    std::vector<unsigned int> pixels((size_t)width * height);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+    return pixels;
+}
+
+// How far one set of images is from another of the same sizes, per channel over every image
+struct ImageDifference
+{
+    // mean absolute difference, out of 255
+    double MeanError = 0.0;
+    // share of pixels with a channel more than 8/255 off
+    double OffPercent = 0.0;
+};
+
+inline ImageDifference compareImages(const std::vector<std::vector<unsigned int>>& a, const std::vector<std::vector<unsigned int>>& b)
+{
+    double error = 0.0;
+    unsigned long long off = 0;
+    unsigned long long pixels = 0;
+    for (size_t image = 0; image < a.size(); image++)
+    {
+        for (size_t i = 0; i < a[image].size(); i++)
+        {
+            int largest = 0;
+            for (int channel = 0; channel < 3; channel++)
+            {
+                int difference = std::abs((int)((a[image][i] >> (channel * 8)) & 0xFF) - (int)((b[image][i] >> (channel * 8)) & 0xFF));
+                error += difference;
+                largest = glm::max(largest, difference);
+            }
+            off += largest > 8;
+        }
+        pixels += a[image].size();
+    }
+
+    ImageDifference difference;
+    if (pixels > 0)
+    {
+        difference.MeanError = error / (pixels * 3.0);
+        difference.OffPercent = 100.0 * off / pixels;
+    }
+    return difference;
+}
+
+
+/* ----------------------------- Depth Prepass ------------------------------ */
+// Looks around the first room with the depth prepass off and on, counting how often each
+// pass ran a fragment shader. Rendering is synchronous here, so GPU time is wall time.
+inline bool runDepthPrepassBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom)
+{
+    if (window == nullptr)
+        return false;
+    if (!glExtensions.PipelineStatistics)
+    {
+        std::cout << "ERROR::BENCHMARK::PIPELINE_STATISTICS_NOT_SUPPORTED" << std::endl;
+        return false;
+    }
+
+    const float yaws[] = { -90.0f, 0.0f, 90.0f, 180.0f };
+    const int framesPerView = 5;
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    state.CountFragments = true;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "mode      prepass-invocations  shaded-invocations  shaded-samples  samples-per-pixel  frame-ms" << std::endl;
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        state.DepthPrepass = mode == 1;
+        FragmentCounts prepass;
+        FragmentCounts shaded;
+        double frameMs = 0.0;
+        int frames = 0;
+
+        for (float yaw : yaws)
+        {
+            state.moveCamera(Camera(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), yaw, 0.0f));
+            for (int i = 0; i < framesPerView; i++)
+            {
+                frameStats.reset();
+                double start = glfwGetTime();
+
+                glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                renderRoom(state.View.GetViewMatrix(), projection);
+                glFinish();
+
+                frameMs += (glfwGetTime() - start) * 1000.0;
+                prepass.invocations += frameStats.prepassFragments.invocations;
+                shaded.invocations += frameStats.shadedFragments.invocations;
+                shaded.samples += frameStats.shadedFragments.samples;
+                frames++;
+                glfwSwapBuffers(window);
+            }
+        }
+
+        int samples = 0;
+        glGetIntegerv(GL_SAMPLES, &samples);
+        std::cout << (state.DepthPrepass ? "prepass " : "forward ") << "  " << std::setw(19) << prepass.invocations / frames
+            << "  " << std::setw(18) << shaded.invocations / frames << "  " << std::setw(14) << shaded.samples / frames
+            << "  " << std::setw(17) << (double)shaded.samples / frames / (width * height * glm::max(samples, 1))
+            << "  " << std::setw(8) << frameMs / frames << std::endl;
+    }
+
+    glfwTerminate();
+    return true;
+}
+
+
+/* --------------------------- Dynamic Resolution --------------------------- */
+// Replays a recorded camera path at a fixed time step, first at full resolution to find the cost
+// of the path, then with the controller aiming at 60% of that. Reports how well the budget was
+// kept and how often the scale moved, a well damped controller settles instead of flipping.
+inline bool runDynamicResolutionBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    DynamicResolution& sceneTarget, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    CameraPath path = loadBenchmarkPath(pathFile);
+    const int frameCount = 60;
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    // Frames are timed on the CPU around glFinish, timer queries of software drivers do not cover
+    // all of the rasterization. The controller still sees each timing QUERY_COUNT frames late, as
+    // it would from GpuTimer in the main loop.
+    auto replay = [&](bool adaptive, std::vector<double>& frameMs, std::vector<float>& scales) {
+        sceneTarget.Controller = ResolutionController(sceneTarget.Controller.TargetMs, sceneTarget.Controller.MinScale, sceneTarget.Controller.MaxScale);
+        for (int frame = 0; frame < frameCount; frame++)
+        {
+            state.moveCamera(path.sample(path.duration() * frame / (frameCount - 1)));
+            frameStats.reset();
+
+            double start = glfwGetTime();
+            sceneTarget.begin(width, height);
+            renderRoom(state.View.GetViewMatrix(), projection);
+            sceneTarget.end();
+            glFinish();
+            frameMs.push_back((glfwGetTime() - start) * 1000.0);
+            scales.push_back(sceneTarget.Controller.Scale);
+            glfwSwapBuffers(window);
+
+            if (adaptive && frame >= GpuTimer::QUERY_COUNT)
+                sceneTarget.update(frameMs[frame - GpuTimer::QUERY_COUNT]);
+        }
+    };
+
+    std::vector<double> fullMs;
+    std::vector<float> fullScales;
+    sceneTarget.Controller.TargetMs = FLT_MAX;
+    replay(false, fullMs, fullScales);
+
+    // median, the first frames also compile shaders and upload textures
+    std::vector<double> sorted = fullMs;
+    std::sort(sorted.begin(), sorted.end());
+    double fullMedian = sorted[sorted.size() / 2];
+    if (fullMedian <= 0.0)
+    {
+        std::cout << "ERROR::BENCHMARK::NO_GPU_TIMINGS" << std::endl;
+        return false;
+    }
+
+    std::vector<double> adaptiveMs;
+    std::vector<float> scales;
+    sceneTarget.Controller.TargetMs = (float)(fullMedian * 0.6);
+    replay(true, adaptiveMs, scales);
+
+    // the controller needs a few frames to react, budget adherence is counted after the first drop settles
+    int settled = 0;
+    while (settled < frameCount && scales[settled] == sceneTarget.Controller.MaxScale)
+        settled++;
+    settled = glm::min(settled + ResolutionController::SETTLE_FRAMES, frameCount);
+
+    int overBudget = 0;
+    int changes = 0;
+    int reversals = 0;
+    std::vector<double> settledMs;
+    float meanScale = 0.0f;
+    float lastStep = 0.0f;
+    for (int i = 0; i < frameCount; i++)
+    {
+        meanScale += scales[i];
+        if (i >= settled)
+        {
+            settledMs.push_back(adaptiveMs[i]);
+            if (adaptiveMs[i] > sceneTarget.Controller.TargetMs)
+                overBudget++;
+        }
+        if (i > 0 && scales[i] != scales[i - 1])
+        {
+            float step = scales[i] - scales[i - 1];
+            changes++;
+            if (lastStep != 0.0f && (step > 0.0f) != (lastStep > 0.0f))
+                reversals++;
+            lastStep = step;
+        }
+    }
+    meanScale /= frameCount;
+    std::sort(settledMs.begin(), settledMs.end());
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "frames: " << frameCount << ", full resolution " << fullMedian << " ms median, budget " << sceneTarget.Controller.TargetMs << " ms" << std::endl;
+    std::cout << "adaptive: scale " << meanScale << " mean, " << scales.back() << " final" << std::endl;
+    if (!settledMs.empty())
+        std::cout << "settled: " << settledMs[settledMs.size() / 2] << " ms median, " << settledMs[settledMs.size() * 95 / 100] << " ms p95" << std::endl;
+    std::cout << "over budget: " << overBudget << " of " << frameCount - settled << " frames after settling at frame " << settled << std::endl;
+    std::cout << "scale changes: " << changes << ", reversals: " << reversals << std::endl;
+
+    glfwTerminate();
+    return true;
+}
+
+
+/* ------------------------------ Command List ------------------------------ */
+// CPU time to submit the room's passes, issued immediately and replayed from the command list.
+// Each frame submits the room as many times as a large gallery would have rooms in view, with
+// rasterization discarded. Drivers spend a fixed time validating each draw that no recording
+// saves, so the room is also submitted from outside the gallery, where every instance is culled
+// and only state changes and uniforms are left to submit.
+inline bool runCommandListBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    const std::function<void()>& redrawRoom, const std::function<void()>& recordRoom, const CommandList& roomCommands)
+{
+    if (window == nullptr)
+        return false;
+
+    const int frameCount = 20;
+    const int submissionsPerFrame = 64;
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    struct View
+    {
+        const char* name;
+        Camera camera;
+    };
+    const View views[] = {
+        { "room ", Camera(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, 0.0f) },
+        { "empty", Camera(glm::vec3(0.0f, 2.0f, -50.0f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, 0.0f) },
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << (glExtensions.MultiDrawIndirect && glExtensions.ShaderDrawParameters ? "multi-draw indirect" : "per-draw fallback")
+        << ", " << submissionsPerFrame << " room submissions per frame" << std::endl;
+    std::cout << "view   immediate-us  replay-us  replay-%  draws" << std::endl;
+
+    for (const View& view : views)
+    {
+        state.moveCamera(view.camera);
+
+        double submitUs[2] = {};
+        for (int mode = 0; mode < 2; mode++)
+        {
+            state.CommandLists = mode == 1;
+            // culls and uploads the draw list, and records it the second time
+            renderRoom(state.View.GetViewMatrix(), projection);
+            glFinish();
+
+            glState.enable(GL_RASTERIZER_DISCARD);
+            std::vector<double> frameMs;
+            for (int frame = 0; frame < frameCount; frame++)
+            {
+                double start = glfwGetTime();
+                for (int i = 0; i < submissionsPerFrame; i++)
+                    redrawRoom();
+                frameMs.push_back((glfwGetTime() - start) * 1000.0);
+                glFinish();
+            }
+            glState.disable(GL_RASTERIZER_DISCARD);
+
+            std::sort(frameMs.begin(), frameMs.end());
+            submitUs[mode] = frameMs[frameMs.size() / 2] * 1000.0 / submissionsPerFrame;
+        }
+
+        std::cout << view.name << "  " << std::setw(12) << submitUs[0] << "  " << std::setw(9) << submitUs[1]
+            << "  " << std::setw(8) << 100.0 * submitUs[1] / glm::max(submitUs[0], 1e-9) << "  " << std::setw(5) << roomCommands.Draws << std::endl;
+    }
+
+    const int records = 100;
+    double start = glfwGetTime();
+    for (int i = 0; i < records; i++)
+        recordRoom();
+    std::cout << "command list: " << roomCommands.sizeBytes() << " bytes, recorded in " << (glfwGetTime() - start) * 1e6 / records << " us" << std::endl;
+
+    glfwTerminate();
+    return true;
+}
+
+
+/* ------------------------------ Ring Buffer ------------------------------- */
+// CPU time per frame to stream the room's uniform blocks through a ring of three regions, a ring
+// of one and the orphaning fallback. Every frame submits the room with fresh uniforms as many
+// times as a large gallery would have rooms in view, and nothing waits for the GPU in between, so
+// a ring too short for the frames in flight has to wait on its fences. Those waits are reported.
+inline bool runRingBufferBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    const std::function<void(RingBuffer*)>& redrawRoom, GLsizeiptr regionSize)
+{
+    if (window == nullptr)
+        return false;
+
+    const int frameCount = 20;
+    const int submissionsPerFrame = 64;
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    struct Mode
+    {
+        const char* name;
+        int regions;
+        bool persistent;
+    };
+    const Mode modes[] = {
+        { "persistent x3", 3, true },
+        { "persistent x1", 1, true },
+        { "orphaning    ", 1, false },
+    };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << submissionsPerFrame << " room submissions per frame" << (glExtensions.PersistentMapping ? "" : ", no persistent mapping") << std::endl;
+    std::cout << "mode           frame-ms  fence-waits  wait-ms" << std::endl;
+
+    state.moveCamera(Camera(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), -90.0f, 0.0f));
+    renderRoom(state.View.GetViewMatrix(), projection);
+    glFinish();
+
+    for (const Mode& mode : modes)
+    {
+        if (mode.persistent && !glExtensions.PersistentMapping)
+            continue;
+
+        RingBuffer ring(GL_UNIFORM_BUFFER, regionSize, mode.regions, mode.persistent);
+        glState.enable(GL_RASTERIZER_DISCARD);
+        FrameStats before = frameStats;
+        std::vector<double> frameMs;
+        for (int frame = 0; frame < frameCount; frame++)
+        {
+            double start = glfwGetTime();
+            ring.beginFrame();
+            for (int i = 0; i < submissionsPerFrame; i++)
+                redrawRoom(&ring);
+            ring.endFrame();
+            frameMs.push_back((glfwGetTime() - start) * 1000.0);
+        }
+        glFinish();
+        glState.disable(GL_RASTERIZER_DISCARD);
+
+        std::sort(frameMs.begin(), frameMs.end());
+        std::cout << mode.name << "  " << std::setw(8) << frameMs[frameMs.size() / 2]
+            << "  " << std::setw(11) << (double)(frameStats.fenceWaits - before.fenceWaits) / frameCount
+            << "  " << std::setw(7) << (frameStats.fenceWaitMs - before.fenceWaitMs) / frameCount << std::endl;
+    }
+
+    glfwTerminate();
+    return true;
+}
+
+
+/* ---------------------------- Software Raster ----------------------------- */
+// Renders views along the camera path with GL, then with the software rasterizer for a few thread
+// counts with and without AVX2. Prints the time of each software stage, checks every software
+// configuration gives the same image and how far that image is from GL's.
+inline bool runSoftwareRasterBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    const std::function<void()>& rasterizeRoom, SoftwareRasterizer& rasterizer, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    const int viewCount = 8;
+    CameraPath path = loadBenchmarkPath(pathFile);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    struct Config
+    {
+        unsigned int threads;
+        bool avx2;
+    };
+    unsigned int cores = glm::max(std::thread::hardware_concurrency(), 1u);
+    bool avx2 = rasterizer.UseAVX2;
+    std::vector<Config> configs = { { 1, false } };
+    if (avx2)
+        configs.push_back({ 1, true });
+    for (unsigned int threads = 2; threads <= cores; threads *= 2)
+        configs.push_back({ threads, avx2 });
+    if (cores > 1 && (cores & (cores - 1)) != 0)
+        configs.push_back({ cores, avx2 });
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << width << "x" << height << ", " << viewCount << " views, " << cores << " cores" << std::endl;
+
+    // GL first, every view read back for the comparison
+    std::vector<std::vector<unsigned int>> glImages;
+    for (int view = 0; view < viewCount; view++)
+    {
+        state.placeCamera(path, path.duration() * view / (viewCount - 1));
+        drawFrame(renderRoom, state.View.GetViewMatrix(), projection, 0, width, height);
+        glImages.push_back(readImage(0, width, height));
+    }
+
+    std::cout << "threads  simd     setup-ms  bin-ms  raster-ms  shade-ms  tiles-ms  triangles  binned  same-image" << std::endl;
+    std::vector<std::vector<unsigned int>> reference(viewCount);
+    for (const Config& config : configs)
+    {
+        rasterizer.setThreads(config.threads);
+        rasterizer.UseAVX2 = config.avx2;
+
+        double setupMs = 0.0, binMs = 0.0, rasterMs = 0.0, shadeMs = 0.0, tileMs = 0.0;
+        unsigned int triangles = 0, binned = 0;
+        bool same = true;
+        for (int view = 0; view < viewCount; view++)
+        {
+            state.placeCamera(path, path.duration() * view / (viewCount - 1));
+
+            // culls and fills the packet, the GL draw itself is not looked at
+            renderRoom(state.View.GetViewMatrix(), projection);
+            rasterizeRoom();
+
+            setupMs += rasterizer.SetupMs;
+            binMs += rasterizer.BinMs;
+            rasterMs += rasterizer.RasterMs;
+            shadeMs += rasterizer.ShadeMs;
+            tileMs += rasterizer.TileMs;
+            triangles += rasterizer.Triangles;
+            binned += rasterizer.BinnedTriangles;
+
+            if (reference[view].empty())
+                reference[view] = rasterizer.pixels();
+            same = same && reference[view] == rasterizer.pixels();
+        }
+
+        std::cout << std::setw(7) << config.threads << "  " << (config.avx2 ? "avx2  " : "scalar") << "  " << std::setw(8) << setupMs / viewCount
+            << "  " << std::setw(6) << binMs / viewCount << "  " << std::setw(9) << rasterMs / viewCount << "  " << std::setw(8) << shadeMs / viewCount
+            << "  " << std::setw(8) << tileMs / viewCount << "  " << std::setw(9) << triangles / viewCount << "  " << std::setw(6) << binned / viewCount
+            << "  " << (same ? "yes" : "NO") << std::endl;
+    }
+
+    ImageDifference difference = compareImages(reference, glImages);
+    std::cout << "vs GL: mean error " << difference.MeanError << "/255, " << difference.OffPercent << "% of pixels off by more than 8/255" << std::endl;
+
+    rasterizer.setThreads(0);
+    rasterizer.UseAVX2 = avx2;
+    glfwTerminate();
+    return true;
+}
+
+
+/* -------------------------------- Lightmap -------------------------------- */
+// Bakes the gallery's lightmap again on one thread, then on 2, 4 ... up to every core, and checks
+// each bake matches the first. Then renders views along a camera path with every light computed
+// per pixel and with the lightmap, and reports the frame time of both and how far apart they are.
+template <typename Light>
+bool runLightmapBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    const Lightmap& baked, const std::vector<Light>& restLights, const std::vector<Occluder>& occluders, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    unsigned int cores = glm::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned int> threadCounts = { 1 };
+    for (unsigned int threads = 2; threads <= cores; threads *= 2)
+        threadCounts.push_back(threads);
+    if (cores > 1 && (cores & (cores - 1)) != 0)
+        threadCounts.push_back(cores);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "lightmap " << baked.Width << "x" << baked.Height << ", " << baked.Charts.size() << " charts, "
+        << cores << " cores" << std::endl;
+    std::cout << "threads   bake-ms  speedup  shadow-rays  same-texels" << std::endl;
+
+    Lightmap reference;
+    for (unsigned int threads : threadCounts)
+    {
+        Lightmap lightmap = baked;
+        lightmap.bake(restLights, occluders, threads);
+        if (reference.Texels.empty())
+            reference = lightmap;
+
+        std::cout << std::setw(7) << threads << "  " << std::setw(8) << lightmap.BakeMs << "  " << std::setw(7) << reference.BakeMs / lightmap.BakeMs
+            << "  " << std::setw(11) << lightmap.ShadowRays << "  " << (lightmap.Texels == reference.Texels ? "yes" : "NO") << std::endl;
+    }
+
+    const int viewCount = 8;
+    const int framesPerView = 3;
+    CameraPath path = loadBenchmarkPath(pathFile);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    std::cout << "shading    frame-ms" << std::endl;
+    std::vector<std::vector<unsigned int>> images[2];
+    for (int mode = 0; mode < 2; mode++)
+    {
+        state.Lightmaps = mode == 1;
+        double frameMs = 0.0;
+        for (int view = 0; view < viewCount; view++)
+        {
+            state.placeCamera(path, path.duration() * view / (viewCount - 1));
+            frameMs += timeView(renderRoom, state.View.GetViewMatrix(), projection, 0, width, height, framesPerView);
+            images[mode].push_back(readImage(0, width, height));
+            glfwSwapBuffers(window);
+        }
+
+        std::cout << (state.Lightmaps ? "lightmap " : "per-pixel") << "  " << std::setw(8) << frameMs / (viewCount * framesPerView) << std::endl;
+    }
+
+    ImageDifference difference = compareImages(images[0], images[1]);
+    std::cout << "vs per-pixel: mean error " << difference.MeanError << "/255, " << difference.OffPercent << "% of pixels off by more than 8/255" << std::endl;
+
+    state.Lightmaps = true;
+    glfwTerminate();
+    return true;
+}
+
+
+/* -------------------------------- Shadows --------------------------------- */
+// Follows a camera path frame by frame with the sculptures turning, once with the shadow atlas
+// caching and once rendering every pass every frame, then without shadows. Reports the passes
+// drawn and skipped per frame, the frame time, and whether caching changed any pixel.
+template <typename Packet>
+bool runShadowBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    ShadowAtlas& atlas, int casters, const Packet& packet, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    const int frameCount = 60;
+    const int imageEvery = 10;
+    CameraPath path = loadBenchmarkPath(pathFile);
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "atlas " << atlas.Size << "x" << atlas.Size << ", " << casters << " moving casters, " << frameCount << " frames" << std::endl;
+    std::cout << "mode      static-drawn  static-skipped  overlay-drawn  overlay-skipped  frame-ms" << std::endl;
+
+    const char* names[3] = { "cached  ", "uncached", "off     " };
+    std::vector<std::vector<unsigned int>> images[2];
+    for (int mode = 0; mode < 3; mode++)
+    {
+        state.Shadows = mode < 2;
+        atlas.Caching = mode == 0;
+        unsigned long long staticPasses = 0, staticSkipped = 0, overlayPasses = 0, overlaySkipped = 0;
+        double frameMs = 0.0;
+
+        // the first frame is not timed, it fills the cache and may record the command list
+        for (int frame = 0; frame <= frameCount; frame++)
+        {
+            state.placeCamera(path, path.duration() * glm::max(frame - 1, 0) / (frameCount - 1));
+            double drawMs = drawFrame(renderRoom, state.View.GetViewMatrix(), projection, 0, width, height);
+            if (frame == 0)
+                continue;
+
+            frameMs += drawMs;
+            if (state.Shadows)
+            {
+                staticPasses += packet.shadowFrame.StaticPasses;
+                staticSkipped += packet.shadowFrame.StaticSkipped;
+                overlayPasses += packet.shadowFrame.OverlayPasses;
+                overlaySkipped += packet.shadowFrame.OverlaySkipped;
+            }
+            if (mode < 2 && frame % imageEvery == 0)
+                images[mode].push_back(readImage(0, width, height));
+            glfwSwapBuffers(window);
+        }
+
+        std::cout << names[mode] << "  " << std::setw(12) << (double)staticPasses / frameCount << "  " << std::setw(14) << (double)staticSkipped / frameCount
+            << "  " << std::setw(13) << (double)overlayPasses / frameCount << "  " << std::setw(15) << (double)overlaySkipped / frameCount
+            << "  " << std::setw(8) << frameMs / frameCount << std::endl;
+    }
+
+    unsigned long long different = 0;
+    for (size_t image = 0; image < images[0].size(); image++)
+    {
+        for (size_t i = 0; i < images[0][image].size(); i++)
+            different += (images[0][image][i] & 0xFFFFFF) != (images[1][image][i] & 0xFFFFFF);
+    }
+    std::cout << "cached vs uncached: " << different << " pixels differ over " << images[0].size() << " frames" << std::endl;
+
+    state.Shadows = true;
+    atlas.Caching = true;
+    glfwTerminate();
+    return true;
+}
+
+
+/* ----------------------------- Texel Shading ------------------------------ */
+// Renders views along a camera path at 720p, 1440p and 4K into an offscreen target, with the room
+// surfaces lit per pixel from the lightmap, per pixel without it, and from the ShadingCache. Reports
+// the frame time of each, how many texels were shaded against how many pixels, and how far the
+// cached image is from the per-pixel one.
+template <typename Packet>
+bool runTexelShadingBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    const Packet& packet, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    const int viewCount = 4;
+    const int framesPerView = 2;
+    const glm::ivec2 resolutions[] = { glm::ivec2(1280, 720), glm::ivec2(2560, 1440), glm::ivec2(3840, 2160) };
+    CameraPath path = loadBenchmarkPath(pathFile);
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "resolution  lightmap-ms  dynamic-ms  texel-ms  pixels     shaded-texels  mean-error  off-by-8" << std::endl;
+    for (const glm::ivec2& size : resolutions)
+    {
+        OffscreenTarget target;
+        target.create(size.x, size.y, true);
+
+        glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)size.x / (float)size.y, 0.1f, 100.0f);
+        std::vector<std::vector<unsigned int>> images[3];
+        double frameMs[3] = {};
+        unsigned long long texels = 0;
+        for (int mode = 0; mode < 3; mode++)
+        {
+            state.Lightmaps = mode != 1;
+            state.TexelShading = mode == 2;
+            for (int view = 0; view < viewCount; view++)
+            {
+                state.placeCamera(path, path.duration() * view / (viewCount - 1));
+                frameMs[mode] += timeView(renderRoom, state.View.GetViewMatrix(), projection, target.FBO, size.x, size.y, framesPerView);
+                if (state.TexelShading)
+                    texels += packet.stats.shadedTexels;
+                images[mode].push_back(readImage(target.FBO, size.x, size.y));
+            }
+            frameMs[mode] /= viewCount * framesPerView;
+        }
+        ImageDifference difference = compareImages(images[0], images[2]);
+
+        char resolution[32];
+        std::snprintf(resolution, sizeof(resolution), "%dx%d", size.x, size.y);
+        std::cout << std::left << std::setw(10) << resolution << std::right << "  " << std::setw(11) << frameMs[0] << "  " << std::setw(10) << frameMs[1]
+            << "  " << std::setw(8) << frameMs[2] << "  " << std::setw(9) << size.x * size.y << "  " << std::setw(13) << texels / viewCount
+            << "  " << std::setw(10) << difference.MeanError << "  " << std::setw(7) << difference.OffPercent << "%" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        target.destroy();
+    }
+
+    state.Lightmaps = true;
+    state.TexelShading = false;
+    glfwTerminate();
+    return true;
+}
+
+
+/* ------------------------------ Light Volume ------------------------------ */
+// Builds LightVolumes over the gallery at 4, 8 and 16 voxels per metre in bricks of 4, 8 and 16
+// voxels. Reports the memory of each, the time to compute every brick, and the bricks recomputed
+// and their time per frame with the lights animated and with them still. Then compares the SSE
+// rows with the scalar ones, and renders views along a camera path at 720p with surfaces lit per
+// pixel and from the volume, both without lightmaps, for the frame time and the image difference.
+// The timed frames repeat their view, the volume has nothing to update in them.
+template <typename Light>
+bool runLightVolumeBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(const glm::mat4&, const glm::mat4&)>& renderRoom,
+    LightVolume& volume, const std::function<void(double, std::vector<Light>*)>& animateLights, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    const int densities[] = { 4, 8, 16 };
+    const int brickSizes[] = { 4, 8, 16 };
+    const int animatedFrames = 60;
+    AABB bounds;
+    for (const Cell& cell : state.Graph.Cells)
+        bounds.expand(cell.Bounds);
+
+    std::vector<Light> lights;
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "light volume on " << volume.threads() << " threads" << std::endl;
+    std::cout << "voxels/m  brick  grid          memory-kb  build-ms  animated-ms  bricks       upload-kb  still-ms  still-bricks" << std::endl;
+    for (int density : densities)
+    {
+        for (int brickSize : brickSizes)
+        {
+            LightVolume grid(density, brickSize);
+            grid.create(bounds);
+            animateLights(0.0, &lights);
+            grid.update(lights);
+            double buildMs = grid.UpdateMs;
+
+            double animatedMs = 0.0;
+            unsigned long long bricks = 0;
+            for (int frame = 1; frame <= animatedFrames; frame++)
+            {
+                animateLights(frame / 60.0, &lights);
+                grid.update(lights);
+                animatedMs += grid.UpdateMs;
+                bricks += grid.BricksUpdated;
+            }
+            grid.update(lights);
+
+            char size[32];
+            std::snprintf(size, sizeof(size), "%dx%dx%d", grid.Size.x, grid.Size.y, grid.Size.z);
+            char updated[32];
+            std::snprintf(updated, sizeof(updated), "%llu/%d", bricks / animatedFrames, grid.brickCount());
+            double uploadKb = (double)bricks / animatedFrames * grid.brickVoxels() * LightVolume::CHANNELS * sizeof(int16_t) / 1024.0;
+            std::cout << std::setw(8) << density << "  " << std::setw(5) << brickSize << "  " << std::left << std::setw(12) << size << std::right
+                << "  " << std::setw(9) << grid.memoryBytes() / 1024 << "  " << std::setw(8) << buildMs << "  " << std::setw(11) << animatedMs / animatedFrames
+                << "  " << std::left << std::setw(11) << updated << std::right << "  " << std::setw(9) << uploadKb << "  " << std::setw(8) << grid.UpdateMs
+                << "  " << std::setw(12) << grid.BricksUpdated << std::endl;
+            glDeleteTextures(1, &grid.Texture);
+        }
+    }
+
+    // The same animation with vector and scalar rows, which must agree to a unit of the fixed point.
+    // A full build is mostly the ambient's noise, which is scalar either way.
+#ifdef LIGHT_VOLUME_SSE
+    {
+        double buildMs[2] = {};
+        double animatedMs[2] = {};
+        std::vector<int16_t> voxels[2];
+        for (int sse = 0; sse < 2; sse++)
+        {
+            LightVolume grid;
+            grid.UseSSE = sse == 1;
+            grid.create(bounds);
+            animateLights(0.0, &lights);
+            grid.update(lights);
+            buildMs[sse] = grid.UpdateMs;
+            for (int frame = 1; frame <= animatedFrames; frame++)
+            {
+                animateLights(frame / 60.0, &lights);
+                grid.update(lights);
+                animatedMs[sse] += grid.UpdateMs / animatedFrames;
+            }
+            voxels[sse] = grid.Voxels;
+            glDeleteTextures(1, &grid.Texture);
+        }
+        int largest = 0;
+        for (size_t i = 0; i < voxels[0].size(); i++)
+            largest = glm::max(largest, std::abs((int)voxels[0][i] - (int)voxels[1][i]));
+        std::cout << "16 voxels/m, bricks of 8: scalar build " << buildMs[0] << " ms, animated " << animatedMs[0] << " ms; sse build " << buildMs[1]
+            << " ms, animated " << animatedMs[1] << " ms; largest difference " << largest << " units" << std::endl;
+    }
+#else
+    std::cout << "built without SSE" << std::endl;
+#endif
+
+    const int viewCount = 4;
+    const int framesPerView = 2;
+    const glm::ivec2 size(1280, 720);
+    CameraPath path = loadBenchmarkPath(pathFile);
+
+    OffscreenTarget target;
+    target.create(size.x, size.y, true);
+
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)size.x / (float)size.y, 0.1f, 100.0f);
+    std::vector<std::vector<unsigned int>> images[2];
+    double frameMs[2] = {};
+    state.Lightmaps = false;
+    for (int mode = 0; mode < 2; mode++)
+    {
+        state.LightVolumes = mode == 1;
+        for (int view = 0; view < viewCount; view++)
+        {
+            state.placeCamera(path, path.duration() * view / (viewCount - 1));
+            frameMs[mode] += timeView(renderRoom, state.View.GetViewMatrix(), projection, target.FBO, size.x, size.y, framesPerView);
+            images[mode].push_back(readImage(target.FBO, size.x, size.y));
+        }
+        frameMs[mode] /= viewCount * framesPerView;
+    }
+
+    ImageDifference difference = compareImages(images[0], images[1]);
+    std::cout << "1280x720 without lightmaps: per pixel " << frameMs[0] << " ms, volume " << frameMs[1] << " ms, mean error "
+        << difference.MeanError << ", " << difference.OffPercent << "% off by more than 8" << std::endl;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    target.destroy();
+
+    state.Lightmaps = true;
+    state.LightVolumes = false;
+    glfwTerminate();
+    return true;
+}
+
+
+/* ----------------------------- Render Thread ------------------------------ */
+// Replays a recorded camera path with rendering on the calling thread, then on a render thread
+// with two and three frame packets. Reports throughput and what each thread spent per frame:
+// the overlap can at best hide the shorter of simulation and rendering behind the longer.
+template <typename Packet>
+bool runRenderThreadBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(Packet&, const glm::mat4&, const glm::mat4&)>& buildPacket,
+    const std::function<void(const Packet&)>& renderFrame, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    CameraPath path = loadBenchmarkPath(pathFile);
+    const int frameCount = 30;
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    // same work every frame, whatever the timings
+    state.DynamicResolution = false;
+    state.Pacing = PacingMode::UNCAPPED;
+
+    struct Mode
+    {
+        const char* name;
+        bool threaded;
+        int packets;
+    };
+    const Mode modes[] = { { "serial", false, 1 }, { "double", true, 2 }, { "triple", true, 3 } };
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "mode     frame-ms      fps   sim-ms  sim-wait-ms  render-ms  render-wait-ms" << std::endl;
+
+    for (const Mode& mode : modes)
+    {
+        std::vector<FrameStats> frames;
+        double start = glfwGetTime();
+        {
+            RenderThread<Packet> renderThread(window, renderFrame, mode.packets, mode.threaded);
+            for (int frame = 0; frame < frameCount; frame++)
+            {
+                Packet& packet = renderThread.acquire();
+                state.moveCamera(path.sample(path.duration() * frame / (frameCount - 1)));
+                frameStats.reset();
+                buildPacket(packet, state.View.GetViewMatrix(), projection);
+                renderThread.submit();
+
+                std::vector<FrameStats> finished = renderThread.finished();
+                frames.insert(frames.end(), finished.begin(), finished.end());
+            }
+            renderThread.stop();
+
+            std::vector<FrameStats> finished = renderThread.finished();
+            frames.insert(frames.end(), finished.begin(), finished.end());
+        }
+        double frameMs = (glfwGetTime() - start) * 1000.0 / frameCount;
+
+        // the first frames also compile shaders and upload textures
+        FrameStats mean;
+        int counted = 0;
+        for (size_t i = frames.size() / 4; i < frames.size(); i++)
+        {
+            mean.simulationMs += frames[i].simulationMs;
+            mean.simulationWaitMs += frames[i].simulationWaitMs;
+            mean.renderMs += frames[i].renderMs;
+            mean.renderWaitMs += frames[i].renderWaitMs;
+            counted++;
+        }
+        counted = glm::max(counted, 1);
+
+        std::cout << std::left << std::setw(7) << mode.name << std::right << "  " << std::setw(8) << frameMs << "  " << std::setw(7) << 1000.0 / frameMs
+            << "  " << std::setw(7) << mean.simulationMs / counted << "  " << std::setw(11) << mean.simulationWaitMs / counted
+            << "  " << std::setw(9) << mean.renderMs / counted << "  " << std::setw(14) << mean.renderWaitMs / counted << std::endl;
+    }
+
+    glfwTerminate();
+    return true;
+}
+
+
+/* ----------------------------- Anti-Aliasing ------------------------------ */
+// Replays a camera path through renderFrame() on the calling thread once per AntiAliasingMode, so
+// each frame is drawn, resolved, filtered and presented as in the main loop. Frames are timed on the
+// CPU around glFinish. The first frames of a mode reallocate the scene target and are not counted.
+template <typename Packet>
+bool runAntiAliasingBenchmark(GLFWwindow* window, BenchmarkState& state, const std::function<void(Packet&, const glm::mat4&, const glm::mat4&)>& buildPacket,
+    const std::function<void(const Packet&)>& renderFrame, const std::string& pathFile)
+{
+    if (window == nullptr)
+        return false;
+
+    CameraPath path = loadBenchmarkPath(pathFile);
+    const int frameCount = 24;
+    const int warmupFrames = 4;
+    const int modeCount = 6;
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    glm::mat4 projection = glm::perspective(glm::radians(ZOOM), (float)width / (float)height, 0.1f, 100.0f);
+
+    // same work every frame, whatever the timings
+    state.DynamicResolution = false;
+    state.Pacing = PacingMode::UNCAPPED;
+    AntiAliasingMode previousMode = state.AntiAliasing;
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "mode      frame-ms  min-ms    max-ms    vs-off" << std::endl;
+    Packet packet;
+    double offMs = 0.0;
+    for (int mode = 0; mode < modeCount; mode++)
+    {
+        state.AntiAliasing = (AntiAliasingMode)mode;
+        double totalMs = 0.0;
+        double minMs = 1e9;
+        double maxMs = 0.0;
+        for (int frame = 0; frame < warmupFrames + frameCount; frame++)
+        {
+            state.moveCamera(path.sample(path.duration() * glm::max(frame - warmupFrames, 0) / (frameCount - 1)));
+            frameStats.reset();
+
+            double start = glfwGetTime();
+            buildPacket(packet, state.View.GetViewMatrix(), projection);
+            renderFrame(packet);
+            glFinish();
+            double frameMs = (glfwGetTime() - start) * 1000.0;
+            if (frame < warmupFrames)
+                continue;
+            totalMs += frameMs;
+            minMs = glm::min(minMs, frameMs);
+            maxMs = glm::max(maxMs, frameMs);
+        }
+
+        double meanMs = totalMs / frameCount;
+        if (state.AntiAliasing == AntiAliasingMode::OFF)
+            offMs = meanMs;
+        std::cout << std::left << std::setw(8) << antiAliasingModeName(state.AntiAliasing) << std::right << "  " << std::setw(8) << meanMs << "  " << std::setw(8) << minMs
+            << "  " << std::setw(8) << maxMs << "  " << std::setw(7) << (offMs > 0.0 ? 100.0 * (meanMs - offMs) / offMs : 0.0) << "%" << std::endl;
+    }
+
+    state.AntiAliasing = previousMode;
+    glfwTerminate();
+    return true;
+}
+#endif
@@ -0,0 +1,172 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+#include "stats.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                Render Thread                               */
+/* -------------------------------------------------------------------------- */
+
+// Renders frame packets on a thread of its own, which owns the window's GL context while it runs.
+// The simulation thread fills a packet between acquire() and submit() and never touches it again
+// until the renderer is done with it. With two packets the simulation of frame N+1 overlaps the
+// rendering of frame N, a third lets it run one more frame ahead at the cost of a frame of latency.
+// Not threaded, submit() renders right away on the calling thread, for comparison.
+//
+// The render function is expected to start from the packet's FrameStats. The stats it leaves,
+// with the time each thread spent on the frame, come back to the simulation thread in finished().
+template <typename Packet>
+class RenderThread
+{
+public:
+    using RenderFunction = std::function<void(const Packet&)>;
+
+    RenderThread(GLFWwindow* window, RenderFunction render, int packets = 2, bool threaded = true)
+        : window(window), render(render), slots(packets < 1 ? 1 : packets)
+    {
+        if (!threaded)
+            return;
+
+        glfwMakeContextCurrent(nullptr);
+        thread = std::thread(&RenderThread::run, this);
+    }
+
+    ~RenderThread()
+    {
+        stop();
+    }
+
+    // Next packet to fill, blocks while every packet is still queued or being rendered
+    Packet& acquire()
+    {
+        Clock::time_point start = Clock::now();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return written - rendered < slots.size(); });
+        }
+
+        Slot& slot = slots[written % slots.size()];
+        slot.simulationWaitMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        acquired = Clock::now();
+        return slot.packet;
+    }
+
+    // Hands the acquired packet over to the renderer
+    void submit()
+    {
+        Slot& slot = slots[written % slots.size()];
+        slot.simulationMs = std::chrono::duration<double, std::milli>(Clock::now() - acquired).count();
+
+        if (!thread.joinable())
+        {
+            renderSlot(slot, 0.0);
+            written++;
+            rendered++;
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written++;
+        }
+        changed.notify_all();
+    }
+
+    // Stats of the frames rendered since the last call, oldest first
+    std::vector<FrameStats> finished()
+    {
+        std::vector<FrameStats> frames;
+        std::lock_guard<std::mutex> lock(mutex);
+        frames.swap(done);
+        return frames;
+    }
+
+    // Renders what was already submitted, then gives the context back to the calling thread
+    void stop()
+    {
+        if (!thread.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+        glfwMakeContextCurrent(window);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot
+    {
+        Packet packet;
+        double simulationMs = 0.0;
+        double simulationWaitMs = 0.0;
+    };
+
+    GLFWwindow* window;
+    RenderFunction render;
+    std::vector<Slot> slots;
+    std::thread thread;
+
+    // packets submitted and packets rendered so far, slot of a packet is its number modulo slots.size()
+    unsigned long long written = 0;
+    unsigned long long rendered = 0;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    Clock::time_point acquired;
+    std::vector<FrameStats> done;
+
+    void run()
+    {
+        glfwMakeContextCurrent(window);
+
+        while (true)
+        {
+            Clock::time_point start = Clock::now();
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return rendered < written || stopping; });
+            if (rendered == written)
+                break;
+            Slot& slot = slots[rendered % slots.size()];
+            lock.unlock();
+
+            renderSlot(slot, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+            lock.lock();
+            rendered++;
+            lock.unlock();
+            changed.notify_all();
+        }
+
+        glfwMakeContextCurrent(nullptr);
+    }
+
+    void renderSlot(const Slot& slot, double waitMs)
+    {
+        Clock::time_point start = Clock::now();
+        render(slot.packet);
+
+        frameStats.simulationMs = slot.simulationMs;
+        frameStats.simulationWaitMs = slot.simulationWaitMs;
+        frameStats.renderMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        frameStats.renderWaitMs = waitMs;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        done.push_back(frameStats);
+    }
+};
+#endif
@@ -0,0 +1,183 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+
+#include "gl_extensions.hpp"
+#include "gl_state.hpp"
+#include "stats.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                 Ring Buffer                                */
+/* -------------------------------------------------------------------------- */
+
+// Streams data the CPU writes every frame (uniform blocks, dynamic vertices) without ever making
+// the driver wait on a buffer the GPU is still reading. The buffer is split into one region per
+// frame in flight and stays mapped for its whole life. A frame allocates linearly from its region,
+// endFrame() fences it, and beginFrame() only reuses a region once that fence has passed. A wait
+// on a fence is counted in frameStats, so a ring that is too short shows up as numbers.
+//
+// Without GL 4.4 there is a single region, orphaned by every beginFrame(): the driver hands out
+// fresh storage and keeps the old one alive for the draws still reading it. Mapped ranges are
+// then unmapped by flush() before drawing, and allocations after that map what is left.
+class RingBuffer
+{
+public:
+    struct Allocation
+    {
+        void* Data = nullptr;
+        // from the start of the buffer, as glBindBufferRange wants it
+        GLintptr Offset = 0;
+        GLsizeiptr Size = 0;
+    };
+
+    unsigned int ID;
+    GLenum Target;
+    GLsizeiptr RegionSize;
+    // false when falling back to orphaning
+    bool Persistent;
+
+    RingBuffer(GLenum target, GLsizeiptr regionSize, int regions = 3, bool persistent = true)
+        : Target(target), RegionSize(regionSize), Persistent(persistent && glExtensions.PersistentMapping),
+          fences(Persistent ? std::max(regions, 1) : 1, nullptr)
+    {
+        GLint offsetAlignment = 4;
+        if (target == GL_UNIFORM_BUFFER)
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offsetAlignment);
+        alignment = std::max<GLsizeiptr>(offsetAlignment, 4);
+
+        glGenBuffers(1, &ID);
+        glState.bindBuffer(Target, ID);
+        if (Persistent)
+        {
+            GLsizeiptr size = RegionSize * (GLsizeiptr)fences.size();
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glExtensions.BufferStorage(Target, size, nullptr, flags);
+            mapped = (unsigned char*)glMapBufferRange(Target, 0, size, flags);
+            if (mapped == nullptr)
+                std::cout << "ERROR::RING_BUFFER::MAP_FAILED" << std::endl;
+        }
+        else
+        {
+            glBufferData(Target, RegionSize, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    int regions() const
+    {
+        return (int)fences.size();
+    }
+
+    // Moves on to the next region, waiting until the GPU is done with it
+    void beginFrame()
+    {
+        endFrame();
+        region = (region + 1) % fences.size();
+        head = 0;
+
+        if (Persistent)
+        {
+            wait(region);
+            return;
+        }
+
+        glState.bindBuffer(Target, ID);
+        glBufferData(Target, RegionSize, nullptr, GL_STREAM_DRAW);
+    }
+
+    // Size bytes at the buffer's offset alignment. A full region is treated as the end of a frame,
+    // so callers issuing more than a region per frame (benchmarks) wrap around and wait instead.
+    Allocation allocate(GLsizeiptr size)
+    {
+        Allocation allocation;
+        if (size > RegionSize)
+        {
+            std::cout << "ERROR::RING_BUFFER::ALLOCATION_LARGER_THAN_REGION " << size << std::endl;
+            return allocation;
+        }
+
+        GLsizeiptr offset = (head + alignment - 1) / alignment * alignment;
+        if (offset + size > RegionSize)
+        {
+            beginFrame();
+            offset = 0;
+        }
+        head = offset + size;
+
+        allocation.Offset = region * RegionSize + offset;
+        allocation.Size = size;
+        if (Persistent)
+        {
+            allocation.Data = mapped + allocation.Offset;
+            return allocation;
+        }
+
+        // unsynchronized is safe, nothing queued reads past head of the current storage
+        if (mapped == nullptr)
+        {
+            glState.bindBuffer(Target, ID);
+            mappedFrom = offset;
+            mapped = (unsigned char*)glMapBufferRange(Target, offset, RegionSize - offset,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        }
+        allocation.Data = mapped + (offset - mappedFrom);
+        return allocation;
+    }
+
+    // Makes what was written visible to the draws that follow. The persistent mapping is coherent,
+    // so only the orphaning fallback has something to do: unmap.
+    void flush()
+    {
+        if (Persistent || mapped == nullptr)
+            return;
+
+        glState.bindBuffer(Target, ID);
+        glUnmapBuffer(Target);
+        mapped = nullptr;
+    }
+
+    // Fences the region after the last draw reading it
+    void endFrame()
+    {
+        flush();
+        if (Persistent && head > 0 && fences[region] == nullptr)
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    GLsizeiptr alignment = 4;
+    std::vector<GLsync> fences;
+    int region = 0;
+    // next free byte of the region
+    GLsizeiptr head = 0;
+    unsigned char* mapped = nullptr;
+    // start of the mapped range in the region, orphaning only
+    GLsizeiptr mappedFrom = 0;
+
+    void wait(int index)
+    {
+        GLsync fence = fences[index];
+        if (fence == nullptr)
+            return;
+
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            Clock::time_point start = Clock::now();
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED)
+                ;
+            frameStats.fenceWaits++;
+            frameStats.fenceWaitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+
+        glDeleteSync(fence);
+        fences[index] = nullptr;
+    }
+};
+#endif
@@ -0,0 +1,116 @@
+#ifndef SCULPTURE_H
+#define SCULPTURE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include "mesh.hpp"
+
+// Procedural stand-in for a scanned sculpture: a sphere grid displaced by layered waves.
+// Scanners emit triangles in no useful order, so scanOrder shuffles triangles and vertices.
+inline Mesh generateSculpture(int rings, int segments, unsigned int seed, bool scanOrder = true)
+{
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> phase(0.0f, glm::two_pi<float>());
+    glm::vec3 phases[3] = {
+        glm::vec3(phase(random), phase(random), phase(random)),
+        glm::vec3(phase(random), phase(random), phase(random)),
+        glm::vec3(phase(random), phase(random), phase(random)),
+    };
+
+    Mesh mesh;
+    for (int r = 0; r <= rings; r++)
+    {
+        float v = (float)r / rings;
+        float theta = v * glm::pi<float>();
+
+        for (int s = 0; s <= segments; s++)
+        {
+            float u = (float)s / segments;
+            float phi = u * glm::two_pi<float>();
+            glm::vec3 direction(glm::sin(theta) * glm::cos(phi), glm::cos(theta), glm::sin(theta) * glm::sin(phi));
+
+            float radius = 1.0f;
+            for (int octave = 0; octave < 3; octave++)
+            {
+                float frequency = 2.0f * (octave + 1);
+                glm::vec3 wave = glm::sin(direction * frequency + phases[octave]);
+                radius += 0.15f / (octave + 1) * wave.x * wave.y * wave.z;
+            }
+
+            mesh.vertices.push_back({ direction * radius, direction, glm::vec2(u, v) });
+        }
+    }
+
+    int stride = segments + 1;
+    for (int r = 0; r < rings; r++)
+    {
+        for (int s = 0; s < segments; s++)
+        {
+            // counter-clockwise seen from outside, the quads touching a pole collapse to one triangle
+            unsigned int a = r * stride + s;
+            unsigned int b = a + stride;
+            if (r > 0)
+                mesh.indices.insert(mesh.indices.end(), { a, a + 1, b });
+            if (r < rings - 1)
+                mesh.indices.insert(mesh.indices.end(), { a + 1, b + 1, b });
+        }
+    }
+
+    // smooth normals from the displaced surface
+    std::vector<glm::vec3> normals(mesh.vertices.size(), glm::vec3(0.0f));
+    for (size_t i = 0; i < mesh.indices.size(); i += 3)
+    {
+        glm::vec3 a = mesh.vertices[mesh.indices[i]].position;
+        glm::vec3 b = mesh.vertices[mesh.indices[i + 1]].position;
+        glm::vec3 c = mesh.vertices[mesh.indices[i + 2]].position;
+        glm::vec3 n = glm::cross(b - a, c - a);
+        for (int k = 0; k < 3; k++)
+            normals[mesh.indices[i + k]] += n;
+    }
+    for (size_t i = 0; i < normals.size(); i++)
+    {
+        if (glm::length(normals[i]) > 0.0f)
+            mesh.vertices[i].normal = glm::normalize(normals[i]);
+    }
+
+    if (scanOrder)
+    {
+        size_t triangleCount = mesh.indices.size() / 3;
+        std::vector<size_t> triangles(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++)
+            triangles[t] = t;
+        std::shuffle(triangles.begin(), triangles.end(), random);
+
+        std::vector<unsigned int> vertexOrder(mesh.vertices.size());
+        for (size_t v = 0; v < vertexOrder.size(); v++)
+            vertexOrder[v] = (unsigned int)v;
+        std::shuffle(vertexOrder.begin(), vertexOrder.end(), random);
+
+        std::vector<unsigned int> remap(mesh.vertices.size());
+        std::vector<Vertex> vertices(mesh.vertices.size());
+        for (size_t v = 0; v < vertexOrder.size(); v++)
+        {
+            remap[vertexOrder[v]] = (unsigned int)v;
+            vertices[v] = mesh.vertices[vertexOrder[v]];
+        }
+
+        std::vector<unsigned int> indices;
+        indices.reserve(mesh.indices.size());
+        for (size_t t : triangles)
+        {
+            for (int k = 0; k < 3; k++)
+                indices.push_back(remap[mesh.indices[t * 3 + k]]);
+        }
+
+        mesh.vertices.swap(vertices);
+        mesh.indices.swap(indices);
+    }
+
+    return mesh;
+}
+#endif
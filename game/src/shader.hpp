@@ -9,12 +9,15 @@
 #include <sstream>
 #include <iostream>
 
+#include "gl_state.hpp"
+
 class Shader
 {
 public:
     unsigned int ID;
 
-    Shader(const char* vertexPath, const char* fragmentPath)
+    // defines are inserted right after the #version line of both stages
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string& defines = "")
     {
         std::string vertexSource;
         std::string fragmentSource;
@@ -43,6 +46,8 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
+        insertDefines(vertexSource, defines);
+        insertDefines(fragmentSource, defines);
         const char* vShaderSource = vertexSource.c_str();
         const char* fShaderSource = fragmentSource.c_str();
         
@@ -73,7 +78,7 @@ public:
 
     void use() const
     { 
-        glUseProgram(ID); 
+        glState.useProgram(ID);
     }
 
 
@@ -136,7 +141,25 @@ public:
         glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
     }
 
+    // Reads the uniform block from whatever glBindBufferRange puts at binding, blocks the program
+    // does not use are ignored
+    void setUniformBlock(const std::string &name, unsigned int binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+
 private:
+    static void insertDefines(std::string& source, const std::string& defines)
+    {
+        if (defines.empty())
+            return;
+
+        size_t lineEnd = source.find('\n');
+        source.insert(lineEnd == std::string::npos ? source.size() : lineEnd + 1, defines);
+    }
+
     void checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
@@ -2,42 +2,91 @@
 
 precision mediump float;
 
+#ifdef TEXEL_SHADING
+// see ShadingCache, the light each texture colour is multiplied with
+layout (location = 0) out vec4 DiffuseLight;
+layout (location = 1) out vec4 SpecularLight;
+#else
 out vec4 FragColor;
+#endif
 
 struct Material {
-    sampler2D diffuse;
-    sampler2D specular;
     float shininess;
     vec3 scale;
     vec3 translate;
-    int sampleSpace;
+    // multiplies the diffuse texture's alpha, 1 for solid materials
+    float opacity;
+    // fragments with less alpha are discarded, 0 keeps them all, see MaterialPass
+    float alphaCutoff;
 };
 
+// std140, each vec3 shares its 16 bytes with a float, matches SpotLight in game.cpp
 struct Light {
     vec3 position;
-    vec3 direction;
     float cutOff;
+    vec3 direction;
     float outerCutOff;
 
     vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
     float constant;
+    vec3 diffuse;
     float linear;
+    vec3 specular;
     float quadratic;
 };
 
 #define MAX_LIGHTS 5
+#define MAX_MATERIALS 8
 
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+flat in int SampleSpace;
+flat in int TextureLayer;
+flat in int MaterialIndex;
+in vec2 LightmapTexel;
+flat in int Lightmapped;
+
+// per frame, streamed through a RingBuffer
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+layout (std140) uniform Lights
+{
+    Light lights[MAX_LIGHTS];
+    // per light, what its baked channel is scaled by this frame
+    vec4 lightmapScale[2];
+    int lightmapEnabled;
+    int shadowsEnabled;
+    int texelShadingEnabled;
+    int lightVolumeEnabled;
+    // per light, world space to its ShadowAtlas tile
+    mat4 shadowMatrix[MAX_LIGHTS];
+    // see LightVolume, world position of voxel 0 in xyz, voxels per metre in w
+    vec4 lightVolumeOrigin;
+};
 
-uniform vec3 viewPos;
 // uniform float time;
-uniform Material material;
-uniform Light lights[MAX_LIGHTS];
+uniform Material materials[MAX_MATERIALS];
+uniform sampler2DArray diffuseTexture;
+uniform sampler2DArray specularTexture;
+// see Lightmap, layer 0 holds lights 0-3, layer 1 light 4 and the ambient in gba
+uniform sampler2DArray lightmap;
+// see ShadowAtlas, what static geometry casts and what moving instances cast this frame
+uniform sampler2DShadow staticShadows;
+uniform sampler2DShadow dynamicShadows;
+// see LightVolume, each component holds two signed 16 bit channels: lights 0-4 then the ambient
+uniform usampler3D lightVolume;
+#ifndef TEXEL_SHADING
+// see ShadingCache, laid out like the lightmap
+uniform sampler2DArray shadedTexels;
+#endif
+
+Material material; // materials[MaterialIndex], picked at the start of main
 
 vec3 quantize(vec3 v, float factor)
 {
@@ -125,7 +174,21 @@ float cnoise(vec3 P) {
     return 2.2 * n_xyz;
 }
 
-vec3 calcLight(Light light, vec3 normal, vec3 fragPos, vec3 viewPos, vec2 uv)
+// How much of light i reaches the fragment, the surface is pushed out along its normal against acne
+float calcShadow(int i, vec3 normal)
+{
+    if (shadowsEnabled == 0)
+        return 1.0;
+
+    vec4 shadowPos = shadowMatrix[i] * vec4(FragPos + normalize(normal) * 0.03, 1.0);
+    if (shadowPos.w <= 0.0)
+        return 1.0;
+    shadowPos.xyz /= shadowPos.w;
+    return texture(staticShadows, shadowPos.xyz) * texture(dynamicShadows, shadowPos.xyz);
+}
+
+// Adds what the light multiplies the diffuse and the specular texture colours by
+void calcLight(Light light, float shadow, vec3 normal, vec3 fragPos, vec3 viewPos, inout vec3 diffuseLight, inout vec3 specularLight)
 {
 
     // fragPos = quantize(fragPos, 1.0f);
@@ -133,25 +196,25 @@ vec3 calcLight(Light light, vec3 normal, vec3 fragPos, vec3 viewPos, vec2 uv)
     normal = normalize(normal);
 
     // ambient
-    vec3 ambient = light.ambient * texture(material.diffuse, uv).rgb;
+    vec3 ambient = light.ambient;
 
     // diffuse
     vec3 lightDir = normalize(quantize(light.position, 16.0f) - fragPos);
     float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, uv).rgb;
+    vec3 diffuse = light.diffuse * diff;
 
     // specular
     vec3 viewDir = normalize(quantize(viewPos, 16.0f) - fragPos);
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.specular, uv).rgb;
+    vec3 specular = light.specular * spec;
 
     // spotlight
     float theta = dot(lightDir, normalize(-light.direction));
     float epsilon = (light.cutOff - light.outerCutOff);
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-    diffuse *= intensity;
-    specular *= intensity;
+    diffuse *= intensity * shadow;
+    specular *= intensity * shadow;
 
     // attenuation
     float distance = length(quantize(light.position, 16.0f) - fragPos);
@@ -173,7 +236,75 @@ vec3 calcLight(Light light, vec3 normal, vec3 fragPos, vec3 viewPos, vec2 uv)
 
     ambient = mix(ambient, vec3(0.0), cnoise(fragPos/2.0f)* 0.7 * cnoise(fragPos) + cnoise(fragPos*5.f)*0.3 );
 
-    return ambient + diffuse + specular;
+    diffuseLight += ambient + diffuse;
+    specularLight += specular;
+}
+
+// calcLight() for a lightmapped surface, the spotlight, attenuation and shadow come baked
+void calcBakedLight(Light light, float baked, vec3 normal, vec3 fragPos, vec3 viewPos, inout vec3 diffuseLight, inout vec3 specularLight)
+{
+    vec3 lightDir = normalize(quantize(light.position, 16.0f) - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+
+    vec3 viewDir = normalize(quantize(viewPos, 16.0f) - fragPos);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+
+    diffuseLight += light.diffuse * diff * baked;
+    specularLight += light.specular * spec * baked;
+}
+
+// A LightVolume channel, keep in sync with LightVolume::RANGE
+float lightVolumeChannel(uint bits)
+{
+    int value = int(bits & 0xFFFFu);
+    return float(value >= 32768 ? value - 65536 : value) * (8.0 / 32767.0);
+}
+
+// Every light at a fragment snapped to the grid, from the lightmap where the surface has one and
+// from the light volume where it covers the fragment
+void shadeSurface(vec3 fragPos, inout vec3 diffuseLight, inout vec3 specularLight)
+{
+    ivec3 voxel = ivec3(floor((fragPos - lightVolumeOrigin.xyz) * lightVolumeOrigin.w + 0.5));
+    bool inVolume = lightVolumeEnabled != 0 && all(greaterThanEqual(voxel, ivec3(0))) && all(lessThan(voxel, textureSize(lightVolume, 0)));
+
+    if (lightmapEnabled != 0 && Lightmapped != 0)
+    {
+        ivec2 texel = ivec2(LightmapTexel);
+        vec4 baked0 = texelFetch(lightmap, ivec3(texel, 0), 0);
+        vec4 baked1 = texelFetch(lightmap, ivec3(texel, 1), 0);
+        float baked[MAX_LIGHTS] = float[](baked0.r, baked0.g, baked0.b, baked0.a, baked1.r);
+
+        vec3 normal = normalize(Normal);
+        diffuseLight += baked1.gba;
+        for (int i = 0; i < MAX_LIGHTS; i++)
+        {
+            if (baked[i] > 0.0)
+                calcBakedLight(lights[i], baked[i] * lightmapScale[i / 4][i % 4] * calcShadow(i, normal), normal, fragPos, viewPos, diffuseLight, specularLight);
+        }
+    }
+    else if (inVolume)
+    {
+        uvec4 channels = texelFetch(lightVolume, voxel, 0);
+        float direct[MAX_LIGHTS] = float[](lightVolumeChannel(channels.x), lightVolumeChannel(channels.x >> 16), lightVolumeChannel(channels.y),
+            lightVolumeChannel(channels.y >> 16), lightVolumeChannel(channels.z));
+
+        vec3 normal = normalize(Normal);
+        diffuseLight += vec3(lightVolumeChannel(channels.z >> 16), lightVolumeChannel(channels.w), lightVolumeChannel(channels.w >> 16));
+        for (int i = 0; i < MAX_LIGHTS; i++)
+        {
+            // the bands below the first step are negative
+            if (direct[i] != 0.0)
+                calcBakedLight(lights[i], direct[i] * calcShadow(i, normal), normal, fragPos, viewPos, diffuseLight, specularLight);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < MAX_LIGHTS; i++)
+        {
+            calcLight(lights[i], calcShadow(i, Normal), Normal, fragPos, viewPos, diffuseLight, specularLight);
+        }
+    }
 }
 
 
@@ -207,29 +338,59 @@ vec3 colorGrade(vec3 color, float contrast, float highlights, float shadows) {
     return color;
 }
 
+#ifdef TEXEL_SHADING
 void main()
 {
+    material = materials[MaterialIndex];
+
+    vec3 diffuseLight = vec3(0.0);
+    vec3 specularLight = vec3(0.0);
+    shadeSurface(quantize(FragPos, 16.0f), diffuseLight, specularLight);
+
+    DiffuseLight = vec4(diffuseLight, 1.0);
+    SpecularLight = vec4(specularLight, 1.0);
+}
+#else
+void main()
+{
+    material = materials[MaterialIndex];
+
     vec3 uvw = vec3(1.0f) * material.scale + material.translate;
-    if (material.sampleSpace == 0) uvw *= vec3(TexCoords, 0.0);
-    if (material.sampleSpace == 1) uvw *= vec3(FragPos.xz, 0.0);
-    if (material.sampleSpace == 2) uvw *= vec3(FragPos.xy, 0.0);
-    if (material.sampleSpace == 3) uvw *= vec3(FragPos.zy, 0.0);
+    if (SampleSpace == 0) uvw *= vec3(TexCoords, 0.0);
+    if (SampleSpace == 1) uvw *= vec3(FragPos.xz, 0.0);
+    if (SampleSpace == 2) uvw *= vec3(FragPos.xy, 0.0);
+    if (SampleSpace == 3) uvw *= vec3(FragPos.zy, 0.0);
     vec2 uv = uvw.xy;
 
-    vec3 color = vec3(0.0);
-    vec3 fragPos = quantize(FragPos, 16.0f);
-
-    for (int i = 0; i < MAX_LIGHTS; i++)
+    // sampled outside the branches so their derivatives are always defined
+    vec4 diffuseSample = texture(diffuseTexture, vec3(uv, TextureLayer));
+    vec3 diffuseColor = diffuseSample.rgb;
+    vec3 specularColor = texture(specularTexture, vec3(uv, TextureLayer)).rgb;
+    float alpha = diffuseSample.a * material.opacity;
+    if (alpha < material.alphaCutoff)
+        discard;
+
+    vec3 diffuseLight = vec3(0.0);
+    vec3 specularLight = vec3(0.0);
+    if (texelShadingEnabled != 0 && Lightmapped != 0)
+    {
+        ivec2 texel = ivec2(LightmapTexel);
+        diffuseLight = texelFetch(shadedTexels, ivec3(texel, 0), 0).rgb;
+        specularLight = texelFetch(shadedTexels, ivec3(texel, 1), 0).rgb;
+    }
+    else
     {
-        color += calcLight(lights[i], Normal, fragPos, viewPos, uv);
+        shadeSurface(quantize(FragPos, 16.0f), diffuseLight, specularLight);
     }
+    vec3 color = diffuseLight * diffuseColor + specularLight * specularColor;
 
     color = ACESFilmTonemap(color);
     color = colorGrade(color, 1.00, 0.004, 0.0);
 
 
-    FragColor = vec4(color, 1.0);
+    FragColor = vec4(color, alpha);
 }
+#endif
 
 
 
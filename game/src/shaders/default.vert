@@ -1,21 +1,85 @@
 #version 330 core
+#ifdef DRAW_PARAMETERS
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 layout (location = 0) in vec3 aPos;
+#ifdef OCTAHEDRAL_NORMALS
+layout (location = 1) in vec2 aNormal;
+#else
 layout (location = 1) in vec3 aNormal;
+#endif
 layout (location = 2) in vec2 aTexCoords;
 
+// per-instance
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in ivec2 aMaterial; // x: sampleSpace, y: textureLayer
+layout (location = 8) in vec4 aLightmapRect; // xy: texel at TexCoords 0, zw: texels up to 1, zero when not lightmapped
+
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+flat out int SampleSpace;
+flat out int TextureLayer;
+flat out int MaterialIndex;
+out vec2 LightmapTexel;
+flat out int Lightmapped;
+
+#define MAX_DRAWS 64
+
+// the depth prepass runs this shader too, its depths must match exactly for GL_EQUAL
+invariant gl_Position;
+
+// per frame, streamed through a RingBuffer, also declared in default.frag
+layout (std140) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per-draw, indexed by drawBase + gl_DrawIDARB under multi-draw indirect, else by drawID set before each draw
+uniform int drawMaterials[MAX_DRAWS];
+// quantized positions are relative to the mesh bounds, identity for float positions
+uniform vec3 drawPositionOffset[MAX_DRAWS];
+uniform vec3 drawPositionScale[MAX_DRAWS];
+uniform int drawID;
+// index of the first draw of the multi-draw call, StaticScene draws each pass with its own
+uniform int drawBase;
+
+#ifdef OCTAHEDRAL_NORMALS
+// matches VertexFormat::octahedralDecode
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+#endif
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+#ifdef DRAW_PARAMETERS
+    int draw = drawBase + gl_DrawIDARB;
+#else
+    int draw = drawID;
+#endif
+
+#ifdef OCTAHEDRAL_NORMALS
+    vec3 normal = octahedralDecode(aNormal);
+#else
+    vec3 normal = aNormal;
+#endif
+
+    vec3 position = aPos * drawPositionScale[draw] + drawPositionOffset[draw];
+    FragPos = vec3(aModel * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(aModel))) * normal;  
     TexCoords = aTexCoords;
+    SampleSpace = aMaterial.x;
+    TextureLayer = aMaterial.y;
+    MaterialIndex = drawMaterials[draw];
+    LightmapTexel = aLightmapRect.xy + aTexCoords * aLightmapRect.zw;
+    Lightmapped = aLightmapRect.z > 0.0 ? 1 : 0;
     
     gl_Position = projection * view * vec4(FragPos, 1.0);
 }
\ No newline at end of file
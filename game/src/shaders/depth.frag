@@ -0,0 +1,6 @@
+#version 330 core
+
+// Depth prepass, paired with default.vert. Colour writes are masked off so nothing is output.
+void main()
+{
+}
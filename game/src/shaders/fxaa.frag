@@ -0,0 +1,50 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// resolved scene, see AntiAliasing
+uniform sampler2D sceneTexture;
+// fraction of sceneTexture the scene was rendered into
+uniform vec2 uvScale;
+
+#define FXAA_REDUCE_MIN (1.0 / 128.0)
+#define FXAA_REDUCE_MUL (1.0 / 8.0)
+#define FXAA_SPAN_MAX 8.0
+
+float luma(vec3 color)
+{
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// FXAA after Timothy Lottes' console version: the luma gradient around the pixel gives the edge
+// direction, two pairs of taps along it are averaged, the outer pair only where it stays in range
+void main()
+{
+    vec2 texel = 1.0 / vec2(textureSize(sceneTexture, 0));
+    vec2 limit = uvScale - texel * 0.5;
+    vec2 uv = TexCoords * uvScale;
+
+    vec3 rgbM = texture(sceneTexture, uv).rgb;
+    float lumaNW = luma(texture(sceneTexture, min(uv + vec2(-1.0, -1.0) * texel, limit)).rgb);
+    float lumaNE = luma(texture(sceneTexture, min(uv + vec2(1.0, -1.0) * texel, limit)).rgb);
+    float lumaSW = luma(texture(sceneTexture, min(uv + vec2(-1.0, 1.0) * texel, limit)).rgb);
+    float lumaSE = luma(texture(sceneTexture, min(uv + vec2(1.0, 1.0) * texel, limit)).rgb);
+    float lumaM = luma(rgbM);
+    float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+    vec2 dir = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25 * FXAA_REDUCE_MUL), FXAA_REDUCE_MIN);
+    float rcpDirMin = 1.0 / (min(abs(dir.x), abs(dir.y)) + dirReduce);
+    dir = clamp(dir * rcpDirMin, vec2(-FXAA_SPAN_MAX), vec2(FXAA_SPAN_MAX)) * texel;
+
+    vec3 rgbA = 0.5 * (texture(sceneTexture, min(uv + dir * (1.0 / 3.0 - 0.5), limit)).rgb
+        + texture(sceneTexture, min(uv + dir * (2.0 / 3.0 - 0.5), limit)).rgb);
+    vec3 rgbB = rgbA * 0.5 + 0.25 * (texture(sceneTexture, min(uv - dir * 0.5, limit)).rgb
+        + texture(sceneTexture, min(uv + dir * 0.5, limit)).rgb);
+
+    float lumaB = luma(rgbB);
+    FragColor = vec4(lumaB < lumaMin || lumaB > lumaMax ? rgbA : rgbB, 1.0);
+}
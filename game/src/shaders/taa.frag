@@ -0,0 +1,48 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// this frame resolved, rendered with a jittered projection, see AntiAliasing
+uniform sampler2D currentFrame;
+// what the frames before accumulated to
+uniform sampler2D history;
+uniform sampler2D depthTexture;
+// fraction of the textures the scene was rendered into
+uniform vec2 uvScale;
+// NDC of this frame to clip space of the last one
+uniform mat4 reprojection;
+// 1.0 restarts the history
+uniform float currentWeight;
+
+void main()
+{
+    vec2 texel = 1.0 / vec2(textureSize(currentFrame, 0));
+    vec2 uv = TexCoords * uvScale;
+    vec3 current = texture(currentFrame, uv).rgb;
+
+    // colours around the pixel bound what the history may hold
+    vec3 low = current;
+    vec3 high = current;
+    for (int y = -1; y <= 1; y++)
+    {
+        for (int x = -1; x <= 1; x++)
+        {
+            vec3 neighbour = texture(currentFrame, clamp(uv + vec2(x, y) * texel, vec2(0.0), uvScale - texel * 0.5)).rgb;
+            low = min(low, neighbour);
+            high = max(high, neighbour);
+        }
+    }
+
+    float depth = texture(depthTexture, uv).r;
+    vec4 previous = reprojection * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    vec2 previousCoords = previous.xy / previous.w * 0.5 + 0.5;
+
+    float weight = currentWeight;
+    if (previous.w <= 0.0 || any(lessThan(previousCoords, vec2(0.0))) || any(greaterThan(previousCoords, vec2(1.0))))
+        weight = 1.0;
+
+    vec3 accumulated = clamp(texture(history, previousCoords * uvScale).rgb, low, high);
+    FragColor = vec4(mix(accumulated, current, weight), 1.0);
+}
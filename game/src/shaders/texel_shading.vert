@@ -0,0 +1,39 @@
+#version 330 core
+// A ShadingBlock, drawn into the ShadingCache atlas with default.frag built with TEXEL_SHADING
+layout (location = 0) in vec2 aCorner;
+
+// per-instance
+layout (location = 1) in vec4 aRect; // xy: first texel, zw: texels
+layout (location = 2) in vec3 aOrigin;
+layout (location = 3) in vec3 aStepU;
+layout (location = 4) in vec3 aStepV;
+layout (location = 5) in vec3 aNormal;
+layout (location = 6) in int aMaterial;
+
+// what default.vert hands default.frag
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+flat out int SampleSpace;
+flat out int TextureLayer;
+flat out int MaterialIndex;
+out vec2 LightmapTexel;
+flat out int Lightmapped;
+
+uniform vec2 atlasSize;
+
+void main()
+{
+    // texel centres sit half a texel in, where FragPos lands on aOrigin + aStepU * x + aStepV * y
+    vec2 texels = aCorner * aRect.zw;
+    FragPos = aOrigin + aStepU * (texels.x - 0.5) + aStepV * (texels.y - 0.5);
+    Normal = aNormal;
+    TexCoords = vec2(0.0);
+    SampleSpace = 0;
+    TextureLayer = 0;
+    MaterialIndex = aMaterial;
+    LightmapTexel = aRect.xy + texels;
+    Lightmapped = 1;
+
+    gl_Position = vec4(LightmapTexel / atlasSize * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,30 @@
+#version 330 core
+
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D sceneTexture;
+// fraction of sceneTexture the scene was rendered into
+uniform vec2 uvScale;
+// unsharp mask strength, grows as the render scale drops
+uniform float sharpness;
+
+void main()
+{
+    vec2 uv = TexCoords * uvScale;
+    vec2 texel = 1.0 / vec2(textureSize(sceneTexture, 0));
+    vec2 limit = uvScale - texel * 0.5;
+
+    vec3 center = texture(sceneTexture, min(uv, limit)).rgb;
+    vec3 left = texture(sceneTexture, min(uv - vec2(texel.x, 0.0), limit)).rgb;
+    vec3 right = texture(sceneTexture, min(uv + vec2(texel.x, 0.0), limit)).rgb;
+    vec3 down = texture(sceneTexture, min(uv - vec2(0.0, texel.y), limit)).rgb;
+    vec3 up = texture(sceneTexture, min(uv + vec2(0.0, texel.y), limit)).rgb;
+
+    // clamped to the neighbourhood so edges do not ring
+    vec3 sharpened = center + (center - (left + right + down + up) * 0.25) * sharpness * 2.0;
+    vec3 low = min(center, min(min(left, right), min(down, up)));
+    vec3 high = max(center, max(max(left, right), max(down, up)));
+    FragColor = vec4(clamp(sharpened, low, high), 1.0);
+}
@@ -0,0 +1,225 @@
+#ifndef SHADING_CACHE_H
+#define SHADING_CACHE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <iostream>
+#include <cstddef>
+#include <unordered_map>
+
+#include "lightmap.hpp"
+#include "static_scene.hpp"
+#include "bvh.hpp"
+#include "shader.hpp"
+#include "stats.hpp"
+#include "gl_state.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                Shading Cache                               */
+/* -------------------------------------------------------------------------- */
+
+// A square of texels of one chart to shade, read per instance by texel_shading.vert
+struct ShadingBlock
+{
+    // first texel and size, in atlas texels
+    glm::vec4 Rect = glm::vec4(0.0f);
+    // world position of the first texel, and the step to the next one along each axis
+    glm::vec3 Origin = glm::vec3(0.0f);
+    int Material = 0;
+    glm::vec3 StepU = glm::vec3(0.0f);
+    glm::vec3 StepV = glm::vec3(0.0f);
+    glm::vec3 Normal = glm::vec3(0.0f);
+};
+
+
+// Lighting of the room surfaces evaluated once per texel instead of once per pixel. default.frag
+// snaps fragments to a 1/16 m grid, so every pixel of a grid cell computes the same light; only the
+// texture colours it is multiplied with change across the cell. A pass before the frame shades the
+// texels of the Lightmap charts the camera can see, with default.frag built with TEXEL_SHADING,
+// into two layers: the light multiplied by the diffuse colour and the light multiplied by the
+// specular colour. The main pass fetches both at the fragment's lightmap texel, so the shading cost
+// follows the visible surface area rather than the resolution.
+// The atlas shares the Lightmap's layout. plan() picks blocks of BLOCK_SIZE texels from the culled
+// draw list on the CPU, render() shades them on the thread owning the context.
+class ShadingCache
+{
+public:
+    static const int BLOCK_SIZE = 16;
+    static const int LAYERS = 2;
+
+    int Width = 0;
+    int Height = 0;
+    unsigned int Texture = 0;
+
+    // of the last plan()
+    unsigned int Blocks = 0;
+    unsigned long long Texels = 0;
+
+    void create(const Lightmap& lightmap)
+    {
+        Width = lightmap.Width;
+        Height = lightmap.Height;
+        for (size_t i = 0; i < lightmap.Charts.size(); i++)
+            chartAt[texelIndex(lightmap.Charts[i].Origin)] = (int)i;
+
+        glGenTextures(1, &Texture);
+        glState.bindTexture(GL_TEXTURE_2D_ARRAY, Texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16F, Width, Height, LAYERS, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        GLenum attachments[LAYERS];
+        for (int layer = 0; layer < LAYERS; layer++)
+        {
+            attachments[layer] = GL_COLOR_ATTACHMENT0 + layer;
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, attachments[layer], Texture, 0, layer);
+        }
+        glDrawBuffers(LAYERS, attachments);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADING_CACHE::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // a unit quad drawn once per block
+        const float corners[] = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f };
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &quadVBO);
+        glGenBuffers(1, &blockVBO);
+        glState.bindVertexArray(vao);
+        glState.bindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+
+        glState.bindBuffer(GL_ARRAY_BUFFER, blockVBO);
+        auto attribute = [](unsigned int location, int size, size_t offset) {
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, sizeof(ShadingBlock), (void*)offset);
+            glVertexAttribDivisor(location, 1);
+        };
+        attribute(1, 4, offsetof(ShadingBlock, Rect));
+        attribute(2, 3, offsetof(ShadingBlock, Origin));
+        attribute(3, 3, offsetof(ShadingBlock, StepU));
+        attribute(4, 3, offsetof(ShadingBlock, StepV));
+        attribute(5, 3, offsetof(ShadingBlock, Normal));
+        glEnableVertexAttribArray(6);
+        glVertexAttribIPointer(6, 1, GL_INT, sizeof(ShadingBlock), (void*)offsetof(ShadingBlock, Material));
+        glVertexAttribDivisor(6, 1);
+        glState.bindVertexArray(0);
+    }
+
+    // Blocks of the charts under the visible lightmapped instances that face the camera and
+    // intersect its frustum. A block's bounds grow by half a texel, as far as the grid cells of
+    // its texels reach.
+    void plan(const DrawList& visible, const StaticScene& scene, const Lightmap& lightmap, const glm::mat4& viewProjection,
+        const glm::vec3& viewPos, std::vector<ShadingBlock>* blocks)
+    {
+        blocks->clear();
+        Texels = 0;
+        Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+        for (size_t draw = 0; draw < visible.Commands.size(); draw++)
+        {
+            const DrawElementsIndirectCommand& command = visible.Commands[draw];
+            for (GLuint i = command.baseInstance; i < command.baseInstance + command.instanceCount; i++)
+            {
+                const glm::vec4& rect = visible.Instances[i].lightmapRect;
+                if (rect.z <= 0.0f)
+                    continue;
+                auto found = chartAt.find(texelIndex(glm::ivec2(rect)));
+                if (found == chartAt.end())
+                    continue;
+
+                const Lightmap::Chart& chart = lightmap.Charts[found->second];
+                if (glm::dot(chart.Normal, viewPos - chart.Corner) <= 0.0f)
+                    continue;
+
+                glm::vec3 cell = (glm::abs(chart.StepU) + glm::abs(chart.StepV)) * 0.5f;
+                for (int y = 0; y < chart.Size.y; y += BLOCK_SIZE)
+                {
+                    for (int x = 0; x < chart.Size.x; x += BLOCK_SIZE)
+                    {
+                        glm::ivec2 size = glm::min(glm::ivec2(BLOCK_SIZE), chart.Size - glm::ivec2(x, y));
+                        glm::vec3 origin = chart.Corner + chart.StepU * (float)x + chart.StepV * (float)y;
+                        glm::vec3 last = origin + chart.StepU * (float)(size.x - 1) + chart.StepV * (float)(size.y - 1);
+
+                        AABB bounds;
+                        bounds.expand(glm::min(origin, last) - cell);
+                        bounds.expand(glm::max(origin, last) + cell);
+                        if (frustum.classify(bounds) == Visibility::OUTSIDE)
+                            continue;
+
+                        ShadingBlock block;
+                        block.Rect = glm::vec4(glm::vec2(chart.Origin + glm::ivec2(x, y)), glm::vec2(size));
+                        block.Origin = origin;
+                        block.Material = scene.drawMaterial((int)draw);
+                        block.StepU = chart.StepU;
+                        block.StepV = chart.StepV;
+                        block.Normal = chart.Normal;
+                        blocks->push_back(block);
+                        Texels += (unsigned long long)size.x * size.y;
+                    }
+                }
+            }
+        }
+        Blocks = (unsigned int)blocks->size();
+    }
+
+    // shader is texel_shading.vert with default.frag built with TEXEL_SHADING, its Camera and Lights
+    // blocks bound for the frame. Restores the framebuffer and viewport it found, and the depth test
+    // and culling setGlGlobalSettings() turns on.
+    void render(const std::vector<ShadingBlock>& blocks, const Shader& shader)
+    {
+        if (blocks.empty())
+            return;
+
+        GLint framebuffer = 0;
+        GLint viewport[4];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glViewport(0, 0, Width, Height);
+        // every texel is written once, as it is
+        glState.disable(GL_DEPTH_TEST);
+        glState.disable(GL_CULL_FACE);
+
+        glState.bindBuffer(GL_ARRAY_BUFFER, blockVBO);
+        glBufferData(GL_ARRAY_BUFFER, blocks.size() * sizeof(ShadingBlock), blocks.data(), GL_STREAM_DRAW);
+        shader.use();
+        shader.setVec2("atlasSize", glm::vec2(Width, Height));
+        glState.bindVertexArray(vao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)blocks.size());
+        frameStats.drawCalls++;
+
+        glState.enable(GL_DEPTH_TEST);
+        glState.enable(GL_CULL_FACE);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    size_t memoryBytes() const
+    {
+        // four half floats per texel on the GPU
+        return (size_t)Width * Height * LAYERS * 8;
+    }
+
+private:
+    unsigned int fbo = 0;
+    unsigned int vao = 0;
+    unsigned int quadVBO = 0;
+    unsigned int blockVBO = 0;
+    // chart index by the atlas texel of its first texel, which is where an instance's lightmapRect starts
+    std::unordered_map<int, int> chartAt;
+
+    int texelIndex(const glm::ivec2& texel) const
+    {
+        return texel.y * Width + texel.x;
+    }
+};
+#endif
@@ -0,0 +1,365 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <functional>
+#include <iostream>
+#include <algorithm>
+
+#include "static_scene.hpp"
+#include "bvh.hpp"
+#include "gl_state.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                Shadow Atlas                                */
+/* -------------------------------------------------------------------------- */
+
+// One planned shadow pass, rendered into Tile of the static atlas or of the dynamic overlay
+struct ShadowPass
+{
+    int Light = 0;
+    bool Dynamic = false;
+    glm::ivec2 Origin = glm::ivec2(0);
+    int Size = 0;
+    glm::mat4 View = glm::mat4(1.0f);
+    glm::mat4 Projection = glm::mat4(1.0f);
+    // empty for a pass that only clears what the tile held last frame
+    DrawList Casters;
+};
+
+// Everything the renderer needs for a frame's shadows, built by ShadowAtlas::plan()
+struct ShadowFrame
+{
+    static const int MAX_LIGHTS = 5;
+
+    std::vector<ShadowPass> Passes;
+    // light space to atlas texture coordinates and depth, per light
+    glm::mat4 Matrices[MAX_LIGHTS];
+    // the whole overlay is cleared first, after tiles moved
+    bool ClearOverlay = false;
+    // static passes drawn and reused from the cache, overlay passes drawn and skipped
+    unsigned int StaticPasses = 0;
+    unsigned int StaticSkipped = 0;
+    unsigned int OverlayPasses = 0;
+    unsigned int OverlaySkipped = 0;
+};
+
+
+// Spotlight shadow maps, one square tile per light in a depth atlas. What the static geometry casts
+// is rendered once and kept until the scene's static instances move, the light leaves its frustum
+// or its tile changes. Each light is given a frustum a few degrees wider than its cone, so the
+// flicker and breathing of the gallery's spots stay inside it. Dynamic instances are rendered
+// every frame into an overlay atlas with the same layout, and only for lights they are in front
+// of; default.frag takes the nearer of the two depths.
+// Tile sizes follow how much of the screen each light can reach, powers of two packed in Morton
+// order, and only change when the wanted size is well past the current one.
+// plan() only touches CPU memory and runs with the culling, render() replays its passes on the
+// thread owning the context.
+class ShadowAtlas
+{
+public:
+    static const int MAX_LIGHTS = ShadowFrame::MAX_LIGHTS;
+
+    int Size;
+    int MinTile;
+    int MaxTile;
+    // spare cone around each light's, in degrees
+    float Margin = 4.0f;
+    // off renders every pass every frame, for comparisons
+    bool Caching = true;
+    float Near = 0.05f;
+    float Far = 40.0f;
+
+    unsigned int StaticDepth = 0;
+    unsigned int DynamicDepth = 0;
+
+    ShadowAtlas(int size = 2048, int minTile = 128, int maxTile = 1024) : Size(size), MinTile(minTile), MaxTile(maxTile) {}
+
+    void create()
+    {
+        createTarget(&StaticDepth, &staticFBO);
+        createTarget(&DynamicDepth, &dynamicFBO);
+    }
+
+    // Any struct with the fields of default.frag's Light. Picks tiles, decides which cached maps are
+    // still good and culls the casters of the passes that are not.
+    template <typename Light>
+    void plan(const std::vector<Light>& lights, StaticScene& scene, const glm::mat4& view, const glm::mat4& projection, ShadowFrame* frame)
+    {
+        int lightCount = glm::min((int)lights.size(), MAX_LIGHTS);
+        frame->Passes.clear();
+        frame->StaticPasses = frame->StaticSkipped = frame->OverlayPasses = frame->OverlaySkipped = 0;
+
+        float importance[MAX_LIGHTS] = {};
+        Frustum cameraFrustum = Frustum::fromMatrix(projection * view);
+        for (int i = 0; i < lightCount; i++)
+            importance[i] = screenImportance(lights[i], cameraFrustum, view, projection);
+        frame->ClearOverlay = allocate(importance, lightCount);
+
+        for (int i = 0; i < lightCount; i++)
+        {
+            const Light& light = lights[i];
+            CachedLight& cached = cache[i];
+
+            // the cone has to fit inside the frustum the map was rendered with
+            glm::vec3 axis = glm::normalize(light.direction);
+            float coneAngle = glm::degrees(glm::acos(glm::clamp(light.outerCutOff, -1.0f, 1.0f)));
+            float offAxis = glm::degrees(glm::acos(glm::clamp(glm::dot(axis, cached.Axis), -1.0f, 1.0f)));
+            bool frustumHolds = cached.Valid && light.position == cached.Position && offAxis + coneAngle <= cached.HalfAngle;
+            if (!frustumHolds)
+            {
+                cached.Position = light.position;
+                cached.Axis = axis;
+                cached.HalfAngle = glm::min(coneAngle + Margin, 80.0f);
+                glm::vec3 up = glm::abs(axis.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+                cached.View = glm::lookAt(light.position, light.position + axis, up);
+                cached.Projection = glm::perspective(glm::radians(cached.HalfAngle * 2.0f), 1.0f, Near, Far);
+            }
+
+            ShadowPass pass;
+            pass.Light = i;
+            pass.Origin = tiles[i].Origin;
+            pass.Size = tiles[i].Size;
+            pass.View = cached.View;
+            pass.Projection = cached.Projection;
+            glm::mat4 viewProjection = cached.Projection * cached.View;
+
+            bool cacheHolds = Caching && frustumHolds && cached.StaticVersion == scene.StaticVersion && cached.Origin == pass.Origin && cached.Size == pass.Size;
+            if (cacheHolds)
+            {
+                frame->StaticSkipped++;
+            }
+            else
+            {
+                pass.Dynamic = false;
+                pass.Casters = scene.cullShadowCasters(viewProjection, false);
+                frame->Passes.push_back(pass);
+                frame->StaticPasses++;
+                cached.Valid = true;
+                cached.StaticVersion = scene.StaticVersion;
+                cached.Origin = pass.Origin;
+                cached.Size = pass.Size;
+            }
+
+            // the overlay is redrawn while something moves in front of the light, and cleared once after
+            pass.Dynamic = true;
+            pass.Casters = scene.cullShadowCasters(viewProjection, true);
+            bool overlayUsed = !pass.Casters.Instances.empty();
+            if (frame->ClearOverlay)
+                cached.OverlayUsed = false;
+            if (overlayUsed || cached.OverlayUsed || !Caching)
+            {
+                frame->Passes.push_back(pass);
+                frame->OverlayPasses++;
+            }
+            else
+            {
+                frame->OverlaySkipped++;
+            }
+            cached.OverlayUsed = overlayUsed;
+
+            frame->Matrices[i] = tileMatrix(pass.Origin, pass.Size) * viewProjection;
+        }
+        for (int i = lightCount; i < MAX_LIGHTS; i++)
+            frame->Matrices[i] = glm::mat4(1.0f);
+    }
+
+    // drawCasters sets up the pass's camera and draws its casters with a depth-only shader.
+    // Restores the framebuffer and viewport it found.
+    void render(const ShadowFrame& frame, const std::function<void(const ShadowPass&)>& drawCasters)
+    {
+        if (frame.Passes.empty() && !frame.ClearOverlay)
+            return;
+
+        GLint framebuffer = 0;
+        GLint viewport[4];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+
+        if (frame.ClearOverlay)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, dynamicFBO);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+
+        // slope scaled, together with the normal offset in default.frag
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        glEnable(GL_SCISSOR_TEST);
+        for (const ShadowPass& pass : frame.Passes)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, pass.Dynamic ? dynamicFBO : staticFBO);
+            glViewport(pass.Origin.x, pass.Origin.y, pass.Size, pass.Size);
+            glScissor(pass.Origin.x, pass.Origin.y, pass.Size, pass.Size);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            if (!pass.Casters.Instances.empty())
+                drawCasters(pass);
+        }
+        glDisable(GL_SCISSOR_TEST);
+        glDisable(GL_POLYGON_OFFSET_FILL);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // Current tile of a light, in atlas texels
+    glm::ivec4 tile(int light) const
+    {
+        return glm::ivec4(tiles[light].Origin, tiles[light].Size, tiles[light].Size);
+    }
+
+private:
+    struct Tile
+    {
+        glm::ivec2 Origin = glm::ivec2(0);
+        int Size = 0;
+    };
+
+    struct CachedLight
+    {
+        bool Valid = false;
+        glm::vec3 Position = glm::vec3(0.0f);
+        glm::vec3 Axis = glm::vec3(0.0f, -1.0f, 0.0f);
+        float HalfAngle = 0.0f;
+        glm::mat4 View = glm::mat4(1.0f);
+        glm::mat4 Projection = glm::mat4(1.0f);
+        unsigned long long StaticVersion = 0;
+        glm::ivec2 Origin = glm::ivec2(-1);
+        int Size = 0;
+        bool OverlayUsed = false;
+    };
+
+    Tile tiles[MAX_LIGHTS];
+    CachedLight cache[MAX_LIGHTS];
+    unsigned int staticFBO = 0;
+    unsigned int dynamicFBO = 0;
+
+    void createTarget(unsigned int* texture, unsigned int* fbo)
+    {
+        glGenTextures(1, texture);
+        glState.bindTexture(GL_TEXTURE_2D, *texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, Size, Size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glGenFramebuffers(1, fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, *texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_ATLAS::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+
+        // nothing cached yet reads as lit
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Fraction of the screen height covered by the sphere the light reaches, until its
+    // attenuation drops under the first band of calcLight()
+    template <typename Light>
+    static float screenImportance(const Light& light, const Frustum& cameraFrustum, const glm::mat4& view, const glm::mat4& projection)
+    {
+        const float threshold = 0.07f;
+        float a = light.quadratic;
+        float b = light.linear;
+        float c = light.constant - 1.0f / threshold;
+        float range = a > 0.0f ? (-b + glm::sqrt(b * b - 4.0f * a * c)) / (2.0f * a) : (b > 0.0f ? -c / b : 1000.0f);
+
+        AABB bounds;
+        bounds.expand(light.position - glm::vec3(range));
+        bounds.expand(light.position + glm::vec3(range));
+        if (cameraFrustum.classify(bounds) == Visibility::OUTSIDE)
+            return 0.0f;
+
+        float distance = -(view * glm::vec4(light.position, 1.0f)).z;
+        if (distance <= range)
+            return 1.0f;
+        return glm::min(range * projection[1][1] / distance, 1.0f);
+    }
+
+    static int floorPowerOfTwo(int value)
+    {
+        int power = 1;
+        while (power * 2 <= value)
+            power *= 2;
+        return power;
+    }
+
+    // New tile sizes from importance, true when any tile moved
+    bool allocate(const float* importance, int lightCount)
+    {
+        int sizes[MAX_LIGHTS] = {};
+        for (int i = 0; i < lightCount; i++)
+        {
+            float wanted = importance[i] * Size;
+            int current = tiles[i].Size;
+            if (current == 0 || wanted > current * 2.5f || wanted < current * 0.4f)
+                sizes[i] = glm::clamp(floorPowerOfTwo((int)wanted), MinTile, MaxTile);
+            else
+                sizes[i] = current;
+        }
+
+        // over budget, the largest tiles give way first
+        auto area = [&]() {
+            long long total = 0;
+            for (int i = 0; i < lightCount; i++)
+                total += (long long)sizes[i] * sizes[i];
+            return total;
+        };
+        while (area() > (long long)Size * Size)
+        {
+            int largest = (int)(std::max_element(sizes, sizes + lightCount) - sizes);
+            if (sizes[largest] <= MinTile)
+            {
+                std::cout << "ERROR::SHADOW_ATLAS::OUT_OF_SPACE" << std::endl;
+                break;
+            }
+            sizes[largest] /= 2;
+        }
+
+        // largest first, so every tile lands on a multiple of its size in Morton order
+        int order[MAX_LIGHTS];
+        for (int i = 0; i < lightCount; i++)
+            order[i] = i;
+        std::stable_sort(order, order + lightCount, [&](int a, int b) { return sizes[a] > sizes[b]; });
+
+        bool moved = false;
+        long long used = 0;
+        for (int k = 0; k < lightCount; k++)
+        {
+            int i = order[k];
+            long long index = used / ((long long)sizes[i] * sizes[i]);
+            used += (long long)sizes[i] * sizes[i];
+
+            glm::ivec2 cell(0);
+            for (int bit = 0; bit < 16; bit++)
+            {
+                cell.x |= (int)((index >> (2 * bit)) & 1) << bit;
+                cell.y |= (int)((index >> (2 * bit + 1)) & 1) << bit;
+            }
+
+            Tile tile = { cell * sizes[i], sizes[i] };
+            moved = moved || tile.Origin != tiles[i].Origin || tile.Size != tiles[i].Size;
+            tiles[i] = tile;
+        }
+        return moved;
+    }
+
+    // Clip space of a light to its tile's texture coordinates, depth to [0, 1]
+    glm::mat4 tileMatrix(const glm::ivec2& origin, int size) const
+    {
+        float scale = (float)size / Size;
+        glm::mat4 matrix = glm::translate(glm::mat4(1.0f), glm::vec3(glm::vec2(origin) / (float)Size + scale * 0.5f, 0.5f));
+        return glm::scale(matrix, glm::vec3(scale * 0.5f, scale * 0.5f, 0.5f));
+    }
+};
+#endif
@@ -0,0 +1,994 @@
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+// AVX2 is compiled into its own functions and picked at run time, the build itself stays baseline
+// x86-64. Elsewhere only the scalar loop exists.
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#include <immintrin.h>
+#define SOFTWARE_RASTERIZER_AVX2
+#define AVX2_FUNCTION
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <immintrin.h>
+#define SOFTWARE_RASTERIZER_AVX2
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
+
+#include "static_scene.hpp"
+#include "instancing.hpp"
+#include "gl_state.hpp"
+#include "lighting.hpp"
+
+inline bool cpuHasAVX2()
+{
+#if defined(SOFTWARE_RASTERIZER_AVX2) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    // the OS has to save the ymm registers too
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5));
+#elif defined(SOFTWARE_RASTERIZER_AVX2)
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+
+/* -------------------------------------------------------------------------- */
+/*                              Software Texture                              */
+/* -------------------------------------------------------------------------- */
+
+// CPU copy of a texture array as loadTextureArray() uploads it, sampled the way the scene's GL
+// arrays are set up: GL_REPEAT, GL_NEAREST when magnified, GL_LINEAR_MIPMAP_NEAREST when minified,
+// mipmaps box filtered like glGenerateMipmap.
+class SoftwareTexture
+{
+public:
+    int Width = 0;
+    int Height = 0;
+    int Layers = 0;
+
+    void create(int width, int height, int layers)
+    {
+        Width = width;
+        Height = height;
+        Layers = layers;
+        levels.assign(1, { width, height, std::vector<unsigned char>((size_t)width * height * layers * 4, 0) });
+    }
+
+    // RGBA8, Width x Height
+    void setLayer(int layer, const unsigned char* texels)
+    {
+        size_t size = (size_t)Width * Height * 4;
+        std::copy(texels, texels + size, levels[0].texels.begin() + layer * size);
+    }
+
+    void generateMipmaps()
+    {
+        levels.resize(1);
+        while (levels.back().width > 1 || levels.back().height > 1)
+        {
+            const Level& fine = levels.back();
+            Level coarse = { glm::max(fine.width / 2, 1), glm::max(fine.height / 2, 1), {} };
+            coarse.texels.resize((size_t)coarse.width * coarse.height * Layers * 4);
+            for (int layer = 0; layer < Layers; layer++)
+            {
+                for (int y = 0; y < coarse.height; y++)
+                {
+                    for (int x = 0; x < coarse.width; x++)
+                    {
+                        int x0 = glm::min(x * 2, fine.width - 1), x1 = glm::min(x * 2 + 1, fine.width - 1);
+                        int y0 = glm::min(y * 2, fine.height - 1), y1 = glm::min(y * 2 + 1, fine.height - 1);
+                        for (int c = 0; c < 4; c++)
+                        {
+                            int sum = fine.texel(layer, x0, y0)[c] + fine.texel(layer, x1, y0)[c] + fine.texel(layer, x0, y1)[c] + fine.texel(layer, x1, y1)[c];
+                            coarse.texels[(((size_t)layer * coarse.height + y) * coarse.width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                        }
+                    }
+                }
+            }
+            levels.push_back(std::move(coarse));
+        }
+    }
+
+    // lod is log2 of the texels a pixel step covers, as GL computes it from the uv derivatives
+    glm::vec3 sample(const glm::vec2& uv, int layer, float lod) const
+    {
+        if (levels.empty())
+            return glm::vec3(1.0f);
+        layer = glm::clamp(layer, 0, Layers - 1);
+
+        if (!(lod > 0.0f))
+        {
+            const Level& level = levels[0];
+            int x = wrap((int)std::floor(uv.x * level.width), level.width);
+            int y = wrap((int)std::floor(uv.y * level.height), level.height);
+            return color(level.texel(layer, x, y));
+        }
+
+        // nearest mip level, bilinear inside it
+        int index = lod <= 0.5f ? 0 : (int)std::ceil(lod + 0.5f) - 1;
+        const Level& level = levels[glm::min(index, (int)levels.size() - 1)];
+        float u = uv.x * level.width - 0.5f;
+        float v = uv.y * level.height - 0.5f;
+        float fu = std::floor(u);
+        float fv = std::floor(v);
+        glm::vec2 t(u - fu, v - fv);
+        int x0 = wrap((int)fu, level.width), x1 = wrap((int)fu + 1, level.width);
+        int y0 = wrap((int)fv, level.height), y1 = wrap((int)fv + 1, level.height);
+
+        glm::vec3 bottom = glm::mix(color(level.texel(layer, x0, y0)), color(level.texel(layer, x1, y0)), t.x);
+        glm::vec3 top = glm::mix(color(level.texel(layer, x0, y1)), color(level.texel(layer, x1, y1)), t.x);
+        return glm::mix(bottom, top, t.y);
+    }
+
+private:
+    struct Level
+    {
+        int width;
+        int height;
+        // layer after layer, rows bottom up as glTexSubImage3D takes them
+        std::vector<unsigned char> texels;
+
+        const unsigned char* texel(int layer, int x, int y) const
+        {
+            return &texels[(((size_t)layer * height + y) * width + x) * 4];
+        }
+    };
+
+    std::vector<Level> levels;
+
+    static int wrap(int i, int size)
+    {
+        i %= size;
+        return i < 0 ? i + size : i;
+    }
+
+    static glm::vec3 color(const unsigned char* texel)
+    {
+        return glm::vec3(texel[0], texel[1], texel[2]) / 255.0f;
+    }
+};
+
+
+/* -------------------------------------------------------------------------- */
+/*                             Software Rasterizer                            */
+/* -------------------------------------------------------------------------- */
+
+// Renders a StaticScene draw list on the CPU with default.vert and default.frag ported to C++, for
+// machines without a GPU and as a reference the GL output can be compared against.
+//
+// A frame goes through three stages, each timed:
+//   setup   transforms every triangle of the visible instances, clips it to the near plane, culls
+//           back faces and snaps it to 1/256 of a pixel
+//   bin     files each triangle under the TILE_SIZE squares of the screen its edges touch
+//   tiles   the threads take tiles one at a time. A tile first rasterizes its triangles into a
+//           depth and triangle id buffer of its own (8 pixels per step, AVX2 when available), then
+//           shades each covered pixel exactly once and writes it to the frame.
+// Edge functions are set up in double per tile so the two triangles sharing an edge see exactly
+// opposite values, and ties go to one of them, so edges never crack or double. Tiles are
+// independent and keep submission order, so the image does not depend on the thread count or
+// on whether AVX2 was used.
+class SoftwareRasterizer
+{
+public:
+    static const int TILE_SIZE = 64;
+    // keep in sync with default.frag
+    static const int MAX_MATERIALS = 8;
+    static const int MAX_LIGHTS = 5;
+
+    struct Material
+    {
+        float Shininess = 0.0f;
+        glm::vec3 Scale = glm::vec3(1.0f);
+        glm::vec3 Translate = glm::vec3(0.0f);
+    };
+
+    Material Materials[MAX_MATERIALS];
+    const SoftwareTexture* DiffuseTexture = nullptr;
+    const SoftwareTexture* SpecularTexture = nullptr;
+    // when the CPU has it, off gives the same image through the scalar loop
+    bool UseAVX2;
+
+    // size and stats of the last frame, raster and shade are summed over the threads
+    int Width = 0;
+    int Height = 0;
+    unsigned int Triangles = 0;
+    unsigned int BinnedTriangles = 0;
+    double SetupMs = 0.0;
+    double BinMs = 0.0;
+    double TileMs = 0.0;
+    double RasterMs = 0.0;
+    double ShadeMs = 0.0;
+
+    // threads 0 uses every core, the calling thread is one of them
+    SoftwareRasterizer(unsigned int threads = 0) : UseAVX2(cpuHasAVX2())
+    {
+        setThreads(threads);
+    }
+
+    ~SoftwareRasterizer()
+    {
+        stopWorkers();
+    }
+
+    unsigned int threads() const
+    {
+        return (unsigned int)workerStats.size();
+    }
+
+    void setThreads(unsigned int threads)
+    {
+        stopWorkers();
+        if (threads == 0)
+            threads = glm::max(std::thread::hardware_concurrency(), 1u);
+
+        workerStats.assign(threads, WorkerStats());
+        for (unsigned int t = 1; t < threads; t++)
+            workers.emplace_back(&SoftwareRasterizer::work, this, t);
+    }
+
+    void setMaterial(int index, float shininess, const glm::vec3& scale, const glm::vec3& translate)
+    {
+        Materials[index] = { shininess, scale, translate };
+    }
+
+    // Any struct with the fields of default.frag's Light, lights past the given ones are black
+    // as in the uniform block
+    template <typename Light>
+    void setLights(const std::vector<Light>& lights)
+    {
+        for (int i = 0; i < MAX_LIGHTS; i++)
+        {
+            ShadingLight& light = this->lights[i];
+            light = ShadingLight();
+            if (i >= (int)lights.size())
+                continue;
+
+            light.Position = quantizePosition(lights[i].position, 16.0f);
+            light.Facing = glm::normalize(-lights[i].direction);
+            light.CutOff = lights[i].cutOff;
+            light.OuterCutOff = lights[i].outerCutOff;
+            light.Ambient = lights[i].ambient;
+            light.Diffuse = lights[i].diffuse;
+            light.Specular = lights[i].specular;
+            light.Constant = lights[i].constant;
+            light.Linear = lights[i].linear;
+            light.Quadratic = lights[i].quadratic;
+        }
+    }
+
+    void render(const StaticScene& scene, const DrawList& list, const glm::mat4& view, const glm::mat4& projection,
+        const glm::vec3& viewPos, int width, int height)
+    {
+        Width = glm::max(width, 1);
+        Height = glm::max(height, 1);
+        tilesX = (Width + TILE_SIZE - 1) / TILE_SIZE;
+        tilesY = (Height + TILE_SIZE - 1) / TILE_SIZE;
+        framePixels.resize((size_t)Width * Height);
+        shadingViewPos = quantizePosition(viewPos, 16.0f);
+
+        Clock::time_point start = Clock::now();
+        setup(scene, list, projection * view);
+        Clock::time_point binned = Clock::now();
+        bin();
+        Clock::time_point tiled = Clock::now();
+        dispatch();
+        Clock::time_point end = Clock::now();
+
+        SetupMs = std::chrono::duration<double, std::milli>(binned - start).count();
+        BinMs = std::chrono::duration<double, std::milli>(tiled - binned).count();
+        TileMs = std::chrono::duration<double, std::milli>(end - tiled).count();
+        RasterMs = ShadeMs = 0.0;
+        for (const WorkerStats& stats : workerStats)
+        {
+            RasterMs += stats.RasterMs;
+            ShadeMs += stats.ShadeMs;
+        }
+        Triangles = (unsigned int)triangles.size();
+    }
+
+    // RGBA8, bottom row first like glReadPixels
+    const std::vector<unsigned int>& pixels() const
+    {
+        return framePixels;
+    }
+
+    // Binary PPM, top row first
+    bool save(const std::string& path) const
+    {
+        std::ofstream file(path, std::ios::binary);
+        if (!file)
+        {
+            std::cout << "ERROR::SOFTWARE_RASTERIZER::IMAGE_NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+
+        file << "P6\n" << Width << " " << Height << "\n255\n";
+        std::vector<unsigned char> row((size_t)Width * 3);
+        for (int y = Height - 1; y >= 0; y--)
+        {
+            for (int x = 0; x < Width; x++)
+            {
+                unsigned int pixel = framePixels[(size_t)y * Width + x];
+                row[x * 3 + 0] = pixel & 0xFF;
+                row[x * 3 + 1] = (pixel >> 8) & 0xFF;
+                row[x * 3 + 2] = (pixel >> 16) & 0xFF;
+            }
+            file.write((const char*)row.data(), (std::streamsize)row.size());
+        }
+        return true;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static const unsigned int NO_TRIANGLE = 0xFFFFFFFFu;
+    static constexpr double SUBPIXELS = 256.0;
+
+    struct ShadingLight
+    {
+        // quantized as default.frag does
+        glm::vec3 Position = glm::vec3(0.0f);
+        // normalize(-direction)
+        glm::vec3 Facing = glm::vec3(0.0f);
+        float CutOff = 0.0f;
+        float OuterCutOff = 0.0f;
+        glm::vec3 Ambient = glm::vec3(0.0f);
+        glm::vec3 Diffuse = glm::vec3(0.0f);
+        glm::vec3 Specular = glm::vec3(0.0f);
+        float Constant = 0.0f;
+        float Linear = 0.0f;
+        float Quadratic = 0.0f;
+    };
+
+    // default.vert's outputs at one corner
+    struct ClipVertex
+    {
+        glm::vec4 Clip;
+        glm::vec3 FragPos;
+        glm::vec3 Normal;
+        glm::vec2 TexCoords;
+    };
+
+    struct Varyings
+    {
+        glm::vec3 FragPos;
+        glm::vec3 Normal;
+        glm::vec2 TexCoords;
+    };
+
+    // A screen space triangle, counter-clockwise with y up like GL window coordinates
+    struct Triangle
+    {
+        // snapped window coordinates
+        double X[3];
+        double Y[3];
+        float InvW[3];
+        // edge i is opposite corner i, A * x + B * y + C is positive inside
+        double EdgeA[3];
+        double EdgeB[3];
+        double EdgeC[3];
+        // wins pixels exactly on the edge
+        bool Tie[3];
+        double Area;
+        // window depth at (X[0], Y[0]) and its slopes
+        double Depth;
+        double DepthDx;
+        double DepthDy;
+        // covered pixel centers
+        int MinX, MinY, MaxX, MaxY;
+
+        ClipVertex Corners[3];
+        int Material;
+        int SampleSpace;
+        int TextureLayer;
+    };
+
+    // A triangle's edges and depth relative to the corner of one tile, pixel centers at i + 0.5
+    struct TileTriangle
+    {
+        float A[3];
+        float B[3];
+        float C[3];
+        bool Tie[3];
+        float DepthDx;
+        float DepthDy;
+        float Depth;
+        unsigned int ID;
+    };
+
+    // default.frag quantizes the fragment position before its noise, so neighbouring pixels
+    // mostly ask for the same value
+    struct NoiseCache
+    {
+        glm::vec3 FragPos = glm::vec3(FLT_MAX);
+        float Value = 0.0f;
+    };
+
+    struct WorkerStats
+    {
+        double RasterMs = 0.0;
+        double ShadeMs = 0.0;
+    };
+
+    ShadingLight lights[MAX_LIGHTS];
+    glm::vec3 shadingViewPos = glm::vec3(0.0f);
+
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<unsigned int>> bins;
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<unsigned int> framePixels;
+
+    std::vector<std::thread> workers;
+    std::vector<WorkerStats> workerStats;
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    unsigned long long generation = 0;
+    unsigned int busy = 0;
+    bool stopping = false;
+    std::atomic<int> nextTile{ 0 };
+
+    /* ---------------------------------- Setup --------------------------------- */
+    void setup(const StaticScene& scene, const DrawList& list, const glm::mat4& viewProjection)
+    {
+        triangles.clear();
+        const std::vector<Vertex>& vertices = scene.Meshes.vertexData();
+        const std::vector<unsigned int>& indices = scene.Meshes.indexData();
+
+        for (size_t draw = 0; draw < list.Commands.size(); draw++)
+        {
+            const DrawElementsIndirectCommand& command = list.Commands[draw];
+            int material = glm::clamp(scene.drawMaterial((int)draw), 0, MAX_MATERIALS - 1);
+
+            for (GLuint i = 0; i < command.instanceCount; i++)
+            {
+                const InstanceData& instance = list.Instances[command.baseInstance + i];
+                glm::mat3 normalMatrix = glm::mat3(glm::transpose(glm::inverse(instance.model)));
+
+                for (GLuint index = 0; index + 2 < command.count; index += 3)
+                {
+                    ClipVertex corners[3];
+                    for (int c = 0; c < 3; c++)
+                    {
+                        const Vertex& vertex = vertices[command.baseVertex + indices[command.firstIndex + index + c]];
+                        corners[c].FragPos = glm::vec3(instance.model * glm::vec4(vertex.position, 1.0f));
+                        corners[c].Normal = normalMatrix * vertex.normal;
+                        corners[c].TexCoords = vertex.texCoords;
+                        corners[c].Clip = viewProjection * glm::vec4(corners[c].FragPos, 1.0f);
+                    }
+                    clip(corners, material, instance.sampleSpace, instance.textureLayer);
+                }
+            }
+        }
+    }
+
+    // Whole triangles outside one frustum plane are dropped. Only the near plane is clipped, the
+    // rest of the frustum is the screen rectangle and the far end of the depth test.
+    void clip(const ClipVertex* corners, int material, int sampleSpace, int textureLayer)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int below = 0, above = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                below += corners[c].Clip[axis] < -corners[c].Clip.w;
+                above += corners[c].Clip[axis] > corners[c].Clip.w;
+            }
+            if (below == 3 || above == 3)
+                return;
+        }
+
+        ClipVertex polygon[4];
+        int count = 0;
+        for (int c = 0; c < 3; c++)
+        {
+            const ClipVertex& a = corners[c];
+            const ClipVertex& b = corners[(c + 1) % 3];
+            float da = a.Clip.z + a.Clip.w;
+            float db = b.Clip.z + b.Clip.w;
+            if (da >= 0.0f)
+                polygon[count++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+            {
+                float t = da / (da - db);
+                ClipVertex& edge = polygon[count++];
+                edge.Clip = glm::mix(a.Clip, b.Clip, t);
+                edge.FragPos = glm::mix(a.FragPos, b.FragPos, t);
+                edge.Normal = glm::mix(a.Normal, b.Normal, t);
+                edge.TexCoords = glm::mix(a.TexCoords, b.TexCoords, t);
+            }
+        }
+
+        for (int i = 1; i + 1 < count; i++)
+            addTriangle(polygon[0], polygon[i], polygon[i + 1], material, sampleSpace, textureLayer);
+    }
+
+    void addTriangle(const ClipVertex& a, const ClipVertex& b, const ClipVertex& c, int material, int sampleSpace, int textureLayer)
+    {
+        Triangle triangle;
+        triangle.Corners[0] = a;
+        triangle.Corners[1] = b;
+        triangle.Corners[2] = c;
+
+        float depth[3];
+        for (int i = 0; i < 3; i++)
+        {
+            const glm::vec4& clip = triangle.Corners[i].Clip;
+            triangle.InvW[i] = 1.0f / clip.w;
+            glm::vec3 ndc = glm::vec3(clip) * triangle.InvW[i];
+            triangle.X[i] = std::floor((ndc.x * 0.5 + 0.5) * Width * SUBPIXELS + 0.5) / SUBPIXELS;
+            triangle.Y[i] = std::floor((ndc.y * 0.5 + 0.5) * Height * SUBPIXELS + 0.5) / SUBPIXELS;
+            depth[i] = ndc.z * 0.5f + 0.5f;
+        }
+
+        // back faces and slivers thinner than the snapping
+        const double* X = triangle.X;
+        const double* Y = triangle.Y;
+        triangle.Area = (X[1] - X[0]) * (Y[2] - Y[0]) - (X[2] - X[0]) * (Y[1] - Y[0]);
+        if (!(triangle.Area > 0.0))
+            return;
+
+        triangle.MinX = glm::max((int)std::ceil(std::min({ X[0], X[1], X[2] }) - 0.5), 0);
+        triangle.MaxX = glm::min((int)std::floor(std::max({ X[0], X[1], X[2] }) - 0.5), Width - 1);
+        triangle.MinY = glm::max((int)std::ceil(std::min({ Y[0], Y[1], Y[2] }) - 0.5), 0);
+        triangle.MaxY = glm::min((int)std::floor(std::max({ Y[0], Y[1], Y[2] }) - 0.5), Height - 1);
+        if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY)
+            return;
+
+        for (int e = 0; e < 3; e++)
+        {
+            int from = (e + 1) % 3;
+            int to = (e + 2) % 3;
+            triangle.EdgeA[e] = Y[from] - Y[to];
+            triangle.EdgeB[e] = X[to] - X[from];
+            triangle.EdgeC[e] = X[from] * Y[to] - X[to] * Y[from];
+            // the neighbour sees the same edge negated, exactly one of the two wins ties
+            triangle.Tie[e] = triangle.EdgeA[e] > 0.0 || (triangle.EdgeA[e] == 0.0 && triangle.EdgeB[e] < 0.0);
+        }
+
+        double dz1 = depth[1] - depth[0];
+        double dz2 = depth[2] - depth[0];
+        triangle.Depth = depth[0];
+        triangle.DepthDx = (dz1 * (Y[2] - Y[0]) - dz2 * (Y[1] - Y[0])) / triangle.Area;
+        triangle.DepthDy = (dz2 * (X[1] - X[0]) - dz1 * (X[2] - X[0])) / triangle.Area;
+
+        triangle.Material = material;
+        triangle.SampleSpace = sampleSpace;
+        triangle.TextureLayer = textureLayer;
+        triangles.push_back(triangle);
+    }
+
+    /* ----------------------------------- Bin ---------------------------------- */
+    // A tile is skipped when one edge is negative over all of its pixel centers
+    void bin()
+    {
+        bins.resize((size_t)tilesX * tilesY);
+        for (std::vector<unsigned int>& tile : bins)
+            tile.clear();
+
+        BinnedTriangles = 0;
+        for (unsigned int id = 0; id < (unsigned int)triangles.size(); id++)
+        {
+            const Triangle& triangle = triangles[id];
+            for (int ty = triangle.MinY / TILE_SIZE; ty <= triangle.MaxY / TILE_SIZE; ty++)
+            {
+                double y0 = ty * TILE_SIZE + 0.5;
+                double y1 = glm::min(ty * TILE_SIZE + TILE_SIZE, Height) - 0.5;
+                for (int tx = triangle.MinX / TILE_SIZE; tx <= triangle.MaxX / TILE_SIZE; tx++)
+                {
+                    double x0 = tx * TILE_SIZE + 0.5;
+                    double x1 = glm::min(tx * TILE_SIZE + TILE_SIZE, Width) - 0.5;
+
+                    bool outside = false;
+                    for (int e = 0; e < 3 && !outside; e++)
+                    {
+                        double A = triangle.EdgeA[e];
+                        double B = triangle.EdgeB[e];
+                        outside = A * (A > 0.0 ? x1 : x0) + B * (B > 0.0 ? y1 : y0) + triangle.EdgeC[e] < 0.0;
+                    }
+                    if (outside)
+                        continue;
+
+                    bins[ty * tilesX + tx].push_back(id);
+                    BinnedTriangles++;
+                }
+            }
+        }
+    }
+
+    /* ---------------------------------- Tiles --------------------------------- */
+    void dispatch()
+    {
+        for (WorkerStats& stats : workerStats)
+            stats = WorkerStats();
+        nextTile = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            generation++;
+            busy = (unsigned int)workers.size();
+        }
+        started.notify_all();
+
+        renderTiles(workerStats[0]);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&]() { return busy == 0; });
+    }
+
+    void work(unsigned int index)
+    {
+        unsigned long long seen = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                started.wait(lock, [&]() { return stopping || generation != seen; });
+                if (stopping)
+                    return;
+                seen = generation;
+            }
+
+            renderTiles(workerStats[index]);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0)
+                finished.notify_one();
+        }
+    }
+
+    void stopWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+        stopping = false;
+    }
+
+    void renderTiles(WorkerStats& stats)
+    {
+        alignas(32) float depth[TILE_SIZE * TILE_SIZE];
+        alignas(32) unsigned int ids[TILE_SIZE * TILE_SIZE];
+
+        int tileCount = tilesX * tilesY;
+        for (int tile = nextTile++; tile < tileCount; tile = nextTile++)
+        {
+            Clock::time_point start = Clock::now();
+            int originX = (tile % tilesX) * TILE_SIZE;
+            int originY = (tile / tilesX) * TILE_SIZE;
+
+            std::fill(depth, depth + TILE_SIZE * TILE_SIZE, 1.0f);
+            std::fill(ids, ids + TILE_SIZE * TILE_SIZE, NO_TRIANGLE);
+            for (unsigned int id : bins[tile])
+                rasterize(id, originX, originY, depth, ids);
+
+            Clock::time_point rasterized = Clock::now();
+            shadeTile(originX, originY, ids);
+
+            stats.RasterMs += std::chrono::duration<double, std::milli>(rasterized - start).count();
+            stats.ShadeMs += std::chrono::duration<double, std::milli>(Clock::now() - rasterized).count();
+        }
+    }
+
+    void rasterize(unsigned int id, int originX, int originY, float* depth, unsigned int* ids) const
+    {
+        const Triangle& triangle = triangles[id];
+
+        TileTriangle local;
+        for (int e = 0; e < 3; e++)
+        {
+            local.A[e] = (float)triangle.EdgeA[e];
+            local.B[e] = (float)triangle.EdgeB[e];
+            local.C[e] = (float)(triangle.EdgeA[e] * originX + triangle.EdgeB[e] * originY + triangle.EdgeC[e]);
+            local.Tie[e] = triangle.Tie[e];
+        }
+        local.DepthDx = (float)triangle.DepthDx;
+        local.DepthDy = (float)triangle.DepthDy;
+        local.Depth = (float)(triangle.Depth + triangle.DepthDx * (originX - triangle.X[0]) + triangle.DepthDy * (originY - triangle.Y[0]));
+        local.ID = id;
+
+        int x0 = glm::max(triangle.MinX - originX, 0);
+        int x1 = glm::min(triangle.MaxX - originX, TILE_SIZE - 1);
+        int y0 = glm::max(triangle.MinY - originY, 0);
+        int y1 = glm::min(triangle.MaxY - originY, TILE_SIZE - 1);
+
+#ifdef SOFTWARE_RASTERIZER_AVX2
+        if (UseAVX2)
+        {
+            rasterizeAVX2(local, x0, x1, y0, y1, depth, ids);
+            return;
+        }
+#endif
+        rasterizeScalar(local, x0, x1, y0, y1, depth, ids);
+    }
+
+    // Evaluates exactly what rasterizeAVX2 does, in the same order, one pixel at a time
+    static void rasterizeScalar(const TileTriangle& t, int x0, int x1, int y0, int y1, float* depth, unsigned int* ids)
+    {
+        for (int y = y0; y <= y1; y++)
+        {
+            float py = y + 0.5f;
+            float rowB[3] = { t.B[0] * py, t.B[1] * py, t.B[2] * py };
+            float rowDepth = t.DepthDy * py;
+            for (int x = x0; x <= x1; x++)
+            {
+                float px = x + 0.5f;
+                bool inside = true;
+                for (int e = 0; e < 3; e++)
+                {
+                    float edge = t.A[e] * px + rowB[e] + t.C[e];
+                    inside = inside && (edge > 0.0f || (edge == 0.0f && t.Tie[e]));
+                }
+
+                float z = t.DepthDx * px + rowDepth + t.Depth;
+                int pixel = y * TILE_SIZE + x;
+                if (inside && z < depth[pixel])
+                {
+                    depth[pixel] = z;
+                    ids[pixel] = t.ID;
+                }
+            }
+        }
+    }
+
+#ifdef SOFTWARE_RASTERIZER_AVX2
+    // 8 pixels of a row per step, lanes outside [x0, x1] are masked so the result matches the scalar loop
+    AVX2_FUNCTION static void rasterizeAVX2(const TileTriangle& t, int x0, int x1, int y0, int y1, float* depth, unsigned int* ids)
+    {
+        const __m256 lanes = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 first = _mm256_set1_ps(x0 + 0.5f);
+        const __m256 last = _mm256_set1_ps(x1 + 0.5f);
+        const __m256 id = _mm256_castsi256_ps(_mm256_set1_epi32((int)t.ID));
+
+        __m256 A[3], C[3], tie[3];
+        for (int e = 0; e < 3; e++)
+        {
+            A[e] = _mm256_set1_ps(t.A[e]);
+            C[e] = _mm256_set1_ps(t.C[e]);
+            tie[e] = _mm256_castsi256_ps(_mm256_set1_epi32(t.Tie[e] ? -1 : 0));
+        }
+        const __m256 depthDx = _mm256_set1_ps(t.DepthDx);
+        const __m256 depthOrigin = _mm256_set1_ps(t.Depth);
+
+        for (int y = y0; y <= y1; y++)
+        {
+            float py = y + 0.5f;
+            __m256 rowB[3];
+            for (int e = 0; e < 3; e++)
+                rowB[e] = _mm256_set1_ps(t.B[e] * py);
+            __m256 rowDepth = _mm256_set1_ps(t.DepthDy * py);
+
+            for (int x = x0 & ~7; x <= x1; x += 8)
+            {
+                __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lanes);
+                __m256 mask = _mm256_and_ps(_mm256_cmp_ps(px, first, _CMP_GE_OQ), _mm256_cmp_ps(px, last, _CMP_LE_OQ));
+                for (int e = 0; e < 3; e++)
+                {
+                    __m256 edge = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(A[e], px), rowB[e]), C[e]);
+                    __m256 inside = _mm256_or_ps(_mm256_cmp_ps(edge, zero, _CMP_GT_OQ), _mm256_and_ps(_mm256_cmp_ps(edge, zero, _CMP_EQ_OQ), tie[e]));
+                    mask = _mm256_and_ps(mask, inside);
+                }
+                if (_mm256_movemask_ps(mask) == 0)
+                    continue;
+
+                float* depthRow = depth + y * TILE_SIZE + x;
+                float* idRow = (float*)(ids + y * TILE_SIZE + x);
+                __m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(depthDx, px), rowDepth), depthOrigin);
+                __m256 stored = _mm256_load_ps(depthRow);
+                mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, stored, _CMP_LT_OQ));
+
+                _mm256_store_ps(depthRow, _mm256_blendv_ps(stored, z, mask));
+                _mm256_store_ps(idRow, _mm256_blendv_ps(_mm256_load_ps(idRow), id, mask));
+            }
+        }
+    }
+#endif
+
+    /* ---------------------------------- Shade --------------------------------- */
+    void shadeTile(int originX, int originY, const unsigned int* ids)
+    {
+        NoiseCache cache;
+        int width = glm::min(TILE_SIZE, Width - originX);
+        int height = glm::min(TILE_SIZE, Height - originY);
+        for (int y = 0; y < height; y++)
+        {
+            unsigned int* row = &framePixels[(size_t)(originY + y) * Width + originX];
+            for (int x = 0; x < width; x++)
+            {
+                unsigned int id = ids[y * TILE_SIZE + x];
+                // cleared to opaque black as DynamicResolution::begin does
+                row[x] = id == NO_TRIANGLE ? 0xFF000000u : pack(shade(triangles[id], originX + x + 0.5, originY + y + 0.5, cache));
+            }
+        }
+    }
+
+    // Perspective correct, as the varyings reach default.frag
+    static Varyings interpolate(const Triangle& triangle, double x, double y)
+    {
+        float weights[3];
+        float sum = 0.0f;
+        for (int i = 0; i < 3; i++)
+        {
+            double barycentric = (triangle.EdgeA[i] * x + triangle.EdgeB[i] * y + triangle.EdgeC[i]) / triangle.Area;
+            weights[i] = (float)barycentric * triangle.InvW[i];
+            sum += weights[i];
+        }
+
+        Varyings varyings = { glm::vec3(0.0f), glm::vec3(0.0f), glm::vec2(0.0f) };
+        for (int i = 0; i < 3; i++)
+        {
+            float weight = weights[i] / sum;
+            varyings.FragPos += triangle.Corners[i].FragPos * weight;
+            varyings.Normal += triangle.Corners[i].Normal * weight;
+            varyings.TexCoords += triangle.Corners[i].TexCoords * weight;
+        }
+        return varyings;
+    }
+
+    // uv of default.frag's main(), from the material and the instance's sample space
+    static glm::vec2 sampleCoords(const Triangle& triangle, const Material& material, const Varyings& varyings)
+    {
+        glm::vec2 uv = glm::vec2(material.Scale + material.Translate);
+        switch (triangle.SampleSpace)
+        {
+        case 0: return uv * varyings.TexCoords;
+        case 1: return uv * glm::vec2(varyings.FragPos.x, varyings.FragPos.z);
+        case 2: return uv * glm::vec2(varyings.FragPos.x, varyings.FragPos.y);
+        case 3: return uv * glm::vec2(varyings.FragPos.z, varyings.FragPos.y);
+        }
+        return uv;
+    }
+
+    glm::vec3 shade(const Triangle& triangle, double x, double y, NoiseCache& cache) const
+    {
+        const Material& material = Materials[triangle.Material];
+        Varyings varyings = interpolate(triangle, x, y);
+        glm::vec2 uv = sampleCoords(triangle, material, varyings);
+
+        // GL takes the mip level from screen space derivatives, here from the next pixel over
+        float lod = 0.0f;
+        if (DiffuseTexture)
+        {
+            glm::vec2 size(DiffuseTexture->Width, DiffuseTexture->Height);
+            glm::vec2 dx = (sampleCoords(triangle, material, interpolate(triangle, x + 1.0, y)) - uv) * size;
+            glm::vec2 dy = (sampleCoords(triangle, material, interpolate(triangle, x, y + 1.0)) - uv) * size;
+            lod = std::log2(glm::max(glm::length(dx), glm::length(dy)));
+        }
+        glm::vec3 diffuseTexel = DiffuseTexture ? DiffuseTexture->sample(uv, triangle.TextureLayer, lod) : glm::vec3(1.0f);
+        glm::vec3 specularTexel = SpecularTexture ? SpecularTexture->sample(uv, triangle.TextureLayer, lod) : glm::vec3(1.0f);
+
+        glm::vec3 fragPos = quantizePosition(varyings.FragPos, 16.0f);
+        glm::vec3 normal = glm::normalize(varyings.Normal);
+        glm::vec3 viewDir = glm::normalize(shadingViewPos - fragPos);
+
+        // calcLight() per light. Its ambient noise only depends on the fragment, so it is applied
+        // once to the summed ambient rather than per light.
+        glm::vec3 ambient(0.0f);
+        glm::vec3 lit(0.0f);
+        for (const ShadingLight& light : lights)
+        {
+            glm::vec3 toLight = light.Position - fragPos;
+            float distance = glm::length(toLight);
+            glm::vec3 lightDir = glm::normalize(toLight);
+            float attenuation = 1.0f / (light.Constant + light.Linear * distance + light.Quadratic * (distance * distance));
+            ambient += light.Ambient * diffuseTexel * attenuation;
+
+            float theta = glm::dot(lightDir, light.Facing);
+            float intensity = glm::clamp((theta - light.OuterCutOff) / (light.CutOff - light.OuterCutOff), 0.0f, 1.0f);
+            if (!(intensity > 0.0f))
+                continue;
+
+            float diff = glm::max(glm::dot(normal, lightDir), 0.0f);
+            glm::vec3 reflectDir = glm::reflect(-lightDir, normal);
+            float spec = std::pow(glm::max(glm::dot(viewDir, reflectDir), 0.0f), material.Shininess);
+            lit += (light.Diffuse * diff * diffuseTexel + light.Specular * spec * specularTexel) * (intensity * bandedAttenuation(attenuation));
+        }
+
+        if (ambient != glm::vec3(0.0f))
+        {
+            if (fragPos != cache.FragPos)
+            {
+                cache.FragPos = fragPos;
+                cache.Value = ambientNoise(fragPos);
+            }
+            ambient *= 1.0f - cache.Value;
+        }
+
+        return colorGrade(tonemap(ambient + lit), 1.0f, 0.004f, 0.0f);
+    }
+
+    static glm::vec3 tonemap(const glm::vec3& x)
+    {
+        const float a = 2.51f, b = 0.03f, c = 2.43f, d = 0.59f, e = 0.14f;
+        return glm::clamp((x * (a * x + b)) / (x * (c * x + d) + e), 0.0f, 1.0f);
+    }
+
+    static glm::vec3 colorGrade(glm::vec3 color, float contrast, float highlights, float shadows)
+    {
+        color = (color - 0.5f) * contrast + 0.5f;
+        color = glm::mix(color, glm::vec3(1.0f), highlights * glm::smoothstep(glm::vec3(0.5f), glm::vec3(1.0f), color));
+        color = glm::mix(color, glm::vec3(0.0f), shadows * glm::smoothstep(glm::vec3(0.0f), glm::vec3(0.5f), color));
+        return color;
+    }
+
+    // To RGBA8 as GL converts a float color for an unorm target
+    static unsigned int pack(const glm::vec3& color)
+    {
+        glm::uvec3 c = glm::uvec3(glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f);
+        return c.r | (c.g << 8) | (c.b << 16) | 0xFF000000u;
+    }
+};
+
+
+/* --------------------------- Software Presenter --------------------------- */
+// Puts a SoftwareRasterizer frame on a GL framebuffer, for showing it in the window or in the
+// headless target in place of a GL rendered one
+class SoftwarePresenter
+{
+public:
+    void present(const SoftwareRasterizer& rasterizer, unsigned int framebuffer, int width, int height)
+    {
+        if (FBO == 0)
+        {
+            glGenFramebuffers(1, &FBO);
+            glGenTextures(1, &texture);
+        }
+
+        glState.bindTexture(GL_TEXTURE_2D, texture);
+        if (rasterizer.Width != size.x || rasterizer.Height != size.y)
+        {
+            size = glm::ivec2(rasterizer.Width, rasterizer.Height);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::SOFTWARE_PRESENTER::FRAMEBUFFER_NOT_COMPLETE" << std::endl;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size.x, size.y, GL_RGBA, GL_UNSIGNED_BYTE, rasterizer.pixels().data());
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+
+private:
+    unsigned int FBO = 0;
+    unsigned int texture = 0;
+    glm::ivec2 size = glm::ivec2(0);
+};
+#endif
@@ -0,0 +1,567 @@
+#ifndef STATIC_SCENE_H
+#define STATIC_SCENE_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include "shader.hpp"
+#include "mesh.hpp"
+#include "instancing.hpp"
+#include "gl_extensions.hpp"
+#include "stats.hpp"
+#include "bvh.hpp"
+#include "portals.hpp"
+#include "pvs.hpp"
+#include "occlusion.hpp"
+#include "command_list.hpp"
+#include "gl_state.hpp"
+
+// Matches the layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// How a material is drawn, see StaticScene::setMaterialPass. Not OPAQUE and TRANSPARENT, which
+// wingdi.h defines as macros.
+enum class MaterialPass {
+    SOLID,        // blending off, nearest first so early-z rejects what they hide
+    ALPHA_TESTED, // fragments below the material's alphaCutoff are discarded, after the solid pass
+    BLENDED,      // blended over what is behind without writing depth, farthest first, drawn last
+};
+
+// Instances that survived a cull, grouped into one run per draw, and the commands drawing them.
+// Version changes whenever the contents do, so a renderer only uploads lists it has not seen.
+struct DrawList
+{
+    std::vector<InstanceData> Instances;
+    std::vector<DrawElementsIndirectCommand> Commands;
+    unsigned long long Version = 0;
+};
+
+
+// All static geometry of the room in one pooled vertex/index buffer. Each draw is a mesh range,
+// a material and a run of instances. On GL 4.3 each pass of the scene is submitted with a single
+// glMultiDrawElementsIndirect call and the vertex shader fetches per-draw data with gl_DrawID.
+// On GL 3.3 the same commands are replayed one by one with a drawID uniform.
+// Draws are ordered by the MaterialPass of their material, each pass is a contiguous range of
+// commands drawn on its own, see draw(shader, pass). Within a draw the visible instances are
+// sorted by depth: front to back for solid and alpha tested ones, back to front for blended ones.
+// Blended draws are each sorted but not against each other, instances of different blended
+// draws overlapping on screen composite in draw order.
+// cull() keeps only the instances inside the view frustum, using a BVH over their world bounds,
+// and when given a PortalGraph or a baked PVS only those of cells that can be seen. Survivors are
+// finally tested against the Occlusion buffer, when one is set and rendered for this frame.
+// Culling only touches CPU memory and leaves its result in drawList(), so it may run on another
+// thread than the one owning the context. submit() uploads a DrawList and draw() renders it.
+class StaticScene
+{
+public:
+    // keep in sync with MAX_DRAWS in default.vert
+    static const int MAX_DRAWS = 64;
+
+    MeshPool Meshes;
+    bool UseIndirect;
+    bool Culling = true;
+    OcclusionBuffer* Occlusion = nullptr;
+    // changes whenever an instance that is not dynamic moves, see ShadowAtlas
+    unsigned long long StaticVersion = 0;
+
+    StaticScene() : UseIndirect(glExtensions.MultiDrawIndirect && glExtensions.ShaderDrawParameters)
+    {
+        glGenBuffers(1, &instanceVBO);
+        glGenBuffers(1, &indirectBuffer);
+    }
+
+    // Shader defines selecting how default.vert finds the current draw and decodes vertices,
+    // the vertex format is only known once build() has run
+    std::string shaderDefines() const
+    {
+        std::string defines = Meshes.Format.shaderDefines();
+        if (UseIndirect)
+            defines += "#define DRAW_PARAMETERS\n";
+        return defines;
+    }
+
+    int addMesh(const Mesh& mesh)
+    {
+        AABB bounds;
+        for (const Vertex& vertex : mesh.vertices)
+            bounds.expand(vertex.position);
+        meshBounds.push_back(bounds);
+        return Meshes.add(mesh);
+    }
+
+    // Returns the index of the draw's first instance, for setInstanceTransform. drawCells gives
+    // the PortalGraph cell of each instance, instances without one are never portal culled.
+    int addDraw(int mesh, int material, const std::vector<InstanceData>& drawInstances, const std::vector<int>& drawCells = {})
+    {
+        if (drawInstances.empty())
+            return -1;
+
+        if (commands.size() == MAX_DRAWS)
+        {
+            std::cout << "ERROR::STATIC_SCENE::TOO_MANY_DRAWS" << std::endl;
+            return -1;
+        }
+
+        int firstInstance = (int)instances.size();
+        for (size_t i = 0; i < drawInstances.size(); i++)
+        {
+            instanceBounds.push_back(meshBounds[mesh].transformed(drawInstances[i].model));
+            instanceCells.push_back(i < drawCells.size() ? drawCells[i] : -1);
+            instanceDynamic.push_back(false);
+        }
+
+        instanceDraws.insert(instanceDraws.end(), drawInstances.size(), (int)commands.size());
+        const MeshPool::Range& range = Meshes.range(mesh);
+        commands.push_back({ range.indexCount, (GLuint)drawInstances.size(), range.firstIndex, range.baseVertex, (GLuint)instances.size() });
+        drawMeshes.push_back(mesh);
+        drawMaterials.push_back(material);
+        instances.insert(instances.end(), drawInstances.begin(), drawInstances.end());
+        return firstInstance;
+    }
+
+    // Materials are SOLID unless set otherwise, call before build(). The pass only orders the draws,
+    // the material's opacity and alphaCutoff in default.frag decide what its fragments do.
+    void setMaterialPass(int material, MaterialPass pass)
+    {
+        if (material >= (int)materialPasses.size())
+            materialPasses.resize(material + 1, MaterialPass::SOLID);
+        materialPasses[material] = pass;
+    }
+
+    // Moves one instance, its BVH leaf is refit on the next cull
+    void setInstanceTransform(int instance, const glm::mat4& model)
+    {
+        instances[instance].model = model;
+        instanceBounds[instance] = meshBounds[drawMeshes[drawOf(instance)]].transformed(model);
+        bvh.update(instance, instanceBounds[instance]);
+        visibleDirty = true;
+        if (!instanceDynamic[instance])
+            StaticVersion++;
+    }
+
+    // Dynamic instances are expected to move every frame, shadow passes keep them apart from the rest
+    void setDynamic(int instance, bool dynamic = true)
+    {
+        instanceDynamic[instance] = dynamic;
+        StaticVersion++;
+    }
+
+    // Uploads geometry, instances and draw commands, call once after all meshes and draws are added
+    void build()
+    {
+        sortDrawsByPass();
+        Meshes.upload();
+        bvh.build(instanceBounds);
+
+        // sized for every instance, submit() uploads the visible ones to the front
+        glState.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), nullptr, GL_DYNAMIC_DRAW);
+        setInstanceAttributes(0);
+
+        glState.bindVertexArray(0);
+
+        if (UseIndirect)
+        {
+            glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), nullptr, GL_DYNAMIC_DRAW);
+        }
+
+        visible.resize(instances.size());
+        for (size_t i = 0; i < visible.size(); i++)
+            visible[i] = (unsigned int)i;
+        sortForDraw(visible, glm::mat4(1.0f));
+        buildDrawList(visible, visibleList);
+        visibleDirty = false;
+        submit(visibleList);
+        StaticVersion++;
+    }
+
+    // Compacts the instances inside the frustum of viewProjection and rewrites the draw commands.
+    // The draw list is only rebuilt when the visible set changed.
+    void cull(const glm::mat4& viewProjection, const PortalGraph* portals = nullptr)
+    {
+        cullInstances(viewProjection, [&]() {
+            if (portals)
+                cullPortals(viewProjection, *portals);
+        });
+    }
+
+    // As above with cells filtered through a baked PVS row, cameraCell is -1 outside every cell
+    void cull(const glm::mat4& viewProjection, const PVS& pvs, int cameraCell)
+    {
+        cullInstances(viewProjection, [&]() {
+            if (cameraCell >= 0)
+                cullPVS(pvs, cameraCell);
+        });
+    }
+
+    // The instances inside a light's frustum for its shadow pass, only the dynamic ones or only the
+    // others. Blended instances cast no shadow. The camera's cull is left as it is, submit() the
+    // list to draw it.
+    DrawList cullShadowCasters(const glm::mat4& viewProjection, bool dynamic)
+    {
+        std::vector<unsigned int> casters;
+        bvh.cull(Frustum::fromMatrix(viewProjection), casters);
+        casters.erase(std::remove_if(casters.begin(), casters.end(), [&](unsigned int instance) {
+            return instanceDynamic[instance] != dynamic || drawPasses[instanceDraws[instance]] == MaterialPass::BLENDED;
+        }), casters.end());
+        sortForDraw(casters, viewProjection);
+
+        DrawList list;
+        if (!casters.empty())
+            buildDrawList(casters, list);
+        return list;
+    }
+
+    // Index into default.frag's materials[] of a draw, as given to addDraw(). Draws are numbered in
+    // the order build() left them, the order of the commands in a DrawList.
+    int drawMaterial(int draw) const
+    {
+        return drawMaterials[draw];
+    }
+
+    // Whether the submitted list has visible instances in a pass, so its state changes can be skipped
+    bool hasPass(MaterialPass pass) const
+    {
+        for (int i = passBegin[(int)pass]; i < passBegin[(int)pass + 1]; i++)
+        {
+            if (submittedCommands[i].instanceCount > 0)
+                return true;
+        }
+        return false;
+    }
+
+    // Result of the last cull
+    const DrawList& drawList() const
+    {
+        return visibleList;
+    }
+
+    // Uploads a draw list for the following draw() calls, nothing to do when it was the last one uploaded
+    void submit(const DrawList& list)
+    {
+        if (list.Version == submittedVersion)
+            return;
+
+        glState.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, list.Instances.size() * sizeof(InstanceData), list.Instances.data());
+
+        if (UseIndirect)
+        {
+            glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, list.Commands.size() * sizeof(DrawElementsIndirectCommand), list.Commands.data());
+        }
+
+        submittedCommands = list.Commands;
+        submittedVersion = list.Version;
+    }
+
+    // Per-draw data read by default.vert, only changes when the scene is rebuilt
+    void setDrawParameters(const Shader& shader) const
+    {
+        shader.use();
+        for (size_t i = 0; i < drawMaterials.size(); i++)
+        {
+            const MeshPool::Range& range = Meshes.range(drawMeshes[i]);
+            std::string index = "[" + std::to_string(i) + "]";
+            shader.setInt("drawMaterials" + index, drawMaterials[i]);
+            shader.setVec3("drawPositionOffset" + index, range.positionOffset);
+            shader.setVec3("drawPositionScale" + index, range.positionScale);
+        }
+    }
+
+    // Every pass, for depth only passes that need no blend state between them
+    void draw(const Shader& shader)
+    {
+        drawRange(shader, 0, (int)commands.size());
+    }
+
+    // The draws of one pass, blend and depth state are left to the caller
+    void draw(const Shader& shader, MaterialPass pass)
+    {
+        drawRange(shader, passBegin[(int)pass], passBegin[(int)pass + 1]);
+    }
+
+    // Appends what draw() would issue for the submitted list, record again after the next submit()
+    // that changes it
+    void record(CommandList& list, const Shader& shader) const
+    {
+        recordRange(list, shader, 0, (int)commands.size());
+    }
+
+    void record(CommandList& list, const Shader& shader, MaterialPass pass) const
+    {
+        recordRange(list, shader, passBegin[(int)pass], passBegin[(int)pass + 1]);
+    }
+
+private:
+    unsigned int instanceVBO;
+    unsigned int indirectBuffer;
+
+    std::vector<InstanceData> instances;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<int> drawMeshes;
+    std::vector<int> drawMaterials;
+    std::vector<MaterialPass> drawPasses;
+    // first draw of each MaterialPass, and one past the last of the last
+    int passBegin[4] = { 0, 0, 0, 0 };
+    std::vector<MaterialPass> materialPasses;
+
+    std::vector<AABB> meshBounds;
+    std::vector<AABB> instanceBounds;
+    std::vector<int> instanceCells;
+    std::vector<int> instanceDraws;
+    std::vector<bool> instanceDynamic;
+    BVH bvh;
+    std::vector<Frustum> cellFrustums;
+    // sortForDraw() scratch, indexed by instance
+    std::vector<float> instanceDepths;
+
+    // instance indices that passed the last cull in sortForDraw() order, and the draw list over them
+    std::vector<unsigned int> visible;
+    DrawList visibleList;
+    bool visibleDirty = false;
+    // shared by every list built, so submit() never mistakes one for another
+    unsigned long long listVersion = 0;
+
+    // commands of the list in the GPU buffers
+    std::vector<DrawElementsIndirectCommand> submittedCommands;
+    unsigned long long submittedVersion = 0;
+
+    // Under multi-draw indirect gl_DrawID counts from zero in every call, drawBase in default.vert
+    // turns it back into the draw's index
+    void drawRange(const Shader& shader, int first, int last)
+    {
+        if (first == last)
+            return;
+
+        // left bound afterwards, the next pass over the same scene finds them in place
+        glState.bindVertexArray(Meshes.VAO);
+
+        if (UseIndirect)
+        {
+            // culled draws stay in the buffer with an instance count of zero
+            glState.bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            shader.setInt("drawBase", first);
+            glExtensions.MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(first * sizeof(DrawElementsIndirectCommand)), (GLsizei)(last - first), 0);
+            frameStats.drawCalls++;
+        }
+        else
+        {
+            glState.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+            for (int i = first; i < last; i++)
+            {
+                const DrawElementsIndirectCommand& command = submittedCommands[i];
+                if (command.instanceCount == 0)
+                    continue;
+
+                shader.setInt("drawID", i);
+                setInstanceAttributes(command.baseInstance);
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                    (void*)(command.firstIndex * sizeof(unsigned int)), command.instanceCount, command.baseVertex);
+                frameStats.drawCalls++;
+            }
+            setInstanceAttributes(0);
+        }
+    }
+
+    void recordRange(CommandList& list, const Shader& shader, int first, int last) const
+    {
+        if (first == last)
+            return;
+
+        list.bindVertexArray(Meshes.VAO);
+
+        if (UseIndirect)
+        {
+            list.bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            list.uniformInt(shader, "drawBase", first);
+            list.multiDrawElementsIndirect((GLsizei)(last - first), (GLuint)first);
+        }
+        else
+        {
+            list.bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+            for (int i = first; i < last; i++)
+            {
+                const DrawElementsIndirectCommand& command = submittedCommands[i];
+                if (command.instanceCount == 0)
+                    continue;
+
+                list.uniformInt(shader, "drawID", i);
+                list.instanceAttributes(command.baseInstance);
+                list.drawElementsInstancedBaseVertex(command.count, command.firstIndex, command.instanceCount, command.baseVertex);
+            }
+            list.instanceAttributes(0);
+        }
+    }
+
+    template <typename Filter>
+    void cullInstances(const glm::mat4& viewProjection, Filter filter)
+    {
+        std::vector<unsigned int> previous;
+        previous.swap(visible);
+
+        if (Culling)
+        {
+            bvh.cull(Frustum::fromMatrix(viewProjection), visible);
+            filter();
+            if (Occlusion)
+                cullOcclusion();
+        }
+        else
+        {
+            visible.resize(instances.size());
+            for (size_t i = 0; i < visible.size(); i++)
+                visible[i] = (unsigned int)i;
+        }
+        sortForDraw(visible, viewProjection);
+
+        if (visible != previous || visibleDirty)
+        {
+            buildDrawList(visible, visibleList);
+            visibleDirty = false;
+        }
+
+        // counted here rather than in draw(), which runs once per pass
+        frameStats.instances += (unsigned int)visible.size();
+        frameStats.culledInstances += (unsigned int)(instances.size() - visible.size());
+    }
+
+    void cullPVS(const PVS& pvs, int cameraCell)
+    {
+        size_t kept = 0;
+        for (unsigned int instance : visible)
+        {
+            int cell = instanceCells[instance];
+            if (cell < 0 || pvs.visible(cameraCell, cell))
+                visible[kept++] = instance;
+        }
+        visible.resize(kept);
+    }
+
+    // Last and most expensive test per instance, so it only sees what the cheaper ones kept
+    void cullOcclusion()
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        size_t kept = 0;
+        for (unsigned int instance : visible)
+        {
+            if (Occlusion->visible(instanceBounds[instance]))
+                visible[kept++] = instance;
+        }
+        visible.resize(kept);
+
+        Occlusion->TestMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Drops instances of hidden cells, the rest are tested against the part of the screen their cell was seen through
+    void cullPortals(const glm::mat4& viewProjection, const PortalGraph& portals)
+    {
+        cellFrustums.resize(portals.Cells.size());
+        for (size_t cell = 0; cell < portals.Cells.size(); cell++)
+        {
+            if (portals.VisibleCells[cell])
+                cellFrustums[cell] = Frustum::fromMatrix(viewProjection, portals.CellRects[cell]);
+        }
+
+        size_t kept = 0;
+        for (unsigned int instance : visible)
+        {
+            int cell = instanceCells[instance];
+            if (cell < 0 || (portals.VisibleCells[cell] && cellFrustums[cell].classify(instanceBounds[instance]) != Visibility::OUTSIDE))
+                visible[kept++] = instance;
+        }
+        visible.resize(kept);
+    }
+
+    int drawOf(int instance) const
+    {
+        return instanceDraws[instance];
+    }
+
+    // Stable, draws of the same pass keep the order they were added in. Instances stay where they
+    // are, addDraw() has handed out their indices.
+    void sortDrawsByPass()
+    {
+        std::vector<int> order(commands.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int)i;
+        auto passOf = [&](int draw) {
+            int material = drawMaterials[draw];
+            return material < (int)materialPasses.size() ? materialPasses[material] : MaterialPass::SOLID;
+        };
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return passOf(a) < passOf(b); });
+
+        std::vector<DrawElementsIndirectCommand> sortedCommands;
+        std::vector<int> sortedMeshes, sortedMaterials, newIndex(order.size());
+        drawPasses.clear();
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            sortedCommands.push_back(commands[order[i]]);
+            sortedMeshes.push_back(drawMeshes[order[i]]);
+            sortedMaterials.push_back(drawMaterials[order[i]]);
+            drawPasses.push_back(passOf(order[i]));
+            newIndex[order[i]] = (int)i;
+        }
+        commands.swap(sortedCommands);
+        drawMeshes.swap(sortedMeshes);
+        drawMaterials.swap(sortedMaterials);
+        for (int& draw : instanceDraws)
+            draw = newIndex[draw];
+
+        for (int pass = 0; pass < 4; pass++)
+            passBegin[pass] = (int)(std::lower_bound(drawPasses.begin(), drawPasses.end(), (MaterialPass)pass) - drawPasses.begin());
+    }
+
+    // Groups instances by draw in draw order, nearest first within solid and alpha tested draws and
+    // farthest first within blended ones. Depth is the clip space z of the bounds' centre, which
+    // grows with distance under both perspective and orthographic projections.
+    void sortForDraw(std::vector<unsigned int>& list, const glm::mat4& viewProjection)
+    {
+        glm::vec4 depthRow(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+        instanceDepths.resize(instances.size());
+        for (unsigned int instance : list)
+        {
+            float depth = glm::dot(depthRow, glm::vec4(instanceBounds[instance].center(), 1.0f));
+            instanceDepths[instance] = drawPasses[instanceDraws[instance]] == MaterialPass::BLENDED ? -depth : depth;
+        }
+
+        std::sort(list.begin(), list.end(), [&](unsigned int a, unsigned int b) {
+            if (instanceDraws[a] != instanceDraws[b])
+                return instanceDraws[a] < instanceDraws[b];
+            if (instanceDepths[a] != instanceDepths[b])
+                return instanceDepths[a] < instanceDepths[b];
+            return a < b;
+        });
+    }
+
+    // The list is in sortForDraw() order, so it splits into one run per draw
+    void buildDrawList(const std::vector<unsigned int>& sorted, DrawList& list)
+    {
+        list.Instances.clear();
+        list.Commands = commands;
+        size_t cursor = 0;
+        for (size_t draw = 0; draw < list.Commands.size(); draw++)
+        {
+            DrawElementsIndirectCommand& command = list.Commands[draw];
+            command.baseInstance = (GLuint)list.Instances.size();
+            while (cursor < sorted.size() && instanceDraws[sorted[cursor]] == (int)draw)
+                list.Instances.push_back(instances[sorted[cursor++]]);
+            command.instanceCount = (GLuint)list.Instances.size() - command.baseInstance;
+        }
+        list.Version = ++listVersion;
+    }
+};
+#endif
@@ -0,0 +1,228 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <string>
+#include <cstdio>
+
+#include "gl_extensions.hpp"
+
+/* -------------------------------------------------------------------------- */
+/*                                 Frame Stats                                */
+/* -------------------------------------------------------------------------- */
+
+struct FragmentCounts
+{
+    unsigned long long samples = 0;
+    unsigned long long invocations = 0;
+};
+
+// Counters filled in by the renderer during a frame, cleared at the start of the next one.
+// Each thread has its own, a frame's counters travel from simulation to rendering in its packet.
+struct FrameStats
+{
+    unsigned int drawCalls = 0;
+    // GL state changes made and dropped as redundant by GLStateCache
+    unsigned int stateCalls = 0;
+    unsigned int stateCallsElided = 0;
+    // times RingBuffer had to wait for the GPU to release a region, and how long
+    unsigned int fenceWaits = 0;
+    double fenceWaitMs = 0.0;
+    unsigned int instances = 0;
+    unsigned int culledInstances = 0;
+    unsigned int rooms = 0;
+    unsigned int visibleRooms = 0;
+    double portalMs = 0.0;
+    unsigned int occlusionTested = 0;
+    unsigned int occludedInstances = 0;
+    double occlusionMs = 0.0;
+    bool depthPrepass = false;
+    float renderScale = 1.0f;
+    const char* pacingMode = "";
+    const char* antiAliasing = "";
+    double frameDeviationMs = 0.0;
+    // time between presented frames, and the work of each thread on this one, see RenderThread
+    double frameMs = 0.0;
+    double simulationMs = 0.0;
+    double simulationWaitMs = 0.0;
+    double renderMs = 0.0;
+    double renderWaitMs = 0.0;
+    double gpuMs = 0.0;
+    // stages of the SoftwareRasterizer when it drew the frame, raster and shade summed over its threads
+    unsigned int softwareTriangles = 0;
+    double softwareSetupMs = 0.0;
+    double softwareBinMs = 0.0;
+    double softwareRasterMs = 0.0;
+    double softwareShadeMs = 0.0;
+    // ShadowAtlas passes drawn this frame and those whose cached depth was reused instead
+    unsigned int shadowPasses = 0;
+    unsigned int shadowPassesSkipped = 0;
+    // lightmap texels lit by the ShadingCache pass
+    unsigned long long shadedTexels = 0;
+    // LightVolume bricks recomputed for the lights that changed, and how long that took
+    unsigned int lightVolumeBricks = 0;
+    double lightVolumeMs = 0.0;
+    // only counted when a benchmark asks for them, see FragmentCounter
+    FragmentCounts prepassFragments;
+    FragmentCounts shadedFragments;
+
+    void reset()
+    {
+        *this = FrameStats();
+    }
+};
+
+inline thread_local FrameStats frameStats;
+
+
+// Measures GPU time of a block of commands with GL_TIME_ELAPSED queries (core since 3.3).
+// Results are read back a few frames late so the query never stalls the pipeline.
+class GpuTimer
+{
+public:
+    static const int QUERY_COUNT = 4;
+
+    double LastMs = 0.0;
+
+    GpuTimer()
+    {
+        glGenQueries(QUERY_COUNT, queries);
+    }
+
+    void begin()
+    {
+        unsigned int query = queries[frame % QUERY_COUNT];
+
+        // collect the oldest result before reusing its query object
+        if (frame >= QUERY_COUNT)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &ns);
+                LastMs = ns / 1.0e6;
+            }
+        }
+
+        glBeginQuery(GL_TIME_ELAPSED, query);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        frame++;
+    }
+
+private:
+    unsigned int queries[QUERY_COUNT];
+    unsigned long long frame = 0;
+};
+
+
+// Counts what a block of commands rasterized: samples passing the depth test (core since 3.3) and
+// fragment shader invocations (glExtensions.PipelineStatistics, left at zero without it). Some
+// drivers count invocations before the depth test, samples show what early-z actually let through.
+// end() waits for the results, so this is for benchmarks rather than every frame.
+class FragmentCounter
+{
+public:
+    FragmentCounter()
+    {
+        glGenQueries(2, queries);
+    }
+
+    void begin()
+    {
+        glBeginQuery(GL_SAMPLES_PASSED, queries[0]);
+        if (glExtensions.PipelineStatistics)
+            glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, queries[1]);
+    }
+
+    FragmentCounts end()
+    {
+        FragmentCounts counts;
+        GLuint64 result = 0;
+
+        glEndQuery(GL_SAMPLES_PASSED);
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &result);
+        counts.samples = result;
+
+        if (glExtensions.PipelineStatistics)
+        {
+            glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+            glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &result);
+            counts.invocations = result;
+        }
+        return counts;
+    }
+
+private:
+    unsigned int queries[2];
+};
+
+
+// Averages frame timings and shows them in the window title every interval seconds
+class StatsReporter
+{
+public:
+    float Interval;
+
+    StatsReporter(float interval = 0.5f) : Interval(interval) {}
+
+    void addFrame(const FrameStats& stats)
+    {
+        frames++;
+        frameTotal += stats.frameMs;
+        simulationTotal += stats.simulationMs;
+        renderTotal += stats.renderMs;
+        gpuTotal += stats.gpuMs;
+    }
+
+    void report(GLFWwindow* window, const char* name)
+    {
+        if (frames == 0 || frameTotal < Interval * 1000.0)
+            return;
+
+        double occludedPercent = frameStats.occlusionTested ? 100.0 * frameStats.occludedInstances / frameStats.occlusionTested : 0.0;
+
+        char software[128] = "";
+        if (frameStats.softwareTriangles > 0)
+            std::snprintf(software, sizeof(software), " | software %u tris (setup %.2f, bin %.2f, raster %.2f, shade %.2f ms)", frameStats.softwareTriangles,
+                frameStats.softwareSetupMs, frameStats.softwareBinMs, frameStats.softwareRasterMs, frameStats.softwareShadeMs);
+
+        char shadows[64] = "";
+        if (frameStats.shadowPasses + frameStats.shadowPassesSkipped > 0)
+            std::snprintf(shadows, sizeof(shadows), " | shadow passes %u (%u cached)", frameStats.shadowPasses, frameStats.shadowPassesSkipped);
+
+        char texels[48] = "";
+        if (frameStats.shadedTexels > 0)
+            std::snprintf(texels, sizeof(texels), " | %llu texels shaded", frameStats.shadedTexels);
+
+        char volume[64] = "";
+        if (frameStats.lightVolumeMs > 0.0)
+            std::snprintf(volume, sizeof(volume), " | light volume %u bricks (%.2f ms)", frameStats.lightVolumeBricks, frameStats.lightVolumeMs);
+
+        char title[768];
+        std::snprintf(title, sizeof(title), "%s | %.1f fps (%s, jitter %.2f ms) | sim %.2f ms | render %.2f ms | gpu %.2f ms | %u draws | %u state calls (%u elided) | %u fence waits (%.2f ms) | %u instances | %u culled | rooms %u/%u (%.3f ms) | occluded %.0f%% (%.3f ms) | %.0f%% res | %s%s%s%s%s%s",
+            name, frames * 1000.0 / frameTotal, frameStats.pacingMode, frameStats.frameDeviationMs, simulationTotal / frames, renderTotal / frames, gpuTotal / frames,
+            frameStats.drawCalls, frameStats.stateCalls, frameStats.stateCallsElided, frameStats.fenceWaits, frameStats.fenceWaitMs, frameStats.instances, frameStats.culledInstances,
+            frameStats.visibleRooms, frameStats.rooms, frameStats.portalMs, occludedPercent, frameStats.occlusionMs, frameStats.renderScale * 100.0f,
+            frameStats.antiAliasing, frameStats.depthPrepass ? " | depth prepass" : "", shadows, texels, volume, software);
+        glfwSetWindowTitle(window, title);
+
+        frames = 0;
+        frameTotal = simulationTotal = renderTotal = gpuTotal = 0.0;
+    }
+
+private:
+    unsigned int frames = 0;
+    double frameTotal = 0.0;
+    double simulationTotal = 0.0;
+    double renderTotal = 0.0;
+    double gpuTotal = 0.0;
+};
+#endif
@@ -0,0 +1,156 @@
+#ifndef TRANSFORM_HIERARCHY_H
+#define TRANSFORM_HIERARCHY_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+/* -------------------------------------------------------------------------- */
+/*                             Transform Hierarchy                            */
+/* -------------------------------------------------------------------------- */
+
+// Nodes with a local position, rotation and scale under an optional parent, and the world matrix
+// derived from them. Each field is its own array indexed by node (structure of arrays), so the
+// update pass streams through exactly the fields it reads, and the world matrices end up
+// contiguous for an instance buffer upload.
+// A parent is always added before its children, so one forward pass sees every parent's world
+// matrix before it is needed. Changing a local transform marks the node dirty; update() carries
+// the flag down to the node's descendants as it passes them and recomputes only the dirty nodes,
+// starting at the first one. Nodes nothing touched keep their world matrix from the last update.
+class TransformHierarchy
+{
+public:
+    // Returns the new node, parent is -1 for a root
+    int add(int parent, const glm::vec3& position, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f))
+    {
+        int node = (int)parents.size();
+        if (parent >= node)
+        {
+            std::cout << "ERROR::TRANSFORM_HIERARCHY::PARENT_AFTER_CHILD" << std::endl;
+            parent = -1;
+        }
+
+        parents.push_back(parent);
+        positions.push_back(position);
+        rotations.push_back(rotation);
+        scales.push_back(scale);
+        worldMatrices.push_back(glm::mat4(1.0f));
+        dirty.push_back(1);
+        firstDirty = glm::min(firstDirty, node);
+        return node;
+    }
+
+    void setPosition(int node, const glm::vec3& position)
+    {
+        positions[node] = position;
+        markDirty(node);
+    }
+
+    void setRotation(int node, const glm::quat& rotation)
+    {
+        rotations[node] = rotation;
+        markDirty(node);
+    }
+
+    void setScale(int node, const glm::vec3& scale)
+    {
+        scales[node] = scale;
+        markDirty(node);
+    }
+
+    // Recomputes the world matrices of dirty nodes and their descendants. changed() lists them
+    // afterwards, in node order.
+    void update()
+    {
+        changedNodes.clear();
+        int count = (int)parents.size();
+        for (int node = firstDirty; node < count; node++)
+        {
+            int parent = parents[node];
+            // a parent updated this pass is still flagged, the flags are cleared below
+            if (parent >= 0 && dirty[parent])
+                dirty[node] = 1;
+            if (!dirty[node])
+                continue;
+
+            glm::mat4 local = localMatrix(node);
+            worldMatrices[node] = parent >= 0 ? worldMatrices[parent] * local : local;
+            changedNodes.push_back(node);
+        }
+
+        for (int node : changedNodes)
+            dirty[node] = 0;
+        firstDirty = count;
+    }
+
+    // Every world matrix from its local transform whether it changed or not, what update() avoids
+    void updateAll()
+    {
+        changedNodes.clear();
+        for (int node = 0; node < (int)parents.size(); node++)
+        {
+            int parent = parents[node];
+            glm::mat4 local = localMatrix(node);
+            worldMatrices[node] = parent >= 0 ? worldMatrices[parent] * local : local;
+            dirty[node] = 0;
+            changedNodes.push_back(node);
+        }
+        firstDirty = (int)parents.size();
+    }
+
+    const glm::mat4& world(int node) const
+    {
+        return worldMatrices[node];
+    }
+
+    // One per node, as of the last update
+    const std::vector<glm::mat4>& worlds() const
+    {
+        return worldMatrices;
+    }
+
+    // Nodes whose world matrix the last update rewrote, the only ones to upload again
+    const std::vector<int>& changed() const
+    {
+        return changedNodes;
+    }
+
+    int size() const
+    {
+        return (int)parents.size();
+    }
+
+private:
+    std::vector<int> parents;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> worldMatrices;
+    // 1 while the local transform or an ancestor's changed since the last update
+    std::vector<uint8_t> dirty;
+    int firstDirty = 0;
+    std::vector<int> changedNodes;
+
+    void markDirty(int node)
+    {
+        dirty[node] = 1;
+        firstDirty = glm::min(firstDirty, node);
+    }
+
+    // translate * rotate * scale, built directly rather than as three matrix products
+    glm::mat4 localMatrix(int node) const
+    {
+        glm::mat3 rotation = glm::mat3_cast(rotations[node]);
+        const glm::vec3& scale = scales[node];
+        glm::mat4 local;
+        local[0] = glm::vec4(rotation[0] * scale.x, 0.0f);
+        local[1] = glm::vec4(rotation[1] * scale.y, 0.0f);
+        local[2] = glm::vec4(rotation[2] * scale.z, 0.0f);
+        local[3] = glm::vec4(positions[node], 1.0f);
+        return local;
+    }
+};
+#endif